@@ -30,21 +30,117 @@
  *     - ./car-rental-system
  */
 
+#define _GNU_SOURCE /* memmem() and Linux specific system calls */
+
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
-/* Specially required for getch() (console input) */
+/* Required for the terminal line editor */
 #include <termios.h>
 #include <unistd.h>
 
-#define CLEAN_SCREEN() (printf("\033c")) /* Macro to clear the screen (for console-based UI). */
+/* Required for creating replica data directories */
+#include <sys/stat.h>
+
+/* Required for following the terminal's size */
+#include <signal.h>
+#include <sys/ioctl.h>
+
+/* Required for loading tables in parallel at startup */
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Required for locking tables between writing processes */
+#include <sys/file.h>
+
+/* Required for mapping index files */
+#include <sys/mman.h>
+
+/* Required for the HTTP API */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#define CLEAN_SCREEN(out) (fputc('\f', out)) /* Start a new page of session output (see sessionRender()). */
 
 #define MAX_USERS 100 /* Maximum number of users that can be registered in the system. */
 #define MAX_CAR_MODELS 100 /* Maximum number of car models that can be stored in the system. */
+#define MAX_BRANCHES 16 /* Maximum number of branch shards. */
+#define BRANCH_NAME_SIZE 20 /* Maximum length of a branch name, including the terminator. */
+#define REPLICA_POLL_INTERVAL_US 200000 /* How often a follower polls the primary's change log (microseconds). */
+#define REPLICA_STATUS_INTERVAL 256 /* Changes a follower applies between saves of its replica status. */
+#define RATE_LIMIT_SLOTS 4096 /* Token buckets kept in memory; bounds the limiter's total memory. */
+#define RATE_LIMIT_PROBES 8 /* Slots searched for a key, or for a full bucket to reuse. */
+#define MAX_IN_FLIGHT 64 /* Requests served at once before new ones are turned away. */
+#define RENTAL_LATENCY_TARGET 0.25 /* Latency target of rentals and logins (seconds). */
+#define LATENCY_WINDOW 10.0 /* How long a latency measurement counts as recent (seconds). */
+#define LATENCY_EWMA_WEIGHT 0.2 /* Weight of the newest sample in the moving latency average. */
+#define ADMISSION_DEFER_RETRIES 5 /* Times a deferred request is re-evaluated before it is rejected. */
+#define ADMISSION_DEFER_US 100000 /* Wait between re-evaluations of a deferred request (microseconds). */
+#define HTTP_MAX_CONNECTIONS 1024 /* Client connections served at once by the HTTP API. */
+#define HTTP_BUFFER_SIZE 8192 /* Largest request (headers and body) the HTTP API accepts. */
+#define HTTP_MAX_PENDING_OUTPUT (1 << 20) /* Unsent bytes after which a connection stops being read. */
+#define HTTP_MAX_HEADERS 32 /* Headers parsed per request. */
+#define SESSION_MAX_CONNECTIONS 4096 /* Terminal sessions served at once by --sessions. */
+#define SESSION_LINE_SIZE 256 /* Longest line of input a session client may send. */
+#define SCREEN_DEFAULT_ROWS 24 /* Terminal size assumed until the client reports its own. */
+#define SCREEN_DEFAULT_COLUMNS 80
+
+/* Telnet commands used to turn the client's echo off for passwords */
+#define TELNET_IAC 255
+#define TELNET_DONT 254
+#define TELNET_DO 253
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_SB 250
+#define TELNET_SE 240
+#define TELNET_ECHO 1
+#define TELNET_NAWS 31 /* Negotiate About Window Size */
+
+#define EDITOR_HISTORY 32 /* Lines the terminal line editor remembers for Up/Down. */
+#define CTRL_KEY(key) ((key) & 0x1f)
+
+#define ARENA_CHUNK_SIZE 16384 /* Smallest block a request arena takes from the heap. */
+#define INDEX_MIN_CAPACITY 64 /* Slots of a new hash index; always a power of two. */
+#define INDEX_FILE_MAGIC "CRSIDX2" /* First bytes of an index file, with the terminator. */
+#define INDEX_FILE_MAX_INDEXES 4 /* Indexes one index file can hold. */
+#define PAGE_ROWS 20 /* Rows of a listing shown on one page of a session. */
+#define HTTP_PAGE_LIMIT 100 /* Rows of an HTTP listing returned when the client gives no limit. */
+#define HTTP_MAX_PAGE_LIMIT 1000 /* Most rows an HTTP listing returns at once. */
+#define EVENT_POLL_MS 100 /* How often change event subscribers are checked for new changes. */
+#define EVENT_BATCH 256 /* Change events read from a change log at a time. */
+#define RENTAL_TIME_STRIDE 1024 /* Rentals between two samples of a rental log's time index. */
+#define RENTAL_TIME_MIN 978307200 /* Earliest commit time taken as genuine (2001-01-01). */
+#define RENTAL_TIME_MAX 4294967296LL /* Commit times from here on are not genuine (2106-02-07). */
+#define LATE_FEE_RATE 1.5 /* Fee per day a car comes back late, as a multiple of its daily rate. */
+#define TIMER_WHEEL_BITS 6 /* A timer wheel level has 2^TIMER_WHEEL_BITS slots. */
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5 /* Levels of the timer wheel; together they span 2^30 seconds (34 years). */
+#define SESSION_IDLE_TIMEOUT 900 /* Seconds without input after which a terminal session is closed. */
+#define RENTAL_CONFIRM_TIMEOUT 300 /* Seconds a rental summary waits for the customer's confirmation. */
+#define OVERDUE_REPORT_IDS 5 /* Rental IDs named when a batch of rentals becomes overdue. */
+#define GROUP_MAX_CARS 50 /* Most cars one group booking takes. */
+#define GROUP_MAX_CHANGES (4 * GROUP_MAX_CARS) /* A unit, car row, rental and notification per car. */
+#define INVOICE_MAX_WORKERS 16 /* Threads writing invoices at once. */
+#define INVOICE_READ_BATCH 4096 /* Records read from a log at a time by the invoice run. */
+#define OUTBOX_BATCH 64 /* Notifications handed to the sink at once. */
+#define OUTBOX_POLL_INTERVAL_US 500000 /* How often the delivery worker looks for new notifications (microseconds). */
+#define OUTBOX_RETRY_MIN 1 /* Seconds before a failed batch is tried again; doubles with every failure. */
+#define OUTBOX_RETRY_MAX 300 /* Longest wait before a failed batch is tried again (seconds). */
+#define OVERDUE_REMINDER_WINDOW 86400 /* Seconds after its due time a rental is still sent an overdue reminder. */
 
 /* Admin User's default username and password */
 const char admin_user[] = "admin";
@@ -54,10 +150,42 @@ const char admin_password[] = "admin";
 const char user_database[] = "data/registered_users.bin";
 /* Number of recorded users within a user database */
 const char current_num_of_user[] = "data/highest_recorded_number.txt";
+/* Branches sharding the fleet and rentals, one per line */
+const char branch_list[] = "data/branches.txt";
+/* Change log of users and of the main branch, shipped to read replicas */
+const char change_log[] = "data/change_log.bin";
+
+/*
+ * Files of the branch shard operations are routed to (see selectBranch()).
+ * The main branch keeps the original files directly under data/.
+ */
 /* Available cars data base file*/
-const char car_database[] = "data/car_database.db";
+char car_database[PATH_MAX] = "data/car_database.db";
 /* Rental log file user for both admin and noral users*/
-const char rental_records[] = "data/rental_records.bin";
+char rental_records[PATH_MAX] = "data/rental_records.bin";
+/* Change log of the branch's cars and rentals */
+char branch_change_log[PATH_MAX] = "data/change_log.bin";
+/* Replication progress of a follower for the branch */
+char replica_status_file[PATH_MAX] = "data/replica_status.txt";
+/* Customers waiting for a car of the branch */
+char waitlist_file[PATH_MAX] = "data/waitlist.bin";
+/* Demand seen by the branch, including demand that could not be met */
+char demand_stats_file[PATH_MAX] = "data/demand_stats.bin";
+/* Physical cars of the branch's models */
+char car_units_file[PATH_MAX] = "data/car_units.bin";
+/* Rentals of the branch that were checked in */
+char returns_file[PATH_MAX] = "data/returns.bin";
+/* Delivery progress of the branch's outbox, the notifications in its change log */
+char outbox_status_file[PATH_MAX] = "data/outbox_status.txt";
+
+/* Set by --read-only: the process serves queries and reports only */
+bool read_only = false;
+/* Set by --reports-from: data directory of the replica serving admin reports */
+const char *report_data_dir = NULL;
+/* Where the current request comes from, used as the per-source rate limit key */
+char request_source[64] = "local";
+/* Requests received by the HTTP API but not started yet */
+size_t queued_requests = 0;
 
 struct CarModel {
   char model_name[50];
@@ -87,67 +215,1254 @@ struct Rental {
   double totalCost;
   int selectedCarIndex;
   char rentalID[20];
-  char time[20];
+  char time[16];     /* Start of ctime() at commit, without the year */
+  time_t rented_at;  /* Commit time; takes the room of the rest of time, so records keep their size */
+};
+
+/* Status of an inventory unit */
+enum UnitStatus {
+  UNIT_AVAILABLE,
+  UNIT_RENTED,
+  UNIT_SERVICE       /* In the garage or otherwise out of service */
+};
+
+/**
+ * One physical car of a branch, stored in the branch's unit table. The car
+ * table is the catalog of models; a model with units is rented a unit at a
+ * time, while a model without any is a single car.
+ */
+struct CarUnit {
+  char plate[12];
+  char model_name[50]; /* Catalog model the unit is of */
+  int status;          /* enum UnitStatus */
+  char rentalID[20];   /* Rental the unit was last allocated to */
+};
+
+/* A rental closed by checking its car back in, kept in the branch's return log */
+struct RentalReturn {
+  char rentalID[20];
+  char username[20];
+  char model_name[50];
+  char plate[12];      /* Unit that came back; empty for a model without units */
+  char returnDate[11]; /* Day the car actually came back */
+  long rental;         /* Record of the rental in the rental log */
+  int late_days;
+  bool canceled;       /* Closed by cancelling the rental before its pickup date */
+  double late_fee;
+  time_t returned_at;
+};
+
+/* Exclusive locks on a branch's unit and car tables, held while cars are taken */
+struct FleetLock {
+  int units;
+  int cars;
+};
+
+/* One model of a group booking, with how many of its cars are wanted */
+struct GroupItem {
+  char model_name[50];
+  int count;
+  long car_index;           /* Row of the model in the car table */
+  struct CarModel car;       /* Row of the model as it was before the booking */
+  struct ModelStock *stock; /* Units of the model, NULL for a model without units */
+};
+
+/**
+ * A group booking: the cars asked for and, while it is being committed, the
+ * units and car rows it took, so a failed booking can put them back.
+ */
+struct GroupBooking {
+  struct GroupItem items[GROUP_MAX_CARS];
+  size_t num_items;
+  long units[GROUP_MAX_CARS];
+  struct CarUnit units_before[GROUP_MAX_CARS];
+  size_t num_units;
+  size_t cars[GROUP_MAX_CARS]; /* Items whose car row became unavailable */
+  size_t num_cars;
+  struct Rental rentals[GROUP_MAX_CARS];
+  size_t num_rentals;
+};
+
+/* What a notification tells a customer */
+enum NotificationKind {
+  NOTIFY_RENTAL_CONFIRMED,
+  NOTIFY_RENTAL_OVERDUE,
+  NOTIFY_WAITLIST_OFFER
+};
+
+/* A message to a customer, logged with the change that caused it until it is delivered */
+struct Notification {
+  int kind;            /* enum NotificationKind */
+  char username[20];
+  char rentalID[20];
+  char model_name[50];
+  char pickupDate[11];
+  char returnDate[11];
+  double amount;
+  time_t created_at;
+};
+
+/* Delivery progress of a branch's outbox */
+struct OutboxStatus {
+  size_t delivered;    /* Changes of the branch's log read through, delivered or skipped */
+  int attempts;        /* Failed attempts at delivering the next batch */
+  time_t retry_at;     /* When the next batch may be tried again */
+};
+
+/**
+ * Where notifications are delivered. deliver() is given a batch of a
+ * branch's outbox and the change log position of its first notification, and returns 0
+ * once all of it is delivered. A failed batch is given again later, whole,
+ * so a sink must cope with seeing a notification twice.
+ */
+struct NotificationSink {
+  const char *name;
+  const char *target;  /* Spool directory of the spool sink */
+  int (*deliver)(const struct NotificationSink *sink, const char *branch, size_t first,
+                 const struct Notification *batch, size_t count);
+};
+
+/* State of a waitlist request */
+enum WaitlistStatus {
+  WAITLIST_WAITING,
+  WAITLIST_ALLOCATED, /* A car was rented for the customer */
+  WAITLIST_NOTIFIED,  /* The customer has seen the allocation */
+  WAITLIST_EXPIRED    /* The pickup date passed before a car was freed */
+};
+
+/* A customer queued for a car model, or for any car when model_name is empty */
+struct WaitlistEntry {
+  char username[20];
+  char model_name[50];
+  char pickupDate[11];
+  char returnDate[11];
+  int priority;
+  int status;
+  time_t requested_at;
+  char rentalID[20];
+};
+
+/* Counters kept per branch and model to show unmet demand */
+enum DemandCounter {
+  DEMAND_TURNED_AWAY,
+  DEMAND_QUEUED,
+  DEMAND_ALLOCATED,
+  DEMAND_EXPIRED
+};
+
+struct DemandStats {
+  char model_name[50];
+  size_t turned_away; /* No car was free and the customer did not wait */
+  size_t queued;
+  size_t allocated;
+  size_t expired;
+};
+
+/* Tables that can be changed through the change log */
+enum ChangeTable {
+  CHANGE_TABLE_CARS,
+  CHANGE_TABLE_USERS,
+  CHANGE_TABLE_RENTALS,
+  CHANGE_TABLE_UNITS,
+  CHANGE_TABLE_RETURNS,
+  CHANGE_TABLE_WAITLIST,
+  CHANGE_TABLE_DEMAND,
+  CHANGE_TABLE_NOTIFICATIONS /* The outbox: appended only, kept in no table, index -1 */
+};
+
+/* Kind of change made to a table, addressed by record index */
+enum ChangeOp {
+  CHANGE_OP_APPEND,
+  CHANGE_OP_UPDATE,
+  CHANGE_OP_REMOVE
+};
+
+/* One committed write, carrying the full after-image of the record */
+struct ChangeRecord {
+  size_t seq;
+  time_t committed_at;
+  int table;
+  int op;
+  long index;
+  union {
+    struct CarModel car;
+    struct Users user;
+    struct Rental rental;
+    struct CarUnit unit;
+    struct RentalReturn rental_return;
+    struct WaitlistEntry waitlist_entry;
+    struct DemandStats demand;
+    struct Notification notification;
+  } data;
+};
+
+/* A shard of the fleet and rentals, stored in its own data directory */
+struct Branch {
+  char name[BRANCH_NAME_SIZE];
+  char dir[sizeof("data/branches/") + BRANCH_NAME_SIZE];
+};
+
+/* Known branches; the main branch is always first */
+struct Branch branches[MAX_BRANCHES];
+size_t num_branches = 0;
+size_t current_branch = 0;
+
+/* A slot of a hash index: the hash of a key and the record holding it */
+struct IndexSlot {
+  unsigned long long hash;
+  long record;              /* -1 when the slot is free */
+};
+
+/**
+ * Open-addressing hash index from keys to record positions in a table file.
+ * A key may lead to several records, and different keys may share a hash,
+ * so callers check every candidate record against the key.
+ */
+struct KeyIndex {
+  struct IndexSlot *slots;
+  size_t capacity;          /* A power of two */
+  size_t count;
+  bool mapped;              /* slots point into a mapped index file */
+};
+
+/* Identity of a table file at the time it was loaded */
+struct FileStamp {
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  struct timespec modified;
+};
+
+/**
+ * Header of an index file, which lets the indexes of a data file be mapped
+ * and used without reading the data file. The slots of each index follow
+ * the header in order.
+ */
+struct IndexFileHeader {
+  char magic[8];               /* INDEX_FILE_MAGIC */
+  size_t record_size;          /* Size of a record of the data file */
+  size_t records;              /* Records the indexes cover */
+  struct FileStamp generation; /* The data file as it was indexed */
+  size_t num_indexes;
+  size_t capacity[INDEX_FILE_MAX_INDEXES];
+  size_t count[INDEX_FILE_MAX_INDEXES];
+};
+
+/* The descriptive part of a car, read when a car is shown rather than scanned */
+struct CarDetails {
+  char model_name[50];
+  char company[50];
+  size_t year;
+  double fuel_efficiency;
+  char color[20];
+};
+
+/**
+ * In-memory car table of a branch, split by how it is used. Availability and
+ * price scans read only the hot columns, each a contiguous array; names and
+ * other descriptions sit in a separate cold store. The table is rebuilt
+ * from the car database when that file changes.
+ */
+struct Fleet {
+  size_t count;
+  size_t capacity;
+  bool *available;            /* Hot columns */
+  double *rental_rate;
+  size_t *passenger_capacity;
+  struct CarDetails *details; /* Cold store */
+  struct KeyIndex by_model;
+  bool loaded;
+  struct FileStamp stamp;     /* The file the table was read from */
+};
+
+/* Car tables of the branches, by branch index */
+struct Fleet fleets[MAX_BRANCHES];
+
+/* Units of one catalog model: its counters and the head of its free list */
+struct ModelStock {
+  char model_name[50];
+  size_t units;
+  size_t available;
+  long free;                  /* First available unit, -1 if there is none */
+};
+
+/**
+ * Inventory units of a branch. The available units of each model form a
+ * free list threaded through next_free, so whether a model is free is a
+ * counter read and allocating a unit takes constant time. Every change made
+ * here keeps the counters and lists current; they are rebuilt when another
+ * process changes the unit table.
+ */
+struct Inventory {
+  struct CarUnit *units;
+  long *next_free;
+  size_t count;
+  size_t capacity;
+  struct ModelStock *models;
+  size_t num_models;
+  size_t models_capacity;
+  struct KeyIndex by_model;   /* Model name to its stock */
+  struct KeyIndex by_plate;   /* Plate number to its unit */
+  struct KeyIndex by_rental;  /* Rental ID to the unit allocated to it */
+  bool loaded;
+  struct FileStamp stamp;
+};
+
+/* Inventories of the branches, by branch index */
+struct Inventory inventories[MAX_BRANCHES];
+
+/* Return log of a branch by rental ID, to close each rental only once */
+struct ReturnIndex {
+  struct KeyIndex by_rental;
+  size_t count;
+  bool loaded;
+  struct FileStamp stamp;
+};
+
+/* Return indexes of the branches, by branch index */
+struct ReturnIndex return_indexes[MAX_BRANCHES];
+
+const char *const unit_status_names[] = {"available", "rented", "in service"};
+
+/* Indexes of the user table, for lookups by any of the login keys */
+struct UserIndex {
+  struct KeyIndex by_username;
+  struct KeyIndex by_number;
+  struct KeyIndex by_email;
+  size_t count;
+  bool loaded;
+  bool dirty;                 /* Records were added since the index file was written */
+  struct FileStamp stamp;
+  void *map;                  /* Mapped index file, if the indexes came from one */
+  size_t map_size;
+};
+
+struct UserIndex user_index;
+
+/**
+ * Rentals of a branch by rental ID, and each user's rentals as a chain in
+ * log order: by_user and last_by_user hold a user's first and latest record,
+ * and next_by_user leads from a record to the user's next one.
+ */
+struct RentalIndex {
+  struct KeyIndex by_user;
+  struct KeyIndex by_id;
+  struct KeyIndex last_by_user;
+  struct KeyIndex next_by_user; /* Under userChainHash of the user and a record */
+  size_t count;
+  char path[PATH_MAX];        /* Rental log the index was built from */
+  bool loaded;
+  bool dirty;
+  struct FileStamp stamp;
+  void *map;
+  size_t map_size;
+};
+
+/* Rental indexes of the branches, by branch index */
+struct RentalIndex rental_indexes[MAX_BRANCHES];
+
+/*
+ * Sparse index of a rental log by commit time. Rentals are appended in
+ * commit order, so the time of every RENTAL_TIME_STRIDE'th rental is enough
+ * to find where a time window starts.
+ */
+struct TimeIndex {
+  time_t *times;              /* times[i] is the time of rental i * RENTAL_TIME_STRIDE */
+  size_t count;
+  size_t capacity;
+  char path[PATH_MAX];        /* Rental log the samples were taken from */
+  dev_t device;
+  ino_t inode;
+};
+
+/* Time indexes of the branches' rental logs, by branch index */
+struct TimeIndex time_indexes[MAX_BRANCHES];
+
+/* One table loaded by a thread of its own at startup */
+struct TableLoad {
+  int table;                  /* enum ChangeTable */
+  size_t branch;
+  char path[PATH_MAX];
+  pthread_t thread;
+  bool started;
+  int result;
+};
+
+/* A charge on a customer's invoice: a rental, or a late fee taken at check-in */
+struct InvoiceLine {
+  char username[20];
+  char rentalID[20];
+  char model_name[50];
+  char pickupDate[11];
+  char returnDate[11];
+  bool late_fee;
+  short branch;
+  double amount;
+  size_t order;               /* Position in the pass, so lines keep the log order */
+};
+
+/* A customer's lines of an invoice run */
+struct InvoiceCustomer {
+  size_t first;
+  size_t end;
+  struct Users user;
+  bool registered;            /* Whether the customer is still in the user table */
+};
+
+/* Work shared by the threads of an invoice run */
+struct InvoiceRun {
+  const char *month;
+  const char *dir;
+  bool csv;
+  const struct InvoiceLine *lines;
+  const struct InvoiceCustomer *customers;
+  size_t num_customers;
+  atomic_size_t next;         /* Next customer a thread takes on */
+  atomic_size_t written;
+};
+
+/* Bytes of table files read so far, for startup progress */
+atomic_size_t table_bytes_loaded = 0;
+atomic_size_t table_loads_done = 0;
+
+/* Set by SIGINT or SIGTERM to have a server shut down cleanly */
+volatile sig_atomic_t stop_requested = 0;
+
+/* Heap node pointing at a waiting entry in the waitlist file */
+struct WaitlistItem {
+  int priority;
+  time_t requested_at;
+  long index;
+};
+
+/* Priority queue of the requests waiting for one car model */
+struct WaitQueue {
+  char model_name[50];
+  struct WaitlistItem *items;
+  size_t count;
+  size_t capacity;
+};
+
+/* Waiting requests of the selected branch, one queue per requested model */
+struct WaitQueue wait_queues[MAX_CAR_MODELS + 1];
+size_t num_wait_queues = 0;
+bool waitlist_loaded = false;
+size_t waitlist_branch = 0;
+
+/* Operations protected by rate limiting */
+enum RateLimitAction {
+  RATE_LIMIT_LOGIN,
+  RATE_LIMIT_RENTAL
+};
+
+/* Burst size and sustained rate of a token bucket */
+struct RateLimitPolicy {
+  double capacity;
+  double refill_per_second;
+};
+
+/* Per-user and per-source limits for each action */
+const struct RateLimitPolicy rate_limit_user_policies[] = {
+  [RATE_LIMIT_LOGIN] = {5, 1.0 / 30},
+  [RATE_LIMIT_RENTAL] = {10, 1.0 / 6},
+};
+const struct RateLimitPolicy rate_limit_source_policies[] = {
+  [RATE_LIMIT_LOGIN] = {20, 1.0 / 3},
+  [RATE_LIMIT_RENTAL] = {30, 1.0 / 2},
+};
+
+/* A token bucket, identified by the hash of its action, scope and key */
+struct TokenBucket {
+  unsigned long long key;
+  const struct RateLimitPolicy *policy;
+  double tokens;
+  double last_refill;
+};
+
+struct TokenBucket rate_limit_buckets[RATE_LIMIT_SLOTS];
+size_t rate_limited_requests = 0;
+
+/* Request classes in order of priority, highest first */
+enum RequestClass {
+  REQUEST_RENTAL, /* Rentals and logins */
+  REQUEST_QUERY,  /* Customer lookups */
+  REQUEST_REPORT, /* Admin reports and bulk listings */
+  NUM_REQUEST_CLASSES
+};
+
+enum AdmissionDecision {
+  ADMIT_ACCEPT,
+  ADMIT_DEFER,
+  ADMIT_REJECT
+};
+
+/* Load and latency seen by one request class */
+struct RequestMetrics {
+  size_t admitted;
+  size_t deferred;
+  size_t rejected;
+  size_t completed;
+  size_t in_flight;
+  double latency_ewma;
+  double latency_max;
+  double last_completed;
+};
+
+/* An admitted request being timed */
+struct RequestTimer {
+  int request_class;
+  double started;
+};
+
+const char *request_class_names[NUM_REQUEST_CLASSES] = {"Rental", "Query", "Report"};
+struct RequestMetrics request_metrics[NUM_REQUEST_CLASSES];
+
+/* Growable byte buffer, reused across requests to avoid per-request allocation */
+struct Buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+/* A block of arena memory; data follows the header */
+struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+};
+
+/**
+ * Bump allocator for temporaries that live as long as one request. Chunks
+ * are kept for reuse when the arena is reset, so a request whose needs
+ * have been seen before allocates nothing from the heap.
+ */
+struct Arena {
+  struct ArenaChunk *chunks; /* In use, newest first */
+  struct ArenaChunk *last;   /* Oldest chunk in use */
+  struct ArenaChunk *spare;  /* Free for reuse */
+  size_t chunk_allocations;
+  size_t reserved;           /* Bytes held in chunks */
+};
+
+/* Arena for the request being served, reset when it ends */
+struct Arena request_arena = {0};
+
+/* A piece of a request, pointing into the connection's input buffer */
+struct HttpSlice {
+  const char *data;
+  size_t length;
+};
+
+struct HttpHeader {
+  struct HttpSlice name;
+  struct HttpSlice value;
+};
+
+/* A parsed request; every field points into the connection's input buffer */
+struct HttpRequest {
+  struct HttpSlice method;
+  struct HttpSlice path;
+  struct HttpSlice query;
+  struct HttpSlice body;
+  struct HttpHeader headers[HTTP_MAX_HEADERS];
+  size_t num_headers;
+  bool keep_alive;
+  size_t length; /* Bytes of the input buffer taken by the request */
+};
+
+struct HttpConnection {
+  int fd;
+  char peer[64];
+  char in[HTTP_BUFFER_SIZE];
+  size_t in_length;
+  struct Buffer out;
+  size_t out_sent;
+  int file;          /* File streamed after out, or -1 */
+  off_t file_offset;
+  off_t file_end;
+  bool subscribed;   /* Receives change events until the client disconnects */
+  size_t events_branch;
+  size_t events_seq; /* Last event sent */
+  bool close_after_write;
+  int deferrals; /* Times the pending request was deferred by admission control */
+};
+
+/* Steps of an interactive session; each one waits for a single line of input */
+enum SessionState {
+  STATE_MAIN_MENU,
+  STATE_REGISTER_FIELD,
+  STATE_REGISTER_REVIEW,
+  STATE_REGISTER_NUMBER,
+  STATE_REGISTER_USERNAME,
+  STATE_REGISTER_PASSWORD,
+  STATE_REGISTER_VERIFY,
+  STATE_REGISTER_DONE,
+  STATE_LOGIN_NAME,
+  STATE_LOGIN_PASSWORD,
+  STATE_LOGIN_RETRY,
+  STATE_USER_MENU,
+  STATE_RENT_BRANCH,
+  STATE_RENT_SELECT,
+  STATE_RENT_PICKUP,
+  STATE_RENT_RETURN,
+  STATE_RENT_CONFIRM,
+  STATE_CHANGE_RENTAL,
+  STATE_CHANGE_RENTAL_DATE,
+  STATE_WAITLIST_JOIN,
+  STATE_WAITLIST_MODEL,
+  STATE_WAITLIST_PICKUP,
+  STATE_WAITLIST_RETURN,
+  STATE_EDIT_USER_FIELD,
+  STATE_EDIT_USER_VALUE,
+  STATE_ADMIN_NAME,
+  STATE_ADMIN_PASSWORD,
+  STATE_ADMIN_MENU,
+  STATE_ADMIN_LOG_CHOICE,
+  STATE_ADMIN_LOG_USER,
+  STATE_ADMIN_BRANCH,
+  STATE_ADMIN_ADD_BRANCH,
+  STATE_ADMIN_WAITLIST,
+  STATE_ADMIN_WAITLIST_ENTRY,
+  STATE_ADMIN_WAITLIST_PRIORITY,
+  STATE_ADMIN_CHECK_IN,
+  STATE_ADMIN_CHECK_IN_DATE,
+  STATE_ADMIN_CARS,
+  STATE_ADMIN_UPDATE_CAR,
+  STATE_EDIT_CAR_FIELD,
+  STATE_EDIT_CAR_VALUE,
+  STATE_ADMIN_REMOVE_CAR,
+  STATE_ADD_CAR,
+  STATE_ADD_UNIT_MODEL,
+  STATE_ADD_UNIT_PLATE,
+  STATE_UNIT_PLATE,
+  STATE_UNIT_STATUS,
+  STATE_ADMIN_USERS,
+  STATE_ADMIN_UPDATE_USER,
+  STATE_ADMIN_REMOVE_USER,
+  STATE_CLOSED
+};
+
+/**
+ * Position in a listing between pages. The next page starts right after the
+ * row the last one ended on, so a page costs its own rows however deep into
+ * the listing it is. Rows are identified by record and key, so a page still
+ * starts in the right place after rows before it were removed.
+ */
+struct PageCursor {
+  size_t branch;          /* Branch of a listing fanned out over all branches */
+  long after;             /* Record of the last row shown; -1 before the first page */
+  unsigned long long key; /* Hash of that row's key */
+  bool more;              /* Rows follow the cursor */
+};
+
+/* Listings a session can page through */
+enum Listing {
+  LISTING_NONE,
+  LISTING_CARS,           /* Cars of every branch */
+  LISTING_BRANCH_CARS,    /* Cars of the selected branch */
+  LISTING_INDEXED_CARS,   /* Cars of the selected branch, to pick one to remove */
+  LISTING_USERS,
+  LISTING_RENTALS         /* A user's rentals or the whole rental log */
+};
+
+/* One row of text as laid out on a terminal */
+struct TextRow {
+  const char *data;
+  size_t length;
+  size_t width; /* Columns taken */
+};
+
+/* What a client's terminal shows, kept to send only what changes */
+struct Screen {
+  struct Buffer text; /* Rows from the top of the terminal, one per line */
+  int rows;
+  int columns;
+  bool valid;         /* false until text is known to match the terminal */
+};
+
+/**
+ * One interactive session: the step it is at and what its flow has gathered
+ * so far. Nothing lives on the stack between two lines of input, so a single
+ * thread can drive any number of sessions.
+ */
+struct Session {
+  int state;
+  int return_state;      /* Menu that registration or a user edit returns to */
+  int field;             /* Field being entered or edited */
+  bool one_field;        /* Registration review: only this field is re-entered */
+  bool masked;           /* The next line is a password and must not be echoed */
+  bool deferred;         /* Admission control deferred the last line; feed it again */
+  int deferrals;
+  char mask_echo;        /* What the client shows for each password character, if anything */
+  size_t branch;         /* Branch the session's car and rental operations use */
+  char source[64];       /* Rate limit key of the client */
+  char login[20];
+  struct Users user;     /* Logged in customer */
+  struct Users form;     /* User being registered or edited */
+  struct CarModel car;   /* Car being added or edited */
+  struct CarUnit unit;   /* Unit being added or changed */
+  struct Rental rental;
+  long choices[MAX_CAR_MODELS]; /* Database positions of the cars offered for rent */
+  int num_choices;
+  struct WaitlistEntry waitlist;
+  long waitlist_index;
+  int listing;           /* Listing whose next page "n" shows */
+  struct PageCursor page; /* Start of the page shown */
+  struct PageCursor next; /* Start of the page after it */
+  char listing_user[20]; /* Whose rentals are listed; empty for the whole log */
+  struct RequestTimer timer;
+  FILE *out;             /* Output of the current step, collected in step */
+  FILE *term;            /* The client's terminal */
+  struct Buffer step;
+  struct Buffer frame;   /* What the terminal should show next */
+  struct Screen screen;
+};
+
+/* Keys the line editor decodes from escape sequences */
+enum EditorKey {
+  KEY_NONE = 256,
+  KEY_UP,
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE
+};
+
+/**
+ * Line editor for the controlling terminal. The terminal stays in raw mode
+ * for the whole session and input is read in blocks, so a key costs no
+ * system call of its own beyond its echo.
+ */
+struct LineEditor {
+  bool raw;                 /* false when input is not a terminal */
+  struct termios saved;     /* Terminal settings to restore */
+  struct termios active;    /* Raw mode, entered again when the process is continued */
+  char in[256];             /* Input read but not yet decoded */
+  size_t in_start;
+  size_t in_length;
+  char line[SESSION_LINE_SIZE];
+  size_t length;
+  size_t cursor;            /* Byte offset of the cursor in line */
+  char history[EDITOR_HISTORY][SESSION_LINE_SIZE]; /* Ring of entered lines */
+  size_t history_first;
+  size_t history_count;
+  struct Buffer out;        /* Redraw of the line, sent in one write */
+};
+
+/* The editor holding the terminal in raw mode, for signal handlers */
+struct LineEditor *raw_editor = NULL;
+
+/* A terminal session served over TCP */
+struct SessionConnection {
+  int fd;
+  char in[SESSION_LINE_SIZE];
+  size_t in_length;
+  struct Buffer out;
+  size_t out_sent;
+  bool echo_off; /* The client was asked to stop echoing */
+  FILE *stream;  /* The session's terminal output, written into out */
+  long idle_timer;    /* Closes the session when no input comes; -1 when not running */
+  long confirm_timer; /* Takes back a rental summary left unconfirmed; -1 when not running */
+  struct Session session;
+};
+
+/* Response body being built, reused by every HTTP request */
+struct Buffer http_body;
+
+/* Progress of a follower applying the primary's change log */
+struct ReplicaStatus {
+  size_t applied_seq;
+  size_t primary_seq;
+  time_t applied_commit_time;
+  time_t last_poll;
+  double lag_seconds;
+};
+
+/* What a timer does when it expires */
+enum TimerKind {
+  TIMER_RENTAL_OVERDUE, /* A rental is past its return date */
+  TIMER_RENTAL_CONFIRM, /* A session's rental summary was not confirmed in time */
+  TIMER_SESSION_IDLE    /* A session had no input for too long */
+};
+
+/* A timer, referred to by its position in the timer wheel's array */
+struct Timer {
+  time_t expires;
+  long next;    /* Next timer in the same slot, or on the free list; -1 at the end */
+  long prev;    /* Previous timer in the slot; -1 at the head */
+  int slot;     /* Slot of the wheel holding the timer; -1 when free */
+  int kind;
+  size_t owner; /* Branch of the rental, or slot of the session connection */
+  long record;  /* Record of the rental in its branch's rental log */
+};
+
+/**
+ * Hierarchical timer wheel with one second ticks. Level l has
+ * TIMER_WHEEL_SLOTS slots of TIMER_WHEEL_SLOTS^l seconds each. A timer sits
+ * in the slot of the lowest level whose span reaches its expiry and moves
+ * down a level each time its slot comes round, so adding and cancelling a
+ * timer take constant time and a tick only touches the timers due in it.
+ * Timers are linked by position in one array that grows by doubling.
+ */
+struct TimerWheel {
+  struct Timer *timers;
+  size_t capacity;
+  size_t used;     /* Positions handed out so far */
+  long free;       /* Positions given back, linked through next */
+  long slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1]; /* The last one holds expired timers */
+  time_t now;      /* Next second to process */
+  size_t pending;  /* Timers running or expired but not handled yet */
+  size_t fired;
+  bool started;
+};
+
+#define TIMER_EXPIRED (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define RENTAL_RETURNED (-2) /* Marks a rental without an overdue timer because it was checked in */
+
+struct TimerWheel timer_wheel;
+
+/* Overdue timers of a branch's rentals, kept in step with its rental and return logs */
+struct RentalTimers {
+  long *timers;    /* Timer of each rental by record; -1 for none, or RENTAL_RETURNED */
+  size_t capacity;
+  size_t rentals;  /* Records of the rental log seen so far */
+  size_t returns;  /* Records of the return log seen so far */
+  size_t changes;  /* Records of the change log seen so far, for rentals changed in place */
 };
 
+struct RentalTimers rental_timers[MAX_BRANCHES];
+size_t overdue_rentals = 0; /* Rentals found past their return date since startup */
+
 int checkIfFileIsEmpty(const char *filename);
-void flushInputBuffer(void);
-void getInput(char *str, size_t size);
-char getch(void);
 size_t loadHighestRecordedNumber(void);
 void saveHighestRecordedNumber(size_t highestNumber);
-void getPasswordInput(char *str, size_t size);
-void showUserRentals(const char *username);
+size_t showUserRentals(FILE *out, const char *username, struct PageCursor *page, size_t limit);
 char *generateUniqueRentalID(const char *prefix);
-void addCar(void);
-void viewUsers(void);
-void updateUser(char *usernameToFind);
-void removeUserByUsername(const char *usernameToRemove);
-void viewCars(void);
-void updateCar(const char *modelToFind);
-void removeCarModelByName(void);
-void enterUserData(struct Users *user);
-void registerNewUsers(void);
-void adminDashboard(void);
+int appendCar(const struct CarModel *car);
+long findUserIndex(const char *username, struct Users *user);
+bool isUserTaken(const char *username, const char *number, long skip);
+int registerUser(const struct Users *user);
+int saveUser(long index, const struct Users *user);
+size_t viewUsers(FILE *out, struct PageCursor *page, size_t limit);
+void removeUserByUsername(FILE *out, const char *usernameToRemove);
+size_t viewCars(FILE *out, struct PageCursor *page, size_t limit);
+long findCarIndex(const char *model_name, struct CarModel *car);
+int readCarAt(long index, struct CarModel *car);
+int saveCar(FILE *out, long index, const struct CarModel *car, bool was_available);
+size_t viewCarsIndexed(FILE *out, struct PageCursor *page, size_t limit);
+void removeCarAt(FILE *out, long index);
 int calculateRentalDays(const char *pickupDate, const char *returnDate);
-void rentCar(struct Users *user);
-void adminLogin(void);
-void userDashboardMenu(struct Users *user);
-void displayMainMenu(void);
-void userLogin(struct Users *loggedInUser);
+const char *tablePath(int table);
+size_t tableRecordSize(int table);
+const char *reportPath(const char *path);
+void logChange(int table, int op, long index, const void *data);
+int logChanges(struct ChangeRecord *changes, size_t count, bool durable);
+int removeRecordAt(const char *filename, size_t record_size, long index);
+int applyChange(const struct ChangeRecord *change);
+bool holdsRemovedRecord(const struct ChangeRecord *change, const char *filename,
+                        size_t record_size);
+void loadReplicaStatus(struct ReplicaStatus *status);
+void saveReplicaStatus(const struct ReplicaStatus *status);
+void showReplicationStatus(FILE *out);
+size_t pollChangeLog(const char *primary_log);
+void mirrorBranchList(const char *primary_dir);
+void followPrimary(const char *primary_dir);
+bool rejectWriteOnReplica(FILE *out);
+const char *tableLogPath(int table);
+void loadBranches(void);
+void selectBranch(size_t branch);
+bool isValidBranchName(const char *name);
+void addBranch(FILE *out, const char *input);
+void listBranches(FILE *out);
+void viewCarsAllBranches(FILE *out, struct PageCursor *page);
+unsigned long long hashKey(const char *key, size_t size);
+void stampFile(struct FileStamp *stamp, const struct stat *info);
+bool stampMatches(const struct FileStamp *stamp, const struct stat *info);
+bool stampCurrent(const struct FileStamp *stamp, const char *path);
+int keyIndexReset(struct KeyIndex *index, size_t capacity);
+int keyIndexInsert(struct KeyIndex *index, unsigned long long hash, long record);
+long keyIndexNext(const struct KeyIndex *index, unsigned long long hash, size_t *probe);
+struct IndexSlot *keyIndexFind(struct KeyIndex *index, unsigned long long hash);
+int reserveFleet(struct Fleet *fleet, size_t capacity);
+int refreshFleet(struct Fleet *fleet, const char *path);
+struct Fleet *loadFleet(void);
+void invalidateFleet(void);
+void fleetCar(const struct Fleet *fleet, size_t index, struct CarModel *car);
+int indexUser(struct UserIndex *index, const struct Users *user, long record);
+int refreshUserIndex(struct UserIndex *index, const char *path);
+struct UserIndex *loadUserIndex(void);
+long nextUser(int fd, const struct KeyIndex *index, size_t offset, const char *key,
+              size_t *probe, struct Users *user);
+int refreshRentalIndex(struct RentalIndex *index, const char *path);
+struct RentalIndex *loadRentalIndex(void);
+unsigned long long userChainHash(unsigned long long user, long record);
+int indexRental(struct RentalIndex *index, const struct Rental *rental, long record);
+long nextUserRental(const struct RentalIndex *index, unsigned long long user, long record);
+struct Rental *findUserRentals(const char *username, struct PageCursor *page, size_t limit,
+                               size_t *count);
+void *loadTableThread(void *arg);
+void preloadTables(bool verbose);
+void indexFilePath(const char *data_path, char *path, size_t size);
+int saveIndexFile(const char *data_path, const struct FileStamp *generation,
+                  size_t record_size, size_t records,
+                  struct KeyIndex *const indexes[], size_t num_indexes);
+void *mapIndexFile(const char *data_path, const struct stat *data_info, size_t record_size,
+                   size_t *records, struct KeyIndex *const indexes[], size_t num_indexes,
+                   size_t *map_size);
+void releaseIndexMap(void **map, size_t *map_size, struct KeyIndex *const indexes[],
+                     size_t num_indexes);
+void saveIndexes(void);
+void handleStopSignal(int signal_number);
+long resumePage(const struct PageCursor *page, unsigned long long current,
+                const struct KeyIndex *index);
+size_t fleetPageStart(const struct Fleet *fleet, const struct PageCursor *page);
+void pageStart(struct PageCursor *page, size_t branch);
+void formatCursor(const struct PageCursor *page, char *text, size_t size);
+bool parseCursor(const char *text, struct PageCursor *page);
+void sessionStartListing(struct Session *session, int listing, const char *username);
+void sessionShowPage(struct Session *session);
+bool sessionNextPage(struct Session *session, const char *line);
+bool httpPage(struct HttpConnection *conn, const struct HttpRequest *request,
+              struct PageCursor *page, size_t *limit);
+void jsonPageEnd(struct Buffer *buffer, size_t count, const struct PageCursor *page);
+ssize_t streamFile(int in, off_t offset, size_t length, int out);
+off_t sealedLength(const struct stat *info, size_t record_size);
+int backupFile(const char *path, const char *dir, size_t record_size, size_t *total);
+int backupData(const char *dir);
+void httpExportRentals(struct HttpConnection *conn, const struct HttpRequest *request);
+void jsonUser(struct Buffer *buffer, const struct Users *user);
+void jsonChange(struct Buffer *buffer, const struct ChangeRecord *change, const char *branch);
+size_t readChanges(const char *path, size_t after, size_t max, struct Buffer *buffer,
+                   const char *branch);
+void pushEvents(struct HttpConnection *conn);
+void httpEvents(struct HttpConnection *conn, const struct HttpRequest *request);
+int tailEvents(const char *branch_name, size_t after);
+bool rentalStamped(const struct Rental *rental);
+const char *rentalTime(const struct Rental *rental, char *text, size_t size);
+int refreshTimeIndex(struct TimeIndex *index, const char *path, size_t *records);
+struct Rental *findRentalsByTime(time_t since, time_t until, size_t last,
+                                 struct PageCursor *page, size_t limit, size_t *count);
+void httpRentalLog(struct HttpConnection *conn, const struct HttpRequest *request);
+int refreshInventory(struct Inventory *inventory, const char *path);
+struct Inventory *loadInventory(void);
+struct ModelStock *findStock(struct Inventory *inventory, const char *model_name);
+long findUnit(struct Inventory *inventory, const char *plate);
+long addUnit(struct Inventory *inventory, const struct CarUnit *unit);
+void pushFreeUnit(struct Inventory *inventory, long index);
+void unlinkFreeUnit(struct Inventory *inventory, long index);
+int saveUnit(struct Inventory *inventory, long index, int op);
+long takeFreeUnit(struct Inventory *inventory, struct ModelStock *stock, const char *rentalID);
+long allocateUnit(struct Inventory *inventory, struct ModelStock *stock, const char *rentalID);
+int storeUnits(struct Inventory *inventory, const long *indexes, size_t count);
+void syncModelAvailability(FILE *out, const char *model_name, bool available);
+void addCarUnit(FILE *out, const struct CarUnit *unit);
+void setCarUnitStatus(FILE *out, const char *plate, int status);
+const char *carStatus(const struct CarModel *car, char *text, size_t size);
+void jsonUnit(struct Buffer *buffer, const struct CarUnit *unit, const char *branch);
+void httpStock(struct HttpConnection *conn, const struct HttpRequest *request);
+int updateUnitStatus(FILE *out, struct Inventory *inventory, long index, int status);
+long findRentedUnit(struct Inventory *inventory, const char *rentalID);
+long findRentalByID(const char *rentalID, struct Rental *rental);
+int refreshReturnIndex(struct ReturnIndex *index, const char *path);
+bool rentalReturned(const char *rentalID);
+int appendReturn(const struct RentalReturn *record);
+const char *checkInRental(FILE *out, const char *rentalID, const char *date,
+                          struct RentalReturn *record);
+void showCheckIn(FILE *out, const char *rentalID, const char *error,
+                 const struct RentalReturn *record);
+size_t checkInBatch(const char *text, FILE *out, struct Buffer *json, double *late_fees);
+void jsonReturn(struct Buffer *buffer, const struct RentalReturn *record);
+void jsonWaitlistEntry(struct Buffer *buffer, const struct WaitlistEntry *entry,
+                       const char *branch);
+void jsonDemand(struct Buffer *buffer, const struct DemandStats *stats, const char *branch);
+void jsonNotification(struct Buffer *buffer, const struct Notification *notification,
+                      const char *branch);
+void httpCheckIn(struct HttpConnection *conn, const struct HttpRequest *request);
+int checkInFile(const char *path);
+void linkTimer(long handle, int slot);
+void unlinkTimer(long handle);
+void placeTimer(long handle);
+long addTimer(int kind, time_t expires, size_t owner, long record);
+void freeTimer(long handle);
+void cancelTimer(long handle);
+size_t expireTimers(time_t until);
+bool nextExpiredTimer(struct Timer *timer);
+int timerPollTimeout(void);
+time_t rentalDue(const struct Rental *rental);
+int reserveRentalTimers(struct RentalTimers *tracked, size_t count);
+int trackRentals(size_t branch);
+void runTimers(void);
+void startTimers(void);
+void sessionTimeout(struct Session *session, int state, const char *message);
+void restartSessionTimers(struct SessionConnection *conn, size_t slot);
+void fireSessionTimers(struct SessionConnection **connections);
+long findRentalAnyBranch(const char *rentalID, struct Rental *rental);
+int closeRental(FILE *out, struct RentalReturn *record);
+int saveRental(long record, const struct Rental *rental);
+bool rentalHoldsCar(const struct Rental *rental);
+size_t waitingBefore(const char *model_name, const char *date);
+const char *changeRentalReturn(const char *rentalID, const char *username, const char *date,
+                               struct Rental *rental);
+const char *cancelRental(FILE *out, const char *rentalID, const char *username,
+                         struct RentalReturn *record);
+void httpChangeRental(struct HttpConnection *conn, const struct HttpRequest *request,
+                      struct HttpSlice rentalID);
+void stampRentalTime(struct Rental *rental, time_t now);
+bool rentalIndexCurrent(void);
+void indexAppendedRentals(bool indexed, long first, const struct Rental *appended, size_t count);
+const char *parseGroup(const char *text, struct GroupBooking *group);
+int lockFleet(struct FleetLock *lock);
+void unlockFleet(struct FleetLock *lock);
+int storeGroupCars(const struct GroupBooking *group, bool taken);
+void releaseGroup(struct GroupBooking *group, struct Inventory *inventory);
+const char *bookGroup(const struct Users *user, struct GroupBooking *group, const char *pickup,
+                      const char *return_date);
+const char *takeGroup(const struct Users *user, struct GroupBooking *group, const char *pickup,
+                      const char *return_date, int days, struct ChangeRecord *changes);
+void httpBookGroup(struct HttpConnection *conn, const struct HttpRequest *request);
+bool isValidMonth(const char *month);
+struct InvoiceLine *addInvoiceLine(struct InvoiceLine **lines, size_t *count, size_t *capacity);
+int readInvoiceLines(const char *month, struct InvoiceLine **lines, size_t *count,
+                     size_t *records);
+int compareInvoiceLines(const void *a, const void *b);
+void invoiceFileName(const char *username, size_t length, char *name, size_t size);
+void csvField(FILE *out, const char *text);
+int writeInvoice(const struct InvoiceRun *run, const struct InvoiceCustomer *customer);
+void *invoiceWorker(void *arg);
+int writeInvoices(const char *month, const char *dir, bool csv);
+void rentalNotification(struct Notification *notification, int kind, const struct Rental *rental);
+void notificationChange(struct ChangeRecord *change, int kind, const struct Rental *rental);
+int queueNotifications(const struct Notification *notifications, size_t count);
+void loadOutboxStatus(struct OutboxStatus *status);
+void saveOutboxStatus(const struct OutboxStatus *status);
+int spoolNotifications(const struct NotificationSink *sink, const char *branch, size_t first,
+                       const struct Notification *batch, size_t count);
+size_t deliverOutbox(const struct NotificationSink *sink);
+void deliverNotifications(const char *spool_dir);
+void showUserRentalsAllBranches(FILE *out, const char *username, struct PageCursor *page);
+bool takeCar(const char *model_name);
+int commitRental(const struct Users *user, struct Rental *rental, int notification);
+void todaysDate(char *date, size_t size);
+bool waitlistItemBefore(const struct WaitlistItem *a, const struct WaitlistItem *b);
+void waitQueuePush(struct WaitQueue *queue, struct WaitlistItem item);
+struct WaitlistItem waitQueuePop(struct WaitQueue *queue);
+struct WaitQueue *findWaitQueue(const char *model_name, bool create);
+void loadWaitlist(void);
+void recordDemand(const char *model_name, int counter);
+long enqueueWaitlist(struct WaitlistEntry *entry);
+int allocateFromWaitlist(const struct CarModel *car, struct WaitlistEntry *allocated);
+void notifyWaitlistAllocations(FILE *out, const struct Users *user);
+void showWaitlist(FILE *out);
+int setWaitlistPriority(long index, int priority);
+double monotonicSeconds(void);
+void detectRequestSource(void);
+unsigned long long hashRateLimitKey(int action, char scope, const char *key);
+struct TokenBucket *findTokenBucket(unsigned long long key,
+                                    const struct RateLimitPolicy *policy, double now);
+bool rateLimitAllow(int action, const char *username, const char *source);
+size_t requestsInFlight(void);
+bool rentalsOverloaded(void);
+int admitRequest(int request_class);
+void completeRequest(int request_class, double service_seconds);
+void endRequest(const struct RequestTimer *timer);
+void showMetrics(FILE *out);
+int bufferReserve(struct Buffer *buffer, size_t extra);
+void bufferAppend(struct Buffer *buffer, const char *data, size_t length);
+void bufferPrintf(struct Buffer *buffer, const char *format, ...);
+void *arenaAlloc(struct Arena *arena, size_t size);
+char *arenaPrintf(struct Arena *arena, const char *format, ...);
+void arenaReset(struct Arena *arena);
+void jsonString(struct Buffer *buffer, const char *text, size_t size);
+void jsonCar(struct Buffer *buffer, const struct CarModel *car, const char *branch);
+void jsonRental(struct Buffer *buffer, const struct Rental *rental, const char *branch);
+bool sliceEquals(struct HttpSlice slice, const char *text);
+bool sliceEqualsIgnoreCase(struct HttpSlice slice, const char *text);
+int parseHttpRequest(const char *data, size_t length, struct HttpRequest *request);
+const struct HttpSlice *httpHeader(const struct HttpRequest *request, const char *name);
+bool httpParamIn(struct HttpSlice params, const char *name, char *value, size_t size);
+bool httpParam(const struct HttpRequest *request, const char *name, char *value, size_t size);
+bool httpBasicAuth(const struct HttpRequest *request, char *username, size_t username_size,
+                   char *password, size_t password_size);
+void httpRespond(struct HttpConnection *conn, const struct HttpRequest *request,
+                 int status, const struct Buffer *body);
+void httpError(struct HttpConnection *conn, const struct HttpRequest *request,
+               int status, const char *message);
+bool httpSelectBranch(const struct HttpRequest *request);
+bool findUser(const char *login, const char *password, struct Users *user);
+bool findCar(const char *model_name, struct CarModel *car);
+void httpListCars(struct HttpConnection *conn, const struct HttpRequest *request,
+                  bool available_only);
+void httpQuote(struct HttpConnection *conn, const struct HttpRequest *request);
+void httpCreateRental(struct HttpConnection *conn, const struct HttpRequest *request);
+void httpUserRentals(struct HttpConnection *conn, const struct HttpRequest *request,
+                     struct HttpSlice username);
+void httpMetrics(struct HttpConnection *conn, const struct HttpRequest *request);
+bool handleHttpRequest(struct HttpConnection *conn, const struct HttpRequest *request);
+void processHttpInput(struct HttpConnection *conn);
+bool flushHttpOutput(struct HttpConnection *conn);
+void closeHttpConnection(struct HttpConnection **slot);
+int openListener(int port);
+void serveHttp(int port);
+bool isYes(const char *line);
+bool parseLong(const char *line, long *value);
+bool parseDouble(const char *line, double *value);
+void setUserField(struct Users *user, int field, const char *value);
+bool setCarField(struct CarModel *car, int field, const char *value);
+int sessionStart(struct Session *session, FILE *term, const char *source);
+void sessionEnd(struct Session *session);
+void sessionResize(struct Session *session, int rows, int columns);
+void sessionRender(struct Session *session);
+void sessionInput(struct Session *session, const char *line);
+void sessionDispatch(struct Session *session, const char *line);
+void sessionPrompt(struct Session *session);
+bool sessionAdmit(struct Session *session, int request_class);
+void sessionStartRegistration(struct Session *session, int return_state);
+void sessionStartEditUser(struct Session *session, const char *username, int return_state);
+void sessionMainMenu(struct Session *session, const char *line);
+void sessionCheckNumber(struct Session *session);
+void sessionRegister(struct Session *session, const char *line);
+void sessionLogin(struct Session *session, const char *line);
+void sessionUserMenu(struct Session *session, const char *line);
+void sessionChooseBranch(struct Session *session, const char *line);
+void sessionOfferCars(struct Session *session);
+void sessionRent(struct Session *session, const char *line);
+void sessionEditUser(struct Session *session, const char *line);
+void sessionAdmin(struct Session *session, const char *line);
+void sessionAdminCars(struct Session *session, const char *line);
+void sessionAdminUsers(struct Session *session, const char *line);
+void editorBegin(struct LineEditor *editor);
+void catchSignal(int signal_number, void (*handler)(int));
+void suspendTerminal(int signal_number);
+void editorEnd(struct LineEditor *editor);
+int editorReadByte(struct LineEditor *editor, int wait_ms);
+int editorReadKey(struct LineEditor *editor);
+size_t editorPrevious(const char *line, size_t position);
+size_t editorNext(const char *line, size_t length, size_t position);
+void editorRefresh(struct LineEditor *editor, size_t old_cursor, char mask, bool masked);
+void editorSetLine(struct LineEditor *editor, const char *text);
+bool editorReadLine(struct LineEditor *editor, char *line, size_t size, bool masked, char mask);
+void runTerminalSession(void);
+ssize_t writeToBuffer(void *cookie, const char *data, size_t size);
+size_t displayWidth(const char *text, size_t length);
+size_t wrapRows(const char *text, size_t length, int columns,
+                struct TextRow **rows, size_t *capacity);
+void screenRender(struct Screen *screen, const char *frame, size_t length, FILE *term);
+void screenEcho(struct Screen *screen, const char *line, bool masked, char mask);
+void handleTerminalResize(int signal);
+void terminalSize(int *rows, int *columns);
+size_t telnetCommand(struct Session *session, const unsigned char *data, size_t length);
+void cleanSessionLine(const char *data, size_t length, char *line);
+void processSessionInput(struct SessionConnection *conn);
+bool flushSessionOutput(struct SessionConnection *conn);
+void closeSessionConnection(struct SessionConnection **slot);
+void serveSessions(int port);
 
 /* Main function */
-int main(void)
+int main(int argc, char *argv[])
 {
-  int choice;
-
-  do {
-    CLEAN_SCREEN();
-    displayMainMenu();
-    printf("\nEnter your choice: ");
-    scanf("%d", &choice);
-    flushInputBuffer();
-
-    switch (choice) {
-    case 1:
-      registerNewUsers();
-      break;
-    case 2: {
-      struct Users loggedInUser;
-      userLogin(&loggedInUser);
-      break;
+  const char *primary_dir = NULL;
+  const char *backup_dir = NULL;
+  const char *events_branch = NULL;
+  const char *check_in_file = NULL;
+  const char *invoice_month = NULL;
+  const char *invoice_dir = NULL;
+  bool invoice_csv = false;
+  const char *spool_dir = NULL;
+  long events_after = 0;
+  int http_port = 0;
+  int session_port = 0;
+
+  /* Route to the main branch until another one is chosen */
+  loadBranches();
+  selectBranch(0);
+  detectRequestSource();
+
+  /* Command line options for running as a replica or against one */
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+      primary_dir = argv[++i];
+    } else if (strcmp(argv[i], "--read-only") == 0) {
+      read_only = true;
+    } else if (strcmp(argv[i], "--reports-from") == 0 && i + 1 < argc) {
+      report_data_dir = argv[++i];
+    } else if (strcmp(argv[i], "--http") == 0 && i + 1 < argc) {
+      http_port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+      session_port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--backup") == 0 && i + 1 < argc) {
+      backup_dir = argv[++i];
+    } else if (strcmp(argv[i], "--check-in") == 0 && i + 1 < argc) {
+      check_in_file = argv[++i];
+    } else if (strcmp(argv[i], "--invoices") == 0 && i + 2 < argc) {
+      invoice_month = argv[++i];
+      invoice_dir = argv[++i];
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      invoice_csv = true;
+    } else if (strcmp(argv[i], "--deliver") == 0 && i + 1 < argc) {
+      spool_dir = argv[++i];
+    } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+      events_branch = argv[++i];
+    } else if (strcmp(argv[i], "--after") == 0 && i + 1 < argc &&
+               parseLong(argv[i + 1], &events_after) && events_after >= 0) {
+      i++;
+    } else {
+      fprintf(stderr, "Usage: %s [--follow <primary data dir>] [--read-only] "
+              "[--reports-from <replica data dir>] [--http <port>] "
+              "[--sessions <port>] [--backup <dir>] [--events <branch> [--after <seq>]] "
+              "[--check-in <file>] [--invoices <YYYY-MM> <dir> [--csv]] "
+              "[--deliver <spool dir>]\n",
+              argv[0]);
+      return 1;
     }
-    case 3:
-      adminLogin();
-      break;
-    case 4:
-      printf("Exiting the Car Rental System. Goodbye!\n");
-      exit(0);
-    default:
-      printf("Invalid choice. Please try again.\n");
+  }
+  if (http_port > 0 && session_port > 0) {
+    fprintf(stderr, "--http and --sessions are served by separate processes\n");
+    return 1;
+  }
+
+  if (primary_dir != NULL) {
+    followPrimary(primary_dir);
+    return 0;
+  }
+  if (backup_dir != NULL)
+    return backupData(backup_dir) == 0 ? 0 : 1;
+  if (events_branch != NULL)
+    return tailEvents(events_branch, events_after) == 0 ? 0 : 1;
+  if (check_in_file != NULL) {
+    if (read_only) {
+      fprintf(stderr, "This is a read-only replica\n");
+      return 1;
     }
-  } while (1);
+    int result = checkInFile(check_in_file);
+    saveIndexes();
+    return result == 0 ? 0 : 1;
+  }
+  if (invoice_month != NULL)
+    return writeInvoices(invoice_month, invoice_dir, invoice_csv) == 0 ? 0 : 1;
+  if (spool_dir != NULL) {
+    deliverNotifications(spool_dir);
+    return 0;
+  }
+  /* Servers load every table up front; the menu loads each one on first use */
+  if (http_port > 0 || session_port > 0) {
+    preloadTables(true);
+    startTimers();
+  }
+
+  if (http_port > 0 || session_port > 0) {
+    if (http_port > 0)
+      serveHttp(http_port);
+    else
+      serveSessions(session_port);
+    saveIndexes();
+    return stop_requested ? 0 : 1;
+  }
 
+  runTerminalSession();
+  saveIndexes();
   return 0;
 }
 
@@ -168,65 +1483,350 @@ int checkIfFileIsEmpty(const char *filename)
   return ((file_size == 0) ? 1 : 0);
 }
 
-/* Flushes the input buffer by reading characters until a newline or EOF is encountered. */
-void flushInputBuffer(void)
+/**
+ * Put the controlling terminal into raw mode for the rest of the session:
+ * keys arrive one by one and the editor does its own echo. Input that is
+ * not a terminal is read as plain lines.
+ */
+void editorBegin(struct LineEditor *editor)
 {
-  int c;
-  while ((c = getchar()) != '\n' && c != EOF);
+  memset(editor, 0, sizeof(struct LineEditor));
+  if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &editor->saved) < 0)
+    return;
+
+  struct termios *raw = &editor->active;
+  *raw = editor->saved;
+  raw->c_lflag &= ~(ICANON | ECHO | IEXTEN);
+  raw->c_iflag &= ~(IXON | ICRNL);
+  raw->c_cc[VMIN] = 1;
+  raw->c_cc[VTIME] = 0;
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, raw) < 0) {
+    fprintf(stderr, "Error entering raw mode: %s\n", strerror(errno));
+    return;
+  }
+  editor->raw = true;
+  raw_editor = editor;
+  catchSignal(SIGTSTP, suspendTerminal);
 }
 
-/* Get a string input and remove a '\n' taken by fgets  */
-void getInput(char *str, size_t size)
+/**
+ * Install a signal handler that interrupts a blocking read() instead of
+ * restarting it, so the input loop sees the signal.
+ */
+void catchSignal(int signal_number, void (*handler)(int))
 {
-  if (fgets(str, size, stdin) != NULL) {
-    char *newline = strchr(str, '\n');
-    if (newline != NULL) {
-      *newline = '\0';
-    } else {
-      if (size > 0) {
-        str[size - 1] = '\0';
-      }
-    }
-  }
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(signal_number, &action, NULL);
 }
 
 /**
- * Custom implementation of getch() for Unix-based systems.
- * Allows reading a single character from the terminal without buffering.
- * Returns the character read.
- *
- * Source: https://stackoverflow.com/questions/7469139/what-is-the-equivalent-to-getch-getche-in-linux
+ * Stop the process on Ctrl-Z with the terminal as it was before raw mode,
+ * and enter raw mode again once the shell continues it.
  */
-char getch(void)
+void suspendTerminal(int signal_number)
 {
-  char buf = 0;
-  struct termios old = {0};
-  fflush(stdout);
-  if(tcgetattr(0, &old) < 0)
-    perror("tcsetattr()");
-  old.c_lflag &= ~ICANON;
-  old.c_lflag &= ~ECHO;
-  old.c_cc[VMIN] = 1;
-  old.c_cc[VTIME] = 0;
-  if(tcsetattr(0, TCSANOW, &old) < 0)
-    perror("tcsetattr ICANON");
-  if(read(0, &buf, 1) < 0)
-    perror("read()");
-  old.c_lflag |= ICANON;
-  old.c_lflag |= ECHO;
-  if(tcsetattr(0, TCSADRAIN, &old) < 0)
-    perror("tcsetattr ~ICANON");
-  return buf;
+  int saved_errno = errno;
+  sigset_t pending;
+
+  if (raw_editor != NULL)
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw_editor->saved);
+  signal(signal_number, SIG_DFL);
+  sigemptyset(&pending);
+  sigaddset(&pending, signal_number);
+  raise(signal_number);
+  sigprocmask(SIG_UNBLOCK, &pending, NULL);
+
+  /* Stopped above until SIGCONT */
+  catchSignal(signal_number, suspendTerminal);
+  if (raw_editor != NULL)
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw_editor->active);
+  errno = saved_errno;
+}
+
+/* Give the terminal back the way it was */
+void editorEnd(struct LineEditor *editor)
+{
+  if (editor->raw && tcsetattr(STDIN_FILENO, TCSAFLUSH, &editor->saved) < 0)
+    fprintf(stderr, "Error leaving raw mode: %s\n", strerror(errno));
+  if (editor->raw)
+    signal(SIGTSTP, SIG_DFL);
+  editor->raw = false;
+  raw_editor = NULL;
+  free(editor->out.data);
 }
 
 /**
- * Load the highest recorded number from a file.
- * Returns the highest number found in the file, or 0 if the file doesn't exist or an error occurs.
+ * Next byte of input, refilling the buffer with one read() when it runs
+ * empty. With wait_ms >= 0 an empty buffer waits only that long for more.
+ * Returns -1 at the end of input, on timeout or once a stop is requested.
  */
-size_t loadHighestRecordedNumber() 
+int editorReadByte(struct LineEditor *editor, int wait_ms)
 {
-  size_t highestNumber = 0;
-  FILE *file = fopen(current_num_of_user, "r");
+  if (editor->in_start == editor->in_length) {
+    struct pollfd input = {.fd = STDIN_FILENO, .events = POLLIN};
+    if (wait_ms >= 0 && poll(&input, 1, wait_ms) <= 0)
+      return -1;
+
+    ssize_t received;
+    do {
+      received = read(STDIN_FILENO, editor->in, sizeof(editor->in));
+    } while (received < 0 && errno == EINTR && !stop_requested);
+    if (received <= 0)
+      return -1;
+    editor->in_start = 0;
+    editor->in_length = received;
+  }
+  return (unsigned char)editor->in[editor->in_start++];
+}
+
+/* Decode one key, including the escape sequences sent for cursor keys */
+int editorReadKey(struct LineEditor *editor)
+{
+  int c = editorReadByte(editor, -1);
+  if (c != '\033')
+    return c;
+
+  /* A lone Escape press is not followed by the rest of a sequence */
+  int kind = editorReadByte(editor, 50);
+  if (kind != '[' && kind != 'O')
+    return KEY_NONE;
+  int code = editorReadByte(editor, 50);
+  if (code >= '0' && code <= '9') {
+    int number = code - '0';
+    while ((code = editorReadByte(editor, 50)) >= '0' && code <= '9')
+      number = number * 10 + code - '0';
+    if (code != '~')
+      return KEY_NONE;
+    switch (number) {
+    case 1:
+    case 7:
+      return KEY_HOME;
+    case 3:
+      return KEY_DELETE;
+    case 4:
+    case 8:
+      return KEY_END;
+    }
+    return KEY_NONE;
+  }
+  switch (code) {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return KEY_RIGHT;
+  case 'D':
+    return KEY_LEFT;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  }
+  return KEY_NONE;
+}
+
+/* Start of the character before position in an edited line */
+size_t editorPrevious(const char *line, size_t position)
+{
+  while (position > 0 && ((unsigned char)line[--position] & 0xC0) == 0x80)
+    ;
+  return position;
+}
+
+/* Start of the character after position in an edited line */
+size_t editorNext(const char *line, size_t length, size_t position)
+{
+  while (position < length && ((unsigned char)line[++position] & 0xC0) == 0x80)
+    ;
+  return position;
+}
+
+/**
+ * Redraw the line being edited from the cursor's old position on, given
+ * how far that was from the start of the line, and leave the cursor at its
+ * new place. Everything goes out in one write.
+ */
+void editorRefresh(struct LineEditor *editor, size_t old_cursor, char mask, bool masked)
+{
+  struct Buffer *out = &editor->out;
+  size_t shown = displayWidth(editor->line, old_cursor);
+
+  if (masked && mask == '\0')
+    return; /* Nothing of the line is on screen */
+  out->length = 0;
+  if (shown > 0)
+    bufferPrintf(out, "\033[%zuD", shown);
+  if (!masked) {
+    bufferAppend(out, editor->line, editor->length);
+  } else if (mask != '\0') {
+    for (size_t i = displayWidth(editor->line, editor->length); i > 0; i--)
+      bufferAppend(out, &mask, 1);
+  }
+  bufferAppend(out, "\033[K", 3);
+  size_t back = displayWidth(editor->line + editor->cursor, editor->length - editor->cursor);
+  if (back > 0)
+    bufferPrintf(out, "\033[%zuD", back);
+  fwrite(out->data, 1, out->length, stdout);
+  fflush(stdout);
+}
+
+/* Replace the edited line, as when stepping through the history */
+void editorSetLine(struct LineEditor *editor, const char *text)
+{
+  size_t old_cursor = editor->cursor;
+
+  snprintf(editor->line, sizeof(editor->line), "%s", text);
+  editor->length = strlen(editor->line);
+  editor->cursor = editor->length;
+  editorRefresh(editor, old_cursor, '\0', false);
+}
+
+/**
+ * Read one line with editing: cursor keys, Home/End, Backspace/Delete,
+ * Ctrl-A/E/U/K, and Up/Down through the lines entered before. A masked line
+ * (a password) shows mask for each character, or nothing if mask is '\0',
+ * and is kept out of the history. Returns false at the end of input.
+ */
+bool editorReadLine(struct LineEditor *editor, char *line, size_t size, bool masked, char mask)
+{
+  char draft[SESSION_LINE_SIZE] = "";
+  size_t browse = editor->history_count;
+
+  editor->length = 0;
+  editor->cursor = 0;
+  editor->line[0] = '\0';
+  for (;;) {
+    int key = editorReadKey(editor);
+    size_t old_cursor = editor->cursor;
+
+    if (key < 0 || (key == CTRL_KEY('d') && editor->length == 0))
+      return false;
+    if (key == '\n' || key == '\r') {
+      /* A terminal sends CR LF or LF CR for one Enter on some setups */
+      if (key == '\r' && editor->in_start < editor->in_length &&
+          editor->in[editor->in_start] == '\n')
+        editor->in_start++;
+      break;
+    }
+    if (!editor->raw) {
+      if (key != '\0' && editor->length < sizeof(editor->line) - 1)
+        editor->line[editor->length++] = key;
+      continue;
+    }
+
+    switch (key) {
+    case 127:
+    case CTRL_KEY('h'):
+      if (editor->cursor == 0)
+        continue;
+      editor->cursor = editorPrevious(editor->line, editor->cursor);
+      memmove(editor->line + editor->cursor, editor->line + old_cursor,
+              editor->length - old_cursor);
+      editor->length -= old_cursor - editor->cursor;
+      break;
+    case KEY_DELETE:
+      if (editor->cursor == editor->length)
+        continue;
+      {
+        size_t next = editorNext(editor->line, editor->length, editor->cursor);
+        memmove(editor->line + editor->cursor, editor->line + next, editor->length - next);
+        editor->length -= next - editor->cursor;
+      }
+      break;
+    case KEY_LEFT:
+      editor->cursor = editorPrevious(editor->line, editor->cursor);
+      break;
+    case KEY_RIGHT:
+      editor->cursor = editorNext(editor->line, editor->length, editor->cursor);
+      break;
+    case KEY_HOME:
+    case CTRL_KEY('a'):
+      editor->cursor = 0;
+      break;
+    case KEY_END:
+    case CTRL_KEY('e'):
+      editor->cursor = editor->length;
+      break;
+    case CTRL_KEY('u'):
+      memmove(editor->line, editor->line + editor->cursor, editor->length - editor->cursor);
+      editor->length -= editor->cursor;
+      editor->cursor = 0;
+      break;
+    case CTRL_KEY('k'):
+      editor->length = editor->cursor;
+      break;
+    case KEY_UP:
+    case KEY_DOWN:
+      if (masked)
+        continue;
+      editor->line[editor->length] = '\0';
+      if (browse == editor->history_count)
+        snprintf(draft, sizeof(draft), "%s", editor->line);
+      if (key == KEY_UP && browse > 0)
+        browse--;
+      else if (key == KEY_DOWN && browse < editor->history_count)
+        browse++;
+      else
+        continue;
+      editorSetLine(editor, browse < editor->history_count
+                                ? editor->history[(editor->history_first + browse) % EDITOR_HISTORY]
+                                : draft);
+      continue;
+    default:
+      if (key < 32 || key > 255 || editor->length >= sizeof(editor->line) - 1)
+        continue;
+      memmove(editor->line + editor->cursor + 1, editor->line + editor->cursor,
+              editor->length - editor->cursor);
+      editor->line[editor->cursor++] = key;
+      editor->length++;
+      /* Typing at the end of the line, the common case, needs no redraw */
+      if (editor->cursor == editor->length && (!masked || mask != '\0')) {
+        char echo = masked ? mask : key;
+        if (!masked || ((unsigned char)key & 0xC0) != 0x80)
+          putchar(echo);
+        fflush(stdout);
+        continue;
+      }
+      break;
+    }
+    editor->line[editor->length] = '\0';
+    editorRefresh(editor, old_cursor, mask, masked);
+  }
+
+  editor->line[editor->length] = '\0';
+  if (editor->raw && !masked)
+    fputs("\r\n", stdout);
+  fflush(stdout);
+  snprintf(line, size, "%s", editor->line);
+
+  /* Remember the line, unless it repeats the last one */
+  if (!masked && editor->length > 0) {
+    size_t last = (editor->history_first + editor->history_count - 1) % EDITOR_HISTORY;
+    if (editor->history_count == 0 || strcmp(editor->history[last], editor->line) != 0) {
+      if (editor->history_count == EDITOR_HISTORY)
+        editor->history_first = (editor->history_first + 1) % EDITOR_HISTORY;
+      else
+        editor->history_count++;
+      last = (editor->history_first + editor->history_count - 1) % EDITOR_HISTORY;
+      memcpy(editor->history[last], editor->line, editor->length + 1);
+    }
+  }
+  return true;
+}
+
+/**
+ * Load the highest recorded number from a file.
+ * Returns the highest number found in the file, or 0 if the file doesn't exist or an error occurs.
+ */
+size_t loadHighestRecordedNumber() 
+{
+  size_t highestNumber = 0;
+  FILE *file = fopen(current_num_of_user, "r");
   if (file != NULL) {
     if (fscanf(file, "%zu", &highestNumber) != 1) {
       /* Handle fscanf error if needed */
@@ -250,340 +1850,342 @@ void saveHighestRecordedNumber(size_t highestNumber)
   }
 }
 
-void getPasswordInput(char *str, size_t size)
+size_t showUserRentals(FILE *out, const char *username, struct PageCursor *page, size_t limit)
 {
-  char password[size];
-  size_t i = 0;
-  char ch;
-
-  while (i < size - 1) {
-    ch = getch();
-     /* Handle Enter key to terminate input */
-    if (ch == '\n' || ch == '\r') {
-      break;
+  struct Rental *rentals;
+  struct Rental record;
+  char time_text[32];
+  size_t count = 0;
+
+  /* One user's rentals are found through the index */
+  if (username != NULL) {
+    rentals = findUserRentals(username, page, limit, &count);
+    if (rentals == NULL) {
+      fprintf(out, "There is no renting transactions made yet\n");
+      return 0;
     }
-     /* Handle backspace to erase characters */
-    if (ch == 127 || ch == '\b') {
-      if (i > 0) {
-        putchar('\b');
-        putchar(' ');
-        putchar('\b');
-        i--;
-      }
-    } else {
-      password[i] = ch;
-      putchar('*'); /*  Print asterisks for each character */
-      i++;
+    fprintf(out, "%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10s\n",
+           "Time", "Renta_ID", "Username", "Model Name", "Company", "Color",
+           "Pickup Date", "Return Date", "Total Cost");
+    for (size_t i = 0; i < count; i++) {
+      const struct Rental *record = &rentals[i];
+      fprintf(out, "%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10.2lf\n",
+             rentalTime(record, time_text, sizeof(time_text)), record->rentalID, record->rentingUser.username,
+             record->selectedCar.model_name, record->selectedCar.company,
+             record->selectedCar.color, record->pickupDate, record->returnDate,
+             record->totalCost);
     }
+    return count;
   }
-  password[i] = '\0'; /* Null-terminate the password */
-  strcpy(str, password);
-}
 
-void showUserRentals(const char *username)
-{
-  FILE *file = fopen(rental_records, "rb");
+  /* Reports may be served by a read replica */
+  const char *filename = reportPath(rental_records);
+  FILE *file = fopen(filename, "rb");
+  page->more = false;
   if (file == NULL) {
     fprintf(stderr, "Error opening the file : %s\n", strerror(errno));
-    return;
+    return 0;
   }
 
-  if (checkIfFileIsEmpty(rental_records) == -1 || checkIfFileIsEmpty(rental_records) == 1) {
-    fprintf(stderr, "There is no renting transactions made yet\n");
+  if (checkIfFileIsEmpty(filename) == -1 || checkIfFileIsEmpty(filename) == 1) {
+    fprintf(out, "There is no renting transactions made yet\n");
   } else {
-    struct Rental record;
-    printf("%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10s\n",
+    fprintf(out, "%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10s\n",
            "Time", "Renta_ID", "Username", "Model Name", "Company", "Color",
            "Pickup Date", "Return Date", "Total Cost");
 
-    while (fread(&record, sizeof(struct Rental), 1, file) == 1) {
-      if (username == NULL ||
-          strcmp(record.rentingUser.username, username) == 0) {
-        printf("%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10.2lf\n",
-               record.time, record.rentalID, record.rentingUser.username,
-               record.selectedCar.model_name, record.selectedCar.company,
-               record.selectedCar.color, record.pickupDate, record.returnDate,
-               record.totalCost);
-      }
+    /* The log is only appended to, so the page starts at the record after the cursor */
+    fseek(file, (page->after + 1) * (long)sizeof(struct Rental), SEEK_SET);
+    while (count < limit && fread(&record, sizeof(struct Rental), 1, file) == 1) {
+      fprintf(out, "%-25s%-15s%-15s%-15s%-12s%-10s%-15s%-15s%-10.2lf\n",
+             rentalTime(&record, time_text, sizeof(time_text)), record.rentalID, record.rentingUser.username,
+             record.selectedCar.model_name, record.selectedCar.company,
+             record.selectedCar.color, record.pickupDate, record.returnDate,
+             record.totalCost);
+      page->after++;
+      count++;
     }
+    page->more = fread(&record, sizeof(struct Rental), 1, file) == 1;
   }
   fclose(file);
+  return count;
 }
 
+/**
+ * Make a rental ID for the selected branch, such as R0-12345 in the first
+ * branch, allocated from the request arena. The branch number keeps IDs of
+ * different branches apart, so only this branch's index is checked.
+ * Returns NULL when the arena is exhausted.
+ */
 char *generateUniqueRentalID(const char *prefix)
 {
-    /* Initialize random number generator */
-    srand(time(NULL));
-    /* Generate a random 5-digit ID */
-    int uniqueID;
-    do {
-        uniqueID = rand() % 100000; /* Generates a random number between 0 and 99999 */
-    } while (uniqueID < 10000); /* Ensure it's a 5-digit number */
+    static bool seeded = false;
+    struct Rental rental;
+    long low = 10000;
+    char *id;
+
+    /* Initialize random number generator once, so IDs drawn in the same second differ */
+    if (!seeded) {
+        srand(time(NULL) ^ getpid());
+        seeded = true;
+    }
+    /* Draw 5-digit IDs until one is unused in the branch, widening them once they run short */
+    for (int attempt = 0;; attempt++) {
+        if (attempt > 0 && attempt % 4 == 0 && low < 100000000)
+            low *= 10;
+        long uniqueID = low + ((long)rand() * RAND_MAX + rand()) % (low * 9);
+        id = arenaPrintf(&request_arena, "%s%zu-%ld", prefix, current_branch, uniqueID);
+        if (id == NULL)
+            return NULL;
+        if (findRentalByID(id, &rental) < 0)
+            break;
+    }
 
-    char *rentlID = (char *) malloc(10*sizeof(char));
-    snprintf(rentlID, 10, "%s%05d", prefix, uniqueID);
-    return rentlID;
+    /* Lives until the end of the request */
+    return id;
 }
 
 /**
- * Add a new car to the car database.
+ * Add a new car to the car database of the selected branch.
+ * Returns 0 on success and -1 on error.
  */
-void addCar(void)
+int appendCar(const struct CarModel *car)
 {
-  struct CarModel car;
-
-  flushInputBuffer();
-  printf("Enter Car Model Name: ");
-  scanf("%s", car.model_name);
-  flushInputBuffer();
-  printf("Enter Car Company: ");
-  scanf("%s", car.company);
-  flushInputBuffer();
-  printf("Enter Year of Manufacture: ");
-  scanf("%zu", &car.year);
-  flushInputBuffer();
-  printf("Enter Rental Rate per Day: ");
-  scanf("%lf", &car.rental_rate);
-  flushInputBuffer();
-  printf("Enter Passenger Capacity: ");
-  scanf("%zu", &car.passenger_capacity);
-  flushInputBuffer();
-  printf("Enter Fuel Efficiency (MPG): ");
-  scanf("%lf", &car.fuel_efficiency);
-  flushInputBuffer();
-  printf("Enter Car Color: ");
-  scanf("%s", car.color);
-
-  /* Assuming the car is available initially */
-  car.available_status = true; 
-
   /* Open a car database */
   FILE *file = fopen(car_database, "ab");
   if (file == NULL) {
     fprintf(stderr, "Error opening the file for writing: %s\n", strerror(errno));
-    return;
+    return -1;
   }
+  fseek(file, 0, SEEK_END);
+  long index = ftell(file) / (long)sizeof(struct CarModel);
   /* Register and save a new car data into a car database */
-  if (fwrite(&car, sizeof(struct CarModel), 1, file) != 1) {
+  if (fwrite(car, sizeof(struct CarModel), 1, file) != 1) {
     fprintf(stderr, "Error writing to file: %s\n", strerror(errno));
     fclose(file);
-    return;
+    return -1;
   }
   /* Close a database */
   fclose(file);
-  printf("Car added successfully.\n");
+  invalidateFleet();
+  logChange(CHANGE_TABLE_CARS, CHANGE_OP_APPEND, index, car);
+  return 0;
+}
+
+long findUserIndex(const char *username, struct Users *user)
+{
+  struct UserIndex *users = loadUserIndex();
+  size_t probe = 0;
+
+  if (users == NULL)
+    return -1;
+  int fd = open(user_database, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  long index = nextUser(fd, &users->by_username, offsetof(struct Users, username),
+                        username, &probe, user);
+  close(fd);
+  return index;
+}
+
+bool isUserTaken(const char *username, const char *number, long skip)
+{
+  struct UserIndex *users = loadUserIndex();
+  struct Users user;
+  bool taken = false;
+  size_t probe;
+  long index;
+
+  if (users == NULL)
+    return false;
+  int fd = open(user_database, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (username != NULL) {
+    probe = 0;
+    while (!taken && (index = nextUser(fd, &users->by_username, offsetof(struct Users, username),
+                                       username, &probe, &user)) >= 0)
+      taken = index != skip;
+  }
+  if (number != NULL) {
+    probe = 0;
+    while (!taken && (index = nextUser(fd, &users->by_number, offsetof(struct Users, number),
+                                       number, &probe, &user)) >= 0)
+      taken = index != skip;
+  }
+  close(fd);
+  return taken;
 }
 
 /**
- * View user information stored in a binary file and display it in a tabular format.
- * @param filename - The name of the binary file containing user data.
+ * Save a new user to the user database.
+ * Returns 0 on success and -1 on error.
  */
-void viewUsers(void)
+int registerUser(const struct Users *user)
 {
-  /* Open a user database file*/
-  FILE *file = fopen(user_database, "rb");
+  bool indexed = user_index.loaded && stampCurrent(&user_index.stamp, user_database);
+
+  /* Open the user database file for appending */
+  FILE *file = fopen(user_database, "ab");
   if (file == NULL) {
-    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
-    return;
+    fprintf(stderr, "Error while opening the user data file: %s\n",
+            strerror(errno));
+    return -1;
   }
 
-  if (checkIfFileIsEmpty(user_database) == -1 || checkIfFileIsEmpty(user_database) == 1) {
-    fprintf(stderr, "Users are not registered yet\n");
+  fseek(file, 0, SEEK_END);
+  long index = ftell(file) / (long)sizeof(struct Users);
+  if (fwrite(user, sizeof(struct Users), 1, file) != 1) {
+    fprintf(stderr, "\nError while writing user data into a file: %s\n",
+            strerror(errno));
+    fclose(file);
+    return -1;
   }
-  else {
-    struct Users user;
-    printf("╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
-    printf("║                                               User information                                               ║\n");
-    printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-    printf("║ %-19s%-19s%-18s%-19s%-21s%-12s ║\n",
-           "Full Name", "Address", "Phone Number", "Email", "Username", "Password");
-    printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-    /* Loop through user records and display them */
-    while (fread(&user, sizeof(struct Users), 1, file) == 1) {
-      if (strlen(user.fullname) > 0 || strlen(user.address) > 0 || strlen(user.number) > 0 || strlen(user.email) > 0 || strlen(user.username) > 0 || strlen(user.password) > 0) {
-        printf("║ %-19s%-19s%-18s%-19s%-21s%-12s ║\n",
-               user.fullname, user.address, user.number, user.email, user.username, user.password);
-      }
-    }
-    printf("╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════╝\n");
-    /* Close a database */
-    if (fclose(file) != 0) {
-      fprintf(stderr, "Error closing the file: %s\n", strerror(errno));
-    }
+  fclose(file);
+  logChange(CHANGE_TABLE_USERS, CHANGE_OP_APPEND, index, user);
+
+  /* Add the user to an index that was up to date, instead of reading the table again */
+  struct stat info;
+  user_index.loaded = indexed && stat(user_database, &info) == 0 &&
+                      indexUser(&user_index, user, index) == 0;
+  if (user_index.loaded) {
+    stampFile(&user_index.stamp, &info);
+    user_index.dirty = true;
   }
+
+  /* Save the new highest recorded number */
+  saveHighestRecordedNumber(loadHighestRecordedNumber() + 1);
+  return 0;
 }
 
-/* Update a user data if available over the database */
-void updateUser(char *usernameToFind)
+/* Overwrite the user at a position of the user database. Returns 0 on success. */
+int saveUser(long index, const struct Users *user)
 {
   FILE *file = fopen(user_database, "rb+");
   if (file == NULL) {
-    printf("\nError opening the file for reading and writing.\n");
-    return;
-  }
-
-  struct Users user;
-
-  bool userFound = false;
-  while (fread(&user, sizeof(struct Users), 1, file) == 1) {
-    if (strcmp(user.username, usernameToFind) == 0) {
-      userFound = true;
-      break;
-    }
+    fprintf(stderr, "Error opening %s: %s\n", user_database, strerror(errno));
+    return -1;
   }
-
-  if (!userFound) {
-    printf("User '%s' not found in the file.\n", usernameToFind);
+  fseek(file, index * (long)sizeof(struct Users), SEEK_SET);
+  if (fwrite(user, sizeof(struct Users), 1, file) != 1) {
+    fprintf(stderr, "Error, while writing into a file : %s", strerror(errno));
     fclose(file);
-    return;
+    return -1;
   }
+  fclose(file);
+  user_index.loaded = false; /* The user's keys may have changed */
+  logChange(CHANGE_TABLE_USERS, CHANGE_OP_UPDATE, index, user);
+  return 0;
+}
 
-  int choice;
-  printf("Select the field to update:\n");
-  printf("1. Full Name\n");
-  printf("2. Address\n");
-  printf("3. Phone Number\n");
-  printf("4. Email\n");
-  printf("5. Username\n");
-  printf("6. Password\n");
-  printf("\nEnter your choice: ");
-  scanf("%d", &choice);
+size_t viewUsers(FILE *out, struct PageCursor *page, size_t limit)
+{
+  size_t shown = 0;
 
-  switch (choice) {
-    case 1:
-      flushInputBuffer();
-      printf("Enter New Full Name: ");
-      getInput(user.fullname, sizeof(user.fullname));
-      break;
-    case 2:
-      flushInputBuffer();
-      printf("Enter New Address: ");
-      scanf("%s", user.address);
-      break;
-    case 3:
-      flushInputBuffer();
-      printf("Enter New Number: ");
-      scanf("%s", user.number);
-      break;
-    case 4:
-      flushInputBuffer();
-      printf("Enter New Email: ");
-      scanf("%s", user.email);
-      break;
-    case 5:
-      flushInputBuffer();
-      printf("Enter New Username: ");
-      scanf("%s", user.username);
-      break;
-    case 6:
-      flushInputBuffer();
-      printf("Enter New Password: ");
-      scanf("%s", user.password);
-      break;
-    default:
-      printf("\nInvalid choice!");
-      break;
+  /* Open a user database file, on the report replica if one is configured */
+  const char *filename = reportPath(user_database);
+  FILE *file = fopen(filename, "rb");
+  page->more = false;
+  if (file == NULL) {
+    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
+    return 0;
   }
-  flushInputBuffer();
-
-  printf("Full Name: %s\n", user.fullname);
-  printf("Address: %s\n", user.address);
-  printf("Contact Number: %s\n", user.number);
-  printf("Email: %s\n", user.email);
 
-
-   /* Move back to the start of the record and write the updated data */
-  fseek(file, -sizeof(struct Users), SEEK_CUR);
-  if(fwrite(&user, sizeof(struct Users), 1, file) != 1) {
-    fprintf(stderr, "Error, while writing into a file : %s", strerror(errno));
-  } else {
-    printf("\nUser '%s' updated successfully.\n", usernameToFind);
+  if (checkIfFileIsEmpty(filename) == -1 || checkIfFileIsEmpty(filename) == 1) {
+    fprintf(out, "Users are not registered yet\n");
   }
-  fclose(file);
+  else {
+    struct Users user;
+    unsigned long long current = 0;
+    const struct KeyIndex *moved = NULL;
+
+    /* The page starts after the last user shown, wherever removals have moved it */
+    if (page->after >= 0 && fseek(file, page->after * (long)sizeof(struct Users), SEEK_SET) == 0 &&
+        fread(&user, sizeof(struct Users), 1, file) == 1)
+      current = hashKey(user.username, sizeof(user.username));
+    if (current != page->key && filename == user_database && loadUserIndex() != NULL)
+      moved = &user_index.by_username;
+    long record = resumePage(page, current, moved);
+    fseek(file, record * (long)sizeof(struct Users), SEEK_SET);
+
+    fprintf(out, "╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
+    fprintf(out, "║                                               User information                                               ║\n");
+    fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+    fprintf(out, "║ %-19s%-19s%-18s%-19s%-21s%-12s ║\n",
+           "Full Name", "Address", "Phone Number", "Email", "Username", "Password");
+    fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+    /* Loop through user records and display them */
+    for (; shown < limit && fread(&user, sizeof(struct Users), 1, file) == 1; record++) {
+      if (strlen(user.fullname) > 0 || strlen(user.address) > 0 || strlen(user.number) > 0 || strlen(user.email) > 0 || strlen(user.username) > 0 || strlen(user.password) > 0) {
+        fprintf(out, "║ %-19s%-19s%-18s%-19s%-21s%-12s ║\n",
+               user.fullname, user.address, user.number, user.email, user.username, user.password);
+        page->after = record;
+        page->key = hashKey(user.username, sizeof(user.username));
+        shown++;
+      }
+    }
+    page->more = fread(&user, sizeof(struct Users), 1, file) == 1;
+    fprintf(out, "╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════╝\n");
+  }
+  /* Close a database */
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Error closing the file: %s\n", strerror(errno));
+  }
+  return shown;
 }
 
 /**
  * Remove a user from the user database by username.
  */
-void removeUserByUsername(const char *usernameToRemove)
+void removeUserByUsername(FILE *out, const char *usernameToRemove)
 {
-  /* Open a user database */
-  FILE *file = fopen(user_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
+  if (rejectWriteOnReplica(out))
     return;
-  }
 
   struct Users user;
 
-  /* Open a newfile for writing a userdata temporaryly */
-  FILE *tempFile = fopen("data/temp.dat", "wb");
-  if (tempFile == NULL) {
-    fprintf(stderr, "Error creating temporary file: %s\n", strerror(errno));
-    fclose(file);
-    return;
-  }
-
-  bool userFound = false;
-  /* If user found change its status to true*/
-  while (fread(&user, sizeof(struct Users), 1, file) == 1) {
-    if (strcmp(user.username, usernameToRemove) == 0) {
-      userFound = true;
-      continue; /* Skip writing this user to the temporary file */
-    }
-    /* Write the structure to the temporary file for all other users */
-    if (fwrite(&user, sizeof(struct Users), 1, tempFile) != 1) {
-      fprintf(stderr, "Error writing data to the file: %s\n", strerror(errno));
-      return;
-    }
-  }
-
-  /* Close user databse and temporary file */
-  fclose(file);
-  fclose(tempFile);
+  /* Find the position of the user to remove */
+  long index = findUserIndex(usernameToRemove, &user);
 
   /* Show errors */
-  if (!userFound) {
-    fprintf(stderr, "User '%s' not found in the file.\n", usernameToRemove);
-    remove("temp.dat"); /* Delete the temporary file */
-    return;
-  }
-  if (remove(user_database) != 0) {
-    fprintf(stderr, "Error deleting the original file: %s\n", strerror(errno));
-    remove("temp.dat"); /* Delete the temporary file */
+  if (index < 0) {
+    fprintf(out, "User '%s' not found in the file.\n", usernameToRemove);
     return;
   }
-  if (rename("temp.dat", user_database) != 0) {
-    fprintf(stderr, "Error renaming the temporary file: %s\n", strerror(errno));
+  user_index.loaded = false; /* Later records move up */
+  if (removeRecordAt(user_database, sizeof(struct Users), index) != 0)
     return;
-  }
-  printf("User '%s' removed successfully.\n", usernameToRemove);
+  logChange(CHANGE_TABLE_USERS, CHANGE_OP_REMOVE, index, &user);
+  fprintf(out, "User '%s' removed successfully.\n", usernameToRemove);
 }
 
-/* Function to view a cars available in a database */
-void viewCars(void)
+size_t viewCars(FILE *out, struct PageCursor *page, size_t limit)
 {
-  /* Open the car database */
-  FILE *file = fopen(car_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
-    return;
-  }
+  size_t shown = 0;
 
-  if (checkIfFileIsEmpty(car_database) == -1 || checkIfFileIsEmpty(car_database) == 1 ) {
-    fprintf(stderr, "Cars are not available at the moment\nMight be went to garage or service center\nPlease visit later!\n");
+  /* Load the car table */
+  struct Fleet *fleet = loadFleet();
+  page->more = false;
+  if (fleet == NULL)
+    return 0;
+
+  if (fleet->count == 0) {
+    fprintf(out, "Cars are not available at the moment\nMight be went to garage or service center\nPlease visit later!\n");
   }
   else {
     struct CarModel car;
-    printf("\n╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
-    printf("║                                                     Available Car Models                                                     ║\n");
-    printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-    printf("║ %-15s%-15s%-12s%-19s%-20s%-12s%-17s%-14s ║\n",
+    char status[32];
+    size_t i = fleetPageStart(fleet, page);
+    fprintf(out, "\n╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
+    fprintf(out, "║                                                     Available Car Models                                                     ║\n");
+    fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+    fprintf(out, "║ %-15s%-15s%-12s%-19s%-20s%-12s%-17s%-14s ║\n",
            "Model Name", "Company", "Year", "Passenger Cap.", "Fuel Efficiency", "Color", "Rate (NPR)", "Status");
-    printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-    /* Read and display cars with a availability status */
-    while (fread(&car, sizeof(struct CarModel), 1, file) == 1) {
-      printf("║ %-15s%-15s%-12zu%-19zu%-20.2lf%-12s%-16.2lf %-15s║\n",
+    fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+    /* Display cars with a availability status */
+    for (; i < fleet->count && shown < limit; i++, shown++) {
+      fleetCar(fleet, i, &car);
+      fprintf(out, "║ %-15s%-15s%-12zu%-19zu%-20.2lf%-12s%-16.2lf %-15s║\n",
              car.model_name,
              car.company,
              car.year,
@@ -591,504 +2193,176 @@ void viewCars(void)
              car.fuel_efficiency,
              car.color,
              car.rental_rate,
-             car.available_status ? "Available" : "Not Available");
+             carStatus(&car, status, sizeof(status)));
+      page->after = i;
+      page->key = hashKey(car.model_name, sizeof(car.model_name));
     }
-    printf("╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╝");
-    /* Close a database */
-    if (fclose(file) != 0) {
-      fprintf(stderr, "Error closing the file: %s\n", strerror(errno));
+    page->more = i < fleet->count;
+    fprintf(out, "╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╝");
+  }
+  return shown;
+}
+
+long findCarIndex(const char *model_name, struct CarModel *car)
+{
+  struct Fleet *fleet = loadFleet();
+  unsigned long long hash = hashKey(model_name, SIZE_MAX);
+  size_t probe = 0;
+  long index;
+
+  if (fleet == NULL)
+    return -1;
+  while ((index = keyIndexNext(&fleet->by_model, hash, &probe)) >= 0) {
+    if (strcmp(fleet->details[index].model_name, model_name) == 0) {
+      fleetCar(fleet, index, car);
+      return index;
     }
   }
+  return -1;
+}
+
+int readCarAt(long index, struct CarModel *car)
+{
+  struct Fleet *fleet = loadFleet();
+
+  if (fleet == NULL || index < 0 || (size_t)index >= fleet->count)
+    return -1;
+  fleetCar(fleet, index, car);
+  return 0;
 }
 
 /**
- * Update car details in the car database by car model name.
+ * Overwrite the car at a position of the selected branch. A car that became
+ * available goes to the next customer on the waitlist.
+ * Returns 0 on success and -1 on error.
  */
-void updateCar(const char *modelToFind)
+int saveCar(FILE *out, long index, const struct CarModel *car, bool was_available)
 {
-  int car_status;
+  struct WaitlistEntry allocated;
+  struct Fleet *fleet = &fleets[current_branch];
+  struct stat info;
+
+  /* A car that keeps its name is changed in the car table in place */
+  bool in_place = fleet->loaded && (size_t)index < fleet->count &&
+                  strcmp(fleet->details[index].model_name, car->model_name) == 0 &&
+                  stampCurrent(&fleet->stamp, car_database);
 
-  /* Open a car database */ 
+  /* Open a car database */
   FILE *file = fopen(car_database, "rb+");
   if (file == NULL) {
     fprintf(stderr, "Error opening the file for reading and writing: %s\n", strerror(errno));
-    return;
+    return -1;
+  }
+  fseek(file, index * (long)sizeof(struct CarModel), SEEK_SET);
+  /* Show error if file didn't written successfully */
+  if (fwrite(car, sizeof(struct CarModel), 1, file) != 1) {
+    fprintf(stderr, "Error writing data to the file: %s\n", strerror(errno));
+    fclose(file);
+    return -1;
+  }
+  /* Close a car database */
+  fclose(file);
+  if (in_place && stat(car_database, &info) == 0) {
+    struct CarDetails *details = &fleet->details[index];
+    fleet->available[index] = car->available_status;
+    fleet->rental_rate[index] = car->rental_rate;
+    fleet->passenger_capacity[index] = car->passenger_capacity;
+    memcpy(details->company, car->company, sizeof(details->company));
+    details->year = car->year;
+    details->fuel_efficiency = car->fuel_efficiency;
+    memcpy(details->color, car->color, sizeof(details->color));
+    stampFile(&fleet->stamp, &info);
+  } else {
+    invalidateFleet();
+  }
+  logChange(CHANGE_TABLE_CARS, CHANGE_OP_UPDATE, index, car);
+
+  if (!was_available && car->available_status &&
+      allocateFromWaitlist(car, &allocated)) {
+    fprintf(out, "\n'%s' was allocated to waitlisted customer %s (rental %s).\n",
+            car->model_name, allocated.username, allocated.rentalID);
+  }
+  return 0;
+}
+
+/* List a page of the cars of the selected branch with their index. Returns the number of cars shown. */
+size_t viewCarsIndexed(FILE *out, struct PageCursor *page, size_t limit)
+{
+  size_t shown = 0;
+
+  /* Load the car table */
+  struct Fleet *fleet = loadFleet();
+  page->more = false;
+  if (fleet == NULL)
+    return 0;
+
+  size_t index = fleetPageStart(fleet, page);
+  fprintf(out, "╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
+  fprintf(out, "║                                        Available Car Models (Select a model to remove)                                               ║\n");
+  fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+  fprintf(out, "║ %-8s%-15s%-15s%-12s%-19s%-20s%-12s%-17s%-14s ║\n",
+          "Index", "Model Name", "Company", "Year", "Passenger Cap.", "Fuel Efficiency", "Color", "Rate (NPR)", "Status");
+  fprintf(out, "╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
+
+  struct CarModel car;
+  char status[32];
+  for (; index < fleet->count && shown < limit; index++, shown++) {
+    fleetCar(fleet, index, &car);
+    fprintf(out, "║ %-8zu%-15s%-15s%-12zu%-19zu%-20.2lf%-12s%-16.2lf %-15s║\n",
+            index,
+            car.model_name,
+            car.company,
+            car.year,
+            car.passenger_capacity,
+            car.fuel_efficiency,
+            car.color,
+            car.rental_rate,
+            carStatus(&car, status, sizeof(status)));
+    page->after = index;
+    page->key = hashKey(car.model_name, sizeof(car.model_name));
   }
+  page->more = index < fleet->count;
+  fprintf(out, "╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╝\n");
+  return shown;
+}
 
+/**
+ * Remove the car model at an index shown by viewCarsIndexed().
+ */
+void removeCarAt(FILE *out, long index)
+{
   struct CarModel car;
 
-  bool carFound = false;
-  /* Change the carFound status to true if available */
-  while (fread(&car, sizeof(struct CarModel), 1, file) == 1) {
-    if (strcmp(car.model_name, modelToFind) == 0) {
-      carFound = true;
-      break;
-    }
+  if (rejectWriteOnReplica(out))
+    return;
+
+  /* Keep the removed record so the change can be shipped to replicas */
+  if (index < 0 || readCarAt(index, &car) != 0) {
+    fprintf(out, "Invalid index.\n");
+    return;
   }
-  /* Show error if car not found */
-  if (!carFound) {
-    fprintf(stderr, "Car '%s' not found in the file.\n", modelToFind);
-    fclose(file);
+  struct Inventory *inventory = loadInventory();
+  if (inventory == NULL || findStock(inventory, car.model_name) != NULL) {
+    fprintf(out, "'%s' has units and cannot be removed.\n", car.model_name);
     return;
   }
-
-  int choice;
-  printf("Select the field to update:\n");
-  printf("1. Model Name\n");
-  printf("2. Company\n");
-  printf("3. Year\n");
-  printf("4. Rental Rate\n");
-  printf("5. Passenger Capacity\n");
-  printf("6. Fuel Efficiency\n");
-  printf("7. Color\n");
-  printf("8. Available Status\n");
-  printf("\nEnter your choice: ");
-  scanf("%d", &choice);
-  flushInputBuffer();
-
-  switch (choice) {
-    case 1:
-      printf("Enter Car Model Name: ");
-      getInput(car.model_name, sizeof(car.model_name));
-      flushInputBuffer();
-      break;
-    case 2:
-      printf("Enter Car Company: ");
-      getInput(car.company, sizeof(car.company));
-      flushInputBuffer();
-      break;
-    case 3:
-      printf("Enter Year of Manufacture: ");
-      scanf("%zu", &car.year);
-      flushInputBuffer();
-      break;
-    case 4:
-      printf("Enter Rental Rate per Day: ");
-      scanf("%lf", &car.rental_rate);
-      flushInputBuffer();
-      break;
-    case 5:
-      printf("Enter Passenger Capacity: ");
-      scanf("%zu", &car.passenger_capacity);
-      flushInputBuffer();
-      break;
-    case 6:
-      printf("Enter Fuel Efficiency (MPG): ");
-      scanf("%lf", &car.fuel_efficiency);
-      flushInputBuffer();
-      break;
-    case 7:
-      printf("Enter Car Color: ");
-      getInput(car.color, sizeof(car.color));
-      flushInputBuffer();
-      break;
-    case 8:
-      printf("Enter Available Staus (1 for available / 0 for not available): ");
-      scanf("%d", &car_status);
-      flushInputBuffer();
-      if (car_status)
-        car.available_status = true;
-      break;
-    default:
-      printf("\nInvalid choice. No fields updated.\n");
-      break;
-  }
-  /* Move back to the start of the record and write the updated data */
-  fseek(file, -sizeof(struct CarModel), SEEK_CUR);
-  /* Show error if file didn't written successfully */
-  if (fwrite(&car, sizeof(struct CarModel), 1, file) != 1) {
-    fprintf(stderr, "Error writing data to the file: %s\n", strerror(errno));
-  }
-  printf("\nCar '%s' updated successfully.\n", modelToFind);
-  /* Close a car database */
-  fclose(file);
-}
-
-/**
- * Remove a car model by selecting its index.
- */
-void removeCarModelByName(void)
-{
-  /* Open a car database */
-  FILE *file = fopen(car_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
-    return;
-  }
-
-  int index = 0;
-  printf("╔══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╗\n");
-  printf("║                                        Available Car Models (Select a model to remove)                                               ║\n");
-  printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-  printf("║ %-8s%-15s%-15s%-12s%-19s%-20s%-12s%-17s%-14s ║\n",
-         "Index", "Model Name", "Company", "Year", "Passenger Cap.", "Fuel Efficiency", "Color", "Rate (NPR)", "Status");
-  printf("╠══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╣\n");
-
-  struct CarModel car;
-  while (fread(&car, sizeof(struct CarModel), 1, file) == 1) {
-    printf("║ %-8d%-15s%-15s%-12zu%-19zu%-20.2lf%-12s%-16.2lf %-15s║\n",
-           index,
-           car.model_name,
-           car.company,
-           car.year,
-           car.passenger_capacity,
-           car.fuel_efficiency,
-           car.color,
-           car.rental_rate,
-           car.available_status ? "Available" : "Not Available");
-    index++;
-  }
-  printf("╚══════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════════╝\n");
-  fclose(file);
-
-  /* Ask the user for the index of the model to remove */
-  printf("Enter the index of the model you want to remove : ");
-  int selectedIndex;
-  if (scanf("%d", &selectedIndex) != 1) {
-    fprintf(stderr, "Invalid input.\n");
-    return;
-  }
-  flushInputBuffer();
-
-  /* Reopen the file in read mode and a temporary file for writing */
-  file = fopen(car_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
-    return;
-  }
-
-  FILE *tempFile = fopen("temp.dat", "wb");
-  if (tempFile == NULL) {
-    fprintf(stderr, "Error creating temporary file: %s\n", strerror(errno));
-    fclose(file);
-    return;
-  }
-
-  index = 0;
-  while (fread(&car, sizeof(struct CarModel), 1, file) == 1) {
-    if (index != selectedIndex) {
-      /* Write the structure to the temporary file if it's not the selected one */
-      fwrite(&car, sizeof(struct CarModel), 1, tempFile);
-    }
-    index++;
-  }
-
-  /* Close a open files */
-  fclose(file);
-  fclose(tempFile);
-
-  remove(car_database);     /* Delete the original file */
-  if (rename("data/temp.dat", car_database) != 0) {
-    fprintf(stderr, "Error renaming the temporary file: %s\n", strerror(errno));
-    return;
-  }
-  printf("Model data removed successfully.\n");
-}
-
-/**
- * Collects user information, validates it, and sets up a username and password.
- * @param user A pointer to the Users struct to store user information.
- */
-void enterUserData(struct Users *user)
-{
-  char choice;
-
-  printf("Please provide the following information:\n");
-  printf("Full Name: ");
-  getInput(user->fullname, sizeof(user->fullname));
-  flushInputBuffer();
-  printf("Address: ");
-  getInput(user->address, sizeof(user->address));
-  flushInputBuffer();
-  printf("Contact Number: ");
-  getInput(user->number, sizeof(user->number));
-  flushInputBuffer();
-  printf("Email Address: ");
-  getInput(user->email, sizeof(user->email));
-  flushInputBuffer();
-
-  while (1) {
-    printf("Review Your Information:\n");
-    printf("Full Name: %s\n", user->fullname);
-    printf("Address: %s\n", user->address);
-    printf("Contact Number: %s\n", user->number);
-    printf("Email : %s\n", user->email);
-
-    printf("Choose a field to change\n");
-    printf("(F)ull Name, (A)ddress, (N)umber, (E)mail, (O)kay : ");
-    scanf("%c", &choice);
-    flushInputBuffer();
-
-    switch (choice) {
-    case 'F': {
-      printf("Full Name: ");
-      getInput(user->fullname, sizeof(user->fullname));
-      flushInputBuffer();
-    } break;
-    case 'A': {
-      printf("Address: ");
-      getInput(user->address, sizeof(user->address));
-      flushInputBuffer();
-    } break;
-    case 'N': {
-      printf("Contact Number: ");
-      getInput(user->number, sizeof(user->number));
-      flushInputBuffer();
-    } break;
-    case 'E': {
-      printf("Email Address: ");
-      getInput(user->email, sizeof(user->email));
-      flushInputBuffer();
-    } break;
-    case 'O':
-      goto create_username_and_password;
-    default:
-      printf("Invalid!");
-      break;
-    }
-  }
-
-create_username_and_password : {
-  FILE *file = fopen(user_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error while opening the user data file: %s\n",
-            strerror(errno));
-  }
-
-  struct Users recordedUser;
-  while (fread(&recordedUser, sizeof(struct Users), 1, file) == 1) {
-    if (strcmp(user->number, recordedUser.number) == 0) {
-      fprintf(
-          stdout,
-          "\n%s, It seems the contact number you have entered is already in use.\n \
-Please use different contact number\n",
-          user->fullname);
-
-      printf("Re-enter Contact Number : ");
-      getInput(user->number, sizeof(user->number));
-      flushInputBuffer();
-    } else {
-      break;
-    }
-    fclose(file);
-  }
-
-  printf("\nThank you, %s, for providing your information.\n", user->fullname);
-  printf("You can now set up your username and password for further access.\n");
-
-  file = fopen(user_database, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Error while opening the user data file: %s\n",
-            strerror(errno));
-  }
-
-  fseek(file, -sizeof(struct Users),
-        SEEK_CUR); /* Move the file pointer back to update the record */
-
-  printf("Enter New Username: ");
-  scanf("%s", user->username);
-  flushInputBuffer();
-
-  while (fread(&recordedUser, sizeof(struct Users), 1, file) == 1) {
-    if (strcmp(user->username, recordedUser.username) == 0) {
-      fprintf(
-          stdout,
-          "\nThe user with this \"%s\" username, seems already registered!\n\
-Please choose different user name\n",
-          user->username);
-      printf("Enter New Username: ");
-      scanf("%s", user->username);
-      flushInputBuffer();
-    } else
-      break;
-  }
-  fclose(file);
-
-  char passwordVerification[20];
-  do {
-    printf("Enter New Password: ");
-    getPasswordInput(user->password, sizeof(user->password));
-    printf("\nRetype the password for verification: ");
-    getPasswordInput(passwordVerification, sizeof(passwordVerification));
-
-    /* Check if the entered passwords match */
-    if (strcmp(user->password, passwordVerification) == 0) {
-      break; /* Passwords match, exit the verification loop */
-    } else {
-      printf("\nPasswords do not match. Please try again.\n");
-    }
-  } while (1); /* Infinite loop until passwords match */
-}
-}
-
-/**
- * Registers new users by collecting their information and saving it to the user
- * database file.
- */
-void registerNewUsers(void)
-{
-  char choice[4];
-  struct Users newUser[MAX_USERS];
-  size_t numUsers =
-      loadHighestRecordedNumber(); /* Start from the highest recorded number */
-
-  /* Open the user database file for reading and appending */
-  FILE *userDatabaseFile = fopen(user_database, "ab+");
-  if (userDatabaseFile == NULL) {
-    fprintf(stderr, "Error while opening the user data file: %s\n",
-            strerror(errno));
-    exit(1); /* Exit the program on error */
-  }
-
-  CLEAN_SCREEN();
-  enterUserData(&newUser[numUsers]);
-
-  /* Write user data to the user database file */
-  if (fwrite(&newUser[numUsers], sizeof(struct Users), 1, userDatabaseFile) ==
-      1) {
-    printf("\nUser data has been registered successfully.\n");
-    fclose(userDatabaseFile);
-  } else {
-    fprintf(stderr, "\nError while writing user data into a file: %s\n",
-            strerror(errno));
-    fclose(userDatabaseFile);
-  }
-
-  printf("\nPress any key to return to the menu!\n");
-  getch();
-
-  numUsers++; /* Increment the number of registered users */
-
-  /* Save the new highest recorded number */
-  saveHighestRecordedNumber(numUsers);
-}
+  if (removeRecordAt(car_database, sizeof(struct CarModel), index) != 0)
+    return;
+  invalidateFleet();
+  logChange(CHANGE_TABLE_CARS, CHANGE_OP_REMOVE, index, &car);
+  fprintf(out, "Model data removed successfully.\n");
+}
 
 /**
- * Displays the admin dashboard with various options to manage cars, users, and
- * view rental logs.
+ * Number of days between two YYYY-MM-DD dates.
+ * Returns -1 if a date is malformed or the return date is before the pickup date.
  */
-void adminDashboard(void)
-{
-  int choice;
-  char car_model[20];
-  char username[20];
-
-  do {
-    printf("\nAdmin Dashboard");
-    printf("\n1. View Cars");
-    printf("\n2. Manage Cars");
-    printf("\n3. View Users");
-    printf("\n4. Manage Users");
-    printf("\n5. Rental Log");
-    printf("\n6. Exit");
-
-    printf("\nChoose the option : ");
-    scanf("%d", &choice);
-    flushInputBuffer();
-
-    switch (choice) {
-    case 1:
-      viewCars();
-      break;
-    case 2: {
-      do {
-        viewCars();
-        printf("\n1. Update Cars");
-        printf("\n2. Remove Cars");
-        printf("\n3. Add Cars");
-        printf("\n4. Return to main menu");
-        printf("\nChoose the option : ");
-        scanf("%d", &choice);
-        flushInputBuffer();
-        switch (choice) {
-        case 1:
-          printf("\nEnter the Model name : ");
-          scanf("%s", car_model);
-          flushInputBuffer();
-          updateCar(car_model);
-          break;
-        case 2:
-          removeCarModelByName();
-          break;
-        case 3:
-          addCar();
-          break;
-        case 4:
-          break;
-        default:
-          printf("\nInvalid choice!");
-          break;
-        }
-      } while (choice != 4);
-    } break;
-    case 3:
-      viewUsers();
-      break;
-    case 4: {
-      do {
-        viewUsers();
-        printf("\n1. Update Users");
-        printf("\n2. Remove Users");
-        printf("\n3. Add Users");
-        printf("\n4. Return to main menu");
-        printf("\nChoose the option : ");
-        scanf("%d", &choice);
-        flushInputBuffer();
-        switch (choice) {
-        case 1:
-          printf("\nEnter the username to update : ");
-          scanf("%s", username);
-          flushInputBuffer();
-          updateUser(username);
-          break;
-        case 2:
-          printf("\nEnter the username to remove : ");
-          scanf("%s", username);
-          flushInputBuffer();
-          removeUserByUsername(username);
-          break;
-        case 3:
-          registerNewUsers();
-          break;
-        case 4:
-          break;
-        default:
-          printf("\nInvalid choice!");
-          break;
-        }
-      } while (choice != 4);
-    } break;
-    case 5: {
-      char user_log_menu_choice[4];
-      char log_username[20];
-
-      printf("Do you want to see a specific users log ? (yes/no) : ");
-      scanf("%3s", user_log_menu_choice);
-
-      if (strcmp(user_log_menu_choice, "yes") == 0 ||
-          strcmp(user_log_menu_choice, "Yes") == 0 ||
-          strcmp(user_log_menu_choice, "YES") == 0) {
-        printf("Enter the specific user's username : ");
-        scanf("%s", log_username);
-        showUserRentals(log_username);
-      } else
-        showUserRentals(NULL);
-    } break;
-    case 6:
-      break;
-    default:
-      printf("\nInvalid choice. Please try again.");
-    }
-  } while (choice != 6);
-}
-
 int calculateRentalDays(const char *pickupDate, const char *returnDate)
 {
   /* Ensure that the date strings are in the correct format (YYYY-MM-DD) */
   if (strlen(pickupDate) != 10 || strlen(returnDate) != 10 ||
       pickupDate[4] != '-' || returnDate[4] != '-' || pickupDate[7] != '-' ||
       returnDate[7] != '-') {
-    printf("Invalid date format. Please use YYYY-MM-DD format.\n");
     return -1; /* Error: Invalid date format */
   }
 
@@ -1099,7 +2373,6 @@ int calculateRentalDays(const char *pickupDate, const char *returnDate)
           3 ||
       sscanf(returnDate, "%d-%d-%d", &returnYear, &returnMonth, &returnDay) !=
           3) {
-    printf("Invalid date format. Please use YYYY-MM-DD format.\n");
     return -1; /* Error: Invalid date components */
   }
 
@@ -1118,13 +2391,11 @@ int calculateRentalDays(const char *pickupDate, const char *returnDate)
   time_t returnTime = mktime(&returnTm);
 
   if (pickupTime == -1 || returnTime == -1) {
-    printf("Error in date conversion.\n");
     return -1; /* Error: Date conversion failed */
   }
 
   double seconds = difftime(returnTime, pickupTime);
   if (seconds < 0) {
-    printf("Return date cannot be earlier than pickup date.\n");
     return -1; /* Error: Invalid date range */
   }
 
@@ -1132,281 +2403,8260 @@ int calculateRentalDays(const char *pickupDate, const char *returnDate)
   return days;
 }
 
-void rentCar(struct Users *user)
+/**
+ * Mark the car of a model without units as rented, reading its row again
+ * from the car table in case someone else took it first.
+ * Returns whether the car was taken.
+ */
+bool takeCar(const char *model_name)
 {
-  char choice[4];
-  int numAvailableCars = 0;
-  bool rentalCompleted = false;
-
-  /* Open a Car database */
-  FILE *file = fopen(car_database, "rb+");
-  if (file == NULL) {
-    fprintf(stderr, "Error opening file %s: %s\n", car_database,
-            strerror(errno));
-    return;
-  }
-
-  struct Rental rental;
-  struct CarModel availableCarModels[MAX_CAR_MODELS];
-
-  /* Read each and every cars details and increement the numAvailableCars if
-   * available status is true */
-  while (fread(&availableCarModels[numAvailableCars], sizeof(struct CarModel),
-               1, file)) {
-    if (availableCarModels[numAvailableCars].available_status)
-      numAvailableCars++;
-  }
-  /* Close a database */
-  fclose(file);
-
-  printf("=== Rent a Car ===\n");
-  /* Shows errors if numAvailableCars is ZERO */
-  if (numAvailableCars == 0) {
-    printf("Sorry, there are no cars available for rent at the moment.\n");
-    return;
-  } else {
-    printf("Available Car Models:\n");
-    printf("%-5s %-15s %-12s %-10s %-11s\n", "Index", "Model Name", "Company",
-           "Color", "Rate (NPR)");
-
-    for (int i = 0; i < numAvailableCars; i++) {
-      printf("%-5d %-15s %-12s %-10s %-11.2lf\n", i + 1,
-             availableCarModels[i].model_name, availableCarModels[i].company,
-             availableCarModels[i].color, availableCarModels[i].rental_rate);
-    }
-
-    printf("\nEnter the index of the car you want to rent (0 to cancel): ");
-    scanf("%d", &rental.selectedCarIndex);
-    flushInputBuffer();
-
-    if (rental.selectedCarIndex == 0) {
-      printf("Rental canceled. Returning to the User Dashboard...\n");
-      return;
-    } else if (rental.selectedCarIndex < 1 ||
-               rental.selectedCarIndex > numAvailableCars) {
-      printf("Invalid car index. Please try again.\n");
-      return;
-    }
-  }
-
-  /* Valid car selection */
-  rental.selectedCar = availableCarModels[rental.selectedCarIndex - 1];
-
-  /* Gather rental dates */
-  printf("Enter Pickup Date (YYYY-MM-DD): ");
-  scanf("%s", rental.pickupDate);
-  flushInputBuffer();
-  printf("Enter Return Date (YYYY-MM-DD): ");
-  scanf("%s", rental.returnDate);
-
-  /* Calculate total cost (simple example: rate * number of days) */
-  /* You can implement more complex pricing logic as needed. */
-  rental.totalCost = rental.selectedCar.rental_rate *
-                     calculateRentalDays(rental.pickupDate, rental.returnDate);
-
-  /* Generate a unique rental-ID for each transaction */
-  char *uniqueID = generateUniqueRentalID("R");
-  strncpy(rental.rentalID, uniqueID, sizeof(rental.rentalID));
-  free(uniqueID);
-
-  /* Display rental summary */
-  printf("\nRental Summary:\n");
-  printf("Rental ID: %s\n", rental.rentalID);
-  printf("Model: %s\n", rental.selectedCar.model_name);
-  printf("Color: %s\n", rental.selectedCar.color);
-  printf("Company: %s\n", rental.selectedCar.company);
-  printf("Rate (NPR): %.2lf per day\n", rental.selectedCar.rental_rate);
-  printf("Pickup Date: %s\n", rental.pickupDate);
-  printf("Return Date: %s\n", rental.returnDate);
-  printf("Total Cost: NRS %0.2lf\n", rental.totalCost);
-
-  /* Confirm the rental */
-  printf("Confirm rental? (yes/no): ");
-  scanf("%3s", choice);
-  flushInputBuffer();
-
-  if (strcmp(choice, "yes") == 0 || strcmp(choice, "Yes") == 0 ||
-      strcmp(choice, "YES") == 0) {
-    rentalCompleted = true;
-    printf("\nRental completed. Enjoy your ride!\n");
-  }
-  /* Change the availability status to false for the rented car model */
-  availableCarModels[rental.selectedCarIndex - 1].available_status = false;
-
   /* Opening file to update the selected Car availability status */
-  file = fopen(car_database, "rb+");
+  FILE *file = fopen(car_database, "rb+");
   if (file == NULL) {
     fprintf(stderr, "Error opening file %s: %s\n", car_database,
             strerror(errno));
+    return false;
   }
 
   struct CarModel car;
+  long carIndex = 0;
+  bool carRented = false;
   while (fread(&car, sizeof(struct CarModel), 1, file) == 1) {
-    if (strcmp(car.model_name, rental.selectedCar.model_name) == 0) {
+    if (strcmp(car.model_name, model_name) == 0) {
+      if (!car.available_status)
+        break; /* Someone else took the car in the meantime */
       car.available_status = false;
       fseek(file, -sizeof(struct CarModel),
             SEEK_CUR); /* Move the file pointer back to update the record */
-      fwrite(&car, sizeof(struct CarModel), 1,
-             file); /* Write the updated record back to the file */
+      if (fwrite(&car, sizeof(struct CarModel), 1,
+                 file) == 1) { /* Write the updated record back to the file */
+        logChange(CHANGE_TABLE_CARS, CHANGE_OP_UPDATE, carIndex, &car);
+        carRented = true;
+      }
       break;        /* No need to continue searching after the update */
     }
+    carIndex++;
   }
   fclose(file);
+  invalidateFleet();
+  return carRented;
+}
 
-  /* Generate a current date and time and assign it with rental.time */
-  time_t current_time = time(NULL);
-  char *timestamp = ctime(&current_time);
-  if (timestamp != NULL)
-    timestamp[strlen(timestamp) - 1] = '\0';
-  strncpy(rental.time, timestamp, sizeof(rental.time));
+/**
+ * Commit a rental in the selected branch: allocate a unit of the model, or
+ * take the car of a model without units, stamp the rental time and append
+ * the record to the rental log. Its change is logged together with a
+ * notification of the given kind, so the customer is told of every rental
+ * the log holds.
+ * The rental must already carry its car, dates, cost and rental ID.
+ * Returns 0 on success and -1 if no car of the model is available any more.
+ */
+int commitRental(const struct Users *user, struct Rental *rental, int notification)
+{
+  struct FleetLock lock;
+
+  /* Other processes may be taking cars of the branch at the same time */
+  if (lockFleet(&lock) != 0)
+    return -1;
+
+  /* A model with units keeps its row available until its last free unit goes */
+  struct Inventory *inventory = loadInventory();
+  struct ModelStock *stock = inventory != NULL ?
+                             findStock(inventory, rental->selectedCar.model_name) : NULL;
+  bool taken = inventory != NULL;
+  if (taken && stock != NULL) {
+    taken = allocateUnit(inventory, stock, rental->rentalID) >= 0;
+    if (taken && stock->available == 0)
+      syncModelAvailability(stdout, rental->selectedCar.model_name, false);
+  } else if (taken) {
+    taken = takeCar(rental->selectedCar.model_name);
+  }
+  unlockFleet(&lock);
+  if (!taken)
+    return -1;
 
-  file = fopen(rental_records, "ab+");
+  stampRentalTime(rental, time(NULL));
+  bool indexed = rentalIndexCurrent();
+
+  FILE *file = fopen(rental_records, "ab+");
   if (file == NULL) {
     fprintf(stderr, "Error while opening file %s", rental_records);
+    return -1;
   }
 
-  strncpy(rental.rentingUser.username, user->username,
-          sizeof(rental.rentingUser.username));
+  rental->rentingUser = *user;
 
-  if (fwrite(&rental, sizeof(struct Rental), 1, file) != 1) {
+  fseek(file, 0, SEEK_END);
+  long rentalIndex = ftell(file) / (long)sizeof(struct Rental);
+  if (fwrite(rental, sizeof(struct Rental), 1, file) != 1) {
     fprintf(stderr, "Error writing to file: %s\n", strerror(errno));
     fclose(file);
-  } else {
-    fclose(file);
+    return -1;
   }
-  while (!rentalCompleted)
-    ;
-}
-
-void adminLogin(void)
-{
-  char loginInput[20];
-  char passwordInput[20];
-
-  CLEAN_SCREEN();
+  fclose(file);
 
-  /* Prompt for admin username */
-  printf("Enter Admin Username : ");
-  getInput(loginInput, sizeof(loginInput));
-  flushInputBuffer();
+  struct ChangeRecord changes[2];
+  memset(changes, 0, sizeof(changes));
+  changes[0].table = CHANGE_TABLE_RENTALS;
+  changes[0].op = CHANGE_OP_APPEND;
+  changes[0].index = rentalIndex;
+  changes[0].data.rental = *rental;
+  notificationChange(&changes[1], notification, rental);
+  logChanges(changes, 2, false);
+  indexAppendedRentals(indexed, rentalIndex, rental, 1);
+  return 0;
+}
 
-  /* Prompt for admin password securely */
-  printf("Enter Admin Password : ");
-  getPasswordInput(passwordInput, sizeof(passwordInput));
 
-  /* Check if the entered credentials match the admin credentials */
-  if (strcmp(loginInput, admin_user) == 0 &&
-      strcmp(passwordInput, admin_password) == 0) {
-    CLEAN_SCREEN();
-    printf("\nSuccessfully logged in!\nYou are in the administration "
-           "dashboard!\n");
-    adminDashboard(); /* Redirect to the admin dashboard upon successful login
-                       */
-  } else {
-    printf("\nLogin Failed!\n"); /* Display a failure message for incorrect
-                                    credentials */
+/* Map a change log table id to its database file */
+const char *tablePath(int table)
+{
+  switch (table) {
+  case CHANGE_TABLE_CARS:
+    return car_database;
+  case CHANGE_TABLE_USERS:
+    return user_database;
+  case CHANGE_TABLE_RENTALS:
+    return rental_records;
+  case CHANGE_TABLE_UNITS:
+    return car_units_file;
+  case CHANGE_TABLE_RETURNS:
+    return returns_file;
+  case CHANGE_TABLE_WAITLIST:
+    return waitlist_file;
+  case CHANGE_TABLE_DEMAND:
+    return demand_stats_file;
   }
+  return NULL;
 }
 
-void userDashboardMenu(struct Users *user)
+/* Size of one record in the given table */
+size_t tableRecordSize(int table)
 {
-  int choice;
-  printf("\nWelcome to the User Dashboard, %s!\n", user->fullname);
-  do {
-    /* Display the user dashboard */
-    printf("\n1. View Available Car Models\n");
-    printf("2. Rent a Car\n");
-    printf("3. View Rental History\n");
-    printf("4. Account Settings\n"); /* Allow users to change their password,
-                                        contact info, etc. */
-    printf("5. Logout\n");
+  switch (table) {
+  case CHANGE_TABLE_CARS:
+    return sizeof(struct CarModel);
+  case CHANGE_TABLE_USERS:
+    return sizeof(struct Users);
+  case CHANGE_TABLE_RENTALS:
+    return sizeof(struct Rental);
+  case CHANGE_TABLE_UNITS:
+    return sizeof(struct CarUnit);
+  case CHANGE_TABLE_RETURNS:
+    return sizeof(struct RentalReturn);
+  case CHANGE_TABLE_WAITLIST:
+    return sizeof(struct WaitlistEntry);
+  case CHANGE_TABLE_DEMAND:
+    return sizeof(struct DemandStats);
+  }
+  return 0;
+}
 
-    /* Prompt for user input */
-    printf("\nEnter your choice: ");
-    scanf("%d", &choice);
-    flushInputBuffer();
+/**
+ * Resolve a database path for report queries.
+ * When --reports-from is given, the file is read from the replica's data
+ * directory instead, keeping heavy reports off the primary's files.
+ */
+const char *reportPath(const char *path)
+{
+  static char replicaPath[PATH_MAX];
 
-    switch (choice) {
-    case 1:
-      viewCars();
-      break;
-    case 2:
-      rentCar(user);
-      break;
-    case 3:
-      showUserRentals(user->username);
-      break;
-    case 4:
-      updateUser(user->username);
-      break;
-    case 5:
-      printf("Logging out from User Dashboard.\n");
-      return;
-    default:
-      printf("Invalid choice. Please try again.\n");
-    }
-  } while (1); /* Infinite loop for the user menu */
+  if (report_data_dir == NULL || strncmp(path, "data/", 5) != 0)
+    return path;
+  snprintf(replicaPath, sizeof(replicaPath), "%s/%s", report_data_dir, path + 5);
+  return replicaPath;
 }
 
-void displayMainMenu(void)
+/**
+ * Append a committed write to the change log.
+ * Sequence numbers start at 1 and equal the record's position in the log, so
+ * followers can resume from the last sequence they applied. Each branch has
+ * its own log for cars and rentals; users are logged in the main log.
+ */
+void logChange(int table, int op, long index, const void *data)
 {
-  printf("=== Car Rental System ===\n");
-  printf("1. User Registration\n");
-  printf("2. User Login\n");
-  printf("3. Admin Login\n");
-  printf("4. Exit\n");
+  struct ChangeRecord change;
+
+  memset(&change, 0, sizeof(change));
+  change.table = table;
+  change.op = op;
+  change.index = index;
+  memcpy(&change.data, data, tableRecordSize(table));
+  logChanges(&change, 1, false);
 }
 
-void userLogin(struct Users *loggedInUser)
+/**
+ * Append several changes to the change log of the first one's table with a
+ * single write, numbering them in order. All of them must go to the same
+ * log. The log is locked from reading its size to the write, so writers in
+ * other processes neither reuse a sequence number nor interleave records
+ * with the batch. With durable set the log is synced to disk before
+ * returning. Returns 0 on success and -1 on error.
+ */
+int logChanges(struct ChangeRecord *changes, size_t count, bool durable)
 {
-  char loginInput[20];
-  char passwordInput[20];
-  char choice[4];
-
-  CLEAN_SCREEN();
-  printf("=== User Login ===\n");
-  printf("Please enter your Username, Contact Number, or Email: ");
-  getInput(loginInput, sizeof(loginInput));
-  printf("Please enter your Password: ");
-  getPasswordInput(passwordInput, sizeof(passwordInput));
-
-  FILE *file = fopen("data/registered_users.bin", "rb");
-  if (file == NULL) {
-    printf("Error while opening user data file.\n");
-    return; /* Login failed */
+  const char *logPath = tableLogPath(changes[0].table);
+  size_t size = count * sizeof(struct ChangeRecord);
+  struct stat info;
+
+  int fd = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0 || fstat(fd, &info) != 0) {
+    fprintf(stderr, "Error opening %s: %s\n", logPath, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
   }
 
-  struct Users user;
-  int found = 0;
-
-  while (fread(&user, sizeof(struct Users), 1, file)) {
-    if ((strcmp(loginInput, user.username) == 0 ||
-         strcmp(loginInput, user.number) == 0 ||
-         strcmp(loginInput, user.email) == 0) &&
-        strcmp(passwordInput, user.password) == 0) {
-      found = 1;
-      *loggedInUser = user; /* Copy user data to the loggedInUser pointer */
-      break;
-    }
+  size_t seq = info.st_size / sizeof(struct ChangeRecord) + 1;
+  time_t now = time(NULL);
+  for (size_t i = 0; i < count; i++) {
+    changes[i].seq = seq + i;
+    changes[i].committed_at = now;
   }
 
-  fclose(file);
-
-  if (found) {
-    /* User successfully logged in, call the user dashboard */
-    printf("\nLogin successful.");
-    userDashboardMenu(loggedInUser);
+  if (write(fd, changes, size) != (ssize_t)size || (durable && fsync(fd) != 0)) {
+    fprintf(stderr, "Error writing to %s: %s\n", logPath, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  /* Closing the log releases the lock */
+  close(fd);
+  return 0;
+}
+
+/**
+ * Remove the record at the given index from a fixed-size record file by
+ * copying every other record into a temporary file and renaming it over the
+ * original. Returns 0 on success and -1 on error.
+ */
+int removeRecordAt(const char *filename, size_t record_size, long index)
+{
+  char tempname[PATH_MAX];
+  char record[sizeof(struct ChangeRecord)];
+  long current = 0;
+  bool removed = false;
+
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
+    return -1;
+  }
+
+  snprintf(tempname, sizeof(tempname), "%s.tmp", filename);
+  FILE *tempFile = fopen(tempname, "wb");
+  if (tempFile == NULL) {
+    fprintf(stderr, "Error creating temporary file: %s\n", strerror(errno));
+    fclose(file);
+    return -1;
+  }
+
+  while (fread(record, record_size, 1, file) == 1) {
+    if (current++ == index) {
+      removed = true;
+      continue; /* Skip writing the removed record */
+    }
+    if (fwrite(record, record_size, 1, tempFile) != 1) {
+      fprintf(stderr, "Error writing data to the file: %s\n", strerror(errno));
+      fclose(file);
+      fclose(tempFile);
+      remove(tempname);
+      return -1;
+    }
+  }
+  fclose(file);
+  fclose(tempFile);
+
+  if (!removed) {
+    remove(tempname);
+    return -1;
+  }
+  if (rename(tempname, filename) != 0) {
+    fprintf(stderr, "Error renaming the temporary file: %s\n", strerror(errno));
+    remove(tempname);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Apply one change from the primary to the local tables.
+ * Appends and updates are written at the record's index so that replaying a
+ * change after a crash leaves the table unchanged. A removal is applied only
+ * while the removed record is still at its index, for the same reason.
+ */
+int applyChange(const struct ChangeRecord *change)
+{
+  const char *filename = tablePath(change->table);
+  size_t record_size = tableRecordSize(change->table);
+
+  /* Notifications are delivered from the primary's log; a replica keeps no outbox */
+  if (change->table == CHANGE_TABLE_NOTIFICATIONS)
+    return 0;
+  if (filename == NULL) {
+    fprintf(stderr, "Unknown table %d in change %zu\n", change->table, change->seq);
+    return -1;
+  }
+  if (change->table == CHANGE_TABLE_CARS)
+    invalidateFleet();
+  else if (change->table == CHANGE_TABLE_USERS)
+    user_index.loaded = false;
+  else if (change->table == CHANGE_TABLE_UNITS)
+    inventories[current_branch].loaded = false;
+  else if (change->table == CHANGE_TABLE_RETURNS)
+    return_indexes[current_branch].loaded = false;
+  else if (change->table == CHANGE_TABLE_WAITLIST)
+    waitlist_loaded = false;
+  if (change->op == CHANGE_OP_REMOVE) {
+    /* Replayed: the record has already moved out of its place */
+    if (!holdsRemovedRecord(change, filename, record_size))
+      return 0;
+    return removeRecordAt(filename, record_size, change->index);
+  }
+
+  FILE *file = fopen(filename, "rb+");
+  if (file == NULL)
+    file = fopen(filename, "wb+");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  fseek(file, change->index * (long)record_size, SEEK_SET);
+  if (fwrite(&change->data, record_size, 1, file) != 1) {
+    fprintf(stderr, "Error writing to %s: %s\n", filename, strerror(errno));
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  return 0;
+}
+
+/* Load the follower's replication progress, or start from the beginning */
+void loadReplicaStatus(struct ReplicaStatus *status)
+{
+  long applied_commit_time = 0;
+  long last_poll = 0;
+
+  memset(status, 0, sizeof(*status));
+  FILE *file = fopen(replica_status_file, "r");
+  if (file == NULL)
+    return;
+  if (fscanf(file, "%zu %zu %ld %ld %lf", &status->applied_seq,
+             &status->primary_seq, &applied_commit_time, &last_poll,
+             &status->lag_seconds) != 5)
+    memset(status, 0, sizeof(*status));
+  status->applied_commit_time = applied_commit_time;
+  status->last_poll = last_poll;
+  fclose(file);
+}
+
+/* Save the follower's replication progress */
+void saveReplicaStatus(const struct ReplicaStatus *status)
+{
+  FILE *file = fopen(replica_status_file, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", replica_status_file, strerror(errno));
+    return;
+  }
+  fprintf(file, "%zu %zu %ld %ld %.0lf\n", status->applied_seq,
+          status->primary_seq, (long)status->applied_commit_time,
+          (long)status->last_poll, status->lag_seconds);
+  fclose(file);
+}
+
+/* Print how far each branch of this replica is behind its primary */
+void showReplicationStatus(FILE *out)
+{
+  struct ReplicaStatus status;
+  size_t branch = current_branch;
+
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    loadReplicaStatus(&status);
+    fprintf(out, "\n[Read replica] %s: applied %zu of %zu changes, %zu behind, "
+           "lag %.0lfs, last contact %.0lfs ago",
+           branches[i].name, status.applied_seq, status.primary_seq,
+           status.primary_seq - status.applied_seq, status.lag_seconds,
+           status.last_poll ? difftime(time(NULL), status.last_poll) : 0.0);
+  }
+  selectBranch(branch);
+}
+
+/**
+ * Apply every new change of one primary log to the selected branch.
+ * Progress and lag are kept in memory and written to the branch's replica
+ * status file every REPLICA_STATUS_INTERVAL changes and once the poll is
+ * done. Returns the number of changes applied.
+ */
+size_t pollChangeLog(const char *primary_log)
+{
+  struct ReplicaStatus status;
+  size_t applied = 0;
+
+  loadReplicaStatus(&status);
+  FILE *log = fopen(primary_log, "rb");
+  if (log != NULL) {
+    struct ChangeRecord change;
+
+    fseek(log, 0, SEEK_END);
+    status.primary_seq = ftell(log) / sizeof(struct ChangeRecord);
+    fseek(log, status.applied_seq * sizeof(struct ChangeRecord), SEEK_SET);
+
+    while (fread(&change, sizeof(struct ChangeRecord), 1, log) == 1) {
+      if (applyChange(&change) != 0)
+        break;
+      status.applied_seq = change.seq;
+      status.applied_commit_time = change.committed_at;
+      status.lag_seconds = difftime(time(NULL), change.committed_at);
+      /* A long catch-up still shows its progress now and then */
+      if (++applied % REPLICA_STATUS_INTERVAL == 0) {
+        status.last_poll = time(NULL);
+        saveReplicaStatus(&status);
+      }
+    }
+    fclose(log);
+  }
+
+  /* A follower that has applied everything has no lag */
+  if (status.applied_seq >= status.primary_seq)
+    status.lag_seconds = 0;
+  status.last_poll = time(NULL);
+  saveReplicaStatus(&status);
+  return applied;
+}
+
+/* Copy the primary's branch list so that new shards are followed as well */
+void mirrorBranchList(const char *primary_dir)
+{
+  char path[PATH_MAX];
+  char line[64];
+
+  snprintf(path, sizeof(path), "%s/branches.txt", primary_dir);
+  FILE *source = fopen(path, "r");
+  if (source == NULL)
+    return;
+  FILE *copy = fopen(branch_list, "w");
+  if (copy == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", branch_list, strerror(errno));
+    fclose(source);
+    return;
+  }
+  while (fgets(line, sizeof(line), source) != NULL)
+    fputs(line, copy);
+  fclose(source);
+  fclose(copy);
+}
+
+/**
+ * Run as a follower of the primary whose data directory is given.
+ * The change log of every branch is polled through the shared directory and
+ * each new change is applied to the matching shard of this process's own data
+ * directory.
+ */
+void followPrimary(const char *primary_dir)
+{
+  char primary_log[PATH_MAX];
+
+  if ((mkdir("data", 0755) != 0 && errno != EEXIST) ||
+      (mkdir("data/branches", 0755) != 0 && errno != EEXIST)) {
+    fprintf(stderr, "Error creating the data directory: %s\n", strerror(errno));
+    return;
+  }
+  printf("Following %s\n", primary_dir);
+
+  while (1) {
+    mirrorBranchList(primary_dir);
+    loadBranches();
+    for (size_t i = 0; i < num_branches; i++) {
+      selectBranch(i);
+      if (mkdir(branches[i].dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error creating %s: %s\n", branches[i].dir, strerror(errno));
+        continue;
+      }
+      /* Branch directories have the same layout under both data directories */
+      snprintf(primary_log, sizeof(primary_log), "%s%s/change_log.bin",
+               primary_dir, branches[i].dir + strlen("data"));
+      if (pollChangeLog(primary_log) > 0) {
+        struct ReplicaStatus status;
+        loadReplicaStatus(&status);
+        printf("%s: applied %zu of %zu changes (lag %.0lfs)\n", branches[i].name,
+               status.applied_seq, status.primary_seq, status.lag_seconds);
+        fflush(stdout);
+      }
+    }
+    usleep(REPLICA_POLL_INTERVAL_US);
+  }
+}
+
+/* Refuse a write when this process is serving as a read-only replica */
+bool rejectWriteOnReplica(FILE *out)
+{
+  if (read_only)
+    fprintf(out, "\nThis is a read-only replica. Changes must be made on the primary.\n");
+  return read_only;
+}
+
+/* Change log a table's writes go to: users are global, the rest per branch */
+const char *tableLogPath(int table)
+{
+  return table == CHANGE_TABLE_USERS ? change_log : branch_change_log;
+}
+
+/**
+ * Load the list of branches. The main branch always exists and keeps its
+ * files directly in data/; every other branch is a shard in data/branches/.
+ */
+void loadBranches(void)
+{
+  char line[64];
+
+  strcpy(branches[0].name, "main");
+  strcpy(branches[0].dir, "data");
+  num_branches = 1;
+
+  FILE *file = fopen(branch_list, "r");
+  if (file != NULL) {
+    while (num_branches < MAX_BRANCHES && fgets(line, sizeof(line), file) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (!isValidBranchName(line) || strcmp(line, "main") == 0)
+        continue;
+      strcpy(branches[num_branches].name, line);
+      snprintf(branches[num_branches].dir, sizeof(branches[num_branches].dir),
+               "data/branches/%.*s", BRANCH_NAME_SIZE - 1, line);
+      num_branches++;
+    }
+    fclose(file);
+  }
+  if (current_branch >= num_branches)
+    current_branch = 0;
+}
+
+/* Route car and rental operations to the given branch's shard */
+void selectBranch(size_t branch)
+{
+  const char *dir = branches[branch].dir;
+
+  current_branch = branch;
+  snprintf(car_database, sizeof(car_database), "%s/car_database.db", dir);
+  snprintf(rental_records, sizeof(rental_records), "%s/rental_records.bin", dir);
+  snprintf(branch_change_log, sizeof(branch_change_log), "%s/change_log.bin", dir);
+  snprintf(replica_status_file, sizeof(replica_status_file), "%s/replica_status.txt", dir);
+  snprintf(waitlist_file, sizeof(waitlist_file), "%s/waitlist.bin", dir);
+  snprintf(demand_stats_file, sizeof(demand_stats_file), "%s/demand_stats.bin", dir);
+  snprintf(car_units_file, sizeof(car_units_file), "%s/car_units.bin", dir);
+  snprintf(returns_file, sizeof(returns_file), "%s/returns.bin", dir);
+  snprintf(outbox_status_file, sizeof(outbox_status_file), "%s/outbox_status.txt", dir);
+}
+
+/* Branch names become directory names, so only allow a safe character set */
+bool isValidBranchName(const char *name)
+{
+  size_t length = strlen(name);
+
+  if (length == 0 || length >= BRANCH_NAME_SIZE)
+    return false;
+  for (size_t i = 0; i < length; i++) {
+    if (!((name[i] >= 'a' && name[i] <= 'z') || (name[i] >= 'A' && name[i] <= 'Z') ||
+          (name[i] >= '0' && name[i] <= '9') || name[i] == '-' || name[i] == '_'))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Create a new branch shard with its own, empty car and rental files.
+ */
+void addBranch(FILE *out, const char *input)
+{
+  char name[BRANCH_NAME_SIZE];
+
+  if (rejectWriteOnReplica(out))
+    return;
+  if (num_branches == MAX_BRANCHES) {
+    fprintf(out, "\nThe maximum of %d branches has been reached.\n", MAX_BRANCHES);
+    return;
+  }
+
+  if (!isValidBranchName(input)) {
+    fprintf(out, "\nBranch names use letters, digits, '-' and '_' only (at most %d).\n",
+            BRANCH_NAME_SIZE - 1);
+    return;
+  }
+  strcpy(name, input);
+  for (size_t i = 0; i < num_branches; i++) {
+    if (strcmp(branches[i].name, name) == 0) {
+      fprintf(out, "\nBranch '%s' already exists.\n", name);
+      return;
+    }
+  }
+
+  char dir[sizeof(branches[0].dir)];
+  snprintf(dir, sizeof(dir), "data/branches/%s", name);
+  if ((mkdir("data/branches", 0755) != 0 && errno != EEXIST) ||
+      (mkdir(dir, 0755) != 0 && errno != EEXIST)) {
+    fprintf(stderr, "Error creating %s: %s\n", dir, strerror(errno));
+    return;
+  }
+
+  FILE *file = fopen(branch_list, "a");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", branch_list, strerror(errno));
+    return;
+  }
+  fprintf(file, "%s\n", name);
+  fclose(file);
+
+  /* Start the shard with empty tables so listings work straight away */
+  size_t branch = current_branch;
+  loadBranches();
+  selectBranch(num_branches - 1);
+  const char *const tables[] = {car_database, rental_records};
+  for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+    file = fopen(tables[i], "ab");
+    if (file == NULL) {
+      fprintf(out, "\nError creating %s: %s\n", tables[i], strerror(errno));
+      selectBranch(branch);
+      return;
+    }
+    fclose(file);
+  }
+  selectBranch(branch);
+  fprintf(out, "\nBranch '%s' added.\n", name);
+}
+
+/* List the branches, marking the selected one */
+void listBranches(FILE *out)
+{
+  fprintf(out, "\nBranches:\n");
+  for (size_t i = 0; i < num_branches; i++)
+    fprintf(out, "%zu. %s%s\n", i + 1, branches[i].name,
+            i == current_branch ? " (current)" : "");
+}
+
+/**
+ * Fan the car listing out over every branch, a page at a time. A page that
+ * finishes a branch goes on with the next one.
+ */
+void viewCarsAllBranches(FILE *out, struct PageCursor *page)
+{
+  size_t branch = current_branch;
+  size_t shown = 0;
+
+  while (page->branch < num_branches) {
+    selectBranch(page->branch);
+    if (num_branches > 1)
+      fprintf(out, "\n\nBranch: %s", branches[page->branch].name);
+    shown += viewCars(out, page, PAGE_ROWS - shown);
+    if (page->more)
+      break;
+    pageStart(page, page->branch + 1);
+    page->more = page->branch < num_branches;
+    if (shown == PAGE_ROWS)
+      break;
+  }
+  selectBranch(branch);
+}
+
+/* Fan a page of a rental history or of the full rental log out over every branch */
+void showUserRentalsAllBranches(FILE *out, const char *username, struct PageCursor *page)
+{
+  size_t branch = current_branch;
+  size_t shown = 0;
+
+  while (page->branch < num_branches) {
+    selectBranch(page->branch);
+    if (num_branches > 1)
+      fprintf(out, "\nBranch: %s\n", branches[page->branch].name);
+    shown += showUserRentals(out, username, page, PAGE_ROWS - shown);
+    if (page->more)
+      break;
+    pageStart(page, page->branch + 1);
+    page->more = page->branch < num_branches;
+    if (shown == PAGE_ROWS)
+      break;
+  }
+  selectBranch(branch);
+}
+
+/* Today's date in the YYYY-MM-DD format used for rental dates */
+void todaysDate(char *date, size_t size)
+{
+  time_t now = time(NULL);
+  strftime(date, size, "%Y-%m-%d", localtime(&now));
+}
+
+/* Waitlist order: higher priority first, then first come first served */
+bool waitlistItemBefore(const struct WaitlistItem *a, const struct WaitlistItem *b)
+{
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  if (a->requested_at != b->requested_at)
+    return a->requested_at < b->requested_at;
+  return a->index < b->index;
+}
+
+/* Add a request to a queue in O(log n) */
+void waitQueuePush(struct WaitQueue *queue, struct WaitlistItem item)
+{
+  if (queue->count == queue->capacity) {
+    size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+    struct WaitlistItem *items = realloc(queue->items, capacity * sizeof(*items));
+    if (items == NULL) {
+      fprintf(stderr, "Out of memory while queueing a waitlist request\n");
+      return;
+    }
+    queue->items = items;
+    queue->capacity = capacity;
+  }
+
+  /* Sift the new item up to its place in the heap */
+  size_t i = queue->count++;
+  while (i > 0 && waitlistItemBefore(&item, &queue->items[(i - 1) / 2])) {
+    queue->items[i] = queue->items[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  queue->items[i] = item;
+}
+
+/* Remove and return the first request of a non-empty queue in O(log n) */
+struct WaitlistItem waitQueuePop(struct WaitQueue *queue)
+{
+  struct WaitlistItem first = queue->items[0];
+  struct WaitlistItem last = queue->items[--queue->count];
+  size_t i = 0;
+
+  /* Sift the last item down from the root */
+  while (2 * i + 1 < queue->count) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < queue->count &&
+        waitlistItemBefore(&queue->items[child + 1], &queue->items[child]))
+      child++;
+    if (!waitlistItemBefore(&queue->items[child], &last))
+      break;
+    queue->items[i] = queue->items[child];
+    i = child;
+  }
+  if (queue->count > 0)
+    queue->items[i] = last;
+  return first;
+}
+
+/* Find the queue for a car model ("" is any car), creating it if asked to */
+struct WaitQueue *findWaitQueue(const char *model_name, bool create)
+{
+  for (size_t i = 0; i < num_wait_queues; i++) {
+    if (strcmp(wait_queues[i].model_name, model_name) == 0)
+      return &wait_queues[i];
+  }
+  if (!create || num_wait_queues == sizeof(wait_queues) / sizeof(wait_queues[0]))
+    return NULL;
+
+  struct WaitQueue *queue = &wait_queues[num_wait_queues++];
+  memset(queue, 0, sizeof(*queue));
+  strncpy(queue->model_name, model_name, sizeof(queue->model_name) - 1);
+  return queue;
+}
+
+/**
+ * Build the in-memory queues from the selected branch's waitlist file.
+ * This runs once per branch; afterwards the queues are kept up to date as
+ * requests are added and allocated.
+ */
+void loadWaitlist(void)
+{
+  struct WaitlistEntry entry;
+  long index = 0;
+
+  if (waitlist_loaded && waitlist_branch == current_branch)
+    return;
+
+  for (size_t i = 0; i < num_wait_queues; i++)
+    free(wait_queues[i].items);
+  num_wait_queues = 0;
+  waitlist_loaded = true;
+  waitlist_branch = current_branch;
+
+  FILE *file = fopen(waitlist_file, "rb");
+  if (file == NULL)
+    return;
+  while (fread(&entry, sizeof(struct WaitlistEntry), 1, file) == 1) {
+    if (entry.status == WAITLIST_WAITING) {
+      struct WaitQueue *queue = findWaitQueue(entry.model_name, true);
+      struct WaitlistItem item = {entry.priority, entry.requested_at, index};
+      if (queue != NULL)
+        waitQueuePush(queue, item);
+    }
+    index++;
+  }
+  fclose(file);
+}
+
+/* Increment one demand counter of a car model in the selected branch */
+void recordDemand(const char *model_name, int counter)
+{
+  struct DemandStats stats;
+  bool found = false;
+  long index = 0;
+
+  FILE *file = fopen(demand_stats_file, "rb+");
+  if (file == NULL)
+    file = fopen(demand_stats_file, "wb+");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", demand_stats_file, strerror(errno));
+    return;
+  }
+
+  while (fread(&stats, sizeof(struct DemandStats), 1, file) == 1) {
+    if (strcmp(stats.model_name, model_name) == 0) {
+      found = true;
+      fseek(file, -sizeof(struct DemandStats), SEEK_CUR);
+      break;
+    }
+    index++;
+  }
+  if (!found) {
+    memset(&stats, 0, sizeof(stats));
+    strncpy(stats.model_name, model_name, sizeof(stats.model_name) - 1);
+    fseek(file, 0, SEEK_END);
+  }
+
+  switch (counter) {
+  case DEMAND_TURNED_AWAY:
+    stats.turned_away++;
+    break;
+  case DEMAND_QUEUED:
+    stats.queued++;
+    break;
+  case DEMAND_ALLOCATED:
+    stats.allocated++;
+    break;
+  case DEMAND_EXPIRED:
+    stats.expired++;
+    break;
+  }
+  if (fwrite(&stats, sizeof(struct DemandStats), 1, file) != 1) {
+    fprintf(stderr, "Error writing to %s: %s\n", demand_stats_file, strerror(errno));
+    fclose(file);
+    return;
+  }
+  fclose(file);
+  logChange(CHANGE_TABLE_DEMAND, found ? CHANGE_OP_UPDATE : CHANGE_OP_APPEND, index, &stats);
+}
+
+/**
+ * Put a request on the waitlist of the selected branch.
+ * Returns the number of requests now waiting for the same model, or -1 on error.
+ */
+long enqueueWaitlist(struct WaitlistEntry *entry)
+{
+  entry->priority = 0;
+  entry->status = WAITLIST_WAITING;
+  entry->requested_at = time(NULL);
+
+  loadWaitlist();
+  FILE *file = fopen(waitlist_file, "ab");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", waitlist_file, strerror(errno));
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long index = ftell(file) / (long)sizeof(struct WaitlistEntry);
+  if (fwrite(entry, sizeof(struct WaitlistEntry), 1, file) != 1) {
+    fprintf(stderr, "Error writing to %s: %s\n", waitlist_file, strerror(errno));
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  logChange(CHANGE_TABLE_WAITLIST, CHANGE_OP_APPEND, index, entry);
+
+  struct WaitQueue *queue = findWaitQueue(entry->model_name, true);
+  struct WaitlistItem item = {entry->priority, entry->requested_at, index};
+  if (queue != NULL)
+    waitQueuePush(queue, item);
+  recordDemand(entry->model_name, DEMAND_QUEUED);
+  return queue != NULL ? (long)queue->count : 0;
+}
+
+/**
+ * Rent a car that has just become available to the next eligible customer
+ * waiting for its model or for any car. Requests whose pickup date has passed
+ * are expired on the way. Returns 1 and the allocated request if the car was
+ * allocated, 0 otherwise.
+ */
+int allocateFromWaitlist(const struct CarModel *car, struct WaitlistEntry *allocated)
+{
+  struct WaitlistEntry entry;
+  char today[11];
+
+  loadWaitlist();
+  todaysDate(today, sizeof(today));
+
+  FILE *file = fopen(waitlist_file, "rb+");
+  if (file == NULL)
+    return 0;
+
+  while (1) {
+    struct WaitQueue *modelQueue = findWaitQueue(car->model_name, false);
+    struct WaitQueue *anyQueue = findWaitQueue("", false);
+    struct WaitQueue *queue = NULL;
+
+    /* The first request is at the top of one of the two matching queues */
+    if (modelQueue != NULL && modelQueue->count > 0)
+      queue = modelQueue;
+    if (anyQueue != NULL && anyQueue->count > 0 &&
+        (queue == NULL || waitlistItemBefore(&anyQueue->items[0], &queue->items[0])))
+      queue = anyQueue;
+    if (queue == NULL)
+      break;
+
+    struct WaitlistItem item = waitQueuePop(queue);
+    fseek(file, item.index * (long)sizeof(struct WaitlistEntry), SEEK_SET);
+    if (fread(&entry, sizeof(struct WaitlistEntry), 1, file) != 1 ||
+        entry.status != WAITLIST_WAITING)
+      continue;
+
+    if (strcmp(entry.pickupDate, today) < 0) {
+      entry.status = WAITLIST_EXPIRED;
+      recordDemand(entry.model_name, DEMAND_EXPIRED);
+    } else {
+      struct Rental rental;
+      struct Users customer;
+
+      memset(&rental, 0, sizeof(rental));
+      /* The rental carries the customer's registered details, as any other rental does */
+      if (findUserIndex(entry.username, &customer) < 0) {
+        memset(&customer, 0, sizeof(customer));
+        memcpy(customer.username, entry.username, sizeof(customer.username));
+      }
+      rental.selectedCar = *car;
+      strcpy(rental.pickupDate, entry.pickupDate);
+      strcpy(rental.returnDate, entry.returnDate);
+      rental.totalCost = car->rental_rate *
+                         calculateRentalDays(entry.pickupDate, entry.returnDate);
+      char *uniqueID = generateUniqueRentalID("R");
+      if (uniqueID != NULL)
+        snprintf(rental.rentalID, sizeof(rental.rentalID), "%s", uniqueID);
+
+      if (uniqueID == NULL || commitRental(&customer, &rental, NOTIFY_WAITLIST_OFFER) != 0) {
+        /* Keep the customer's place for the next free car */
+        waitQueuePush(queue, item);
+        break;
+      }
+      entry.status = WAITLIST_ALLOCATED;
+      strncpy(entry.rentalID, rental.rentalID, sizeof(entry.rentalID));
+      recordDemand(entry.model_name, DEMAND_ALLOCATED);
+    }
+
+    fseek(file, item.index * (long)sizeof(struct WaitlistEntry), SEEK_SET);
+    if (fwrite(&entry, sizeof(struct WaitlistEntry), 1, file) != 1)
+      fprintf(stderr, "Error writing to %s: %s\n", waitlist_file, strerror(errno));
+    else
+      logChange(CHANGE_TABLE_WAITLIST, CHANGE_OP_UPDATE, item.index, &entry);
+    if (entry.status == WAITLIST_ALLOCATED) {
+      *allocated = entry;
+      fclose(file);
+      return 1;
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+/* Tell a customer about waitlist requests that were turned into rentals */
+void notifyWaitlistAllocations(FILE *out, const struct Users *user)
+{
+  struct WaitlistEntry entry;
+  size_t branch = current_branch;
+
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    FILE *file = fopen(waitlist_file, "rb+");
+    if (file == NULL)
+      continue;
+    for (long index = 0; fread(&entry, sizeof(struct WaitlistEntry), 1, file) == 1; index++) {
+      if (entry.status != WAITLIST_ALLOCATED ||
+          strcmp(entry.username, user->username) != 0)
+        continue;
+      fprintf(out, "Good news: your waitlisted request for %s (%s to %s) at %s was "
+             "allocated as rental %s.\n",
+             entry.model_name[0] ? entry.model_name : "any car", entry.pickupDate,
+             entry.returnDate, branches[i].name, entry.rentalID);
+      entry.status = WAITLIST_NOTIFIED;
+      fseek(file, -sizeof(struct WaitlistEntry), SEEK_CUR);
+      if (fwrite(&entry, sizeof(struct WaitlistEntry), 1, file) == 1)
+        logChange(CHANGE_TABLE_WAITLIST, CHANGE_OP_UPDATE, index, &entry);
+      fseek(file, 0, SEEK_CUR); /* Required between a write and a read */
+    }
+    fclose(file);
+  }
+  selectBranch(branch);
+}
+
+/* Show the selected branch's waitlist and its demand statistics */
+void showWaitlist(FILE *out)
+{
+  static const char *status_names[] = {"Waiting", "Allocated", "Allocated", "Expired"};
+  struct WaitlistEntry entry;
+  struct DemandStats stats;
+  long index = 0;
+
+  fprintf(out, "\nWaitlist of branch %s\n", branches[current_branch].name);
+  fprintf(out, "%-7s%-20s%-15s%-13s%-13s%-10s%-11s%-10s\n", "Entry", "Username",
+         "Model Name", "Pickup Date", "Return Date", "Priority", "Status", "Rental");
+  FILE *file = fopen(waitlist_file, "rb");
+  if (file != NULL) {
+    while (fread(&entry, sizeof(struct WaitlistEntry), 1, file) == 1) {
+      fprintf(out, "%-7ld%-20s%-15s%-13s%-13s%-10d%-11s%-10s\n", index++, entry.username,
+             entry.model_name[0] ? entry.model_name : "(any)", entry.pickupDate,
+             entry.returnDate, entry.priority, status_names[entry.status],
+             entry.rentalID);
+    }
+    fclose(file);
+  }
+
+  fprintf(out, "\nDemand\n");
+  fprintf(out, "%-15s%-13s%-10s%-11s%-9s%-8s\n", "Model Name", "Turned Away", "Queued",
+         "Allocated", "Expired", "Unmet");
+  file = fopen(demand_stats_file, "rb");
+  if (file != NULL) {
+    while (fread(&stats, sizeof(struct DemandStats), 1, file) == 1) {
+      fprintf(out, "%-15s%-13zu%-10zu%-11zu%-9zu%-8zu\n",
+             stats.model_name[0] ? stats.model_name : "(any)", stats.turned_away,
+             stats.queued, stats.allocated, stats.expired,
+             stats.turned_away + stats.expired);
+    }
+    fclose(file);
+  }
+}
+
+/**
+ * Move a waiting request up or down the queue.
+ * Returns 0 on success and -1 if the entry is not waiting.
+ */
+int setWaitlistPriority(long index, int priority)
+{
+  struct WaitlistEntry entry;
+
+  FILE *file = fopen(waitlist_file, "rb+");
+  if (file == NULL)
+    return -1;
+  fseek(file, index * (long)sizeof(struct WaitlistEntry), SEEK_SET);
+  if (index < 0 || fread(&entry, sizeof(struct WaitlistEntry), 1, file) != 1 ||
+      entry.status != WAITLIST_WAITING) {
+    fclose(file);
+    return -1;
+  }
+  entry.priority = priority;
+  fseek(file, index * (long)sizeof(struct WaitlistEntry), SEEK_SET);
+  if (fwrite(&entry, sizeof(struct WaitlistEntry), 1, file) != 1)
+    fprintf(stderr, "Error writing to %s: %s\n", waitlist_file, strerror(errno));
+  else
+    logChange(CHANGE_TABLE_WAITLIST, CHANGE_OP_UPDATE, index, &entry);
+  fclose(file);
+
+  /* Rebuild the queues so the entry moves to its new place */
+  waitlist_loaded = false;
+  return 0;
+}
+
+/* Seconds from an arbitrary start point, unaffected by clock changes */
+double monotonicSeconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Identify a terminal client by its SSH peer address or its terminal */
+void detectRequestSource(void)
+{
+  const char *ssh_client = getenv("SSH_CLIENT");
+  const char *tty = ttyname(0);
+
+  if (ssh_client != NULL)
+    snprintf(request_source, sizeof(request_source), "%.*s",
+             (int)strcspn(ssh_client, " "), ssh_client);
+  else if (tty != NULL)
+    snprintf(request_source, sizeof(request_source), "%s", tty);
+}
+
+/* FNV-1a hash of a bucket's action, scope ('u'ser or 's'ource) and key */
+unsigned long long hashRateLimitKey(int action, char scope, const char *key)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+
+  hash = (hash ^ (unsigned char)action) * 1099511628211ULL;
+  hash = (hash ^ (unsigned char)scope) * 1099511628211ULL;
+  for (; *key != '\0'; key++)
+    hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+  return hash != 0 ? hash : 1; /* 0 marks an unused slot */
+}
+
+/**
+ * Find the bucket of a key in O(1), refilled up to now.
+ * Only a few slots are probed; when the key is not among them, an unused
+ * slot or one whose bucket has refilled completely is handed to the key as a
+ * full bucket. Such a bucket's owner has lost nothing, so this bounds memory
+ * without loosening anyone's limits. Returns NULL when every probed bucket
+ * is still being drawn on.
+ */
+struct TokenBucket *findTokenBucket(unsigned long long key,
+                                    const struct RateLimitPolicy *policy, double now)
+{
+  struct TokenBucket *reusable = NULL;
+  struct TokenBucket *bucket = NULL;
+
+  for (size_t probe = 0; probe < RATE_LIMIT_PROBES; probe++) {
+    struct TokenBucket *slot = &rate_limit_buckets[(key + probe) % RATE_LIMIT_SLOTS];
+    if (slot->key == key) {
+      bucket = slot;
+      break;
+    }
+    if (reusable == NULL &&
+        (slot->key == 0 || slot->tokens + (now - slot->last_refill) *
+                           slot->policy->refill_per_second >= slot->policy->capacity))
+      reusable = slot;
+  }
+
+  if (bucket == NULL) {
+    if (reusable == NULL)
+      return NULL;
+    bucket = reusable;
+    bucket->key = key;
+    bucket->policy = policy;
+    bucket->tokens = policy->capacity;
+    bucket->last_refill = now;
+  }
+
+  bucket->tokens += (now - bucket->last_refill) * policy->refill_per_second;
+  if (bucket->tokens > policy->capacity)
+    bucket->tokens = policy->capacity;
+  bucket->last_refill = now;
+  return bucket;
+}
+
+/**
+ * Take one token from both the user's and the source's bucket for an action.
+ * Returns false, without taking any token, when either bucket is empty or
+ * has no room to be kept in.
+ */
+bool rateLimitAllow(int action, const char *username, const char *source)
+{
+  double now = monotonicSeconds();
+  struct TokenBucket *user = findTokenBucket(hashRateLimitKey(action, 'u', username),
+                                             &rate_limit_user_policies[action], now);
+  struct TokenBucket *origin = findTokenBucket(hashRateLimitKey(action, 's', source),
+                                               &rate_limit_source_policies[action], now);
+
+  if (user == NULL || origin == NULL || user->tokens < 1 || origin->tokens < 1) {
+    rate_limited_requests++;
+    return false;
+  }
+  user->tokens -= 1;
+  origin->tokens -= 1;
+  return true;
+}
+
+/* Requests of every class currently being served or waiting to be served */
+size_t requestsInFlight(void)
+{
+  size_t in_flight = queued_requests;
+  for (int i = 0; i < NUM_REQUEST_CLASSES; i++)
+    in_flight += request_metrics[i].in_flight;
+  return in_flight;
+}
+
+/* Whether recent rentals have been slower than their latency target */
+bool rentalsOverloaded(void)
+{
+  const struct RequestMetrics *rentals = &request_metrics[REQUEST_RENTAL];
+  return rentals->completed > 0 &&
+         monotonicSeconds() - rentals->last_completed < LATENCY_WINDOW &&
+         rentals->latency_ewma > RENTAL_LATENCY_TARGET;
+}
+
+/**
+ * Decide whether a request may start, based on the number of requests in
+ * flight and on recent rental latency. Reports are shed first, then customer
+ * queries are deferred; rentals are only turned away at the hard limit.
+ */
+int admitRequest(int request_class)
+{
+  struct RequestMetrics *metrics = &request_metrics[request_class];
+  size_t in_flight = requestsInFlight();
+  bool overloaded = rentalsOverloaded();
+  int decision = ADMIT_ACCEPT;
+
+  switch (request_class) {
+  case REQUEST_RENTAL:
+    if (in_flight >= MAX_IN_FLIGHT)
+      decision = ADMIT_REJECT;
+    break;
+  case REQUEST_QUERY:
+    if (in_flight >= MAX_IN_FLIGHT)
+      decision = ADMIT_REJECT;
+    else if (overloaded || in_flight >= MAX_IN_FLIGHT * 3 / 4)
+      decision = ADMIT_DEFER;
+    break;
+  case REQUEST_REPORT:
+    if (overloaded || in_flight >= MAX_IN_FLIGHT * 3 / 4)
+      decision = ADMIT_REJECT;
+    else if (in_flight >= MAX_IN_FLIGHT / 2)
+      decision = ADMIT_DEFER;
+    break;
+  }
+
+  if (decision == ADMIT_ACCEPT) {
+    metrics->admitted++;
+    metrics->in_flight++;
+  } else if (decision == ADMIT_DEFER) {
+    metrics->deferred++;
+  } else {
+    metrics->rejected++;
+  }
+  return decision;
+}
+
+/* Record the end of an admitted request and how long it took to serve */
+void completeRequest(int request_class, double service_seconds)
+{
+  struct RequestMetrics *metrics = &request_metrics[request_class];
+
+  metrics->in_flight--;
+  metrics->completed++;
+  if (metrics->completed == 1)
+    metrics->latency_ewma = service_seconds;
+  else
+    metrics->latency_ewma += LATENCY_EWMA_WEIGHT * (service_seconds - metrics->latency_ewma);
+  if (service_seconds > metrics->latency_max)
+    metrics->latency_max = service_seconds;
+  metrics->last_completed = monotonicSeconds();
+}
+
+/* Finish a request admitted with sessionAdmit() */
+void endRequest(const struct RequestTimer *timer)
+{
+  completeRequest(timer->request_class, monotonicSeconds() - timer->started);
+}
+
+/* Show admission, overload and rate limiting counters */
+void showMetrics(FILE *out)
+{
+  fprintf(out, "\n%-8s%-10s%-10s%-10s%-11s%-10s%-14s%-12s\n", "Class", "Admitted",
+         "Deferred", "Rejected", "Completed", "In Flight", "Latency (ms)",
+         "Max (ms)");
+  for (int i = 0; i < NUM_REQUEST_CLASSES; i++) {
+    const struct RequestMetrics *metrics = &request_metrics[i];
+    fprintf(out, "%-8s%-10zu%-10zu%-10zu%-11zu%-10zu%-14.2lf%-12.2lf\n",
+           request_class_names[i], metrics->admitted, metrics->deferred,
+           metrics->rejected, metrics->completed, metrics->in_flight,
+           metrics->latency_ewma * 1000, metrics->latency_max * 1000);
+  }
+  fprintf(out, "\nOverloaded: %s (rental target %.0lf ms)\n",
+         rentalsOverloaded() ? "yes" : "no", RENTAL_LATENCY_TARGET * 1000);
+  fprintf(out, "Rate limited attempts: %zu\n", rate_limited_requests);
+  fprintf(out, "Request arena: %zu KB in chunks, %zu chunk allocations\n",
+         request_arena.reserved / 1024, request_arena.chunk_allocations);
+  fprintf(out, "Timers: %zu pending, %zu fired; %zu rentals overdue\n",
+         timer_wheel.pending, timer_wheel.fired, overdue_rentals);
+}
+
+/* Make room for extra bytes at the end of a buffer. Returns -1 when out of memory. */
+int bufferReserve(struct Buffer *buffer, size_t extra)
+{
+  if (buffer->length + extra <= buffer->capacity)
+    return 0;
+
+  size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+  while (capacity < buffer->length + extra)
+    capacity *= 2;
+  char *data = realloc(buffer->data, capacity);
+  if (data == NULL) {
+    fprintf(stderr, "Out of memory while growing a buffer\n");
+    return -1;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+void bufferAppend(struct Buffer *buffer, const char *data, size_t length)
+{
+  if (bufferReserve(buffer, length) != 0)
+    return;
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+/* Append formatted text; the buffer only grows when the text does not fit */
+void bufferPrintf(struct Buffer *buffer, const char *format, ...)
+{
+  va_list args;
+  size_t available = buffer->capacity - buffer->length;
+
+  va_start(args, format);
+  int length = vsnprintf(buffer->data + buffer->length, available, format, args);
+  va_end(args);
+  if (length < 0)
+    return;
+  if ((size_t)length >= available) {
+    if (bufferReserve(buffer, length + 1) != 0)
+      return;
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, length + 1, format, args);
+    va_end(args);
+  }
+  buffer->length += length;
+}
+
+
+/**
+ * Allocate size bytes, aligned for any type, from an arena. Returns NULL
+ * when out of memory.
+ */
+void *arenaAlloc(struct Arena *arena, size_t size)
+{
+  const size_t alignment = _Alignof(max_align_t);
+  struct ArenaChunk *chunk = arena->chunks;
+
+  size = (size + alignment - 1) & ~(alignment - 1);
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk = arena->spare;
+    if (chunk != NULL && chunk->size >= size) {
+      arena->spare = chunk->next;
+    } else {
+      size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+      chunk = malloc(sizeof(struct ArenaChunk) + capacity);
+      if (chunk == NULL) {
+        fprintf(stderr, "Out of memory while growing an arena\n");
+        return NULL;
+      }
+      chunk->size = capacity;
+      arena->chunk_allocations++;
+      arena->reserved += capacity;
+    }
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    if (arena->chunks == NULL)
+      arena->last = chunk;
+    arena->chunks = chunk;
+  }
+
+  void *memory = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  return memory;
+}
+
+/* Format a string into arena memory. Returns NULL when out of memory. */
+char *arenaPrintf(struct Arena *arena, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if (length < 0)
+    return NULL;
+  char *text = arenaAlloc(arena, length + 1);
+  if (text == NULL)
+    return NULL;
+  va_start(args, format);
+  vsnprintf(text, length + 1, format, args);
+  va_end(args);
+  return text;
+}
+
+/* Free everything allocated from an arena at once, keeping its chunks */
+void arenaReset(struct Arena *arena)
+{
+  if (arena->chunks == NULL)
+    return;
+  arena->last->next = arena->spare;
+  arena->spare = arena->chunks;
+  arena->chunks = NULL;
+  arena->last = NULL;
+}
+/* Append a fixed-size record field as a quoted and escaped JSON string */
+void jsonString(struct Buffer *buffer, const char *text, size_t size)
+{
+  size_t length = strnlen(text, size);
+
+  bufferAppend(buffer, "\"", 1);
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\')
+      bufferPrintf(buffer, "\\%c", c);
+    else if (c < 0x20)
+      bufferPrintf(buffer, "\\u%04x", c);
+    else
+      bufferAppend(buffer, (const char *)&c, 1);
+  }
+  bufferAppend(buffer, "\"", 1);
+}
+
+void jsonCar(struct Buffer *buffer, const struct CarModel *car, const char *branch)
+{
+  bufferAppend(buffer, "{\"model\":", 9);
+  jsonString(buffer, car->model_name, sizeof(car->model_name));
+  bufferAppend(buffer, ",\"company\":", 11);
+  jsonString(buffer, car->company, sizeof(car->company));
+  bufferAppend(buffer, ",\"color\":", 9);
+  jsonString(buffer, car->color, sizeof(car->color));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferPrintf(buffer, ",\"year\":%zu,\"rate\":%.2f,\"capacity\":%zu,"
+               "\"fuel_efficiency\":%.2f,\"available\":%s}",
+               car->year, car->rental_rate, car->passenger_capacity,
+               car->fuel_efficiency, car->available_status ? "true" : "false");
+}
+
+void jsonRental(struct Buffer *buffer, const struct Rental *rental, const char *branch)
+{
+  char time_text[32];
+
+  bufferAppend(buffer, "{\"id\":", 6);
+  jsonString(buffer, rental->rentalID, sizeof(rental->rentalID));
+  bufferAppend(buffer, ",\"username\":", 12);
+  jsonString(buffer, rental->rentingUser.username, sizeof(rental->rentingUser.username));
+  bufferAppend(buffer, ",\"model\":", 9);
+  jsonString(buffer, rental->selectedCar.model_name, sizeof(rental->selectedCar.model_name));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferAppend(buffer, ",\"pickup\":", 10);
+  jsonString(buffer, rental->pickupDate, sizeof(rental->pickupDate));
+  bufferAppend(buffer, ",\"return\":", 10);
+  jsonString(buffer, rental->returnDate, sizeof(rental->returnDate));
+  bufferAppend(buffer, ",\"time\":", 8);
+  jsonString(buffer, rentalTime(rental, time_text, sizeof(time_text)), sizeof(time_text));
+  if (rentalStamped(rental))
+    bufferPrintf(buffer, ",\"rented_at\":%lld", (long long)rental->rented_at);
+  else
+    bufferAppend(buffer, ",\"rented_at\":null", 17);
+  bufferPrintf(buffer, ",\"total\":%.2f}", rental->totalCost);
+}
+
+bool sliceEquals(struct HttpSlice slice, const char *text)
+{
+  return slice.length == strlen(text) && memcmp(slice.data, text, slice.length) == 0;
+}
+
+bool sliceEqualsIgnoreCase(struct HttpSlice slice, const char *text)
+{
+  return slice.length == strlen(text) && strncasecmp(slice.data, text, slice.length) == 0;
+}
+
+/**
+ * Parse one request at the start of a connection's input without copying or
+ * allocating: every field of the request points into the input itself.
+ * Returns 1 for a complete request, 0 when more input is needed and -1 for a
+ * malformed or oversized request.
+ */
+int parseHttpRequest(const char *data, size_t length, struct HttpRequest *request)
+{
+  const char *end = memmem(data, length, "\r\n\r\n", 4);
+  if (end == NULL)
+    return length >= HTTP_BUFFER_SIZE ? -1 : 0;
+
+  size_t header_length = end - data + 4;
+  const char *line_end = memmem(data, header_length, "\r\n", 2);
+  const char *method_end = memchr(data, ' ', line_end - data);
+  if (method_end == NULL)
+    return -1;
+  const char *target_end = memchr(method_end + 1, ' ', line_end - method_end - 1);
+  if (target_end == NULL)
+    return -1;
+
+  struct HttpSlice version = {target_end + 1, line_end - target_end - 1};
+  if (sliceEquals(version, "HTTP/1.1"))
+    request->keep_alive = true;
+  else if (sliceEquals(version, "HTTP/1.0"))
+    request->keep_alive = false;
+  else
+    return -1;
+
+  request->method = (struct HttpSlice){data, method_end - data};
+  const char *target = method_end + 1;
+  const char *query = memchr(target, '?', target_end - target);
+  if (query != NULL) {
+    request->path = (struct HttpSlice){target, query - target};
+    request->query = (struct HttpSlice){query + 1, target_end - query - 1};
+  } else {
+    request->path = (struct HttpSlice){target, target_end - target};
+    request->query = (struct HttpSlice){target_end, 0};
+  }
+
+  size_t content_length = 0;
+  request->num_headers = 0;
+  for (const char *line = line_end + 2; line < end + 2; line = line_end + 2) {
+    line_end = memmem(line, end + 2 - line, "\r\n", 2);
+    const char *colon = memchr(line, ':', line_end - line);
+    if (colon == NULL)
+      return -1;
+
+    const char *value = colon + 1;
+    const char *value_end = line_end;
+    while (value < value_end && (*value == ' ' || *value == '\t'))
+      value++;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+      value_end--;
+    struct HttpHeader header = {{line, colon - line}, {value, value_end - value}};
+
+    if (sliceEqualsIgnoreCase(header.name, "Content-Length")) {
+      for (const char *digit = value; digit < value_end; digit++) {
+        if (!isdigit((unsigned char)*digit) || content_length > HTTP_BUFFER_SIZE)
+          return -1;
+        content_length = content_length * 10 + (*digit - '0');
+      }
+    } else if (sliceEqualsIgnoreCase(header.name, "Connection")) {
+      if (sliceEqualsIgnoreCase(header.value, "close"))
+        request->keep_alive = false;
+      else if (sliceEqualsIgnoreCase(header.value, "keep-alive"))
+        request->keep_alive = true;
+    }
+    if (request->num_headers < HTTP_MAX_HEADERS)
+      request->headers[request->num_headers++] = header;
+  }
+
+  if (header_length + content_length > HTTP_BUFFER_SIZE)
+    return -1;
+  if (length < header_length + content_length)
+    return 0;
+  request->body = (struct HttpSlice){data + header_length, content_length};
+  request->length = header_length + content_length;
+  return 1;
+}
+
+const struct HttpSlice *httpHeader(const struct HttpRequest *request, const char *name)
+{
+  for (size_t i = 0; i < request->num_headers; i++) {
+    if (sliceEqualsIgnoreCase(request->headers[i].name, name))
+      return &request->headers[i].value;
+  }
+  return NULL;
+}
+
+/* Find a URL-encoded parameter and decode its value into the caller's buffer */
+bool httpParamIn(struct HttpSlice params, const char *name, char *value, size_t size)
+{
+  size_t name_length = strlen(name);
+  const char *p = params.data;
+  const char *end = params.data + params.length;
+
+  while (p < end) {
+    const char *pair_end = memchr(p, '&', end - p);
+    if (pair_end == NULL)
+      pair_end = end;
+    const char *equals = memchr(p, '=', pair_end - p);
+    const char *name_end = equals != NULL ? equals : pair_end;
+
+    if ((size_t)(name_end - p) == name_length && memcmp(p, name, name_length) == 0) {
+      size_t length = 0;
+      for (const char *c = equals != NULL ? equals + 1 : pair_end;
+           c < pair_end && length + 1 < size; c++) {
+        if (*c == '+') {
+          value[length++] = ' ';
+        } else if (*c == '%' && pair_end - c > 2 && isxdigit((unsigned char)c[1]) &&
+                   isxdigit((unsigned char)c[2])) {
+          char hex[3] = {c[1], c[2], '\0'};
+          value[length++] = (char)strtol(hex, NULL, 16);
+          c += 2;
+        } else {
+          value[length++] = *c;
+        }
+      }
+      value[length] = '\0';
+      return true;
+    }
+    p = pair_end + 1;
+  }
+  return false;
+}
+
+/* Look a parameter up in the query string, then in a form-encoded body */
+bool httpParam(const struct HttpRequest *request, const char *name, char *value, size_t size)
+{
+  return httpParamIn(request->query, name, value, size) ||
+         httpParamIn(request->body, name, value, size);
+}
+
+/* Decode the credentials of an "Authorization: Basic" header */
+bool httpBasicAuth(const struct HttpRequest *request, char *username, size_t username_size,
+                   char *password, size_t password_size)
+{
+  const struct HttpSlice *header = httpHeader(request, "Authorization");
+  char decoded[64];
+  size_t length = 0;
+  unsigned int bits = 0;
+  int pending = 0;
+
+  if (header == NULL || header->length < 6 || strncasecmp(header->data, "Basic ", 6) != 0)
+    return false;
+
+  for (size_t i = 6; i < header->length && header->data[i] != '='; i++) {
+    char c = header->data[i];
+    int value;
+    if (c >= 'A' && c <= 'Z')
+      value = c - 'A';
+    else if (c >= 'a' && c <= 'z')
+      value = c - 'a' + 26;
+    else if (c >= '0' && c <= '9')
+      value = c - '0' + 52;
+    else if (c == '+')
+      value = 62;
+    else if (c == '/')
+      value = 63;
+    else
+      return false;
+
+    bits = (bits << 6) | value;
+    pending += 6;
+    if (pending >= 8) {
+      pending -= 8;
+      if (length + 1 >= sizeof(decoded))
+        return false;
+      decoded[length++] = (bits >> pending) & 0xff;
+    }
+  }
+  decoded[length] = '\0';
+
+  char *colon = strchr(decoded, ':');
+  if (colon == NULL)
+    return false;
+  *colon = '\0';
+  snprintf(username, username_size, "%s", decoded);
+  snprintf(password, password_size, "%s", colon + 1);
+  return true;
+}
+
+/* Queue a JSON response on the connection */
+void httpRespond(struct HttpConnection *conn, const struct HttpRequest *request,
+                 int status, const struct Buffer *body)
+{
+  const char *reason;
+  bool keep_alive = request != NULL && request->keep_alive && status != 400;
+
+  switch (status) {
+  case 200: reason = "OK"; break;
+  case 201: reason = "Created"; break;
+  case 400: reason = "Bad Request"; break;
+  case 401: reason = "Unauthorized"; break;
+  case 403: reason = "Forbidden"; break;
+  case 404: reason = "Not Found"; break;
+  case 405: reason = "Method Not Allowed"; break;
+  case 409: reason = "Conflict"; break;
+  case 429: reason = "Too Many Requests"; break;
+  case 503: reason = "Service Unavailable"; break;
+  default: reason = "Internal Server Error"; break;
+  }
+
+  bufferPrintf(&conn->out,
+               "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+               "Content-Length: %zu\r\n%s%s%s\r\n",
+               status, reason, body->length,
+               keep_alive ? "" : "Connection: close\r\n",
+               status == 401 ? "WWW-Authenticate: Basic realm=\"CRS\"\r\n" : "",
+               status == 429 || status == 503 ? "Retry-After: 1\r\n" : "");
+  bufferAppend(&conn->out, body->data, body->length);
+  if (!keep_alive)
+    conn->close_after_write = true;
+}
+
+void httpError(struct HttpConnection *conn, const struct HttpRequest *request,
+               int status, const char *message)
+{
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"error\":", 9);
+  jsonString(&http_body, message, strlen(message));
+  bufferAppend(&http_body, "}", 1);
+  httpRespond(conn, request, status, &http_body);
+}
+
+/* Route to the branch named by the "branch" parameter, main by default */
+bool httpSelectBranch(const struct HttpRequest *request)
+{
+  char name[BRANCH_NAME_SIZE];
+
+  if (!httpParam(request, "branch", name, sizeof(name))) {
+    selectBranch(0);
+    return true;
+  }
+  for (size_t i = 0; i < num_branches; i++) {
+    if (strcmp(branches[i].name, name) == 0) {
+      selectBranch(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool findUser(const char *login, const char *password, struct Users *user)
+{
+  struct UserIndex *users = loadUserIndex();
+  const struct KeyIndex *indexes[] = {
+    users ? &users->by_username : NULL, users ? &users->by_number : NULL,
+    users ? &users->by_email : NULL
+  };
+  const size_t offsets[] = {
+    offsetof(struct Users, username), offsetof(struct Users, number),
+    offsetof(struct Users, email)
+  };
+  struct Users candidate;
+  long found = -1;
+
+  if (users == NULL)
+    return false;
+  int fd = open(user_database, O_RDONLY);
+  if (fd < 0)
+    return false;
+  /* The first user in the table that the login and password fit, as before */
+  for (int i = 0; i < 3; i++) {
+    size_t probe = 0;
+    long index;
+    while ((index = nextUser(fd, indexes[i], offsets[i], login, &probe, &candidate)) >= 0) {
+      if ((found < 0 || index < found) && strcmp(password, candidate.password) == 0) {
+        found = index;
+        *user = candidate;
+      }
+    }
+  }
+  close(fd);
+  return found >= 0;
+}
+
+bool findCar(const char *model_name, struct CarModel *car)
+{
+  return findCarIndex(model_name, car) >= 0;
+}
+
+/* GET /cars and GET /availability, for one branch or fanned out over all */
+void httpListCars(struct HttpConnection *conn, const struct HttpRequest *request,
+                  bool available_only)
+{
+  char name[BRANCH_NAME_SIZE];
+  bool all_branches = !httpParam(request, "branch", name, sizeof(name));
+  struct PageCursor page;
+  struct CarModel car;
+  size_t count = 0;
+  size_t limit;
+
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  pageStart(&page, all_branches ? 0 : current_branch);
+  if (!httpPage(conn, request, &page, &limit))
+    return;
+  size_t last = all_branches ? num_branches : current_branch + 1;
+  if (!all_branches && page.branch != current_branch) {
+    httpError(conn, request, 400, "Invalid cursor");
+    return;
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"cars\":[", 9);
+  for (; page.branch < last; pageStart(&page, page.branch + 1)) {
+    selectBranch(page.branch);
+    struct Fleet *fleet = loadFleet();
+    if (fleet == NULL)
+      continue;
+    size_t car_index = fleetPageStart(fleet, &page);
+    for (; car_index < fleet->count && count < limit; car_index++) {
+      if (available_only && !fleet->available[car_index])
+        continue;
+      fleetCar(fleet, car_index, &car);
+      if (count++ > 0)
+        bufferAppend(&http_body, ",", 1);
+      jsonCar(&http_body, &car, branches[current_branch].name);
+      page.after = car_index;
+      page.key = hashKey(car.model_name, sizeof(car.model_name));
+    }
+    /* The page is full before the end of this branch */
+    if (car_index < fleet->count)
+      break;
+  }
+  page.more = page.branch < last;
+  jsonPageEnd(&http_body, count, &page);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/* GET /quote?model=&pickup=&return=[&branch=] */
+void httpQuote(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char model[50], pickup[11], dropoff[11];
+  struct CarModel car;
+
+  if (!httpParam(request, "model", model, sizeof(model)) ||
+      !httpParam(request, "pickup", pickup, sizeof(pickup)) ||
+      !httpParam(request, "return", dropoff, sizeof(dropoff))) {
+    httpError(conn, request, 400, "model, pickup and return are required");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  if (!findCar(model, &car)) {
+    httpError(conn, request, 404, "Unknown car model");
+    return;
+  }
+  int days = calculateRentalDays(pickup, dropoff);
+  if (days < 0) {
+    httpError(conn, request, 400, "Invalid rental dates");
+    return;
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"car\":", 7);
+  jsonCar(&http_body, &car, branches[current_branch].name);
+  bufferPrintf(&http_body, ",\"days\":%d,\"total\":%.2f}", days, car.rental_rate * days);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/* POST /rentals with model, pickup, return and branch, as the Basic-auth user */
+void httpCreateRental(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20], model[50];
+  struct Users user;
+  struct Rental rental;
+
+  if (read_only) {
+    httpError(conn, request, 403, "This is a read-only replica");
+    return;
+  }
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_RENTAL, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many rental attempts");
+    return;
+  }
+  if (!findUser(login, password, &user)) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+
+  memset(&rental, 0, sizeof(rental));
+  if (!httpParam(request, "model", model, sizeof(model)) ||
+      !httpParam(request, "pickup", rental.pickupDate, sizeof(rental.pickupDate)) ||
+      !httpParam(request, "return", rental.returnDate, sizeof(rental.returnDate))) {
+    httpError(conn, request, 400, "model, pickup and return are required");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  if (!findCar(model, &rental.selectedCar)) {
+    httpError(conn, request, 404, "Unknown car model");
+    return;
+  }
+  if (!rental.selectedCar.available_status) {
+    httpError(conn, request, 409, "The car is not available");
+    return;
+  }
+  int days = calculateRentalDays(rental.pickupDate, rental.returnDate);
+  if (days < 0) {
+    httpError(conn, request, 400, "Invalid rental dates");
+    return;
+  }
+
+  rental.totalCost = rental.selectedCar.rental_rate * days;
+  char *uniqueID = generateUniqueRentalID("R");
+  if (uniqueID == NULL) {
+    httpError(conn, request, 503, "The rental could not be recorded, please retry");
+    return;
+  }
+  snprintf(rental.rentalID, sizeof(rental.rentalID), "%s", uniqueID);
+  if (commitRental(&user, &rental, NOTIFY_RENTAL_CONFIRMED) != 0) {
+    httpError(conn, request, 409, "The car is not available");
+    return;
+  }
+
+  http_body.length = 0;
+  jsonRental(&http_body, &rental, branches[current_branch].name);
+  httpRespond(conn, request, 201, &http_body);
+}
+
+/* GET /users/<username>/rentals, as that user */
+void httpUserRentals(struct HttpConnection *conn, const struct HttpRequest *request,
+                     struct HttpSlice username)
+{
+  char login[20], password[20];
+  struct Users user;
+  struct PageCursor page;
+  size_t count = 0;
+  size_t limit;
+
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  pageStart(&page, 0);
+  if (!httpPage(conn, request, &page, &limit))
+    return;
+  if (!rateLimitAllow(RATE_LIMIT_LOGIN, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many attempts");
+    return;
+  }
+  if (!findUser(login, password, &user) || !sliceEquals(username, user.username)) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"rentals\":[", 12);
+  for (; page.branch < num_branches; pageStart(&page, page.branch + 1)) {
+    size_t found;
+    selectBranch(page.branch);
+    struct Rental *rentals = findUserRentals(user.username, &page, limit - count, &found);
+    for (size_t j = 0; rentals != NULL && j < found; j++) {
+      if (count++ > 0)
+        bufferAppend(&http_body, ",", 1);
+      jsonRental(&http_body, &rentals[j], branches[page.branch].name);
+    }
+    if (page.more)
+      break;
+  }
+  page.more = page.branch < num_branches;
+  jsonPageEnd(&http_body, count, &page);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/* GET /metrics: admission control, overload and rate limiting counters */
+void httpMetrics(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"classes\":{", 12);
+  for (int i = 0; i < NUM_REQUEST_CLASSES; i++) {
+    const struct RequestMetrics *metrics = &request_metrics[i];
+    bufferPrintf(&http_body,
+                 "%s\"%s\":{\"admitted\":%zu,\"deferred\":%zu,\"rejected\":%zu,"
+                 "\"completed\":%zu,\"in_flight\":%zu,\"latency_ms\":%.3f,"
+                 "\"max_latency_ms\":%.3f}",
+                 i > 0 ? "," : "", request_class_names[i], metrics->admitted,
+                 metrics->deferred, metrics->rejected, metrics->completed,
+                 metrics->in_flight, metrics->latency_ewma * 1000,
+                 metrics->latency_max * 1000);
+  }
+  bufferPrintf(&http_body, "},\"overloaded\":%s,\"rate_limited\":%zu,"
+               "\"arena_bytes\":%zu,\"arena_chunk_allocations\":%zu,"
+               "\"timers_pending\":%zu,\"timers_fired\":%zu,\"overdue_rentals\":%zu}",
+               rentalsOverloaded() ? "true" : "false", rate_limited_requests,
+               request_arena.reserved, request_arena.chunk_allocations,
+               timer_wheel.pending, timer_wheel.fired, overdue_rentals);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/**
+ * Route one request, subject to admission control.
+ * Returns false when the request was deferred; it then stays in the input
+ * buffer and is retried on a later pass of the event loop.
+ */
+bool handleHttpRequest(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  enum { ROUTE_CARS, ROUTE_AVAILABILITY, ROUTE_QUOTE, ROUTE_RENTALS,
+         ROUTE_RENTAL_LOG, ROUTE_RETURNS, ROUTE_STOCK, ROUTE_USER_RENTALS,
+         ROUTE_EXPORT_RENTALS, ROUTE_EVENTS, ROUTE_METRICS, ROUTE_RENTAL,
+         ROUTE_BOOKINGS } route;
+  struct HttpSlice username = {NULL, 0};
+  struct HttpSlice rentalID = {NULL, 0};
+  int request_class = REQUEST_QUERY;
+  bool method_allowed = sliceEquals(request->method, "GET");
+
+  if (sliceEquals(request->path, "/cars")) {
+    route = ROUTE_CARS;
+    request_class = REQUEST_REPORT;
+  } else if (sliceEquals(request->path, "/availability")) {
+    route = ROUTE_AVAILABILITY;
+  } else if (sliceEquals(request->path, "/quote")) {
+    route = ROUTE_QUOTE;
+  } else if (sliceEquals(request->path, "/returns")) {
+    route = ROUTE_RETURNS;
+    request_class = REQUEST_RENTAL;
+    method_allowed = sliceEquals(request->method, "POST");
+  } else if (sliceEquals(request->path, "/stock")) {
+    route = ROUTE_STOCK;
+  } else if (sliceEquals(request->path, "/rentals")) {
+    bool listing = sliceEquals(request->method, "GET");
+    route = listing ? ROUTE_RENTAL_LOG : ROUTE_RENTALS;
+    request_class = listing ? REQUEST_REPORT : REQUEST_RENTAL;
+    method_allowed = listing || sliceEquals(request->method, "POST");
+  } else if (request->path.length > 9 && memcmp(request->path.data, "/rentals/", 9) == 0) {
+    route = ROUTE_RENTAL;
+    request_class = REQUEST_RENTAL;
+    rentalID = (struct HttpSlice){request->path.data + 9, request->path.length - 9};
+    method_allowed = sliceEquals(request->method, "POST") ||
+                     sliceEquals(request->method, "DELETE");
+  } else if (sliceEquals(request->path, "/bookings")) {
+    route = ROUTE_BOOKINGS;
+    request_class = REQUEST_RENTAL;
+    method_allowed = sliceEquals(request->method, "POST");
+  } else if (sliceEquals(request->path, "/export/rentals")) {
+    route = ROUTE_EXPORT_RENTALS;
+    request_class = REQUEST_REPORT;
+  } else if (sliceEquals(request->path, "/events")) {
+    route = ROUTE_EVENTS;
+    request_class = REQUEST_REPORT;
+  } else if (sliceEquals(request->path, "/metrics")) {
+    route = ROUTE_METRICS;
+  } else if (request->path.length > 15 &&
+             memcmp(request->path.data, "/users/", 7) == 0 &&
+             memcmp(request->path.data + request->path.length - 8, "/rentals", 8) == 0) {
+    route = ROUTE_USER_RENTALS;
+    username = (struct HttpSlice){request->path.data + 7, request->path.length - 15};
+  } else {
+    httpError(conn, request, 404, "Not found");
+    return true;
+  }
+  if (!method_allowed) {
+    httpError(conn, request, 405, "Method not allowed");
+    return true;
+  }
+
+  /* Metrics must stay readable while the server sheds load */
+  if (route == ROUTE_METRICS) {
+    httpMetrics(conn, request);
+    return true;
+  }
+
+  int decision = admitRequest(request_class);
+  if (decision == ADMIT_DEFER && conn->deferrals < ADMISSION_DEFER_RETRIES) {
+    conn->deferrals++;
+    return false;
+  }
+  conn->deferrals = 0;
+  if (decision != ADMIT_ACCEPT) {
+    if (decision == ADMIT_DEFER)
+      request_metrics[request_class].rejected++;
+    httpError(conn, request, 503, "The system is busy, please retry");
+    return true;
+  }
+
+  double started = monotonicSeconds();
+  switch (route) {
+  case ROUTE_CARS:
+    httpListCars(conn, request, false);
+    break;
+  case ROUTE_AVAILABILITY:
+    httpListCars(conn, request, true);
+    break;
+  case ROUTE_QUOTE:
+    httpQuote(conn, request);
+    break;
+  case ROUTE_RENTALS:
+    httpCreateRental(conn, request);
+    break;
+  case ROUTE_RENTAL_LOG:
+    httpRentalLog(conn, request);
+    break;
+  case ROUTE_RENTAL:
+    httpChangeRental(conn, request, rentalID);
+    break;
+  case ROUTE_BOOKINGS:
+    httpBookGroup(conn, request);
+    break;
+  case ROUTE_STOCK:
+    httpStock(conn, request);
+    break;
+  case ROUTE_RETURNS:
+    httpCheckIn(conn, request);
+    break;
+  case ROUTE_USER_RENTALS:
+    httpUserRentals(conn, request, username);
+    break;
+  case ROUTE_EXPORT_RENTALS:
+    httpExportRentals(conn, request);
+    break;
+  case ROUTE_EVENTS:
+    httpEvents(conn, request);
+    break;
+  case ROUTE_METRICS:
+    break;
+  }
+  completeRequest(request_class, monotonicSeconds() - started);
+  return true;
+}
+
+/**
+ * Serve every complete request in a connection's input, in order, so that
+ * pipelined requests are answered without waiting for another read. Reading
+ * stops while too much output is waiting for a slow client.
+ */
+void processHttpInput(struct HttpConnection *conn)
+{
+  struct HttpRequest request;
+  size_t offset = 0;
+
+  /* Responses to pipelined requests wait until a streamed file is sent */
+  while (!conn->close_after_write && conn->file < 0 && !conn->subscribed &&
+         conn->out.length - conn->out_sent < HTTP_MAX_PENDING_OUTPUT) {
+    int parsed = parseHttpRequest(conn->in + offset, conn->in_length - offset, &request);
+    if (parsed == 0)
+      break;
+    if (parsed < 0) {
+      httpError(conn, NULL, 400, "Malformed or oversized request");
+      break;
+    }
+    bool handled = handleHttpRequest(conn, &request);
+    arenaReset(&request_arena);
+    if (!handled)
+      break;
+    offset += request.length;
+  }
+
+  memmove(conn->in, conn->in + offset, conn->in_length - offset);
+  conn->in_length -= offset;
+}
+
+/* Send queued output. Returns false when the connection has failed. */
+bool flushHttpOutput(struct HttpConnection *conn)
+{
+  while (conn->out_sent < conn->out.length) {
+    ssize_t sent = send(conn->fd, conn->out.data + conn->out_sent,
+                        conn->out.length - conn->out_sent, MSG_NOSIGNAL);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    conn->out_sent += sent;
+  }
+  conn->out.length = 0;
+  conn->out_sent = 0;
+
+  /* A streamed file follows its headers straight from the page cache */
+  while (conn->file >= 0 && conn->file_offset < conn->file_end) {
+    ssize_t sent = streamFile(conn->file, conn->file_offset,
+                              conn->file_end - conn->file_offset, conn->fd);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (sent == 0)
+      return false;
+    conn->file_offset += sent;
+  }
+  if (conn->file >= 0) {
+    close(conn->file);
+    conn->file = -1;
+  }
+  return true;
+}
+
+void closeHttpConnection(struct HttpConnection **slot)
+{
+  close((*slot)->fd);
+  if ((*slot)->file >= 0)
+    close((*slot)->file);
+  free((*slot)->out.data);
+  free(*slot);
+  *slot = NULL;
+}
+
+/* Open a non-blocking TCP listener on a port. Returns the socket, or -1 on error. */
+int openListener(int port)
+{
+  struct sockaddr_in address;
+  int enable = 1;
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    fprintf(stderr, "Error creating a socket: %s\n", strerror(errno));
+    return -1;
+  }
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, 512) != 0) {
+    fprintf(stderr, "Error listening on port %d: %s\n", port, strerror(errno));
+    close(listener);
+    return -1;
+  }
+  fcntl(listener, F_SETFL, O_NONBLOCK);
+  return listener;
+}
+
+/**
+ * Serve the JSON API on the given port.
+ * A single thread multiplexes every connection with poll(). Connections are
+ * kept alive between requests and pipelined requests are answered in order.
+ */
+void serveHttp(int port)
+{
+  static struct HttpConnection *connections[HTTP_MAX_CONNECTIONS];
+  static struct pollfd fds[HTTP_MAX_CONNECTIONS + 1];
+  static int slots[HTTP_MAX_CONNECTIONS + 1];
+  int enable = 1;
+
+  int listener = openListener(port);
+  if (listener < 0)
+    return;
+  printf("Serving the HTTP API on port %d\n", port);
+  fflush(stdout);
+  signal(SIGINT, handleStopSignal);
+  signal(SIGTERM, handleStopSignal);
+
+  while (!stop_requested) {
+    size_t num_connections = 0;
+    bool deferred = false;
+    bool subscribers = false;
+    nfds_t nfds = 1;
+
+    for (size_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+      struct HttpConnection *conn = connections[i];
+      if (conn == NULL)
+        continue;
+      num_connections++;
+      deferred = deferred || conn->deferrals > 0;
+      subscribers = subscribers || conn->subscribed;
+      fds[nfds].fd = conn->fd;
+      fds[nfds].events = 0;
+      if (conn->out_sent < conn->out.length || conn->file >= 0)
+        fds[nfds].events |= POLLOUT;
+      /* Backpressure: stop reading from clients that do not read their responses */
+      if (!conn->close_after_write &&
+          conn->out.length - conn->out_sent < HTTP_MAX_PENDING_OUTPUT &&
+          conn->in_length < HTTP_BUFFER_SIZE)
+        fds[nfds].events |= POLLIN;
+      slots[nfds++] = i;
+    }
+    fds[0].fd = listener;
+    fds[0].events = num_connections < HTTP_MAX_CONNECTIONS ? POLLIN : 0;
+
+    /* Subscribers are sent changes committed by any process, so the logs are polled */
+    int timeout = deferred ? ADMISSION_DEFER_US / 1000 :
+                  subscribers ? EVENT_POLL_MS : timerPollTimeout();
+    if (poll(fds, nfds, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Error polling connections: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      struct sockaddr_in peer;
+      socklen_t peer_length = sizeof(peer);
+      int fd;
+      size_t slot = 0;
+      while ((fd = accept(listener, (struct sockaddr *)&peer, &peer_length)) >= 0) {
+        while (slot < HTTP_MAX_CONNECTIONS && connections[slot] != NULL)
+          slot++;
+        struct HttpConnection *conn = slot < HTTP_MAX_CONNECTIONS ?
+                                      calloc(1, sizeof(struct HttpConnection)) : NULL;
+        if (conn == NULL) {
+          close(fd);
+          break;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        conn->fd = fd;
+        conn->file = -1;
+        inet_ntop(AF_INET, &peer.sin_addr, conn->peer, sizeof(conn->peer));
+        connections[slot] = conn;
+        peer_length = sizeof(peer);
+      }
+    }
+
+    /* Connections with input to serve form the queue seen by admission control */
+    queued_requests = 0;
+    for (nfds_t i = 1; i < nfds; i++) {
+      if ((fds[i].revents & POLLIN) || connections[slots[i]]->deferrals > 0)
+        queued_requests++;
+    }
+
+    for (nfds_t i = 1; i < nfds; i++) {
+      struct HttpConnection **slot = &connections[slots[i]];
+      struct HttpConnection *conn = *slot;
+      bool readable = fds[i].revents & POLLIN;
+
+      if (readable || conn->deferrals > 0)
+        queued_requests--;
+      if (readable) {
+        ssize_t received = recv(conn->fd, conn->in + conn->in_length,
+                                HTTP_BUFFER_SIZE - conn->in_length, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+          closeHttpConnection(slot);
+          continue;
+        }
+        if (received > 0)
+          conn->in_length += received;
+      } else if (fds[i].revents & (POLLERR | POLLHUP)) {
+        closeHttpConnection(slot);
+        continue;
+      }
+
+      bool streaming = conn->file >= 0;
+      if (readable || conn->deferrals > 0)
+        processHttpInput(conn);
+      if (conn->subscribed)
+        pushEvents(conn);
+      bool flushed = flushHttpOutput(conn);
+      /* Requests that arrived behind a streamed file are served once it is sent */
+      if (flushed && streaming && conn->file < 0 && conn->in_length > 0) {
+        processHttpInput(conn);
+        flushed = flushHttpOutput(conn);
+      }
+      if (!flushed ||
+          (conn->close_after_write && conn->out_sent == conn->out.length && conn->file < 0)) {
+        closeHttpConnection(slot);
+      }
+    }
+    runTimers();
+  }
+  close(listener);
+}
+
+/* Whether a yes/no answer is yes */
+bool isYes(const char *line)
+{
+  return strcmp(line, "yes") == 0 || strcmp(line, "Yes") == 0 ||
+         strcmp(line, "YES") == 0;
+}
+
+/* Parse a whole line as an integer. Returns false if it holds anything else. */
+bool parseLong(const char *line, long *value)
+{
+  char *end;
+
+  errno = 0;
+  *value = strtol(line, &end, 10);
+  while (isspace((unsigned char)*end))
+    end++;
+  return end != line && *end == '\0' && errno == 0;
+}
+
+/* Parse a whole line as a decimal number. Returns false if it holds anything else. */
+bool parseDouble(const char *line, double *value)
+{
+  char *end;
+
+  errno = 0;
+  *value = strtod(line, &end);
+  while (isspace((unsigned char)*end))
+    end++;
+  return end != line && *end == '\0' && errno == 0;
+}
+
+/* Set one of the fields of a user, numbered as in the update menu */
+void setUserField(struct Users *user, int field, const char *value)
+{
+  switch (field) {
+  case 1:
+    snprintf(user->fullname, sizeof(user->fullname), "%s", value);
+    break;
+  case 2:
+    snprintf(user->address, sizeof(user->address), "%s", value);
+    break;
+  case 3:
+    snprintf(user->number, sizeof(user->number), "%s", value);
+    break;
+  case 4:
+    snprintf(user->email, sizeof(user->email), "%s", value);
+    break;
+  case 5:
+    snprintf(user->username, sizeof(user->username), "%s", value);
+    break;
+  case 6:
+    snprintf(user->password, sizeof(user->password), "%s", value);
+    break;
+  }
+}
+
+/**
+ * Set one of the fields of a car, numbered as in the update menu.
+ * Returns false if a numeric field is given something that is not a number.
+ */
+bool setCarField(struct CarModel *car, int field, const char *value)
+{
+  long number;
+  double decimal;
+
+  switch (field) {
+  case 1:
+    snprintf(car->model_name, sizeof(car->model_name), "%s", value);
+    break;
+  case 2:
+    snprintf(car->company, sizeof(car->company), "%s", value);
+    break;
+  case 3:
+  case 5:
+    if (!parseLong(value, &number) || number < 0)
+      return false;
+    if (field == 3)
+      car->year = number;
+    else
+      car->passenger_capacity = number;
+    break;
+  case 4:
+  case 6:
+    if (!parseDouble(value, &decimal) || decimal < 0)
+      return false;
+    if (field == 4)
+      car->rental_rate = decimal;
+    else
+      car->fuel_efficiency = decimal;
+    break;
+  case 7:
+    snprintf(car->color, sizeof(car->color), "%s", value);
+    break;
+  case 8:
+    if (!parseLong(value, &number))
+      return false;
+    car->available_status = number != 0;
+    break;
+  }
+  return true;
+}
+
+/**
+ * Start a new session at the main menu, showing it on term. The first screen
+ * is sent by sessionRender(), once the driver has set the terminal's size.
+ * Returns 0 on success and -1 when out of memory.
+ */
+int sessionStart(struct Session *session, FILE *term, const char *source)
+{
+  cookie_io_functions_t output = {.write = writeToBuffer};
+
+  memset(session, 0, sizeof(struct Session));
+  session->out = fopencookie(&session->step, "w", output);
+  if (session->out == NULL)
+    return -1;
+  session->term = term;
+  session->state = STATE_MAIN_MENU;
+  session->mask_echo = '*';
+  session->screen.rows = SCREEN_DEFAULT_ROWS;
+  session->screen.columns = SCREEN_DEFAULT_COLUMNS;
+  snprintf(session->source, sizeof(session->source), "%s", source);
+  sessionPrompt(session);
+  return 0;
+}
+
+/* Release what a session holds */
+void sessionEnd(struct Session *session)
+{
+  fclose(session->out);
+  free(session->step.data);
+  free(session->frame.data);
+  free(session->screen.text.data);
+}
+
+/* Use a new terminal size; the next frame is drawn from scratch */
+void sessionResize(struct Session *session, int rows, int columns)
+{
+  if (rows < 2 || columns < 1)
+    return;
+  session->screen.rows = rows;
+  session->screen.columns = columns;
+  session->screen.valid = false;
+}
+
+/**
+ * Show the output of the current step. The step's output follows what is
+ * already on screen, unless it starts a new page with CLEAN_SCREEN(); then
+ * the page replaces the screen, and whatever the step printed before the
+ * page is shown above the page's prompt. Only the difference to the
+ * terminal's current content is sent.
+ */
+void sessionRender(struct Session *session)
+{
+  struct Buffer *step = &session->step;
+  struct Buffer *frame = &session->frame;
+  struct Screen *screen = &session->screen;
+
+  fflush(session->out);
+  frame->length = 0;
+  const char *page = step->length ? memrchr(step->data, '\f', step->length) : NULL;
+  if (page == NULL) {
+    bufferAppend(frame, screen->text.data, screen->text.length);
+    bufferAppend(frame, step->data, step->length);
+  } else {
+    const char *view = page + 1;
+    const char *end = step->data + step->length;
+    const char *prompt = memrchr(view, '\n', end - view);
+    prompt = prompt != NULL ? prompt + 1 : view;
+
+    bufferAppend(frame, view, prompt - view);
+    size_t messages = frame->length;
+    for (const char *c = step->data; c < page; c++) {
+      if (*c != '\f')
+        bufferAppend(frame, c, 1);
+    }
+    if (frame->length > messages && frame->data[frame->length - 1] != '\n')
+      bufferAppend(frame, "\n", 1);
+    bufferAppend(frame, prompt, end - prompt);
+  }
+  step->length = 0;
+  screenRender(screen, frame->data, frame->length, session->term);
+}
+
+/**
+ * Feed one line of input to a session. The line is handled by the session's
+ * current state, which prints any result, moves to the next state and
+ * prompts for the next line, then the screen is brought up to date.
+ * Nothing blocks: a request deferred by admission control leaves the
+ * session in its state with deferred set, and the driver feeds the same
+ * line again later.
+ */
+void sessionInput(struct Session *session, const char *input)
+{
+  char line[SESSION_LINE_SIZE];
+  bool masked = session->masked;
+  size_t length = 0;
+
+  /* Control characters would reach other terminals as commands */
+  for (size_t i = 0; input[i] != '\0' && length < sizeof(line) - 1; i++) {
+    if (!iscntrl((unsigned char)input[i]))
+      line[length++] = input[i];
+  }
+  line[length] = '\0';
+
+  /* Sessions share the process, so route to this session's branch */
+  selectBranch(session->branch < num_branches ? session->branch : 0);
+  session->deferred = false;
+  session->masked = false;
+
+  /* A line asking for the next page of a listing is not for the state */
+  if (!sessionNextPage(session, line))
+    sessionDispatch(session, line);
+
+  session->branch = current_branch;
+  if (!session->deferred) {
+    screenEcho(&session->screen, line, masked, session->mask_echo);
+    sessionPrompt(session);
+    sessionRender(session);
+  }
+  arenaReset(&request_arena);
+}
+
+/* Hand a line of input to the handler of the session's state */
+void sessionDispatch(struct Session *session, const char *line)
+{
+  switch (session->state) {
+  case STATE_MAIN_MENU:
+    sessionMainMenu(session, line);
+    break;
+  case STATE_REGISTER_FIELD:
+  case STATE_REGISTER_REVIEW:
+  case STATE_REGISTER_NUMBER:
+  case STATE_REGISTER_USERNAME:
+  case STATE_REGISTER_PASSWORD:
+  case STATE_REGISTER_VERIFY:
+  case STATE_REGISTER_DONE:
+    sessionRegister(session, line);
+    break;
+  case STATE_LOGIN_NAME:
+  case STATE_LOGIN_PASSWORD:
+  case STATE_LOGIN_RETRY:
+    sessionLogin(session, line);
+    break;
+  case STATE_USER_MENU:
+    sessionUserMenu(session, line);
+    break;
+  case STATE_RENT_BRANCH:
+  case STATE_RENT_SELECT:
+  case STATE_RENT_PICKUP:
+  case STATE_RENT_RETURN:
+  case STATE_RENT_CONFIRM:
+  case STATE_CHANGE_RENTAL:
+  case STATE_CHANGE_RENTAL_DATE:
+  case STATE_WAITLIST_JOIN:
+  case STATE_WAITLIST_MODEL:
+  case STATE_WAITLIST_PICKUP:
+  case STATE_WAITLIST_RETURN:
+    sessionRent(session, line);
+    break;
+  case STATE_EDIT_USER_FIELD:
+  case STATE_EDIT_USER_VALUE:
+    sessionEditUser(session, line);
+    break;
+  case STATE_ADMIN_NAME:
+  case STATE_ADMIN_PASSWORD:
+  case STATE_ADMIN_MENU:
+  case STATE_ADMIN_LOG_CHOICE:
+  case STATE_ADMIN_LOG_USER:
+  case STATE_ADMIN_BRANCH:
+  case STATE_ADMIN_ADD_BRANCH:
+  case STATE_ADMIN_WAITLIST:
+  case STATE_ADMIN_WAITLIST_ENTRY:
+  case STATE_ADMIN_WAITLIST_PRIORITY:
+  case STATE_ADMIN_CHECK_IN:
+  case STATE_ADMIN_CHECK_IN_DATE:
+    sessionAdmin(session, line);
+    break;
+  case STATE_ADMIN_CARS:
+  case STATE_ADMIN_UPDATE_CAR:
+  case STATE_EDIT_CAR_FIELD:
+  case STATE_EDIT_CAR_VALUE:
+  case STATE_ADMIN_REMOVE_CAR:
+  case STATE_ADD_CAR:
+  case STATE_ADD_UNIT_MODEL:
+  case STATE_ADD_UNIT_PLATE:
+  case STATE_UNIT_PLATE:
+  case STATE_UNIT_STATUS:
+    sessionAdminCars(session, line);
+    break;
+  case STATE_ADMIN_USERS:
+  case STATE_ADMIN_UPDATE_USER:
+  case STATE_ADMIN_REMOVE_USER:
+    sessionAdminUsers(session, line);
+    break;
+  }
+}
+
+/* Print what the session's current state asks for */
+void sessionPrompt(struct Session *session)
+{
+  static const char *register_prompts[] = {
+    NULL, "Full Name: ", "Address: ", "Contact Number: ", "Email Address: "
+  };
+  static const char *user_prompts[] = {
+    NULL, "Enter New Full Name: ", "Enter New Address: ", "Enter New Number: ",
+    "Enter New Email: ", "Enter New Username: ", "Enter New Password: "
+  };
+  static const char *car_prompts[] = {
+    NULL, "Enter Car Model Name: ", "Enter Car Company: ",
+    "Enter Year of Manufacture: ", "Enter Rental Rate per Day: ",
+    "Enter Passenger Capacity: ", "Enter Fuel Efficiency (MPG): ",
+    "Enter Car Color: ",
+    "Enter Available Staus (1 for available / 0 for not available): "
+  };
+  FILE *out = session->out;
+  struct Users *form = &session->form;
+
+  switch (session->state) {
+  case STATE_MAIN_MENU:
+    CLEAN_SCREEN(out);
+    fprintf(out, "=== Car Rental System ===\n");
+    fprintf(out, "1. User Registration\n");
+    fprintf(out, "2. User Login\n");
+    fprintf(out, "3. Admin Login\n");
+    fprintf(out, "4. Exit\n");
+    fprintf(out, "\nEnter your choice: ");
+    break;
+  case STATE_REGISTER_FIELD:
+    fprintf(out, "%s", register_prompts[session->field]);
+    break;
+  case STATE_REGISTER_REVIEW:
+    fprintf(out, "Review Your Information:\n");
+    fprintf(out, "Full Name: %s\n", form->fullname);
+    fprintf(out, "Address: %s\n", form->address);
+    fprintf(out, "Contact Number: %s\n", form->number);
+    fprintf(out, "Email : %s\n", form->email);
+    fprintf(out, "Choose a field to change\n");
+    fprintf(out, "(F)ull Name, (A)ddress, (N)umber, (E)mail, (O)kay : ");
+    break;
+  case STATE_REGISTER_NUMBER:
+    fprintf(out, "Re-enter Contact Number : ");
+    break;
+  case STATE_REGISTER_USERNAME:
+    fprintf(out, "Enter New Username: ");
+    break;
+  case STATE_REGISTER_PASSWORD:
+    fprintf(out, "Enter New Password: ");
+    session->masked = true;
+    break;
+  case STATE_REGISTER_VERIFY:
+    fprintf(out, "\nRetype the password for verification: ");
+    session->masked = true;
+    break;
+  case STATE_REGISTER_DONE:
+    fprintf(out, "\nPress Enter to return to the menu!\n");
+    break;
+  case STATE_LOGIN_NAME:
+    CLEAN_SCREEN(out);
+    fprintf(out, "=== User Login ===\n");
+    fprintf(out, "Please enter your Username, Contact Number, or Email: ");
+    break;
+  case STATE_LOGIN_PASSWORD:
+    fprintf(out, "Please enter your Password: ");
+    session->masked = true;
+    break;
+  case STATE_LOGIN_RETRY:
+    fprintf(out, "\nDo you want to login again ? (yes/no) : ");
+    break;
+  case STATE_USER_MENU:
+    CLEAN_SCREEN(out);
+    fprintf(out, "\n1. View Available Car Models\n");
+    fprintf(out, "2. Rent a Car\n");
+    fprintf(out, "3. View Rental History\n");
+    fprintf(out, "4. Account Settings\n");
+    fprintf(out, "5. Change or Cancel a Rental\n");
+    fprintf(out, "6. Logout\n");
+    fprintf(out, "\nEnter your choice: ");
+    break;
+  case STATE_RENT_BRANCH:
+  case STATE_ADMIN_BRANCH:
+    listBranches(out);
+    fprintf(out, "Select the branch : ");
+    break;
+  case STATE_RENT_SELECT:
+    fprintf(out, "\nEnter the index of the car you want to rent (0 to cancel): ");
+    break;
+  case STATE_RENT_PICKUP:
+  case STATE_WAITLIST_PICKUP:
+    fprintf(out, "Enter Pickup Date (YYYY-MM-DD): ");
+    break;
+  case STATE_RENT_RETURN:
+  case STATE_WAITLIST_RETURN:
+    fprintf(out, "Enter Return Date (YYYY-MM-DD): ");
+    break;
+  case STATE_RENT_CONFIRM:
+    fprintf(out, "Confirm rental? (yes/no): ");
+    break;
+  case STATE_CHANGE_RENTAL:
+    fprintf(out, "\nEnter the Rental ID: ");
+    break;
+  case STATE_CHANGE_RENTAL_DATE:
+    fprintf(out, "Enter the new Return Date (YYYY-MM-DD), or 'cancel' to cancel the rental: ");
+    break;
+  case STATE_WAITLIST_JOIN:
+    fprintf(out, "Would you like to join the waitlist? (yes/no): ");
+    break;
+  case STATE_WAITLIST_MODEL:
+    fprintf(out, "Enter the model name you are waiting for (or 'any'): ");
+    break;
+  case STATE_EDIT_USER_FIELD:
+    fprintf(out, "Select the field to update:\n");
+    fprintf(out, "1. Full Name\n");
+    fprintf(out, "2. Address\n");
+    fprintf(out, "3. Phone Number\n");
+    fprintf(out, "4. Email\n");
+    fprintf(out, "5. Username\n");
+    fprintf(out, "6. Password\n");
+    fprintf(out, "\nEnter your choice: ");
+    break;
+  case STATE_EDIT_USER_VALUE:
+    fprintf(out, "%s", user_prompts[session->field]);
+    session->masked = session->field == 6;
+    break;
+  case STATE_ADMIN_NAME:
+    CLEAN_SCREEN(out);
+    fprintf(out, "Enter Admin Username : ");
+    break;
+  case STATE_ADMIN_PASSWORD:
+    fprintf(out, "Enter Admin Password : ");
+    session->masked = true;
+    break;
+  case STATE_ADMIN_MENU:
+    CLEAN_SCREEN(out);
+    fprintf(out, "\nAdmin Dashboard (branch: %s)", branches[current_branch].name);
+    if (read_only)
+      showReplicationStatus(out);
+    fprintf(out, "\n1. View Cars");
+    fprintf(out, "\n2. Manage Cars");
+    fprintf(out, "\n3. View Users");
+    fprintf(out, "\n4. Manage Users");
+    fprintf(out, "\n5. Rental Log");
+    fprintf(out, "\n6. Select Branch");
+    fprintf(out, "\n7. Add Branch");
+    fprintf(out, "\n8. Waitlist and Demand");
+    fprintf(out, "\n9. System Metrics");
+    fprintf(out, "\n10. Check In Rental");
+    fprintf(out, "\n11. Exit");
+    fprintf(out, "\nChoose the option : ");
+    break;
+  case STATE_ADMIN_LOG_CHOICE:
+    fprintf(out, "Do you want to see a specific users log ? (yes/no) : ");
+    break;
+  case STATE_ADMIN_LOG_USER:
+    fprintf(out, "Enter the specific user's username : ");
+    break;
+  case STATE_ADMIN_ADD_BRANCH:
+    fprintf(out, "\nEnter the new branch name : ");
+    break;
+  case STATE_ADMIN_WAITLIST:
+    fprintf(out, "\n1. Change request priority");
+    fprintf(out, "\n2. Return to main menu");
+    fprintf(out, "\nChoose the option : ");
+    break;
+  case STATE_ADMIN_WAITLIST_ENTRY:
+    fprintf(out, "\nEnter the entry number : ");
+    break;
+  case STATE_ADMIN_WAITLIST_PRIORITY:
+    fprintf(out, "Enter the new priority (higher is served first) : ");
+    break;
+  case STATE_ADMIN_CHECK_IN:
+    fprintf(out, "\nEnter the Rental ID : ");
+    break;
+  case STATE_ADMIN_CHECK_IN_DATE:
+    fprintf(out, "Enter the return date (YYYY-MM-DD, empty for today) : ");
+    break;
+  case STATE_ADMIN_CARS:
+    CLEAN_SCREEN(out);
+    fprintf(out, "\nBranch: %s", branches[current_branch].name);
+    if (session->listing != LISTING_BRANCH_CARS)
+      sessionStartListing(session, LISTING_BRANCH_CARS, NULL);
+    sessionShowPage(session);
+    fprintf(out, "\n1. Update Cars");
+    fprintf(out, "\n2. Remove Cars");
+    fprintf(out, "\n3. Add Cars");
+    fprintf(out, "\n4. Add Unit");
+    fprintf(out, "\n5. Set Unit Status");
+    fprintf(out, "\n6. Return to main menu");
+    fprintf(out, "\nChoose the option : ");
+    break;
+  case STATE_ADMIN_UPDATE_CAR:
+    fprintf(out, "\nEnter the Model name : ");
+    break;
+  case STATE_EDIT_CAR_FIELD:
+    fprintf(out, "Select the field to update:\n");
+    fprintf(out, "1. Model Name\n");
+    fprintf(out, "2. Company\n");
+    fprintf(out, "3. Year\n");
+    fprintf(out, "4. Rental Rate\n");
+    fprintf(out, "5. Passenger Capacity\n");
+    fprintf(out, "6. Fuel Efficiency\n");
+    fprintf(out, "7. Color\n");
+    fprintf(out, "8. Available Status\n");
+    fprintf(out, "\nEnter your choice: ");
+    break;
+  case STATE_EDIT_CAR_VALUE:
+  case STATE_ADD_CAR:
+    fprintf(out, "%s", car_prompts[session->field]);
+    break;
+  case STATE_ADMIN_REMOVE_CAR:
+    fprintf(out, "Enter the index of the model you want to remove : ");
+    break;
+  case STATE_ADD_UNIT_MODEL:
+    fprintf(out, "\nEnter the Model name of the unit : ");
+    break;
+  case STATE_ADD_UNIT_PLATE:
+  case STATE_UNIT_PLATE:
+    fprintf(out, "Enter the plate number : ");
+    break;
+  case STATE_UNIT_STATUS:
+    fprintf(out, "1. Available\n2. Rented\n3. In Service\nEnter the new status : ");
+    break;
+  case STATE_ADMIN_USERS:
+    CLEAN_SCREEN(out);
+    if (session->listing != LISTING_USERS)
+      sessionStartListing(session, LISTING_USERS, NULL);
+    sessionShowPage(session);
+    fprintf(out, "\n1. Update Users");
+    fprintf(out, "\n2. Remove Users");
+    fprintf(out, "\n3. Add Users");
+    fprintf(out, "\n4. Return to main menu");
+    fprintf(out, "\nChoose the option : ");
+    break;
+  case STATE_ADMIN_UPDATE_USER:
+    fprintf(out, "\nEnter the username to update : ");
+    break;
+  case STATE_ADMIN_REMOVE_USER:
+    fprintf(out, "\nEnter the username to remove : ");
+    break;
+  }
+}
+
+/**
+ * Admit a request of the session and start timing it. When admission control
+ * defers it, the session is marked deferred so the driver retries the line
+ * later instead of waiting. Returns false, after telling the user when the
+ * request is refused, unless the request may go ahead.
+ */
+bool sessionAdmit(struct Session *session, int request_class)
+{
+  int decision = admitRequest(request_class);
+
+  if (decision == ADMIT_DEFER && session->deferrals < ADMISSION_DEFER_RETRIES) {
+    session->deferrals++;
+    session->deferred = true;
+    return false;
+  }
+  session->deferrals = 0;
+  if (decision != ADMIT_ACCEPT) {
+    if (decision == ADMIT_DEFER)
+      request_metrics[request_class].rejected++;
+    fprintf(session->out, "\nThe system is busy right now. Please try again in a moment.\n");
+    return false;
+  }
+
+  session->timer.request_class = request_class;
+  session->timer.started = monotonicSeconds();
+  return true;
+}
+
+/* Start registering a new user; the session returns to return_state afterwards */
+void sessionStartRegistration(struct Session *session, int return_state)
+{
+  if (rejectWriteOnReplica(session->out))
+    return;
+  CLEAN_SCREEN(session->out);
+  fprintf(session->out, "Please provide the following information:\n");
+  memset(&session->form, 0, sizeof(session->form));
+  session->return_state = return_state;
+  session->field = 1;
+  session->one_field = false;
+  session->state = STATE_REGISTER_FIELD;
+}
+
+/* Start editing a user; the session returns to return_state afterwards */
+void sessionStartEditUser(struct Session *session, const char *username, int return_state)
+{
+  if (rejectWriteOnReplica(session->out))
+    return;
+  if (findUserIndex(username, &session->form) < 0) {
+    fprintf(session->out, "User '%s' not found in the file.\n", username);
+    return;
+  }
+  session->return_state = return_state;
+  session->state = STATE_EDIT_USER_FIELD;
+}
+
+void sessionMainMenu(struct Session *session, const char *line)
+{
+  long choice = 0;
+
+  parseLong(line, &choice);
+  switch (choice) {
+  case 1:
+    sessionStartRegistration(session, STATE_MAIN_MENU);
+    break;
+  case 2:
+    session->state = STATE_LOGIN_NAME;
+    break;
+  case 3:
+    session->state = STATE_ADMIN_NAME;
+    break;
+  case 4:
+    fprintf(session->out, "Exiting the Car Rental System. Goodbye!\n");
+    session->state = STATE_CLOSED;
+    break;
+  default:
+    fprintf(session->out, "Invalid choice. Please try again.\n");
+  }
+}
+
+/* Move on to choosing a username once the contact number is not in use */
+void sessionCheckNumber(struct Session *session)
+{
+  struct Users *form = &session->form;
+
+  if (isUserTaken(NULL, form->number, -1)) {
+    fprintf(session->out, "\n%s, It seems the contact number you have entered is already in use.\n"
+            " Please use different contact number\n", form->fullname);
+    session->state = STATE_REGISTER_NUMBER;
+    return;
+  }
+  fprintf(session->out, "\nThank you, %s, for providing your information.\n", form->fullname);
+  fprintf(session->out, "You can now set up your username and password for further access.\n");
+  session->state = STATE_REGISTER_USERNAME;
+}
+
+/**
+ * Registration: the contact fields, a review of them, then a unique username
+ * and a password typed twice.
+ */
+void sessionRegister(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  struct Users *form = &session->form;
+
+  switch (session->state) {
+  case STATE_REGISTER_FIELD:
+    setUserField(form, session->field, line);
+    if (session->one_field || session->field == 4)
+      session->state = STATE_REGISTER_REVIEW;
+    else
+      session->field++;
+    break;
+  case STATE_REGISTER_REVIEW:
+    session->one_field = true;
+    switch (line[0]) {
+    case 'F':
+      session->field = 1;
+      session->state = STATE_REGISTER_FIELD;
+      break;
+    case 'A':
+      session->field = 2;
+      session->state = STATE_REGISTER_FIELD;
+      break;
+    case 'N':
+      session->field = 3;
+      session->state = STATE_REGISTER_FIELD;
+      break;
+    case 'E':
+      session->field = 4;
+      session->state = STATE_REGISTER_FIELD;
+      break;
+    case 'O':
+      sessionCheckNumber(session);
+      break;
+    default:
+      fprintf(out, "Invalid!");
+      break;
+    }
+    break;
+  case STATE_REGISTER_NUMBER:
+    setUserField(form, 3, line);
+    sessionCheckNumber(session);
+    break;
+  case STATE_REGISTER_USERNAME:
+    if (line[0] == '\0' || strchr(line, ' ') != NULL) {
+      fprintf(out, "\nPlease choose a username without spaces\n");
+      break;
+    }
+    setUserField(form, 5, line);
+    if (isUserTaken(form->username, NULL, -1)) {
+      fprintf(out, "\nThe user with this \"%s\" username, seems already registered!\n"
+              "Please choose different user name\n", form->username);
+      break;
+    }
+    session->state = STATE_REGISTER_PASSWORD;
+    break;
+  case STATE_REGISTER_PASSWORD:
+    setUserField(form, 6, line);
+    session->state = STATE_REGISTER_VERIFY;
+    break;
+  case STATE_REGISTER_VERIFY:
+    /* Check if the entered passwords match */
+    if (strcmp(form->password, line) != 0) {
+      fprintf(out, "\nPasswords do not match. Please try again.\n");
+      session->state = STATE_REGISTER_PASSWORD;
+      break;
+    }
+    /* Another session may have taken the username in the meantime */
+    if (isUserTaken(form->username, NULL, -1)) {
+      fprintf(out, "\nThe user with this \"%s\" username, seems already registered!\n"
+              "Please choose different user name\n", form->username);
+      session->state = STATE_REGISTER_USERNAME;
+      break;
+    }
+    if (registerUser(form) == 0)
+      fprintf(out, "\nUser data has been registered successfully.\n");
+    session->state = STATE_REGISTER_DONE;
+    break;
+  case STATE_REGISTER_DONE:
+    session->state = session->return_state;
+    break;
+  }
+}
+
+void sessionLogin(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+
+  switch (session->state) {
+  case STATE_LOGIN_NAME:
+    snprintf(session->login, sizeof(session->login), "%s", line);
+    session->state = STATE_LOGIN_PASSWORD;
+    break;
+  case STATE_LOGIN_PASSWORD:
+    if (!sessionAdmit(session, REQUEST_RENTAL)) {
+      if (!session->deferred)
+        session->state = STATE_MAIN_MENU;
+      break;
+    }
+    /* Reject hammering clients before scanning the user file */
+    if (!rateLimitAllow(RATE_LIMIT_LOGIN, session->login, session->source)) {
+      endRequest(&session->timer);
+      fprintf(out, "\nToo many login attempts. Please wait a while and try again.\n");
+      session->state = STATE_MAIN_MENU;
+      break;
+    }
+    bool found = findUser(session->login, line, &session->user);
+    endRequest(&session->timer);
+
+    if (found) {
+      fprintf(out, "\nLogin successful.");
+      fprintf(out, "\nWelcome to the User Dashboard, %s!\n", session->user.fullname);
+      notifyWaitlistAllocations(out, &session->user);
+      session->state = STATE_USER_MENU;
+    } else {
+      fprintf(out, "\nLogin failed. Please check your credentials.\n");
+      fprintf(out, "If you have forgotten your password, please consult your "
+              "administrator for assistance.\n");
+      session->state = STATE_LOGIN_RETRY;
+    }
+    break;
+  case STATE_LOGIN_RETRY:
+    session->state = isYes(line) ? STATE_LOGIN_NAME : STATE_MAIN_MENU;
+    break;
+  }
+}
+
+void sessionUserMenu(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  long choice = 0;
+
+  parseLong(line, &choice);
+  switch (choice) {
+  case 1:
+    if (sessionAdmit(session, REQUEST_QUERY)) {
+      sessionStartListing(session, LISTING_CARS, NULL);
+      sessionShowPage(session);
+      endRequest(&session->timer);
+    }
+    break;
+  case 2:
+    if (rejectWriteOnReplica(out))
+      break;
+    if (!rateLimitAllow(RATE_LIMIT_RENTAL, session->user.username, session->source)) {
+      fprintf(out, "\nToo many rental attempts. Please wait a while and try again.\n");
+      break;
+    }
+    /* Route the rental to the branch the car is picked up from */
+    if (num_branches > 1)
+      session->state = STATE_RENT_BRANCH;
+    else
+      sessionOfferCars(session);
+    break;
+  case 3:
+    if (sessionAdmit(session, REQUEST_QUERY)) {
+      sessionStartListing(session, LISTING_RENTALS, session->user.username);
+      sessionShowPage(session);
+      endRequest(&session->timer);
+    }
+    break;
+  case 4:
+    sessionStartEditUser(session, session->user.username, STATE_USER_MENU);
+    break;
+  case 5:
+    if (rejectWriteOnReplica(out))
+      break;
+    session->state = STATE_CHANGE_RENTAL;
+    break;
+  case 6:
+    fprintf(out, "Logging out from User Dashboard.\n");
+    memset(&session->user, 0, sizeof(session->user));
+    session->state = STATE_MAIN_MENU;
+    break;
+  default:
+    fprintf(out, "Invalid choice. Please try again.\n");
+  }
+}
+
+/* Select the branch chosen from the list printed by listBranches() */
+void sessionChooseBranch(struct Session *session, const char *line)
+{
+  long choice;
+
+  if (!parseLong(line, &choice) || choice < 1 || (size_t)choice > num_branches) {
+    fprintf(session->out, "\nInvalid branch. Staying in '%s'.\n",
+            branches[current_branch].name);
+    return;
+  }
+  selectBranch(choice - 1);
+  fprintf(session->out, "\nWorking in branch '%s'.\n", branches[current_branch].name);
+}
+
+/* List the free cars of the selected branch, or offer the waitlist if there are none */
+void sessionOfferCars(struct Session *session)
+{
+  FILE *out = session->out;
+
+  session->num_choices = 0;
+  fprintf(out, "=== Rent a Car ===\n");
+
+  /* Load the car table */
+  struct Fleet *fleet = loadFleet();
+  if (fleet == NULL) {
+    session->state = STATE_USER_MENU;
+    return;
+  }
+  for (size_t index = 0; index < fleet->count && session->num_choices < MAX_CAR_MODELS;
+       index++) {
+    if (!fleet->available[index])
+      continue;
+    const struct CarDetails *details = &fleet->details[index];
+    if (session->num_choices == 0) {
+      fprintf(out, "Available Car Models:\n");
+      fprintf(out, "%-5s %-15s %-12s %-10s %-11s\n", "Index", "Model Name",
+              "Company", "Color", "Rate (NPR)");
+    }
+    session->choices[session->num_choices++] = index;
+    fprintf(out, "%-5d %-15s %-12s %-10s %-11.2lf\n", session->num_choices,
+            details->model_name, details->company, details->color,
+            fleet->rental_rate[index]);
+  }
+
+  /* Offer the waitlist if no car is free, so the demand is not lost */
+  if (session->num_choices == 0) {
+    fprintf(out, "Sorry, there are no cars available for rent at the moment.\n");
+    session->state = STATE_WAITLIST_JOIN;
+  } else {
+    session->state = STATE_RENT_SELECT;
+  }
+}
+
+/**
+ * Renting: pick a free car and the dates, confirm, and commit the rental.
+ * Without a free car the customer may join the waitlist instead.
+ */
+void sessionRent(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  struct Rental *rental = &session->rental;
+  struct WaitlistEntry *entry = &session->waitlist;
+  long choice;
+  int days;
+
+  switch (session->state) {
+  case STATE_RENT_BRANCH:
+    sessionChooseBranch(session, line);
+    sessionOfferCars(session);
+    break;
+  case STATE_RENT_SELECT:
+    session->state = STATE_USER_MENU;
+    if (!parseLong(line, &choice) || choice < 0 || choice > session->num_choices) {
+      fprintf(out, "Invalid car index. Please try again.\n");
+      break;
+    }
+    if (choice == 0) {
+      fprintf(out, "Rental canceled. Returning to the User Dashboard...\n");
+      break;
+    }
+    memset(rental, 0, sizeof(struct Rental));
+    if (readCarAt(session->choices[choice - 1], &rental->selectedCar) != 0) {
+      fprintf(out, "Sorry, that car is no longer available.\n");
+      break;
+    }
+    rental->selectedCarIndex = choice;
+    session->state = STATE_RENT_PICKUP;
+    break;
+  case STATE_RENT_PICKUP:
+    snprintf(rental->pickupDate, sizeof(rental->pickupDate), "%s", line);
+    session->state = STATE_RENT_RETURN;
+    break;
+  case STATE_RENT_RETURN:
+    snprintf(rental->returnDate, sizeof(rental->returnDate), "%s", line);
+    session->state = STATE_USER_MENU;
+
+    /* Calculate total cost (simple example: rate * number of days) */
+    days = calculateRentalDays(rental->pickupDate, rental->returnDate);
+    if (days < 0) {
+      fprintf(out, "Invalid dates. Use the YYYY-MM-DD format and a return date "
+              "on or after the pickup date.\n");
+      break;
+    }
+    rental->totalCost = rental->selectedCar.rental_rate * days;
+
+    /* Generate a unique rental-ID for each transaction */
+    char *uniqueID = generateUniqueRentalID("R");
+    if (uniqueID == NULL) {
+      fprintf(out, "The rental could not be recorded. Please try again.\n");
+      break;
+    }
+    snprintf(rental->rentalID, sizeof(rental->rentalID), "%s", uniqueID);
+
+    /* Display rental summary */
+    fprintf(out, "\nRental Summary:\n");
+    fprintf(out, "Rental ID: %s\n", rental->rentalID);
+    fprintf(out, "Model: %s\n", rental->selectedCar.model_name);
+    fprintf(out, "Color: %s\n", rental->selectedCar.color);
+    fprintf(out, "Company: %s\n", rental->selectedCar.company);
+    fprintf(out, "Rate (NPR): %.2lf per day\n", rental->selectedCar.rental_rate);
+    fprintf(out, "Pickup Date: %s\n", rental->pickupDate);
+    fprintf(out, "Return Date: %s\n", rental->returnDate);
+    fprintf(out, "Total Cost: NRS %0.2lf\n", rental->totalCost);
+    session->state = STATE_RENT_CONFIRM;
+    break;
+  case STATE_RENT_CONFIRM:
+    if (!isYes(line)) {
+      fprintf(out, "Rental canceled. Returning to the User Dashboard...\n");
+      session->state = STATE_USER_MENU;
+      break;
+    }
+    if (!sessionAdmit(session, REQUEST_RENTAL)) {
+      if (!session->deferred)
+        session->state = STATE_USER_MENU;
+      break;
+    }
+    if (commitRental(&session->user, rental, NOTIFY_RENTAL_CONFIRMED) == 0)
+      fprintf(out, "\nRental completed. Enjoy your ride!\n");
+    else
+      fprintf(out, "\nSorry, '%s' is no longer available.\n", rental->selectedCar.model_name);
+    endRequest(&session->timer);
+    session->state = STATE_USER_MENU;
+    break;
+  case STATE_CHANGE_RENTAL: {
+    size_t branch = current_branch;
+    session->state = STATE_USER_MENU;
+    if (findRentalAnyBranch(line, rental) < 0 ||
+        strcmp(rental->rentingUser.username, session->user.username) != 0) {
+      fprintf(out, "You have no rental '%s'.\n", line);
+      break;
+    }
+    bool closed = rentalReturned(rental->rentalID);
+    selectBranch(branch);
+    if (closed) {
+      fprintf(out, "Rental %s was checked in or canceled already.\n", rental->rentalID);
+      break;
+    }
+    fprintf(out, "\nRental %s: %s from %s to %s, NRS %0.2lf\n", rental->rentalID,
+            rental->selectedCar.model_name, rental->pickupDate, rental->returnDate,
+            rental->totalCost);
+    session->state = STATE_CHANGE_RENTAL_DATE;
+  } break;
+  case STATE_CHANGE_RENTAL_DATE: {
+    struct RentalReturn record;
+    const char *error;
+    if (!sessionAdmit(session, REQUEST_RENTAL)) {
+      if (!session->deferred)
+        session->state = STATE_USER_MENU;
+      break;
+    }
+    session->state = STATE_USER_MENU;
+    if (strcmp(line, "cancel") == 0) {
+      error = cancelRental(out, rental->rentalID, session->user.username, &record);
+      if (error == NULL)
+        fprintf(out, "\nRental %s canceled.\n", rental->rentalID);
+    } else {
+      error = changeRentalReturn(rental->rentalID, session->user.username, line, rental);
+      if (error == NULL)
+        fprintf(out, "\nRental %s now returns on %s. Total Cost: NRS %0.2lf\n",
+                rental->rentalID, rental->returnDate, rental->totalCost);
+    }
+    if (error != NULL)
+      fprintf(out, "\n%s.\n", error);
+    endRequest(&session->timer);
+  } break;
+  case STATE_WAITLIST_JOIN:
+    if (!isYes(line)) {
+      recordDemand("", DEMAND_TURNED_AWAY);
+      session->state = STATE_USER_MENU;
+      break;
+    }
+    memset(entry, 0, sizeof(struct WaitlistEntry));
+    snprintf(entry->username, sizeof(entry->username), "%s", session->user.username);
+    session->state = STATE_WAITLIST_MODEL;
+    break;
+  case STATE_WAITLIST_MODEL: {
+    struct CarModel car;
+    session->state = STATE_USER_MENU;
+    if (strcmp(line, "any") != 0) {
+      if (!findCar(line, &car)) {
+        fprintf(out, "There is no '%s' in this branch.\n", line);
+        break;
+      }
+      snprintf(entry->model_name, sizeof(entry->model_name), "%s", line);
+    }
+    session->state = STATE_WAITLIST_PICKUP;
+  } break;
+  case STATE_WAITLIST_PICKUP:
+    snprintf(entry->pickupDate, sizeof(entry->pickupDate), "%s", line);
+    session->state = STATE_WAITLIST_RETURN;
+    break;
+  case STATE_WAITLIST_RETURN:
+    snprintf(entry->returnDate, sizeof(entry->returnDate), "%s", line);
+    session->state = STATE_USER_MENU;
+    if (calculateRentalDays(entry->pickupDate, entry->returnDate) < 0) {
+      fprintf(out, "Invalid dates. Use the YYYY-MM-DD format and a return date "
+              "on or after the pickup date.\n");
+      break;
+    }
+    long waiting = enqueueWaitlist(entry);
+    if (waiting >= 0)
+      fprintf(out, "\nYou are on the waitlist for %s (%ld waiting). A car will be rented "
+              "for you automatically as soon as one is free.\n",
+              entry->model_name[0] ? entry->model_name : "any car", waiting);
+    break;
+  }
+}
+
+/* Editing a user, either by the user themselves or by an admin */
+void sessionEditUser(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  struct Users edited;
+  struct Users current;
+  long choice;
+
+  switch (session->state) {
+  case STATE_EDIT_USER_FIELD:
+    if (!parseLong(line, &choice) || choice < 1 || choice > 6) {
+      fprintf(out, "\nInvalid choice!\n");
+      session->state = session->return_state;
+      break;
+    }
+    session->field = choice;
+    session->state = STATE_EDIT_USER_VALUE;
+    break;
+  case STATE_EDIT_USER_VALUE:
+    session->state = session->return_state;
+
+    /* Find the user again, other sessions may have changed the database */
+    long index = findUserIndex(session->form.username, &current);
+    if (index < 0) {
+      fprintf(out, "User '%s' not found in the file.\n", session->form.username);
+      break;
+    }
+    edited = current;
+    setUserField(&edited, session->field, line);
+    if ((session->field == 5 && isUserTaken(edited.username, NULL, index)) ||
+        (session->field == 3 && isUserTaken(NULL, edited.number, index))) {
+      fprintf(out, "\nThat %s is already used by another user.\n",
+              session->field == 5 ? "username" : "contact number");
+      break;
+    }
+
+    fprintf(out, "Full Name: %s\n", edited.fullname);
+    fprintf(out, "Address: %s\n", edited.address);
+    fprintf(out, "Contact Number: %s\n", edited.number);
+    fprintf(out, "Email: %s\n", edited.email);
+
+    if (saveUser(index, &edited) != 0)
+      break;
+    fprintf(out, "\nUser '%s' updated successfully.\n", current.username);
+    if (session->return_state == STATE_USER_MENU)
+      session->user = edited;
+    break;
+  }
+}
+
+/* Admin login and the admin dashboard, apart from managing cars and users */
+void sessionAdmin(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  long choice = 0;
+  long priority;
+
+  switch (session->state) {
+  case STATE_ADMIN_NAME:
+    snprintf(session->login, sizeof(session->login), "%s", line);
+    session->state = STATE_ADMIN_PASSWORD;
+    break;
+  case STATE_ADMIN_PASSWORD:
+    session->state = STATE_MAIN_MENU;
+    if (!rateLimitAllow(RATE_LIMIT_LOGIN, session->login, session->source)) {
+      fprintf(out, "\nToo many login attempts. Please wait a while and try again.\n");
+      break;
+    }
+    /* Check if the entered credentials match the admin credentials */
+    if (strcmp(session->login, admin_user) == 0 &&
+        strcmp(line, admin_password) == 0) {
+      CLEAN_SCREEN(out);
+      fprintf(out, "\nSuccessfully logged in!\nYou are in the administration "
+              "dashboard!\n");
+      session->state = STATE_ADMIN_MENU;
+    } else {
+      fprintf(out, "\nLogin Failed!\n");
+    }
+    break;
+  case STATE_ADMIN_MENU:
+    parseLong(line, &choice);
+    switch (choice) {
+    case 1:
+      if (sessionAdmit(session, REQUEST_REPORT)) {
+        sessionStartListing(session, LISTING_CARS, NULL);
+        sessionShowPage(session);
+        endRequest(&session->timer);
+      }
+      break;
+    case 2:
+      session->state = STATE_ADMIN_CARS;
+      break;
+    case 3:
+      if (sessionAdmit(session, REQUEST_REPORT)) {
+        sessionStartListing(session, LISTING_USERS, NULL);
+        sessionShowPage(session);
+        endRequest(&session->timer);
+      }
+      break;
+    case 4:
+      session->state = STATE_ADMIN_USERS;
+      break;
+    case 5:
+      session->state = STATE_ADMIN_LOG_CHOICE;
+      break;
+    case 6:
+      if (num_branches > 1)
+        session->state = STATE_ADMIN_BRANCH;
+      break;
+    case 7:
+      if (!rejectWriteOnReplica(out))
+        session->state = STATE_ADMIN_ADD_BRANCH;
+      break;
+    case 8:
+      showWaitlist(out);
+      session->state = STATE_ADMIN_WAITLIST;
+      break;
+    case 9:
+      showMetrics(out);
+      break;
+    case 10:
+      if (!rejectWriteOnReplica(out))
+        session->state = STATE_ADMIN_CHECK_IN;
+      break;
+    case 11:
+      session->state = STATE_MAIN_MENU;
+      break;
+    default:
+      fprintf(out, "\nInvalid choice. Please try again.");
+    }
+    break;
+  case STATE_ADMIN_LOG_CHOICE:
+    if (isYes(line)) {
+      session->state = STATE_ADMIN_LOG_USER;
+    } else if (sessionAdmit(session, REQUEST_REPORT)) {
+      sessionStartListing(session, LISTING_RENTALS, NULL);
+      sessionShowPage(session);
+      endRequest(&session->timer);
+      session->state = STATE_ADMIN_MENU;
+    } else if (!session->deferred) {
+      session->state = STATE_ADMIN_MENU;
+    }
+    break;
+  case STATE_ADMIN_LOG_USER:
+    if (sessionAdmit(session, REQUEST_QUERY)) {
+      sessionStartListing(session, LISTING_RENTALS, line);
+      sessionShowPage(session);
+      endRequest(&session->timer);
+    }
+    if (!session->deferred)
+      session->state = STATE_ADMIN_MENU;
+    break;
+  case STATE_ADMIN_BRANCH:
+    sessionChooseBranch(session, line);
+    session->state = STATE_ADMIN_MENU;
+    break;
+  case STATE_ADMIN_ADD_BRANCH:
+    addBranch(out, line);
+    session->state = STATE_ADMIN_MENU;
+    break;
+  case STATE_ADMIN_WAITLIST:
+    parseLong(line, &choice);
+    session->state = choice == 1 ? STATE_ADMIN_WAITLIST_ENTRY : STATE_ADMIN_MENU;
+    break;
+  case STATE_ADMIN_WAITLIST_ENTRY:
+    if (!parseLong(line, &session->waitlist_index) || session->waitlist_index < 0) {
+      fprintf(out, "\nInvalid entry.\n");
+      session->state = STATE_ADMIN_MENU;
+      break;
+    }
+    session->state = STATE_ADMIN_WAITLIST_PRIORITY;
+    break;
+  case STATE_ADMIN_WAITLIST_PRIORITY:
+    session->state = STATE_ADMIN_MENU;
+    if (!parseLong(line, &priority) || priority < INT_MIN || priority > INT_MAX) {
+      fprintf(out, "\nInvalid priority.\n");
+      break;
+    }
+    if (setWaitlistPriority(session->waitlist_index, priority) != 0) {
+      fprintf(out, "\nEntry %ld is not waiting.\n", session->waitlist_index);
+      break;
+    }
+    fprintf(out, "\nPriority of entry %ld set to %ld.\n", session->waitlist_index, priority);
+    break;
+  case STATE_ADMIN_CHECK_IN:
+    snprintf(session->rental.rentalID, sizeof(session->rental.rentalID), "%s", line);
+    session->state = STATE_ADMIN_CHECK_IN_DATE;
+    break;
+  case STATE_ADMIN_CHECK_IN_DATE: {
+    struct RentalReturn record;
+    char date[11];
+
+    if (line[0] == '\0')
+      todaysDate(date, sizeof(date));
+    else
+      snprintf(date, sizeof(date), "%s", line);
+    const char *error = checkInRental(out, session->rental.rentalID, date, &record);
+    fprintf(out, "\n");
+    showCheckIn(out, session->rental.rentalID, error, &record);
+    session->state = STATE_ADMIN_MENU;
+  } break;
+  }
+}
+
+/* Managing the cars of the selected branch */
+void sessionAdminCars(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  struct CarModel *car = &session->car;
+  struct CarModel current;
+  long choice = 0;
+
+  switch (session->state) {
+  case STATE_ADMIN_CARS:
+    parseLong(line, &choice);
+    switch (choice) {
+    case 1:
+      if (!rejectWriteOnReplica(out))
+        session->state = STATE_ADMIN_UPDATE_CAR;
+      break;
+    case 2:
+      if (rejectWriteOnReplica(out))
+        break;
+      sessionStartListing(session, LISTING_INDEXED_CARS, NULL);
+      sessionShowPage(session);
+      session->state = STATE_ADMIN_REMOVE_CAR;
+      break;
+    case 3:
+      if (rejectWriteOnReplica(out))
+        break;
+      memset(car, 0, sizeof(struct CarModel));
+      /* Assuming the car is available initially */
+      car->available_status = true;
+      session->field = 1;
+      session->state = STATE_ADD_CAR;
+      break;
+    case 4:
+      if (!rejectWriteOnReplica(out)) {
+        memset(&session->unit, 0, sizeof(struct CarUnit));
+        session->state = STATE_ADD_UNIT_MODEL;
+      }
+      break;
+    case 5:
+      if (!rejectWriteOnReplica(out)) {
+        memset(&session->unit, 0, sizeof(struct CarUnit));
+        session->state = STATE_UNIT_PLATE;
+      }
+      break;
+    case 6:
+      session->state = STATE_ADMIN_MENU;
+      break;
+    default:
+      fprintf(out, "\nInvalid choice!");
+      break;
+    }
+    break;
+  case STATE_ADMIN_UPDATE_CAR:
+    if (findCarIndex(line, car) < 0) {
+      /* Show error if car not found */
+      fprintf(out, "Car '%s' not found in the file.\n", line);
+      session->state = STATE_ADMIN_CARS;
+      break;
+    }
+    session->state = STATE_EDIT_CAR_FIELD;
+    break;
+  case STATE_EDIT_CAR_FIELD:
+    if (!parseLong(line, &choice) || choice < 1 || choice > 8) {
+      fprintf(out, "\nInvalid choice. No fields updated.\n");
+      session->state = STATE_ADMIN_CARS;
+      break;
+    }
+    session->field = choice;
+    session->state = STATE_EDIT_CAR_VALUE;
+    break;
+  case STATE_EDIT_CAR_VALUE: {
+    /* Find the car again, other sessions may have changed the database */
+    long index = findCarIndex(car->model_name, &current);
+    if (index < 0) {
+      fprintf(out, "Car '%s' not found in the file.\n", car->model_name);
+      session->state = STATE_ADMIN_CARS;
+      break;
+    }
+    /* The units of a model refer to it by name and decide whether it is available */
+    struct Inventory *inventory = loadInventory();
+    if ((session->field == 1 || session->field == 8) && inventory != NULL &&
+        findStock(inventory, current.model_name) != NULL) {
+      fprintf(out, "\n'%s' has units; set the status of its units instead.\n", current.model_name);
+      session->state = STATE_ADMIN_CARS;
+      break;
+    }
+    struct CarModel edited = current;
+    if (!setCarField(&edited, session->field, line)) {
+      fprintf(out, "Please enter a number.\n");
+      break;
+    }
+    if (saveCar(out, index, &edited, current.available_status) == 0)
+      fprintf(out, "\nCar '%s' updated successfully.\n", current.model_name);
+    session->state = STATE_ADMIN_CARS;
+  } break;
+  case STATE_ADMIN_REMOVE_CAR:
+    if (!parseLong(line, &choice)) {
+      fprintf(out, "Invalid input.\n");
+    } else {
+      removeCarAt(out, choice);
+    }
+    session->state = STATE_ADMIN_CARS;
+    break;
+  case STATE_ADD_CAR:
+    if (!setCarField(car, session->field, line)) {
+      fprintf(out, "Please enter a number.\n");
+      break;
+    }
+    if (session->field < 7) {
+      session->field++;
+      break;
+    }
+    if (appendCar(car) == 0)
+      fprintf(out, "Car added successfully.\n");
+    session->state = STATE_ADMIN_CARS;
+    break;
+  case STATE_ADD_UNIT_MODEL:
+    snprintf(session->unit.model_name, sizeof(session->unit.model_name), "%s", line);
+    session->state = STATE_ADD_UNIT_PLATE;
+    break;
+  case STATE_ADD_UNIT_PLATE:
+    snprintf(session->unit.plate, sizeof(session->unit.plate), "%s", line);
+    addCarUnit(out, &session->unit);
+    session->state = STATE_ADMIN_CARS;
+    break;
+  case STATE_UNIT_PLATE:
+    snprintf(session->unit.plate, sizeof(session->unit.plate), "%s", line);
+    session->state = STATE_UNIT_STATUS;
+    break;
+  case STATE_UNIT_STATUS:
+    if (!parseLong(line, &choice) || choice < 1 || choice > 3)
+      fprintf(out, "\nInvalid choice. The unit was not changed.\n");
+    else
+      setCarUnitStatus(out, session->unit.plate, UNIT_AVAILABLE + (int)choice - 1);
+    session->state = STATE_ADMIN_CARS;
+    break;
+  }
+}
+
+/* Managing users */
+void sessionAdminUsers(struct Session *session, const char *line)
+{
+  FILE *out = session->out;
+  long choice = 0;
+
+  switch (session->state) {
+  case STATE_ADMIN_USERS:
+    parseLong(line, &choice);
+    switch (choice) {
+    case 1:
+      session->state = STATE_ADMIN_UPDATE_USER;
+      break;
+    case 2:
+      session->state = STATE_ADMIN_REMOVE_USER;
+      break;
+    case 3:
+      sessionStartRegistration(session, STATE_ADMIN_USERS);
+      break;
+    case 4:
+      session->state = STATE_ADMIN_MENU;
+      break;
+    default:
+      fprintf(out, "\nInvalid choice!");
+      break;
+    }
+    break;
+  case STATE_ADMIN_UPDATE_USER:
+    session->state = STATE_ADMIN_USERS;
+    sessionStartEditUser(session, line, STATE_ADMIN_USERS);
+    break;
+  case STATE_ADMIN_REMOVE_USER:
+    removeUserByUsername(out, line);
+    session->state = STATE_ADMIN_USERS;
+    break;
+  }
+}
+
+/* fopencookie() writer appending to a struct Buffer */
+ssize_t writeToBuffer(void *cookie, const char *data, size_t size)
+{
+  bufferAppend(cookie, data, size);
+  return size;
+}
+
+/* Columns taken by UTF-8 text; every character is taken to be one column wide */
+size_t displayWidth(const char *text, size_t length)
+{
+  size_t width = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    if (((unsigned char)text[i] & 0xC0) != 0x80)
+      width++;
+  }
+  return width;
+}
+
+/**
+ * Split text into the rows it takes on a terminal the given number of
+ * columns wide, wrapping long lines the way the terminal does. The rows
+ * point into the text. Returns the number of rows.
+ */
+size_t wrapRows(const char *text, size_t length, int columns,
+                struct TextRow **rows, size_t *capacity)
+{
+  size_t count = 0;
+  size_t start = 0;
+  size_t width = 0;
+
+  for (size_t i = 0; i <= length; i++) {
+    bool end_of_line = i == length || text[i] == '\n';
+    bool wrap = !end_of_line && width == (size_t)columns &&
+                ((unsigned char)text[i] & 0xC0) != 0x80;
+
+    if (end_of_line || wrap) {
+      if (count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        struct TextRow *resized = realloc(*rows, grown * sizeof(struct TextRow));
+        if (resized == NULL)
+          return count;
+        *rows = resized;
+        *capacity = grown;
+      }
+      (*rows)[count].data = text + start;
+      (*rows)[count].length = i - start;
+      (*rows)[count].width = width;
+      count++;
+      start = end_of_line ? i + 1 : i;
+      width = 0;
+    }
+    if (!end_of_line && ((unsigned char)text[i] & 0xC0) != 0x80)
+      width++;
+  }
+  return count;
+}
+
+/**
+ * Bring a terminal from what the screen model says it shows to a new frame.
+ * Only rows that changed are sent, each from its first changed character,
+ * using cursor addressing. A frame taller than the terminal is written from
+ * its first change on and scrolls, keeping the earlier rows in the
+ * terminal's scrollback. The cursor is left at the end of the frame, where
+ * the prompt waits for input.
+ */
+void screenRender(struct Screen *screen, const char *frame, size_t length, FILE *term)
+{
+  static struct TextRow *old_rows, *new_rows;
+  static size_t old_capacity, new_capacity;
+  size_t rows = screen->rows;
+  size_t columns = screen->columns;
+  size_t old_count = 0;
+  size_t first = 0;
+
+  if (screen->valid) {
+    old_count = wrapRows(screen->text.data, screen->text.length, columns,
+                         &old_rows, &old_capacity);
+  } else {
+    fputs("\033[H\033[2J", term);
+  }
+  size_t new_count = wrapRows(frame, length, columns, &new_rows, &new_capacity);
+
+  /* Rows typed past the bottom of the terminal scrolled the top rows away */
+  struct TextRow *old = old_rows;
+  if (old_count > rows) {
+    old += old_count - rows;
+    old_count = rows;
+  }
+
+  while (first < old_count && first < new_count &&
+         old[first].length == new_rows[first].length &&
+         memcmp(old[first].data, new_rows[first].data, old[first].length) == 0)
+    first++;
+
+  if (new_count <= rows) {
+    for (size_t i = first; i < new_count; i++) {
+      const struct TextRow *row = &new_rows[i];
+      size_t same = 0;
+
+      if (i < old_count) {
+        size_t shorter = old[i].length < row->length ? old[i].length : row->length;
+        while (same < shorter && old[i].data[same] == row->data[same])
+          same++;
+        if (same == row->length && same == old[i].length)
+          continue;
+        /* Restart at the first byte of the character that changed */
+        while (same > 0 && ((unsigned char)row->data[same] & 0xC0) == 0x80)
+          same--;
+      }
+      fprintf(term, "\033[%zu;%zuH", i + 1, displayWidth(row->data, same) + 1);
+      fwrite(row->data + same, 1, row->length - same, term);
+      if (i >= old_count || old[i].width > row->width)
+        fputs("\033[K", term);
+    }
+    if (old_count > new_count)
+      fprintf(term, "\033[%zu;1H\033[J", new_count + 1);
+  } else {
+    if (first >= rows)
+      first = rows - 1;
+    fprintf(term, "\033[%zu;1H", first + 1);
+    for (size_t i = first; i < new_count; i++) {
+      if (i > first)
+        fputs("\r\n", term);
+      fwrite(new_rows[i].data, 1, new_rows[i].length, term);
+      /* Clearing at the right margin would erase the last character */
+      if (new_rows[i].width < columns)
+        fputs("\033[K", term);
+    }
+  }
+
+  /* Keep the rows now on the terminal as the model of the screen */
+  size_t kept = new_count > rows ? new_count - rows : 0;
+  screen->text.length = 0;
+  for (size_t i = kept; i < new_count; i++) {
+    if (i > kept)
+      bufferAppend(&screen->text, "\n", 1);
+    bufferAppend(&screen->text, new_rows[i].data, new_rows[i].length);
+  }
+  if (new_count > 0) {
+    const struct TextRow *last = &new_rows[new_count - 1];
+    fprintf(term, "\033[%zu;%zuH", new_count - kept,
+            last->width < columns ? last->width + 1 : columns);
+  }
+  screen->valid = true;
+  fflush(term);
+}
+
+/**
+ * Add what the terminal showed while the user typed a line to the screen
+ * model: the line and the newline, or for a password the mask characters,
+ * if the client shows any.
+ */
+void screenEcho(struct Screen *screen, const char *line, bool masked, char mask)
+{
+  if (!masked) {
+    bufferAppend(&screen->text, line, strlen(line));
+    bufferAppend(&screen->text, "\n", 1);
+  } else if (mask != '\0') {
+    for (size_t i = 0; line[i] != '\0'; i++)
+      bufferAppend(&screen->text, &mask, 1);
+  }
+}
+
+/* Set by SIGWINCH when the controlling terminal changes its size */
+volatile sig_atomic_t terminal_resized = 0;
+
+void handleTerminalResize(int signal)
+{
+  (void)signal;
+  terminal_resized = 1;
+}
+
+/* Size of the controlling terminal, or the default size if it cannot be told */
+void terminalSize(int *rows, int *columns)
+{
+  struct winsize size;
+
+  *rows = SCREEN_DEFAULT_ROWS;
+  *columns = SCREEN_DEFAULT_COLUMNS;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+    *rows = size.ws_row;
+    *columns = size.ws_col;
+  }
+}
+
+/* Run one session on the controlling terminal until the user exits */
+void runTerminalSession(void)
+{
+  static struct Session session;
+  static struct LineEditor editor;
+  char line[SESSION_LINE_SIZE];
+  int rows, columns;
+
+  if (sessionStart(&session, stdout, request_source) != 0)
+    return;
+  editorBegin(&editor);
+  signal(SIGWINCH, handleTerminalResize);
+  /* Ctrl-C ends the session like Ctrl-D, so the indexes are still saved */
+  catchSignal(SIGINT, handleStopSignal);
+  catchSignal(SIGTERM, handleStopSignal);
+  terminalSize(&rows, &columns);
+  sessionResize(&session, rows, columns);
+  sessionRender(&session);
+
+  while (session.state != STATE_CLOSED && !stop_requested) {
+    if (!editorReadLine(&editor, line, sizeof(line), session.masked, session.mask_echo))
+      break;
+    if (terminal_resized) {
+      terminal_resized = 0;
+      terminalSize(&rows, &columns);
+      sessionResize(&session, rows, columns);
+    }
+    sessionInput(&session, line);
+    /* A lone terminal has nothing else to serve while its request is deferred */
+    while (session.deferred && !stop_requested) {
+      usleep(ADMISSION_DEFER_US);
+      sessionInput(&session, line);
+    }
+  }
+  editorEnd(&editor);
+  sessionEnd(&session);
+}
+
+/**
+ * Apply the telnet command at the start of data, which begins with IAC, and
+ * return its length; 0 if it has not fully arrived yet. A window size
+ * reported by the client is applied to the session, other commands are
+ * ignored.
+ */
+size_t telnetCommand(struct Session *session, const unsigned char *data, size_t length)
+{
+  if (length < 2)
+    return 0;
+  if (data[1] >= TELNET_WILL && data[1] <= TELNET_DONT)
+    return length < 3 ? 0 : 3;
+  if (data[1] != TELNET_SB)
+    return 2;
+
+  for (size_t i = 2; i + 1 < length; i++) {
+    if (data[i] == TELNET_IAC && data[i + 1] == TELNET_SE) {
+      /* IAC SB NAWS <width> <height> IAC SE, both sizes 16 bits */
+      if (data[2] == TELNET_NAWS && i == 7)
+        sessionResize(session, data[5] << 8 | data[6], data[3] << 8 | data[4]);
+      return i + 2;
+    }
+  }
+  return 0;
+}
+
+/* Copy a line received from a session client, dropping carriage returns */
+void cleanSessionLine(const char *data, size_t length, char *line)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != '\r' && data[i] != '\0')
+      line[n++] = data[i];
+  }
+  line[n] = '\0';
+}
+
+/* Feed the complete lines received on a connection to its session */
+void processSessionInput(struct SessionConnection *conn)
+{
+  static const char echo_off[] = {(char)TELNET_IAC, (char)TELNET_WILL, TELNET_ECHO};
+  static const char echo_on[] = {(char)TELNET_IAC, (char)TELNET_WONT, TELNET_ECHO};
+  char line[SESSION_LINE_SIZE];
+  size_t start = 0;
+  size_t text = 0;
+  size_t i = 0;
+
+  /* Take telnet commands out first; their option bytes may look like newlines */
+  while (i < conn->in_length) {
+    if ((unsigned char)conn->in[i] != TELNET_IAC) {
+      conn->in[text++] = conn->in[i++];
+      continue;
+    }
+    size_t command = telnetCommand(&conn->session, (unsigned char *)conn->in + i,
+                                   conn->in_length - i);
+    if (command == 0 && conn->in_length < SESSION_LINE_SIZE)
+      break; /* Wait for the rest of it */
+    i += command > 0 ? command : conn->in_length - i;
+  }
+  memmove(conn->in + text, conn->in + i, conn->in_length - i);
+  conn->in_length = text + (conn->in_length - i);
+
+  while (conn->session.state != STATE_CLOSED) {
+    char *newline = memchr(conn->in + start, '\n', text - start);
+    size_t end;
+    if (newline != NULL)
+      end = newline - conn->in;
+    else if (start == 0 && text == SESSION_LINE_SIZE)
+      end = text - 1; /* Overlong line, cut it */
+    else
+      break;
+
+    cleanSessionLine(conn->in + start, end - start, line);
+    sessionInput(&conn->session, line);
+    if (conn->session.deferred)
+      break; /* Keep the line to feed it again */
+    start = end + 1;
+  }
+  memmove(conn->in, conn->in + start, conn->in_length - start);
+  conn->in_length -= start;
+
+  /* Redraw at a new window size that came without a line */
+  if (!conn->session.screen.valid && !conn->session.deferred &&
+      conn->session.state != STATE_CLOSED)
+    sessionRender(&conn->session);
+
+  /* Ask the client not to echo passwords */
+  if (conn->session.masked != conn->echo_off) {
+    conn->echo_off = conn->session.masked;
+    bufferAppend(&conn->out, conn->echo_off ? echo_off : echo_on, sizeof(echo_off));
+  }
+}
+
+/* Send pending output of a session connection. Returns false if the connection failed. */
+bool flushSessionOutput(struct SessionConnection *conn)
+{
+  while (conn->out_sent < conn->out.length) {
+    ssize_t sent = send(conn->fd, conn->out.data + conn->out_sent,
+                        conn->out.length - conn->out_sent, MSG_NOSIGNAL);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    conn->out_sent += sent;
+  }
+  conn->out.length = 0;
+  conn->out_sent = 0;
+  return true;
+}
+
+void closeSessionConnection(struct SessionConnection **slot)
+{
+  struct SessionConnection *conn = *slot;
+
+  cancelTimer(conn->idle_timer);
+  cancelTimer(conn->confirm_timer);
+  sessionEnd(&conn->session);
+  fclose(conn->stream);
+  close(conn->fd);
+  free(conn->out.data);
+  free(conn);
+  *slot = NULL;
+}
+
+/**
+ * Serve interactive sessions to telnet or netcat clients on a TCP port.
+ * Every connection gets its own session, all of them driven by this one
+ * thread: input is read as it arrives and each complete line advances its
+ * session's state machine.
+ */
+void serveSessions(int port)
+{
+  static struct SessionConnection *connections[SESSION_MAX_CONNECTIONS];
+  static struct pollfd fds[SESSION_MAX_CONNECTIONS + 1];
+  static int slots[SESSION_MAX_CONNECTIONS + 1];
+  static const char ask_window_size[] = {(char)TELNET_IAC, (char)TELNET_DO, TELNET_NAWS};
+  cookie_io_functions_t output = {.write = writeToBuffer};
+
+  int listener = openListener(port);
+  if (listener < 0)
+    return;
+  printf("Serving terminal sessions on port %d\n", port);
+  fflush(stdout);
+  signal(SIGINT, handleStopSignal);
+  signal(SIGTERM, handleStopSignal);
+
+  while (!stop_requested) {
+    size_t num_connections = 0;
+    bool deferred = false;
+    nfds_t nfds = 1;
+
+    for (size_t i = 0; i < SESSION_MAX_CONNECTIONS; i++) {
+      struct SessionConnection *conn = connections[i];
+      if (conn == NULL)
+        continue;
+      num_connections++;
+      deferred = deferred || conn->session.deferred;
+      fds[nfds].fd = conn->fd;
+      fds[nfds].events = 0;
+      if (conn->out_sent < conn->out.length)
+        fds[nfds].events |= POLLOUT;
+      /* Deferred sessions wait for their pending line before reading more */
+      if (conn->session.state != STATE_CLOSED && !conn->session.deferred &&
+          conn->in_length < SESSION_LINE_SIZE)
+        fds[nfds].events |= POLLIN;
+      slots[nfds++] = i;
+    }
+    fds[0].fd = listener;
+    fds[0].events = num_connections < SESSION_MAX_CONNECTIONS ? POLLIN : 0;
+
+    if (poll(fds, nfds, deferred ? ADMISSION_DEFER_US / 1000 : timerPollTimeout()) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Error polling connections: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      struct sockaddr_in peer;
+      socklen_t peer_length = sizeof(peer);
+      int fd;
+      size_t slot = 0;
+      while ((fd = accept(listener, (struct sockaddr *)&peer, &peer_length)) >= 0) {
+        while (slot < SESSION_MAX_CONNECTIONS && connections[slot] != NULL)
+          slot++;
+        struct SessionConnection *conn = slot < SESSION_MAX_CONNECTIONS ?
+                                         calloc(1, sizeof(struct SessionConnection)) : NULL;
+        char address[64];
+        inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+        if (conn != NULL)
+          conn->stream = fopencookie(&conn->out, "w", output);
+        if (conn != NULL && conn->stream != NULL &&
+            sessionStart(&conn->session, conn->stream, address) != 0) {
+          fclose(conn->stream);
+          conn->stream = NULL;
+        }
+        if (conn == NULL || conn->stream == NULL) {
+          free(conn);
+          close(fd);
+          break;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        conn->fd = fd;
+        conn->idle_timer = -1;
+        conn->confirm_timer = -1;
+        restartSessionTimers(conn, slot);
+        /* The client echoes nothing for passwords and reports its window size */
+        conn->session.mask_echo = '\0';
+        bufferAppend(&conn->out, ask_window_size, sizeof(ask_window_size));
+        sessionRender(&conn->session);
+        connections[slot] = conn;
+        peer_length = sizeof(peer);
+      }
+    }
+
+    /* Sessions with input to handle form the queue seen by admission control */
+    queued_requests = 0;
+    for (nfds_t i = 1; i < nfds; i++) {
+      if ((fds[i].revents & POLLIN) || connections[slots[i]]->session.deferred)
+        queued_requests++;
+    }
+
+    for (nfds_t i = 1; i < nfds; i++) {
+      struct SessionConnection **slot = &connections[slots[i]];
+      struct SessionConnection *conn = *slot;
+      bool readable = fds[i].revents & POLLIN;
+
+      if (readable || conn->session.deferred)
+        queued_requests--;
+      if (readable) {
+        ssize_t received = recv(conn->fd, conn->in + conn->in_length,
+                                SESSION_LINE_SIZE - conn->in_length, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+          closeSessionConnection(slot);
+          continue;
+        }
+        if (received > 0)
+          conn->in_length += received;
+      } else if (fds[i].revents & (POLLERR | POLLHUP)) {
+        closeSessionConnection(slot);
+        continue;
+      }
+
+      if (readable || conn->session.deferred) {
+        processSessionInput(conn);
+        restartSessionTimers(conn, slots[i]);
+      }
+      if (!flushSessionOutput(conn) ||
+          (conn->session.state == STATE_CLOSED && conn->out.length == 0)) {
+        closeSessionConnection(slot);
+      }
+    }
+    runTimers();
+    fireSessionTimers(connections);
+  }
+  close(listener);
+}
+
+/* Make room for capacity cars in every column of a fleet. Returns -1 when out of memory. */
+int reserveFleet(struct Fleet *fleet, size_t capacity)
+{
+  if (capacity <= fleet->capacity)
+    return 0;
+
+  bool *available = realloc(fleet->available, capacity * sizeof(bool));
+  if (available != NULL)
+    fleet->available = available;
+  double *rental_rate = realloc(fleet->rental_rate, capacity * sizeof(double));
+  if (rental_rate != NULL)
+    fleet->rental_rate = rental_rate;
+  size_t *passenger_capacity = realloc(fleet->passenger_capacity, capacity * sizeof(size_t));
+  if (passenger_capacity != NULL)
+    fleet->passenger_capacity = passenger_capacity;
+  struct CarDetails *details = realloc(fleet->details, capacity * sizeof(struct CarDetails));
+  if (details != NULL)
+    fleet->details = details;
+
+  if (available == NULL || rental_rate == NULL || passenger_capacity == NULL ||
+      details == NULL) {
+    fprintf(stderr, "Out of memory while loading the car table\n");
+    return -1;
+  }
+  fleet->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Bring a car table up to date with its file, reading the file again only
+ * if it changed since it was last loaded, by this process or another.
+ * Returns -1 if the file cannot be read.
+ */
+int refreshFleet(struct Fleet *fleet, const char *path)
+{
+  struct CarModel cars[64];
+  struct stat info;
+  size_t read;
+
+  if (stat(path, &info) != 0) {
+    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
+    return -1;
+  }
+  if (fleet->loaded && stampMatches(&fleet->stamp, &info))
+    return 0;
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening the file for reading: %s\n", strerror(errno));
+    return -1;
+  }
+  fleet->loaded = false;
+  fleet->count = 0;
+  if (keyIndexReset(&fleet->by_model, info.st_size / sizeof(struct CarModel)) != 0) {
+    fclose(file);
+    return -1;
+  }
+  while ((read = fread(cars, sizeof(struct CarModel), 64, file)) > 0) {
+    if (reserveFleet(fleet, fleet->count + read) != 0) {
+      fclose(file);
+      return -1;
+    }
+    for (size_t i = 0; i < read; i++) {
+      size_t index = fleet->count++;
+      struct CarDetails *details = &fleet->details[index];
+
+      fleet->available[index] = cars[i].available_status;
+      fleet->rental_rate[index] = cars[i].rental_rate;
+      fleet->passenger_capacity[index] = cars[i].passenger_capacity;
+      memcpy(details->model_name, cars[i].model_name, sizeof(details->model_name));
+      memcpy(details->company, cars[i].company, sizeof(details->company));
+      details->year = cars[i].year;
+      details->fuel_efficiency = cars[i].fuel_efficiency;
+      memcpy(details->color, cars[i].color, sizeof(details->color));
+      keyIndexInsert(&fleet->by_model,
+                     hashKey(details->model_name, sizeof(details->model_name)), index);
+    }
+    atomic_fetch_add(&table_bytes_loaded, read * sizeof(struct CarModel));
+  }
+  fclose(file);
+
+  /* A write that raced with the read changes the file again, so it is seen next time */
+  stampFile(&fleet->stamp, &info);
+  fleet->loaded = true;
+  return 0;
+}
+
+/* Car table of the selected branch, or NULL if the database cannot be read */
+struct Fleet *loadFleet(void)
+{
+  struct Fleet *fleet = &fleets[current_branch];
+
+  return refreshFleet(fleet, car_database) == 0 ? fleet : NULL;
+}
+/* Have the selected branch's car table read again after a write */
+void invalidateFleet(void)
+{
+  fleets[current_branch].loaded = false;
+}
+
+/* Put a car of a fleet back together */
+void fleetCar(const struct Fleet *fleet, size_t index, struct CarModel *car)
+{
+  const struct CarDetails *details = &fleet->details[index];
+
+  memset(car, 0, sizeof(struct CarModel));
+  memcpy(car->model_name, details->model_name, sizeof(car->model_name));
+  memcpy(car->company, details->company, sizeof(car->company));
+  car->year = details->year;
+  car->rental_rate = fleet->rental_rate[index];
+  car->passenger_capacity = fleet->passenger_capacity[index];
+  car->fuel_efficiency = details->fuel_efficiency;
+  memcpy(car->color, details->color, sizeof(car->color));
+  car->available_status = fleet->available[index];
+}
+
+/* Hash of a key stored in a field of at most size bytes (FNV-1a) */
+unsigned long long hashKey(const char *key, size_t size)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < size && key[i] != '\0'; i++)
+    hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+  return hash;
+}
+
+void stampFile(struct FileStamp *stamp, const struct stat *info)
+{
+  stamp->device = info->st_dev;
+  stamp->inode = info->st_ino;
+  stamp->size = info->st_size;
+  stamp->modified = info->st_mtim;
+}
+
+/* Whether a file is still the one a stamp was taken of, unchanged */
+bool stampMatches(const struct FileStamp *stamp, const struct stat *info)
+{
+  return stamp->device == info->st_dev && stamp->inode == info->st_ino &&
+         stamp->size == info->st_size &&
+         stamp->modified.tv_sec == info->st_mtim.tv_sec &&
+         stamp->modified.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+bool stampCurrent(const struct FileStamp *stamp, const char *path)
+{
+  struct stat info;
+
+  return stat(path, &info) == 0 && stampMatches(stamp, &info);
+}
+
+/**
+ * Empty an index, making room for about expected keys.
+ * Returns -1 when out of memory.
+ */
+int keyIndexReset(struct KeyIndex *index, size_t expected)
+{
+  size_t capacity = INDEX_MIN_CAPACITY;
+
+  while (capacity < expected * 2)
+    capacity *= 2;
+  if (index->mapped) {
+    /* The mapping belongs to the index file; start over on the heap */
+    index->slots = NULL;
+    index->capacity = 0;
+    index->mapped = false;
+  }
+  if (capacity > index->capacity) {
+    struct IndexSlot *slots = realloc(index->slots, capacity * sizeof(struct IndexSlot));
+    if (slots == NULL) {
+      fprintf(stderr, "Out of memory while building an index\n");
+      return -1;
+    }
+    index->slots = slots;
+    index->capacity = capacity;
+  }
+  for (size_t i = 0; i < index->capacity; i++)
+    index->slots[i].record = -1;
+  index->count = 0;
+  return 0;
+}
+
+/* Add a record under the hash of its key. Returns -1 when out of memory. */
+int keyIndexInsert(struct KeyIndex *index, unsigned long long hash, long record)
+{
+  /* Keep the index at most three quarters full */
+  if ((index->count + 1) * 4 > index->capacity * 3) {
+    struct KeyIndex grown = {0};
+    if (keyIndexReset(&grown, index->capacity) != 0)
+      return -1;
+    for (size_t i = 0; i < index->capacity; i++) {
+      if (index->slots[i].record >= 0)
+        keyIndexInsert(&grown, index->slots[i].hash, index->slots[i].record);
+    }
+    if (!index->mapped)
+      free(index->slots);
+    *index = grown;
+  }
+
+  size_t mask = index->capacity - 1;
+  size_t position = hash & mask;
+  while (index->slots[position].record >= 0)
+    position = (position + 1) & mask;
+  index->slots[position].hash = hash;
+  index->slots[position].record = record;
+  index->count++;
+  return 0;
+}
+
+/**
+ * Next record filed under a hash, continuing from *probe (0 to start).
+ * Returns -1 when there are no more.
+ */
+long keyIndexNext(const struct KeyIndex *index, unsigned long long hash, size_t *probe)
+{
+  size_t mask = index->capacity - 1;
+
+  for (; *probe < index->capacity; (*probe)++) {
+    const struct IndexSlot *slot = &index->slots[(hash + *probe) & mask];
+    if (slot->record < 0)
+      return -1;
+    if (slot->hash == hash) {
+      (*probe)++;
+      return slot->record;
+    }
+  }
+  return -1;
+}
+
+/* File a user under each of the keys a user can log in with */
+int indexUser(struct UserIndex *index, const struct Users *user, long record)
+{
+  if (keyIndexInsert(&index->by_username, hashKey(user->username, sizeof(user->username)),
+                     record) != 0 ||
+      keyIndexInsert(&index->by_number, hashKey(user->number, sizeof(user->number)),
+                     record) != 0 ||
+      keyIndexInsert(&index->by_email, hashKey(user->email, sizeof(user->email)),
+                     record) != 0)
+    return -1;
+  index->count++;
+  return 0;
+}
+
+/**
+ * Bring the user indexes up to date with the user table, reading it again
+ * only if it changed. Returns -1 if the table cannot be read.
+ */
+int refreshUserIndex(struct UserIndex *index, const char *path)
+{
+  struct KeyIndex *const sections[] = {
+    &index->by_username, &index->by_number, &index->by_email
+  };
+  struct Users users[64];
+  struct stat info;
+  size_t read;
+
+  if (stat(path, &info) != 0)
+    return -1;
+  if (index->loaded && stampMatches(&index->stamp, &info))
+    return 0;
+
+  /* Use the index file if it was written for the table as it is now */
+  index->loaded = false;
+  index->dirty = false;
+  releaseIndexMap(&index->map, &index->map_size, sections, 3);
+  index->map = mapIndexFile(path, &info, sizeof(struct Users), &index->count, sections, 3,
+                            &index->map_size);
+  if (index->map != NULL) {
+    stampFile(&index->stamp, &info);
+    index->loaded = true;
+    return 0;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return -1;
+  size_t expected = info.st_size / sizeof(struct Users);
+  index->count = 0;
+  if (keyIndexReset(&index->by_username, expected) != 0 ||
+      keyIndexReset(&index->by_number, expected) != 0 ||
+      keyIndexReset(&index->by_email, expected) != 0) {
+    fclose(file);
+    return -1;
+  }
+  while ((read = fread(users, sizeof(struct Users), 64, file)) > 0) {
+    for (size_t i = 0; i < read; i++) {
+      if (indexUser(index, &users[i], index->count) != 0) {
+        fclose(file);
+        return -1;
+      }
+    }
+    atomic_fetch_add(&table_bytes_loaded, read * sizeof(struct Users));
+  }
+  fclose(file);
+  stampFile(&index->stamp, &info);
+  index->loaded = true;
+  saveIndexFile(path, &index->stamp, sizeof(struct Users), index->count, sections, 3);
+  return 0;
+}
+
+/* Indexes of the user table, or NULL if it cannot be read */
+struct UserIndex *loadUserIndex(void)
+{
+  return refreshUserIndex(&user_index, user_database) == 0 ? &user_index : NULL;
+}
+
+/**
+ * Next user, read from the open user table fd, whose field at offset is
+ * key, continuing from *probe in the index of that field.
+ * Returns the user's position, or -1 when there are no more.
+ */
+long nextUser(int fd, const struct KeyIndex *index, size_t offset, const char *key,
+              size_t *probe, struct Users *user)
+{
+  unsigned long long hash = hashKey(key, SIZE_MAX);
+  long record;
+
+  while ((record = keyIndexNext(index, hash, probe)) >= 0) {
+    if (pread(fd, user, sizeof(struct Users), record * (off_t)sizeof(struct Users)) ==
+            (ssize_t)sizeof(struct Users) &&
+        strcmp((const char *)user + offset, key) == 0)
+      return record;
+  }
+  return -1;
+}
+
+/**
+ * Bring a rental index up to date with a rental log, reading the log again
+ * only if it changed. Returns -1 if the log cannot be read.
+ */
+int refreshRentalIndex(struct RentalIndex *index, const char *path)
+{
+  struct KeyIndex *const sections[] = {
+    &index->by_user, &index->by_id, &index->last_by_user, &index->next_by_user
+  };
+  struct Rental rentals[16];
+  struct stat info;
+  size_t read;
+
+  if (stat(path, &info) != 0)
+    return -1;
+  if (index->loaded && strcmp(index->path, path) == 0 && stampMatches(&index->stamp, &info))
+    return 0;
+
+  /* Use the index file if it was written for the log as it is now */
+  index->loaded = false;
+  index->dirty = false;
+  releaseIndexMap(&index->map, &index->map_size, sections, 4);
+  snprintf(index->path, sizeof(index->path), "%s", path);
+  index->map = mapIndexFile(path, &info, sizeof(struct Rental), &index->count, sections, 4,
+                            &index->map_size);
+  if (index->map != NULL) {
+    stampFile(&index->stamp, &info);
+    index->loaded = true;
+    return 0;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return -1;
+  index->count = 0;
+  /* Users are far fewer than rentals, so their indexes start small and grow */
+  if (keyIndexReset(&index->by_user, 0) != 0 ||
+      keyIndexReset(&index->last_by_user, 0) != 0 ||
+      keyIndexReset(&index->by_id, info.st_size / sizeof(struct Rental)) != 0 ||
+      keyIndexReset(&index->next_by_user, info.st_size / sizeof(struct Rental)) != 0) {
+    fclose(file);
+    return -1;
+  }
+  while ((read = fread(rentals, sizeof(struct Rental), 16, file)) > 0) {
+    for (size_t i = 0; i < read; i++) {
+      if (indexRental(index, &rentals[i], index->count) != 0) {
+        fclose(file);
+        return -1;
+      }
+      index->count++;
+    }
+    atomic_fetch_add(&table_bytes_loaded, read * sizeof(struct Rental));
+  }
+  fclose(file);
+  stampFile(&index->stamp, &info);
+  index->loaded = true;
+  saveIndexFile(path, &index->stamp, sizeof(struct Rental), index->count, sections, 4);
+  return 0;
+}
+
+/* Rental index of the selected branch's rental log, as reports read it */
+struct RentalIndex *loadRentalIndex(void)
+{
+  struct RentalIndex *index = &rental_indexes[current_branch];
+
+  return refreshRentalIndex(index, reportPath(rental_records)) == 0 ? index : NULL;
+}
+
+/**
+ * Read a page of a user's rentals in the selected branch: the rentals after
+ * the cursor's record, oldest first, at most limit of them. The page follows
+ * the user's chain in the rental index, so only its own records are looked
+ * up and read from the log; the cursor is moved past them. Returns an arena
+ * array of count rentals, or NULL if the rental log is empty.
+ */
+struct Rental *findUserRentals(const char *username, struct PageCursor *page, size_t limit,
+                               size_t *count)
+{
+  struct RentalIndex *index = loadRentalIndex();
+  unsigned long long user = hashKey(username, SIZE_MAX);
+  size_t probe = 0;
+  long record;
+
+  *count = 0;
+  page->more = false;
+  if (index == NULL || index->count == 0)
+    return NULL;
+  struct Rental *rentals = arenaAlloc(&request_arena, limit * sizeof(struct Rental));
+  if (rentals == NULL)
+    return NULL;
+
+  /* Resume after the cursor's record, which is normally one of the user's */
+  if (page->after < 0)
+    record = keyIndexNext(&index->by_user, user, &probe);
+  else if (keyIndexNext(&index->last_by_user, user, &probe) == page->after)
+    record = -1;
+  else if ((record = nextUserRental(index, user, page->after)) < 0) {
+    /* A cursor from elsewhere: skip the user's rentals up to it */
+    probe = 0;
+    record = keyIndexNext(&index->by_user, user, &probe);
+    while (record >= 0 && record <= page->after)
+      record = nextUserRental(index, user, record);
+  }
+  if (record < 0)
+    return rentals;
+
+  int fd = open(index->path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  for (; record >= 0 && *count < limit; record = nextUserRental(index, user, record)) {
+    struct Rental *rental = &rentals[*count];
+    if (pread(fd, rental, sizeof(struct Rental), record * (off_t)sizeof(struct Rental)) ==
+            (ssize_t)sizeof(struct Rental) &&
+        strcmp(rental->rentingUser.username, username) == 0)
+      (*count)++;
+    page->after = record;
+  }
+  close(fd);
+  page->more = record >= 0;
+  return rentals;
+}
+
+/* Body of a startup loader thread */
+void *loadTableThread(void *arg)
+{
+  struct TableLoad *load = arg;
+
+  switch (load->table) {
+  case CHANGE_TABLE_USERS:
+    load->result = refreshUserIndex(&user_index, load->path);
+    break;
+  case CHANGE_TABLE_CARS:
+    load->result = refreshFleet(&fleets[load->branch], load->path);
+    break;
+  case CHANGE_TABLE_RENTALS:
+    load->result = refreshRentalIndex(&rental_indexes[load->branch], load->path);
+    break;
+  }
+  atomic_fetch_add(&table_loads_done, 1);
+  return NULL;
+}
+
+/**
+ * Load the user table and every branch's car table and rental log, with
+ * their indexes, each on a thread of its own, so startup takes as long as
+ * the largest table. Used by the servers; everything else loads tables
+ * lazily through loadUserIndex(), loadFleet() and loadRentalIndex(). With
+ * verbose, progress and a summary are printed.
+ */
+void preloadTables(bool verbose)
+{
+  static struct TableLoad loads[1 + 2 * MAX_BRANCHES];
+  size_t num_loads = 0;
+  size_t total = 0;
+  size_t branch = current_branch;
+  double started = monotonicSeconds();
+  bool progress = verbose && isatty(STDOUT_FILENO);
+  struct stat info;
+
+  memset(loads, 0, sizeof(loads));
+  loads[num_loads].table = CHANGE_TABLE_USERS;
+  snprintf(loads[num_loads++].path, PATH_MAX, "%s", user_database);
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    loads[num_loads].table = CHANGE_TABLE_CARS;
+    loads[num_loads].branch = i;
+    snprintf(loads[num_loads++].path, PATH_MAX, "%s", car_database);
+    loads[num_loads].table = CHANGE_TABLE_RENTALS;
+    loads[num_loads].branch = i;
+    snprintf(loads[num_loads++].path, PATH_MAX, "%s", reportPath(rental_records));
+  }
+  selectBranch(branch);
+
+  atomic_store(&table_bytes_loaded, 0);
+  atomic_store(&table_loads_done, 0);
+  for (size_t i = 0; i < num_loads; i++) {
+    if (stat(loads[i].path, &info) == 0)
+      total += info.st_size;
+    loads[i].started = pthread_create(&loads[i].thread, NULL, loadTableThread, &loads[i]) == 0;
+    if (!loads[i].started)
+      loadTableThread(&loads[i]);
+  }
+
+  while (progress && atomic_load(&table_loads_done) < num_loads) {
+    size_t loaded = atomic_load(&table_bytes_loaded);
+    printf("\rLoading tables: %3zu%%", total > 0 && loaded < total ? loaded * 100 / total : 100);
+    fflush(stdout);
+    usleep(50000);
+  }
+  for (size_t i = 0; i < num_loads; i++) {
+    if (loads[i].started)
+      pthread_join(loads[i].thread, NULL);
+  }
+
+  if (verbose) {
+    size_t cars = 0, rentals = 0;
+    for (size_t i = 0; i < num_branches; i++) {
+      cars += fleets[i].count;
+      rentals += rental_indexes[i].count;
+    }
+    printf("%sLoaded %zu users, %zu cars and %zu rentals in %.0lf ms\n", progress ? "\r" : "",
+           user_index.count, cars, rentals, (monotonicSeconds() - started) * 1000);
+  }
+}
+
+/* Path of the index file kept next to a data file */
+void indexFilePath(const char *data_path, char *path, size_t size)
+{
+  snprintf(path, size, "%s.idx", data_path);
+}
+
+/**
+ * Write the indexes of a data file to its index file, tied to the data
+ * file's generation. The file is replaced atomically, so a reader maps
+ * either the old or the new one. Returns -1 on error.
+ */
+int saveIndexFile(const char *data_path, const struct FileStamp *generation,
+                  size_t record_size, size_t records,
+                  struct KeyIndex *const indexes[], size_t num_indexes)
+{
+  struct IndexFileHeader header;
+  char path[PATH_MAX + 4], temporary[PATH_MAX + 8];
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+  header.record_size = record_size;
+  header.records = records;
+  header.generation = *generation;
+  header.num_indexes = num_indexes;
+  for (size_t i = 0; i < num_indexes; i++) {
+    header.capacity[i] = indexes[i]->capacity;
+    header.count[i] = indexes[i]->count;
+  }
+
+  indexFilePath(data_path, path, sizeof(path));
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Error writing index %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (size_t i = 0; written && i < num_indexes; i++)
+    written = fwrite(indexes[i]->slots, sizeof(struct IndexSlot), indexes[i]->capacity,
+                     file) == indexes[i]->capacity;
+  if (fclose(file) != 0 || !written || rename(temporary, path) != 0) {
+    fprintf(stderr, "Error writing index %s: %s\n", path, strerror(errno));
+    remove(temporary);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Map the index file of a data file and point the indexes straight into the
+ * mapping, if the file was written for the data file as it is now. The
+ * mapping is private, so adding to an index never touches the file.
+ * Returns the mapping, or NULL if the file is missing or stale.
+ */
+void *mapIndexFile(const char *data_path, const struct stat *data_info, size_t record_size,
+                   size_t *records, struct KeyIndex *const indexes[], size_t num_indexes,
+                   size_t *map_size)
+{
+  char path[PATH_MAX + 4];
+  struct stat info;
+
+  indexFilePath(data_path, path, sizeof(path));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct IndexFileHeader)) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  const struct IndexFileHeader *header = map;
+  size_t expected = sizeof(struct IndexFileHeader);
+  bool valid = memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+               header->record_size == record_size && header->num_indexes == num_indexes &&
+               stampMatches(&header->generation, data_info);
+  for (size_t i = 0; valid && i < num_indexes; i++) {
+    size_t capacity = header->capacity[i];
+    valid = capacity > 0 && (capacity & (capacity - 1)) == 0 &&
+            header->count[i] <= capacity;
+    expected += capacity * sizeof(struct IndexSlot);
+  }
+  if (!valid || expected != (size_t)info.st_size) {
+    munmap(map, info.st_size);
+    return NULL;
+  }
+
+  struct IndexSlot *slots = (struct IndexSlot *)(header + 1);
+  for (size_t i = 0; i < num_indexes; i++) {
+    indexes[i]->slots = slots;
+    indexes[i]->capacity = header->capacity[i];
+    indexes[i]->count = header->count[i];
+    indexes[i]->mapped = true;
+    slots += header->capacity[i];
+  }
+  *records = header->records;
+  *map_size = info.st_size;
+  return map;
+}
+
+/* Unmap an index file, detaching the indexes that still point into it */
+void releaseIndexMap(void **map, size_t *map_size, struct KeyIndex *const indexes[],
+                     size_t num_indexes)
+{
+  if (*map == NULL)
+    return;
+  for (size_t i = 0; i < num_indexes; i++) {
+    if (indexes[i]->mapped) {
+      indexes[i]->slots = NULL;
+      indexes[i]->capacity = 0;
+      indexes[i]->count = 0;
+      indexes[i]->mapped = false;
+    }
+  }
+  munmap(*map, *map_size);
+  *map = NULL;
+  *map_size = 0;
+}
+
+/* Write out the indexes that records were added to since they were last saved */
+void saveIndexes(void)
+{
+  struct KeyIndex *const users[] = {
+    &user_index.by_username, &user_index.by_number, &user_index.by_email
+  };
+
+  if (user_index.loaded && user_index.dirty) {
+    saveIndexFile(user_database, &user_index.stamp, sizeof(struct Users), user_index.count,
+                  users, 3);
+    user_index.dirty = false;
+  }
+  for (size_t i = 0; i < num_branches; i++) {
+    struct RentalIndex *rentals = &rental_indexes[i];
+    struct KeyIndex *const sections[] = {
+      &rentals->by_user, &rentals->by_id, &rentals->last_by_user, &rentals->next_by_user
+    };
+
+    if (rentals->loaded && rentals->dirty) {
+      saveIndexFile(rentals->path, &rentals->stamp, sizeof(struct Rental), rentals->count,
+                    sections, 4);
+      rentals->dirty = false;
+    }
+  }
+}
+
+/* Ask a server to stop after the current round of work */
+void handleStopSignal(int signal_number)
+{
+  (void)signal_number;
+  stop_requested = 1;
+}
+
+/**
+ * First record of the page after a cursor. The row the cursor ended on is
+ * normally still at its record, whose key hash is given as current; when
+ * removals have moved it down, its key is looked up in the table's index.
+ */
+long resumePage(const struct PageCursor *page, unsigned long long current,
+                const struct KeyIndex *index)
+{
+  long moved = -1;
+  long record;
+  size_t probe = 0;
+
+  if (page->after < 0)
+    return 0;
+  if (current == page->key)
+    return page->after + 1;
+  while (index != NULL && (record = keyIndexNext(index, page->key, &probe)) >= 0) {
+    if (record < page->after && record > moved)
+      moved = record;
+  }
+  /* The row itself was removed: the rows after it moved down at least one record */
+  return moved >= 0 ? moved + 1 : page->after;
+}
+
+/* First car of a branch's fleet on the page after a cursor */
+size_t fleetPageStart(const struct Fleet *fleet, const struct PageCursor *page)
+{
+  unsigned long long current = 0;
+
+  if (page->after >= 0 && (size_t)page->after < fleet->count)
+    current = hashKey(fleet->details[page->after].model_name,
+                      sizeof(fleet->details[page->after].model_name));
+  return resumePage(page, current, &fleet->by_model);
+}
+
+/* A cursor at the start of a listing */
+void pageStart(struct PageCursor *page, size_t branch)
+{
+  memset(page, 0, sizeof(struct PageCursor));
+  page->branch = branch;
+  page->after = -1;
+}
+
+/* Write a cursor as the opaque token clients pass back as "after" */
+void formatCursor(const struct PageCursor *page, char *text, size_t size)
+{
+  snprintf(text, size, "%zx.%lx.%llx", page->branch, page->after, page->key);
+}
+
+/* Read a token written by formatCursor(). Returns false if it is not one. */
+bool parseCursor(const char *text, struct PageCursor *page)
+{
+  size_t branch;
+  unsigned long after;
+  unsigned long long key;
+  char extra;
+
+  if (!isxdigit((unsigned char)text[0]) ||
+      sscanf(text, "%zx.%lx.%llx%c", &branch, &after, &key, &extra) != 3 ||
+      branch >= num_branches || after > LONG_MAX)
+    return false;
+  page->branch = branch;
+  page->after = after;
+  page->key = key;
+  page->more = true;
+  return true;
+}
+
+/**
+ * Start a listing of the session's at its first page. Listings of one
+ * user's rentals are of username; a NULL username lists the whole log.
+ */
+void sessionStartListing(struct Session *session, int listing, const char *username)
+{
+  session->listing = listing;
+  pageStart(&session->page, listing == LISTING_CARS || listing == LISTING_RENTALS ?
+                            0 : current_branch);
+  snprintf(session->listing_user, sizeof(session->listing_user), "%s",
+           username != NULL ? username : "");
+}
+
+/* Print the page of the session's listing and note where the next one starts */
+void sessionShowPage(struct Session *session)
+{
+  FILE *out = session->out;
+
+  session->next = session->page;
+  switch (session->listing) {
+  case LISTING_CARS:
+    viewCarsAllBranches(out, &session->next);
+    break;
+  case LISTING_BRANCH_CARS:
+    viewCars(out, &session->next, PAGE_ROWS);
+    break;
+  case LISTING_INDEXED_CARS:
+    viewCarsIndexed(out, &session->next, PAGE_ROWS);
+    break;
+  case LISTING_USERS:
+    viewUsers(out, &session->next, PAGE_ROWS);
+    break;
+  case LISTING_RENTALS:
+    showUserRentalsAllBranches(out, session->listing_user[0] != '\0' ? session->listing_user : NULL,
+                               &session->next);
+    break;
+  default:
+    return;
+  }
+  if (session->next.more)
+    fprintf(out, "\n(Enter 'n' for the next page)\n");
+}
+
+/**
+ * Show the next page of the session's listing if that is what the line asks
+ * for. Any other line ends the listing and is left to the session's state.
+ */
+bool sessionNextPage(struct Session *session, const char *line)
+{
+  if (session->listing == LISTING_NONE || !session->next.more || strcmp(line, "n") != 0) {
+    session->listing = LISTING_NONE;
+    return false;
+  }
+  /* The car and user screens show their listing with their menu */
+  if (session->state == STATE_ADMIN_CARS || session->state == STATE_ADMIN_USERS) {
+    session->page = session->next;
+    return true;
+  }
+  bool report = session->listing == LISTING_USERS ||
+                (session->listing == LISTING_RENTALS && session->listing_user[0] == '\0');
+  if (sessionAdmit(session, report ? REQUEST_REPORT : REQUEST_QUERY)) {
+    session->page = session->next;
+    sessionShowPage(session);
+    endRequest(&session->timer);
+  }
+  return true;
+}
+
+/**
+ * Read the "after" and "limit" parameters of a listing request into a
+ * cursor and page size. Responds and returns false if either is malformed.
+ */
+bool httpPage(struct HttpConnection *conn, const struct HttpRequest *request,
+              struct PageCursor *page, size_t *limit)
+{
+  char text[64];
+  long value = HTTP_PAGE_LIMIT;
+
+  if (httpParam(request, "limit", text, sizeof(text)) &&
+      (!parseLong(text, &value) || value < 1 || value > HTTP_MAX_PAGE_LIMIT)) {
+    httpError(conn, request, 400, "Invalid limit");
+    return false;
+  }
+  *limit = value;
+  if (httpParam(request, "after", text, sizeof(text)) && !parseCursor(text, page)) {
+    httpError(conn, request, 400, "Invalid cursor");
+    return false;
+  }
+  return true;
+}
+
+/* End a page of a JSON listing with its row count and the cursor of the next page */
+void jsonPageEnd(struct Buffer *buffer, size_t count, const struct PageCursor *page)
+{
+  char cursor[64];
+
+  bufferPrintf(buffer, "],\"count\":%zu,\"next\":", count);
+  if (page->more) {
+    formatCursor(page, cursor, sizeof(cursor));
+    jsonString(buffer, cursor, sizeof(cursor));
+  } else {
+    bufferAppend(buffer, "null", 4);
+  }
+  bufferAppend(buffer, "}", 1);
+}
+
+/**
+ * Move length bytes of a file, starting at offset, to another descriptor
+ * without copying them through this process: copy_file_range() between
+ * regular files, which lets the file system share or offload the copy, and
+ * sendfile() to anything else, sockets included. Kernels or file systems
+ * supporting neither fall back to a read/write loop. Stops early when a
+ * non-blocking output would block. Returns the bytes moved, or -1 with
+ * errno set if none could be.
+ */
+ssize_t streamFile(int in, off_t offset, size_t length, int out)
+{
+  struct stat info;
+  bool copy_range = fstat(out, &info) == 0 && S_ISREG(info.st_mode);
+  bool kernel = true;
+  size_t moved = 0;
+  char buffer[65536];
+
+  while (moved < length) {
+    ssize_t step;
+
+    if (copy_range) {
+      step = copy_file_range(in, &offset, out, NULL, length - moved, 0);
+      if (step < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                       errno == EOPNOTSUPP)) {
+        copy_range = false;
+        continue;
+      }
+    } else if (kernel) {
+      step = sendfile(out, in, &offset, length - moved);
+      if (step < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        kernel = false;
+        continue;
+      }
+    } else {
+      size_t size = length - moved < sizeof(buffer) ? length - moved : sizeof(buffer);
+      step = pread(in, buffer, size, offset);
+      if (step > 0) {
+        step = write(out, buffer, step);
+        if (step > 0)
+          offset += step;
+      }
+    }
+    if (step < 0 && errno == EINTR)
+      continue;
+    if (step < 0)
+      return moved > 0 ? (ssize_t)moved : -1;
+    if (step == 0)
+      break;
+    moved += step;
+  }
+  return moved;
+}
+
+/* Bytes of a file up to its last complete record; a record being appended is left out */
+off_t sealedLength(const struct stat *info, size_t record_size)
+{
+  return info->st_size - info->st_size % (off_t)record_size;
+}
+
+/**
+ * Copy one data file into a backup directory, keeping its path below data/.
+ * Only whole records are copied. A file that does not exist is skipped.
+ * Returns -1 on error.
+ */
+int backupFile(const char *path, const char *dir, size_t record_size, size_t *total)
+{
+  char target[PATH_MAX];
+  struct stat info;
+
+  int in = open(path, O_RDONLY);
+  if (in < 0)
+    return errno == ENOENT ? 0 : -1;
+  snprintf(target, sizeof(target), "%s%s", dir, path + strlen("data"));
+  int out = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0 || fstat(in, &info) != 0) {
+    fprintf(stderr, "Error backing up %s: %s\n", path, strerror(errno));
+    close(in);
+    if (out >= 0)
+      close(out);
+    return -1;
+  }
+
+  off_t length = sealedLength(&info, record_size);
+  ssize_t copied = streamFile(in, 0, length, out);
+  int result = 0;
+  if (copied != length || fsync(out) != 0) {
+    fprintf(stderr, "Error backing up %s: %s\n", path,
+            copied < 0 ? strerror(errno) : "short copy");
+    result = -1;
+  }
+  close(in);
+  close(out);
+  *total += copied > 0 ? copied : 0;
+  return result;
+}
+
+/**
+ * Back up the data directory into dir, branch by branch. The servers may
+ * keep running: each log is copied up to its last complete record.
+ */
+int backupData(const char *dir)
+{
+  char target[PATH_MAX];
+  size_t branch = current_branch;
+  size_t total = 0;
+  int result = 0;
+  double started = monotonicSeconds();
+
+  snprintf(target, sizeof(target), "%s/branches", dir);
+  if ((mkdir(dir, 0755) != 0 && errno != EEXIST) ||
+      (mkdir(target, 0755) != 0 && errno != EEXIST)) {
+    fprintf(stderr, "Error creating %s: %s\n", target, strerror(errno));
+    return -1;
+  }
+  if (backupFile(branch_list, dir, 1, &total) != 0 ||
+      backupFile(current_num_of_user, dir, 1, &total) != 0 ||
+      backupFile(user_database, dir, sizeof(struct Users), &total) != 0)
+    result = -1;
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    snprintf(target, sizeof(target), "%s%s", dir, branches[i].dir + strlen("data"));
+    if (mkdir(target, 0755) != 0 && errno != EEXIST) {
+      fprintf(stderr, "Error creating %s: %s\n", target, strerror(errno));
+      result = -1;
+      continue;
+    }
+    if (backupFile(car_database, dir, sizeof(struct CarModel), &total) != 0 ||
+        backupFile(rental_records, dir, sizeof(struct Rental), &total) != 0 ||
+        backupFile(branch_change_log, dir, sizeof(struct ChangeRecord), &total) != 0 ||
+        backupFile(waitlist_file, dir, sizeof(struct WaitlistEntry), &total) != 0 ||
+        backupFile(demand_stats_file, dir, 1, &total) != 0 ||
+        backupFile(car_units_file, dir, sizeof(struct CarUnit), &total) != 0 ||
+        backupFile(returns_file, dir, sizeof(struct RentalReturn), &total) != 0)
+      result = -1;
+  }
+  selectBranch(branch);
+
+  double seconds = monotonicSeconds() - started;
+  printf("Backed up %zu bytes to %s in %.0f ms (%.0f MB/s)\n", total, dir, seconds * 1000,
+         seconds > 0 ? total / seconds / 1e6 : 0.0);
+  return result;
+}
+
+/**
+ * GET /export/rentals[?branch=], as the admin: the raw rental log of a
+ * branch, up to its last complete record. The headers go out through the
+ * connection's buffer and the log is streamed from the file after them.
+ */
+void httpExportRentals(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20];
+  struct stat info;
+
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_LOGIN, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many attempts");
+    return;
+  }
+  if (strcmp(login, admin_user) != 0 || strcmp(password, admin_password) != 0) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+
+  int fd = open(reportPath(rental_records), O_RDONLY);
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    if (fd >= 0)
+      close(fd);
+    httpError(conn, request, 500, "The rental log cannot be read");
+    return;
+  }
+  bool keep_alive = request->keep_alive;
+  off_t length = sealedLength(&info, sizeof(struct Rental));
+  bufferPrintf(&conn->out,
+               "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+               "Content-Length: %lld\r\n%s\r\n",
+               (long long)length, keep_alive ? "" : "Connection: close\r\n");
+  conn->file = fd;
+  conn->file_offset = 0;
+  conn->file_end = length;
+  if (!keep_alive)
+    conn->close_after_write = true;
+}
+
+/* A user without the password, for change events */
+void jsonUser(struct Buffer *buffer, const struct Users *user)
+{
+  bufferAppend(buffer, "{\"username\":", 12);
+  jsonString(buffer, user->username, sizeof(user->username));
+  bufferAppend(buffer, ",\"fullname\":", 12);
+  jsonString(buffer, user->fullname, sizeof(user->fullname));
+  bufferAppend(buffer, ",\"address\":", 11);
+  jsonString(buffer, user->address, sizeof(user->address));
+  bufferAppend(buffer, ",\"number\":", 10);
+  jsonString(buffer, user->number, sizeof(user->number));
+  bufferAppend(buffer, ",\"email\":", 9);
+  jsonString(buffer, user->email, sizeof(user->email));
+  bufferAppend(buffer, "}", 1);
+}
+
+/**
+ * One change of a branch's change log as a change event: a JSON object on
+ * a line of its own, named after the table and the kind of change, with
+ * the record as it is after the change (or as it was, for a removal).
+ */
+void jsonChange(struct Buffer *buffer, const struct ChangeRecord *change, const char *branch)
+{
+  static const char *const tables[] = {"car", "user", "rental", "unit", "return", "waitlist",
+                                       "demand", "notification"};
+  static const char *const ops[] = {"created", "updated", "removed"};
+
+  if (change->table < CHANGE_TABLE_CARS || change->table > CHANGE_TABLE_NOTIFICATIONS ||
+      change->op < CHANGE_OP_APPEND || change->op > CHANGE_OP_REMOVE)
+    return;
+  bufferPrintf(buffer, "{\"seq\":%zu,\"type\":\"%s.%s\",\"time\":%lld,\"record\":%ld,\"branch\":",
+               change->seq, tables[change->table], ops[change->op],
+               (long long)change->committed_at, change->index);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferAppend(buffer, ",\"data\":", 8);
+  if (change->table == CHANGE_TABLE_CARS)
+    jsonCar(buffer, &change->data.car, branch);
+  else if (change->table == CHANGE_TABLE_USERS)
+    jsonUser(buffer, &change->data.user);
+  else if (change->table == CHANGE_TABLE_RENTALS)
+    jsonRental(buffer, &change->data.rental, branch);
+  else if (change->table == CHANGE_TABLE_UNITS)
+    jsonUnit(buffer, &change->data.unit, branch);
+  else if (change->table == CHANGE_TABLE_RETURNS)
+    jsonReturn(buffer, &change->data.rental_return);
+  else if (change->table == CHANGE_TABLE_WAITLIST)
+    jsonWaitlistEntry(buffer, &change->data.waitlist_entry, branch);
+  else if (change->table == CHANGE_TABLE_DEMAND)
+    jsonDemand(buffer, &change->data.demand, branch);
+  else
+    jsonNotification(buffer, &change->data.notification, branch);
+  bufferAppend(buffer, "}\n", 2);
+}
+
+/**
+ * Append the events of a change log that follow sequence number after, at
+ * most max of them, to a buffer. Returns the sequence number of the last
+ * event appended, or after if there were none.
+ */
+size_t readChanges(const char *path, size_t after, size_t max, struct Buffer *buffer,
+                   const char *branch)
+{
+  struct ChangeRecord changes[16];
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return after;
+  while (max > 0) {
+    size_t wanted = max < 16 ? max : 16;
+    ssize_t length = pread(fd, changes, wanted * sizeof(struct ChangeRecord),
+                           after * (off_t)sizeof(struct ChangeRecord));
+    size_t count = length > 0 ? length / sizeof(struct ChangeRecord) : 0;
+    if (count == 0)
+      break;
+    for (size_t i = 0; i < count; i++) {
+      jsonChange(buffer, &changes[i], branch);
+      after = changes[i].seq;
+    }
+    max -= count;
+  }
+  close(fd);
+  return after;
+}
+
+/* Send a subscriber the events it has not seen yet, while its client keeps up */
+void pushEvents(struct HttpConnection *conn)
+{
+  if (conn->out.length - conn->out_sent >= HTTP_MAX_PENDING_OUTPUT)
+    return;
+  selectBranch(conn->events_branch);
+  conn->events_seq = readChanges(branch_change_log, conn->events_seq, EVENT_BATCH, &conn->out,
+                                 branches[conn->events_branch].name);
+}
+
+/**
+ * GET /events[?branch=][&after=], as the admin: the branch's change events
+ * with a sequence number above after, then every new one as it is
+ * committed, until the client disconnects. Users are changed in the main
+ * branch's feed.
+ */
+void httpEvents(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20], text[32];
+  long after = 0;
+
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_LOGIN, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many attempts");
+    return;
+  }
+  if (strcmp(login, admin_user) != 0 || strcmp(password, admin_password) != 0) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  if (httpParam(request, "after", text, sizeof(text)) && (!parseLong(text, &after) || after < 0)) {
+    httpError(conn, request, 400, "Invalid sequence number");
+    return;
+  }
+
+  /* The response has no length: it lasts as long as the subscription */
+  bufferPrintf(&conn->out, "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\n"
+               "Cache-Control: no-cache\r\nConnection: close\r\n\r\n");
+  conn->subscribed = true;
+  conn->events_branch = current_branch;
+  conn->events_seq = after;
+  pushEvents(conn);
+}
+
+/**
+ * Print a branch's change events to standard output as they are committed,
+ * starting after sequence number after, like tail -f on the change log.
+ * Runs until interrupted.
+ */
+int tailEvents(const char *branch_name, size_t after)
+{
+  struct Buffer lines = {NULL, 0, 0};
+  size_t branch = 0;
+
+  while (branch < num_branches && strcmp(branches[branch].name, branch_name) != 0)
+    branch++;
+  if (branch == num_branches) {
+    fprintf(stderr, "Unknown branch '%s'\n", branch_name);
+    return -1;
+  }
+  signal(SIGINT, handleStopSignal);
+  signal(SIGTERM, handleStopSignal);
+  selectBranch(branch);
+
+  while (!stop_requested) {
+    lines.length = 0;
+    size_t seq = readChanges(branch_change_log, after, EVENT_BATCH, &lines, branch_name);
+    if (fwrite(lines.data, 1, lines.length, stdout) != lines.length || fflush(stdout) != 0)
+      break;
+    if (seq == after)
+      usleep(EVENT_POLL_MS * 1000);
+    after = seq;
+  }
+  free(lines.data);
+  return 0;
+}
+
+/**
+ * Whether a rental carries its commit time. Rentals logged before rented_at
+ * existed hold the tail of the old time text there, which always reads as a
+ * time before 2001 or after 2106.
+ */
+bool rentalStamped(const struct Rental *rental)
+{
+  return rental->rented_at >= RENTAL_TIME_MIN && rental->rented_at < RENTAL_TIME_MAX;
+}
+
+/* The time a rental was made, as text */
+const char *rentalTime(const struct Rental *rental, char *text, size_t size)
+{
+  struct tm local;
+  time_t rented_at = rental->rented_at;
+
+  if (rentalStamped(rental) && localtime_r(&rented_at, &local) != NULL &&
+      strftime(text, size, "%a %b %d %H:%M:%S %Y", &local) > 0)
+    return text;
+  snprintf(text, size, "%.*s", (int)sizeof(rental->time), rental->time);
+  return text;
+}
+
+/**
+ * Bring a time index up to date with a rental log, sampling one record of
+ * every RENTAL_TIME_STRIDE appended since the last call. A log that was
+ * replaced is sampled again from the start. Stores the rentals in the log
+ * in records. Returns 0 on success and -1 on error.
+ */
+int refreshTimeIndex(struct TimeIndex *index, const char *path, size_t *records)
+{
+  struct stat info;
+  struct Rental rental;
+
+  *records = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT ? 0 : -1;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return -1;
+  }
+  *records = info.st_size / sizeof(struct Rental);
+  if (strcmp(index->path, path) != 0 || index->device != info.st_dev ||
+      index->inode != info.st_ino ||
+      (index->count > 0 && (index->count - 1) * RENTAL_TIME_STRIDE >= *records)) {
+    snprintf(index->path, sizeof(index->path), "%s", path);
+    index->device = info.st_dev;
+    index->inode = info.st_ino;
+    index->count = 0;
+  }
+
+  while (index->count * RENTAL_TIME_STRIDE < *records) {
+    if (index->count == index->capacity) {
+      size_t capacity = index->capacity > 0 ? index->capacity * 2 : INDEX_MIN_CAPACITY;
+      time_t *times = realloc(index->times, capacity * sizeof(time_t));
+      if (times == NULL) {
+        close(fd);
+        return -1;
+      }
+      index->times = times;
+      index->capacity = capacity;
+    }
+    off_t offset = index->count * RENTAL_TIME_STRIDE * (off_t)sizeof(struct Rental);
+    if (pread(fd, &rental, sizeof(struct Rental), offset) != (ssize_t)sizeof(struct Rental))
+      break;
+
+    /* Unstamped rentals and a clock set back take the time before them */
+    time_t previous = index->count > 0 ? index->times[index->count - 1] : 0;
+    time_t rented_at = rentalStamped(&rental) ? rental.rented_at : previous;
+    index->times[index->count++] = rented_at > previous ? rented_at : previous;
+  }
+  close(fd);
+  return 0;
+}
+
+/**
+ * Read a page of the rentals of the selected branch made from since up to,
+ * but not including, until, oldest first, at most limit of them, considering
+ * only the last rentals of the log when last is not 0. The time index finds
+ * the first candidate; the log is read from there. The cursor is moved past
+ * the rentals read. Returns an arena array of count rentals, or NULL on
+ * error.
+ */
+struct Rental *findRentalsByTime(time_t since, time_t until, size_t last,
+                                 struct PageCursor *page, size_t limit, size_t *count)
+{
+  struct TimeIndex *index = &time_indexes[current_branch];
+  struct Rental batch[16];
+  size_t records;
+
+  *count = 0;
+  page->more = false;
+  const char *path = reportPath(rental_records);
+  if (refreshTimeIndex(index, path, &records) != 0)
+    return NULL;
+  struct Rental *rentals = arenaAlloc(&request_arena, limit * sizeof(struct Rental));
+  if (rentals == NULL)
+    return NULL;
+
+  /* The last sample before since bounds where its rentals can start */
+  size_t low = 0, high = index->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (index->times[middle] < since)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  size_t first = low > 0 ? (low - 1) * RENTAL_TIME_STRIDE : 0;
+  if (last > 0 && last < records && records - last > first)
+    first = records - last;
+  if (page->after >= 0 && (size_t)page->after + 1 > first)
+    first = page->after + 1;
+  time_t previous = low > 0 ? index->times[low - 1] : 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return records == 0 ? rentals : NULL;
+  for (size_t record = first; record < records && !page->more;) {
+    ssize_t length = pread(fd, batch, sizeof(batch), record * (off_t)sizeof(struct Rental));
+    size_t read_count = length > 0 ? length / sizeof(struct Rental) : 0;
+    if (read_count == 0)
+      break;
+    for (size_t i = 0; i < read_count; i++, record++) {
+      time_t rented_at = rentalStamped(&batch[i]) ? batch[i].rented_at : previous;
+      if (rented_at > previous)
+        previous = rented_at;
+      if (previous >= until) {
+        record = records;
+        break;
+      }
+      if (previous < since)
+        continue;
+      if (*count == limit) {
+        page->more = true;
+        break;
+      }
+      rentals[(*count)++] = batch[i];
+      page->after = record;
+    }
+  }
+  close(fd);
+  return rentals;
+}
+
+/**
+ * GET /rentals[?branch=][&since=][&until=][&last=], as the admin: the
+ * branch's rentals made in a time window, given in seconds since the epoch,
+ * or among the last rentals made, oldest first and a page at a time.
+ */
+void httpRentalLog(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20], text[32];
+  long since = 0, until = LONG_MAX, last = 0;
+  struct PageCursor page;
+  size_t count;
+  size_t limit;
+
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_LOGIN, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many attempts");
+    return;
+  }
+  if (strcmp(login, admin_user) != 0 || strcmp(password, admin_password) != 0) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  if ((httpParam(request, "since", text, sizeof(text)) && (!parseLong(text, &since) || since < 0)) ||
+      (httpParam(request, "until", text, sizeof(text)) && (!parseLong(text, &until) || until < since)) ||
+      (httpParam(request, "last", text, sizeof(text)) && (!parseLong(text, &last) || last < 1))) {
+    httpError(conn, request, 400, "since, until and last must be counts of seconds or rentals");
+    return;
+  }
+  pageStart(&page, current_branch);
+  if (!httpPage(conn, request, &page, &limit))
+    return;
+  if (page.branch != current_branch) {
+    httpError(conn, request, 400, "Invalid cursor");
+    return;
+  }
+
+  struct Rental *rentals = findRentalsByTime(since, until, last, &page, limit, &count);
+  if (rentals == NULL) {
+    httpError(conn, request, 500, "The rental log could not be read");
+    return;
+  }
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"rentals\":[", 12);
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0)
+      bufferAppend(&http_body, ",", 1);
+    jsonRental(&http_body, &rentals[i], branches[current_branch].name);
+  }
+  jsonPageEnd(&http_body, count, &page);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/**
+ * Bring a branch's inventory up to date with its unit table, reading the
+ * table again only if another process changed it. Rebuilds the counters and
+ * free lists of every model, whose available units are handed out in table
+ * order. Returns -1 if the table cannot be read.
+ */
+int refreshInventory(struct Inventory *inventory, const char *path)
+{
+  struct CarUnit units[64];
+  struct stat info;
+  size_t read;
+
+  if (stat(path, &info) != 0) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+    /* A branch without units: every model is a single car */
+    memset(&info, 0, sizeof(info));
+  }
+  if (inventory->loaded && stampMatches(&inventory->stamp, &info))
+    return 0;
+
+  inventory->loaded = false;
+  inventory->count = 0;
+  inventory->num_models = 0;
+  if (keyIndexReset(&inventory->by_model, 0) != 0 ||
+      keyIndexReset(&inventory->by_plate, info.st_size / sizeof(struct CarUnit)) != 0 ||
+      keyIndexReset(&inventory->by_rental, info.st_size / sizeof(struct CarUnit)) != 0)
+    return -1;
+  FILE *file = info.st_size > 0 ? fopen(path, "rb") : NULL;
+  while (file != NULL && (read = fread(units, sizeof(struct CarUnit), 64, file)) > 0) {
+    for (size_t i = 0; i < read; i++) {
+      if (addUnit(inventory, &units[i]) < 0) {
+        fclose(file);
+        return -1;
+      }
+    }
+  }
+  if (file != NULL)
+    fclose(file);
+
+  /* Thread the free lists back to front so that they start with the first unit */
+  for (size_t i = inventory->count; i-- > 0;) {
+    if (inventory->units[i].status == UNIT_AVAILABLE)
+      pushFreeUnit(inventory, i);
+  }
+  stampFile(&inventory->stamp, &info);
+  inventory->loaded = true;
+  return 0;
+}
+
+/* Inventory of the selected branch, or NULL if its unit table cannot be read */
+struct Inventory *loadInventory(void)
+{
+  struct Inventory *inventory = &inventories[current_branch];
+
+  return refreshInventory(inventory, car_units_file) == 0 ? inventory : NULL;
+}
+
+/* Stock of a model, or NULL if the model has no units */
+struct ModelStock *findStock(struct Inventory *inventory, const char *model_name)
+{
+  unsigned long long hash = hashKey(model_name, SIZE_MAX);
+  size_t probe = 0;
+  long index;
+
+  while ((index = keyIndexNext(&inventory->by_model, hash, &probe)) >= 0) {
+    if (strcmp(inventory->models[index].model_name, model_name) == 0)
+      return &inventory->models[index];
+  }
+  return NULL;
+}
+
+/* Unit with a plate number, or -1 if there is none */
+long findUnit(struct Inventory *inventory, const char *plate)
+{
+  unsigned long long hash = hashKey(plate, SIZE_MAX);
+  size_t probe = 0;
+  long index;
+
+  while ((index = keyIndexNext(&inventory->by_plate, hash, &probe)) >= 0) {
+    if (strcmp(inventory->units[index].plate, plate) == 0)
+      return index;
+  }
+  return -1;
+}
+
+/**
+ * Add a unit read from or appended to the unit table to the in-memory
+ * inventory, counting it in its model's stock. The caller puts an available
+ * unit on its model's free list. Returns the unit's index, or -1 when out of
+ * memory.
+ */
+long addUnit(struct Inventory *inventory, const struct CarUnit *unit)
+{
+  struct ModelStock *stock = findStock(inventory, unit->model_name);
+
+  if (stock == NULL) {
+    if (inventory->num_models == inventory->models_capacity) {
+      size_t capacity = inventory->models_capacity > 0 ? inventory->models_capacity * 2 : 16;
+      struct ModelStock *models = realloc(inventory->models, capacity * sizeof(struct ModelStock));
+      if (models == NULL) {
+        fprintf(stderr, "Out of memory while loading the unit table\n");
+        return -1;
+      }
+      inventory->models = models;
+      inventory->models_capacity = capacity;
+    }
+    stock = &inventory->models[inventory->num_models];
+    memset(stock, 0, sizeof(struct ModelStock));
+    memcpy(stock->model_name, unit->model_name, sizeof(stock->model_name));
+    stock->free = -1;
+    if (keyIndexInsert(&inventory->by_model, hashKey(stock->model_name, sizeof(stock->model_name)),
+                       inventory->num_models) != 0)
+      return -1;
+    inventory->num_models++;
+  }
+
+  if (inventory->count == inventory->capacity) {
+    size_t capacity = inventory->capacity > 0 ? inventory->capacity * 2 : 64;
+    struct CarUnit *units = realloc(inventory->units, capacity * sizeof(struct CarUnit));
+    if (units != NULL)
+      inventory->units = units;
+    long *next_free = realloc(inventory->next_free, capacity * sizeof(long));
+    if (next_free != NULL)
+      inventory->next_free = next_free;
+    if (units == NULL || next_free == NULL) {
+      fprintf(stderr, "Out of memory while loading the unit table\n");
+      return -1;
+    }
+    inventory->capacity = capacity;
+  }
+  long index = inventory->count;
+  if (keyIndexInsert(&inventory->by_plate, hashKey(unit->plate, sizeof(unit->plate)), index) != 0 ||
+      (unit->status == UNIT_RENTED &&
+       keyIndexInsert(&inventory->by_rental, hashKey(unit->rentalID, sizeof(unit->rentalID)),
+                      index) != 0))
+    return -1;
+  inventory->units[index] = *unit;
+  inventory->next_free[index] = -1;
+  inventory->count++;
+  stock->units++;
+  return index;
+}
+
+/* Put an available unit at the head of its model's free list */
+void pushFreeUnit(struct Inventory *inventory, long index)
+{
+  struct ModelStock *stock = findStock(inventory, inventory->units[index].model_name);
+
+  inventory->next_free[index] = stock->free;
+  stock->free = index;
+  stock->available++;
+}
+
+/* Take a unit that stops being available off its model's free list */
+void unlinkFreeUnit(struct Inventory *inventory, long index)
+{
+  struct ModelStock *stock = findStock(inventory, inventory->units[index].model_name);
+  long *link = &stock->free;
+
+  while (*link >= 0 && *link != index)
+    link = &inventory->next_free[*link];
+  if (*link == index) {
+    *link = inventory->next_free[index];
+    stock->available--;
+  }
+}
+
+/**
+ * Write units of the selected branch to the unit table, without logging
+ * them. The inventory stays loaded unless another process changed the table
+ * since it was read. Returns 0 on success and -1 on error.
+ */
+int storeUnits(struct Inventory *inventory, const long *indexes, size_t count)
+{
+  struct stat info;
+
+  /* A table that does not exist yet matches the stamp of an empty inventory */
+  if (stat(car_units_file, &info) != 0)
+    memset(&info, 0, sizeof(info));
+  bool current = stampMatches(&inventory->stamp, &info);
+
+  int fd = open(car_units_file, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Error opening %s: %s\n", car_units_file, strerror(errno));
+    inventory->loaded = false;
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (pwrite(fd, &inventory->units[indexes[i]], sizeof(struct CarUnit),
+               indexes[i] * (off_t)sizeof(struct CarUnit)) != (ssize_t)sizeof(struct CarUnit)) {
+      fprintf(stderr, "Error writing to %s: %s\n", car_units_file, strerror(errno));
+      close(fd);
+      inventory->loaded = false;
+      return -1;
+    }
+  }
+  close(fd);
+
+  inventory->loaded = current && stat(car_units_file, &info) == 0;
+  if (inventory->loaded)
+    stampFile(&inventory->stamp, &info);
+  return 0;
+}
+
+/**
+ * Write a unit of the selected branch to the unit table and log the change.
+ * Returns 0 on success and -1 on error.
+ */
+int saveUnit(struct Inventory *inventory, long index, int op)
+{
+  if (storeUnits(inventory, &index, 1) != 0)
+    return -1;
+  logChange(CHANGE_TABLE_UNITS, op, index, &inventory->units[index]);
+  return 0;
+}
+
+/**
+ * Take the first free unit of a model of the selected branch for a rental,
+ * in memory only. Returns the unit's index, or -1 if no unit is free.
+ */
+long takeFreeUnit(struct Inventory *inventory, struct ModelStock *stock, const char *rentalID)
+{
+  long index = stock->free;
+
+  if (index < 0)
+    return -1;
+  stock->free = inventory->next_free[index];
+  stock->available--;
+  inventory->units[index].status = UNIT_RENTED;
+  snprintf(inventory->units[index].rentalID, sizeof(inventory->units[index].rentalID), "%s",
+           rentalID);
+  if (keyIndexInsert(&inventory->by_rental, hashKey(rentalID, SIZE_MAX), index) != 0)
+    inventory->loaded = false;
+  return index;
+}
+
+/**
+ * Allocate the first free unit of a model of the selected branch to a
+ * rental. Returns the unit's index, or -1 if no unit is free.
+ */
+long allocateUnit(struct Inventory *inventory, struct ModelStock *stock, const char *rentalID)
+{
+  long index = takeFreeUnit(inventory, stock, rentalID);
+
+  if (index < 0)
+    return -1;
+  return saveUnit(inventory, index, CHANGE_OP_UPDATE) == 0 ? index : -1;
+}
+
+/**
+ * Keep a model's catalog row available exactly while one of its units is.
+ * A model that becomes available goes to the next customer on the waitlist.
+ */
+void syncModelAvailability(FILE *out, const char *model_name, bool available)
+{
+  struct CarModel car;
+
+  long index = findCarIndex(model_name, &car);
+  if (index < 0 || car.available_status == available)
+    return;
+  car.available_status = available;
+  saveCar(out, index, &car, !available);
+}
+
+/**
+ * Add a unit of a catalog model to the selected branch, available at once.
+ * From its first unit on, a model is available exactly while a unit is.
+ */
+void addCarUnit(FILE *out, const struct CarUnit *unit)
+{
+  struct CarModel car;
+
+  if (rejectWriteOnReplica(out))
+    return;
+  struct Inventory *inventory = loadInventory();
+  if (inventory == NULL)
+    return;
+  if (findCarIndex(unit->model_name, &car) < 0) {
+    fprintf(out, "Car '%s' not found in the file.\n", unit->model_name);
+    return;
+  }
+  if (unit->plate[0] == '\0' || findUnit(inventory, unit->plate) >= 0) {
+    fprintf(out, "Plate number '%s' is empty or already taken.\n", unit->plate);
+    return;
+  }
+
+  struct CarUnit added = *unit;
+  added.status = UNIT_AVAILABLE;
+  long index = addUnit(inventory, &added);
+  if (index < 0) {
+    inventory->loaded = false;
+    return;
+  }
+  pushFreeUnit(inventory, index);
+  if (saveUnit(inventory, index, CHANGE_OP_APPEND) != 0)
+    return;
+  fprintf(out, "Unit '%s' of '%s' added.\n", added.plate, added.model_name);
+  syncModelAvailability(out, added.model_name, true);
+}
+
+/**
+ * Set the status of a unit of the selected branch, keeping its model's
+ * counters, free list and catalog row in step.
+ */
+void setCarUnitStatus(FILE *out, const char *plate, int status)
+{
+  if (rejectWriteOnReplica(out))
+    return;
+  struct Inventory *inventory = loadInventory();
+  if (inventory == NULL)
+    return;
+  long index = findUnit(inventory, plate);
+  if (index < 0) {
+    fprintf(out, "Unit '%s' not found.\n", plate);
+    return;
+  }
+
+  if (updateUnitStatus(out, inventory, index, status) == 0)
+    fprintf(out, "Unit '%s' is now %s.\n", plate, unit_status_names[status]);
+}
+
+/**
+ * Change the status of a unit of the selected branch, keeping its model's
+ * counters, free list and catalog row in step. Putting a unit back on the
+ * free list and making its model available take constant time.
+ * Returns 0 on success and -1 on error.
+ */
+int updateUnitStatus(FILE *out, struct Inventory *inventory, long index, int status)
+{
+  struct CarUnit *unit = &inventory->units[index];
+  if (unit->status == status)
+    return 0;
+  if (unit->status == UNIT_AVAILABLE)
+    unlinkFreeUnit(inventory, index);
+  else if (status == UNIT_AVAILABLE)
+    pushFreeUnit(inventory, index);
+  unit->status = status;
+
+  char model_name[sizeof(unit->model_name)];
+  memcpy(model_name, unit->model_name, sizeof(model_name));
+  if (saveUnit(inventory, index, CHANGE_OP_UPDATE) != 0)
+    return -1;
+  struct ModelStock *stock = findStock(inventory, model_name);
+  syncModelAvailability(out, model_name, stock != NULL && stock->available > 0);
+  return 0;
+}
+
+/* What the status column of a car listing shows for a model */
+const char *carStatus(const struct CarModel *car, char *text, size_t size)
+{
+  struct Inventory *inventory = loadInventory();
+  struct ModelStock *stock = inventory != NULL ? findStock(inventory, car->model_name) : NULL;
+
+  if (stock == NULL)
+    return car->available_status ? "Available" : "Not Available";
+  snprintf(text, size, "%zu of %zu free", stock->available, stock->units);
+  return text;
+}
+
+void jsonUnit(struct Buffer *buffer, const struct CarUnit *unit, const char *branch)
+{
+  bufferAppend(buffer, "{\"plate\":", 9);
+  jsonString(buffer, unit->plate, sizeof(unit->plate));
+  bufferAppend(buffer, ",\"model\":", 9);
+  jsonString(buffer, unit->model_name, sizeof(unit->model_name));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferPrintf(buffer, ",\"status\":\"%s\",\"rental\":",
+               unit->status >= UNIT_AVAILABLE && unit->status <= UNIT_SERVICE ?
+               unit_status_names[unit->status] : "unknown");
+  jsonString(buffer, unit->rentalID, sizeof(unit->rentalID));
+  bufferAppend(buffer, "}", 1);
+}
+
+/**
+ * GET /stock?model=[&branch=]: how many cars of a model the branch has and
+ * how many are free, read from the model's counters. A model without units
+ * is a single car.
+ */
+void httpStock(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char model[50];
+  struct CarModel car;
+
+  if (!httpParam(request, "model", model, sizeof(model))) {
+    httpError(conn, request, 400, "model is required");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+  struct Inventory *inventory = loadInventory();
+  struct ModelStock *stock = inventory != NULL ? findStock(inventory, model) : NULL;
+  if (stock == NULL && !findCar(model, &car)) {
+    httpError(conn, request, 404, "Unknown car model");
+    return;
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"model\":", 9);
+  jsonString(&http_body, model, sizeof(model));
+  bufferAppend(&http_body, ",\"branch\":", 10);
+  jsonString(&http_body, branches[current_branch].name, BRANCH_NAME_SIZE);
+  if (stock != NULL)
+    bufferPrintf(&http_body, ",\"units\":%zu,\"available\":%zu}", stock->units, stock->available);
+  else
+    bufferPrintf(&http_body, ",\"units\":1,\"available\":%d}", car.available_status ? 1 : 0);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/* Unit allocated to a rental that is still out, or -1 if there is none */
+long findRentedUnit(struct Inventory *inventory, const char *rentalID)
+{
+  unsigned long long hash = hashKey(rentalID, SIZE_MAX);
+  size_t probe = 0;
+  long index;
+
+  while ((index = keyIndexNext(&inventory->by_rental, hash, &probe)) >= 0) {
+    const struct CarUnit *unit = &inventory->units[index];
+    if (unit->status == UNIT_RENTED && strcmp(unit->rentalID, rentalID) == 0)
+      return index;
+  }
+  return -1;
+}
+
+/**
+ * Find a rental of the selected branch by its ID through the rental index.
+ * Returns the rental's record in the log, or -1 if there is no such rental.
+ */
+long findRentalByID(const char *rentalID, struct Rental *rental)
+{
+  struct RentalIndex *index = loadRentalIndex();
+  unsigned long long hash = hashKey(rentalID, SIZE_MAX);
+  size_t probe = 0;
+  long record;
+
+  if (index == NULL)
+    return -1;
+  int fd = open(index->path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  while ((record = keyIndexNext(&index->by_id, hash, &probe)) >= 0) {
+    if (pread(fd, rental, sizeof(struct Rental), record * (off_t)sizeof(struct Rental)) ==
+            (ssize_t)sizeof(struct Rental) &&
+        strcmp(rental->rentalID, rentalID) == 0)
+      break;
+  }
+  close(fd);
+  return record;
+}
+
+/**
+ * Bring a return index up to date with a branch's return log, reading the
+ * log again only if another process changed it.
+ * Returns -1 if the log cannot be read.
+ */
+int refreshReturnIndex(struct ReturnIndex *index, const char *path)
+{
+  struct RentalReturn returns[16];
+  struct stat info;
+  size_t read;
+
+  if (stat(path, &info) != 0) {
+    if (errno != ENOENT)
+      return -1;
+    memset(&info, 0, sizeof(info));
+  }
+  if (index->loaded && stampMatches(&index->stamp, &info))
+    return 0;
+
+  index->loaded = false;
+  index->count = 0;
+  if (keyIndexReset(&index->by_rental, info.st_size / sizeof(struct RentalReturn)) != 0)
+    return -1;
+  FILE *file = info.st_size > 0 ? fopen(path, "rb") : NULL;
+  while (file != NULL && (read = fread(returns, sizeof(struct RentalReturn), 16, file)) > 0) {
+    for (size_t i = 0; i < read; i++) {
+      if (keyIndexInsert(&index->by_rental,
+                         hashKey(returns[i].rentalID, sizeof(returns[i].rentalID)),
+                         index->count++) != 0) {
+        fclose(file);
+        return -1;
+      }
+    }
+  }
+  if (file != NULL)
+    fclose(file);
+  stampFile(&index->stamp, &info);
+  index->loaded = true;
+  return 0;
+}
+
+/* Whether a rental of the selected branch was checked in already */
+bool rentalReturned(const char *rentalID)
+{
+  struct ReturnIndex *index = &return_indexes[current_branch];
+  struct RentalReturn record;
+  unsigned long long hash = hashKey(rentalID, SIZE_MAX);
+  size_t probe = 0;
+  long position;
+  bool returned = false;
+
+  if (refreshReturnIndex(index, returns_file) != 0)
+    return false;
+  int fd = open(returns_file, O_RDONLY);
+  while (fd >= 0 && !returned && (position = keyIndexNext(&index->by_rental, hash, &probe)) >= 0) {
+    returned = pread(fd, &record, sizeof(record), position * (off_t)sizeof(record)) ==
+                   (ssize_t)sizeof(record) &&
+               strcmp(record.rentalID, rentalID) == 0;
+  }
+  if (fd >= 0)
+    close(fd);
+  return returned;
+}
+
+/**
+ * Append a return record to the selected branch's return log and log the
+ * change. Returns 0 on success and -1 on error.
+ */
+int appendReturn(const struct RentalReturn *record)
+{
+  struct ReturnIndex *index = &return_indexes[current_branch];
+  struct stat info;
+
+  bool current = refreshReturnIndex(index, returns_file) == 0;
+  FILE *file = fopen(returns_file, "ab");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", returns_file, strerror(errno));
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long position = ftell(file) / (long)sizeof(struct RentalReturn);
+  if (fwrite(record, sizeof(struct RentalReturn), 1, file) != 1) {
+    fprintf(stderr, "Error writing to %s: %s\n", returns_file, strerror(errno));
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  logChange(CHANGE_TABLE_RETURNS, CHANGE_OP_APPEND, position, record);
+
+  index->loaded = current && (size_t)position == index->count &&
+                  stat(returns_file, &info) == 0 &&
+                  keyIndexInsert(&index->by_rental,
+                                 hashKey(record->rentalID, sizeof(record->rentalID)),
+                                 position) == 0;
+  if (index->loaded) {
+    index->count++;
+    stampFile(&index->stamp, &info);
+  }
+  return 0;
+}
+
+/**
+ * Check a rental's car back in on the day it came back (YYYY-MM-DD): close
+ * the rental with a return record, charge the days past its return date at
+ * LATE_FEE_RATE times the daily rate, and make the unit or car available
+ * again. The rental is looked up by ID in every branch. Output of the
+ * waitlist, which may take the car straight away, goes to out.
+ * Returns NULL on success and what went wrong otherwise.
+ */
+const char *checkInRental(FILE *out, const char *rentalID, const char *date,
+                          struct RentalReturn *record)
+{
+  struct Rental rental;
+  size_t branch = current_branch;
+
+  long position = findRentalAnyBranch(rentalID, &rental);
+  if (position < 0)
+    return "Unknown rental";
+
+  const char *error = NULL;
+  int days = calculateRentalDays(rental.pickupDate, date);
+  if (rentalReturned(rentalID))
+    error = "The rental was checked in already";
+  else if (days < 0)
+    error = "The return date must be a YYYY-MM-DD date from the pickup date on";
+  if (error != NULL) {
+    selectBranch(branch);
+    return error;
+  }
+
+  memset(record, 0, sizeof(struct RentalReturn));
+  memcpy(record->rentalID, rental.rentalID, sizeof(record->rentalID));
+  memcpy(record->username, rental.rentingUser.username, sizeof(record->username));
+  memcpy(record->model_name, rental.selectedCar.model_name, sizeof(record->model_name));
+  snprintf(record->returnDate, sizeof(record->returnDate), "%s", date);
+  record->rental = position;
+  int late_days = calculateRentalDays(rental.returnDate, date);
+  record->late_days = late_days > 0 ? late_days : 0;
+  record->late_fee = record->late_days * rental.selectedCar.rental_rate * LATE_FEE_RATE;
+  record->returned_at = time(NULL);
+
+  error = closeRental(out, record) != 0 ? "The return could not be recorded" : NULL;
+  selectBranch(branch);
+  return error;
+}
+
+/* Describe a check-in, or why it failed, on a line of its own */
+void showCheckIn(FILE *out, const char *rentalID, const char *error,
+                 const struct RentalReturn *record)
+{
+  if (error != NULL)
+    fprintf(out, "%s: %s.\n", rentalID, error);
+  else if (record->late_days > 0)
+    fprintf(out, "%s: returned %s, %d day(s) late, late fee %.2lf NPR.\n", rentalID,
+            record->returnDate, record->late_days, record->late_fee);
+  else
+    fprintf(out, "%s: returned %s on time.\n", rentalID, record->returnDate);
+}
+
+/**
+ * Check in a batch of returns, one per line of text: a rental ID and,
+ * optionally, the day the car came back (today when omitted). Each result
+ * goes to out, or to json as an array element when json is not NULL.
+ * Returns the number of rentals checked in.
+ */
+size_t checkInBatch(const char *text, FILE *out, struct Buffer *json, double *late_fees)
+{
+  char line[128], rentalID[20], date[11], today[11];
+  struct RentalReturn record;
+  size_t checked_in = 0;
+  size_t items = 0;
+
+  todaysDate(today, sizeof(today));
+  *late_fees = 0;
+  while (*text != '\0') {
+    size_t length = strcspn(text, "\r\n");
+    snprintf(line, sizeof(line), "%.*s", (int)(length < sizeof(line) ? length : sizeof(line) - 1),
+             text);
+    text += length;
+    text += strspn(text, "\r\n");
+
+    int fields = sscanf(line, "%19s %10s", rentalID, date);
+    if (fields < 1)
+      continue;
+    /* Each return is a request of its own; neither caller keeps arena memory */
+    arenaReset(&request_arena);
+    const char *error = checkInRental(out, rentalID, fields == 2 ? date : today, &record);
+    if (error == NULL) {
+      checked_in++;
+      *late_fees += record.late_fee;
+    }
+    if (json == NULL) {
+      showCheckIn(out, rentalID, error, &record);
+      continue;
+    }
+    if (items++ > 0)
+      bufferAppend(json, ",", 1);
+    if (error != NULL) {
+      bufferAppend(json, "{\"rental\":", 10);
+      jsonString(json, rentalID, sizeof(rentalID));
+      bufferAppend(json, ",\"error\":", 9);
+      jsonString(json, error, strlen(error) + 1);
+      bufferAppend(json, "}", 1);
+    } else {
+      jsonReturn(json, &record);
+    }
+  }
+  return checked_in;
+}
+
+void jsonReturn(struct Buffer *buffer, const struct RentalReturn *record)
+{
+  bufferAppend(buffer, "{\"rental\":", 10);
+  jsonString(buffer, record->rentalID, sizeof(record->rentalID));
+  bufferAppend(buffer, ",\"username\":", 12);
+  jsonString(buffer, record->username, sizeof(record->username));
+  bufferAppend(buffer, ",\"model\":", 9);
+  jsonString(buffer, record->model_name, sizeof(record->model_name));
+  bufferAppend(buffer, ",\"plate\":", 9);
+  jsonString(buffer, record->plate, sizeof(record->plate));
+  bufferAppend(buffer, ",\"returned\":", 12);
+  jsonString(buffer, record->returnDate, sizeof(record->returnDate));
+  bufferPrintf(buffer, ",\"late_days\":%d,\"late_fee\":%.2f,\"canceled\":%s}",
+               record->late_days, record->late_fee, record->canceled ? "true" : "false");
+}
+
+/**
+ * POST /returns, as the admin: check in the rental given as rental, on the
+ * day given as date (today when omitted), or a batch of returns sent as the
+ * body, one "<rental ID> [<date>]" per line.
+ */
+void httpCheckIn(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20], rentalID[20], date[11];
+  char text[HTTP_BUFFER_SIZE];
+  double late_fees;
+
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_LOGIN, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many attempts");
+    return;
+  }
+  if (strcmp(login, admin_user) != 0 || strcmp(password, admin_password) != 0) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+  if (read_only) {
+    httpError(conn, request, 403, "This is a read-only replica");
+    return;
+  }
+
+  if (httpParam(request, "rental", rentalID, sizeof(rentalID))) {
+    if (httpParam(request, "date", date, sizeof(date)))
+      snprintf(text, sizeof(text), "%s %s", rentalID, date);
+    else
+      snprintf(text, sizeof(text), "%s", rentalID);
+  } else {
+    snprintf(text, sizeof(text), "%.*s", (int)request->body.length, request->body.data);
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"returns\":[", 12);
+  size_t checked_in = checkInBatch(text, stdout, &http_body, &late_fees);
+  bufferPrintf(&http_body, "],\"checked_in\":%zu,\"late_fees\":%.2f}", checked_in, late_fees);
+  httpRespond(conn, request, 200, &http_body);
+}
+
+/**
+ * Check in every return listed in a file, as the end of day does, and print
+ * each result and a summary. Returns 0 if the file could be read.
+ */
+int checkInFile(const char *path)
+{
+  double late_fees;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  char *text = malloc(size + 1);
+  if (text == NULL || fread(text, 1, size, file) != (size_t)size) {
+    fprintf(stderr, "Error reading %s\n", path);
+    free(text);
+    fclose(file);
+    return -1;
+  }
+  text[size] = '\0';
+  fclose(file);
+
+  double started = monotonicSeconds();
+  size_t checked_in = checkInBatch(text, stdout, NULL, &late_fees);
+  printf("Checked in %zu rental(s) in %.0f ms, late fees %.2lf NPR\n", checked_in,
+         (monotonicSeconds() - started) * 1000, late_fees);
+  free(text);
+  return 0;
+}
+
+/* Put a timer at the head of a slot of the timer wheel */
+void linkTimer(long handle, int slot)
+{
+  struct Timer *timer = &timer_wheel.timers[handle];
+
+  timer->slot = slot;
+  timer->prev = -1;
+  timer->next = timer_wheel.slots[slot];
+  if (timer->next >= 0)
+    timer_wheel.timers[timer->next].prev = handle;
+  timer_wheel.slots[slot] = handle;
+}
+
+/* Take a timer out of its slot */
+void unlinkTimer(long handle)
+{
+  struct Timer *timer = &timer_wheel.timers[handle];
+
+  if (timer->prev >= 0)
+    timer_wheel.timers[timer->prev].next = timer->next;
+  else
+    timer_wheel.slots[timer->slot] = timer->next;
+  if (timer->next >= 0)
+    timer_wheel.timers[timer->next].prev = timer->prev;
+}
+
+/**
+ * Put a timer in the slot its expiry falls in, on the lowest level whose
+ * span reaches it. A timer already due goes in the slot of the next tick,
+ * and one beyond the top level's span waits in its last slot.
+ */
+void placeTimer(long handle)
+{
+  time_t expires = timer_wheel.timers[handle].expires;
+  time_t span = (time_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  int level = 0;
+
+  if (expires < timer_wheel.now)
+    expires = timer_wheel.now;
+  if (expires - timer_wheel.now >= span)
+    expires = timer_wheel.now + span - 1;
+  while (expires - timer_wheel.now >= (time_t)1 << (TIMER_WHEEL_BITS * (level + 1)))
+    level++;
+  linkTimer(handle, level * TIMER_WHEEL_SLOTS +
+                    ((expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)));
+}
+
+/**
+ * Start a timer that expires at the given time (seconds since the epoch).
+ * Returns the timer's handle, or -1 when out of memory.
+ */
+long addTimer(int kind, time_t expires, size_t owner, long record)
+{
+  long handle = timer_wheel.free;
+
+  if (handle >= 0) {
+    timer_wheel.free = timer_wheel.timers[handle].next;
+  } else {
+    if (timer_wheel.used == timer_wheel.capacity) {
+      size_t capacity = timer_wheel.capacity > 0 ? timer_wheel.capacity * 2 : 1024;
+      struct Timer *timers = realloc(timer_wheel.timers, capacity * sizeof(struct Timer));
+      if (timers == NULL)
+        return -1;
+      timer_wheel.timers = timers;
+      timer_wheel.capacity = capacity;
+    }
+    handle = timer_wheel.used++;
+  }
+
+  struct Timer *timer = &timer_wheel.timers[handle];
+  timer->expires = expires;
+  timer->kind = kind;
+  timer->owner = owner;
+  timer->record = record;
+  placeTimer(handle);
+  timer_wheel.pending++;
+  return handle;
+}
+
+/* Give a timer's position back for reuse */
+void freeTimer(long handle)
+{
+  struct Timer *timer = &timer_wheel.timers[handle];
+
+  timer->slot = -1;
+  timer->next = timer_wheel.free;
+  timer_wheel.free = handle;
+  timer_wheel.pending--;
+}
+
+/* Stop a timer, whether it is still running or expired but not handled yet */
+void cancelTimer(long handle)
+{
+  if (handle < 0 || timer_wheel.timers[handle].slot < 0)
+    return;
+  unlinkTimer(handle);
+  freeTimer(handle);
+}
+
+/**
+ * Advance the timer wheel to the given time. Every time a level's slot
+ * comes round, its timers move to the levels below; the timers of each
+ * second passed join the expired list, from which they are handled as one
+ * batch. Returns the number of timers that expired.
+ */
+size_t expireTimers(time_t until)
+{
+  size_t expired = 0;
+
+  while (timer_wheel.now <= until) {
+    time_t now = timer_wheel.now;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if ((now & (((time_t)1 << (TIMER_WHEEL_BITS * level)) - 1)) != 0)
+        break;
+      int slot = level * TIMER_WHEEL_SLOTS +
+                 ((now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+      long handle = timer_wheel.slots[slot];
+      timer_wheel.slots[slot] = -1;
+      while (handle >= 0) {
+        long next = timer_wheel.timers[handle].next;
+        placeTimer(handle);
+        handle = next;
+      }
+    }
+
+    int slot = now & (TIMER_WHEEL_SLOTS - 1);
+    long handle = timer_wheel.slots[slot];
+    timer_wheel.slots[slot] = -1;
+    while (handle >= 0) {
+      long next = timer_wheel.timers[handle].next;
+      if (timer_wheel.timers[handle].expires > now) {
+        placeTimer(handle); /* Beyond the top level's span when it was placed */
+      } else {
+        linkTimer(handle, TIMER_EXPIRED);
+        expired++;
+      }
+      handle = next;
+    }
+    timer_wheel.now++;
+  }
+  timer_wheel.fired += expired;
+  return expired;
+}
+
+/* Take the next expired timer that was not handled yet. Returns false when there is none. */
+bool nextExpiredTimer(struct Timer *timer)
+{
+  long handle = timer_wheel.slots[TIMER_EXPIRED];
+
+  if (handle < 0)
+    return false;
+  *timer = timer_wheel.timers[handle];
+  unlinkTimer(handle);
+  freeTimer(handle);
+  return true;
+}
+
+/* Milliseconds a server may wait for input before the timer wheel's next tick */
+int timerPollTimeout(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return 1000 - now.tv_nsec / 1000000;
+}
+
+/**
+ * When a rental becomes overdue: the end of its return date. A log holds
+ * few distinct dates, so conversions are remembered in a small cache keyed
+ * by the date instead of calling mktime() for every rental.
+ * Returns -1 for an invalid date.
+ */
+time_t rentalDue(const struct Rental *rental)
+{
+  static struct { long date; time_t due; } cache[1024];
+  const char *text = rental->returnDate;
+  struct tm due = {0};
+  long date = 0;
+
+  /* YYYY-MM-DD read by hand; sscanf() would cost more than the rest of the scan */
+  for (int i = 0; i < 10; i++) {
+    if (i == 4 || i == 7 ? text[i] != '-' : !isdigit((unsigned char)text[i]))
+      return -1;
+    if (i != 4 && i != 7)
+      date = date * 10 + (text[i] - '0');
+  }
+  int year = date / 10000, month = date / 100 % 100, day = date % 100;
+  if (text[10] != '\0' || year < 1900 || month < 1 || month > 12 || day < 1 || day > 31)
+    return -1;
+  size_t slot = date % (sizeof(cache) / sizeof(cache[0]));
+  if (cache[slot].date == date)
+    return cache[slot].due;
+  due.tm_year = year - 1900;
+  due.tm_mon = month - 1;
+  due.tm_mday = day + 1;
+  due.tm_isdst = -1;
+  cache[slot].date = date;
+  cache[slot].due = mktime(&due);
+  return cache[slot].due;
+}
+
+/* Make room for the timers of count rentals. Returns -1 when out of memory. */
+int reserveRentalTimers(struct RentalTimers *tracked, size_t count)
+{
+  size_t capacity = tracked->capacity > 0 ? tracked->capacity : 1024;
+
+  if (count <= tracked->capacity)
+    return 0;
+  while (capacity < count)
+    capacity *= 2;
+  long *timers = realloc(tracked->timers, capacity * sizeof(long));
+  if (timers == NULL)
+    return -1;
+  for (size_t i = tracked->capacity; i < capacity; i++)
+    timers[i] = -1;
+  tracked->timers = timers;
+  tracked->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Bring the overdue timers of the selected branch up to date with its logs:
+ * start a timer for every rental appended since the last call and cancel
+ * the timer of every rental checked in since. Only what was appended is
+ * read, so rentals and returns of any process are picked up within a tick.
+ * Returns -1 if a log cannot be read or memory runs out.
+ */
+int trackRentals(size_t branch)
+{
+  struct RentalTimers *tracked = &rental_timers[branch];
+  struct Rental rentals[64];
+  struct RentalReturn returns[64];
+  struct stat info;
+  size_t read;
+  int result = 0;
+
+  size_t total = stat(rental_records, &info) == 0 ? info.st_size / sizeof(struct Rental) : 0;
+  FILE *file = total > tracked->rentals ? fopen(rental_records, "rb") : NULL;
+  if (file != NULL && fseeko(file, tracked->rentals * (off_t)sizeof(struct Rental), SEEK_SET) != 0) {
+    fclose(file);
+    file = NULL;
+  }
+  while (file != NULL && tracked->rentals < total &&
+         (read = fread(rentals, sizeof(struct Rental),
+                       total - tracked->rentals < 64 ? total - tracked->rentals : 64, file)) > 0) {
+    if (reserveRentalTimers(tracked, tracked->rentals + read) != 0) {
+      result = -1;
+      break;
+    }
+    for (size_t i = 0; i < read; i++) {
+      long record = tracked->rentals++;
+      time_t due = rentalDue(&rentals[i]);
+      if (tracked->timers[record] == RENTAL_RETURNED || due < 0)
+        continue;
+      tracked->timers[record] = addTimer(TIMER_RENTAL_OVERDUE, due, branch, record);
+      if (tracked->timers[record] < 0)
+        result = -1;
+    }
+  }
+  if (file != NULL)
+    fclose(file);
+
+  /* A return may be seen before its rental when both were appended since the last call */
+  total = stat(returns_file, &info) == 0 ? info.st_size / sizeof(struct RentalReturn) : 0;
+  file = total > tracked->returns ? fopen(returns_file, "rb") : NULL;
+  if (file != NULL &&
+      fseeko(file, tracked->returns * (off_t)sizeof(struct RentalReturn), SEEK_SET) != 0) {
+    fclose(file);
+    file = NULL;
+  }
+  while (file != NULL && tracked->returns < total &&
+         (read = fread(returns, sizeof(struct RentalReturn),
+                       total - tracked->returns < 64 ? total - tracked->returns : 64, file)) > 0) {
+    for (size_t i = 0; i < read; i++) {
+      long record = returns[i].rental;
+      if (record < 0 || reserveRentalTimers(tracked, record + 1) != 0)
+        continue;
+      cancelTimer(tracked->timers[record]);
+      tracked->timers[record] = RENTAL_RETURNED;
+    }
+    tracked->returns += read;
+  }
+  if (file != NULL)
+    fclose(file);
+
+  /* Rentals extended or shortened in place are found in the change log */
+  struct ChangeRecord changes[16];
+  const char *log = tableLogPath(CHANGE_TABLE_RENTALS);
+  total = stat(log, &info) == 0 ? info.st_size / sizeof(struct ChangeRecord) : 0;
+  int fd = total > tracked->changes ? open(log, O_RDONLY) : -1;
+  while (fd >= 0 && tracked->changes < total) {
+    ssize_t length = pread(fd, changes, sizeof(changes),
+                           tracked->changes * (off_t)sizeof(struct ChangeRecord));
+    size_t count = length > 0 ? length / sizeof(struct ChangeRecord) : 0;
+    if (count == 0)
+      break;
+    for (size_t i = 0; i < count; i++) {
+      long record = changes[i].index;
+      if (changes[i].table != CHANGE_TABLE_RENTALS || changes[i].op != CHANGE_OP_UPDATE ||
+          record < 0 || (size_t)record >= tracked->rentals ||
+          tracked->timers[record] == RENTAL_RETURNED)
+        continue;
+      time_t due = rentalDue(&changes[i].data.rental);
+      cancelTimer(tracked->timers[record]);
+      tracked->timers[record] = due >= 0 ?
+                                addTimer(TIMER_RENTAL_OVERDUE, due, branch, record) : -1;
+    }
+    tracked->changes += count;
+  }
+  if (fd >= 0)
+    close(fd);
+  return result;
+}
+
+/**
+ * Run the servers' timers once a tick: follow every branch's rental and
+ * return logs, advance the timer wheel to the current time, and report the
+ * rentals that became overdue, one line per branch. Other expired timers
+ * are left for the server to take with nextExpiredTimer().
+ */
+void runTimers(void)
+{
+  static size_t overdue[MAX_BRANCHES];
+  static char ids[MAX_BRANCHES][OVERDUE_REPORT_IDS * 22];
+  static struct Notification reminders[MAX_BRANCHES][OUTBOX_BATCH];
+  static size_t num_reminders[MAX_BRANCHES];
+  int logs[MAX_BRANCHES];
+  size_t branch = current_branch;
+
+  if (!timer_wheel.started)
+    return;
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    trackRentals(i);
+  }
+  selectBranch(branch);
+  time_t now = time(NULL);
+  if (expireTimers(now) == 0)
+    return;
+
+  memset(overdue, 0, sizeof(overdue));
+  memset(num_reminders, 0, sizeof(num_reminders));
+  for (size_t i = 0; i < num_branches; i++)
+    logs[i] = -1;
+  long handle = timer_wheel.slots[TIMER_EXPIRED];
+  while (handle >= 0) {
+    struct Timer *timer = &timer_wheel.timers[handle];
+    long next = timer->next;
+    if (timer->kind == TIMER_RENTAL_OVERDUE) {
+      size_t owner = timer->owner;
+      struct Rental rental;
+      rental_timers[owner].timers[timer->record] = -1;
+      if (overdue[owner] == 0)
+        ids[owner][0] = '\0';
+      /* Rentals long overdue at startup were reminded before */
+      bool remind = now - timer->expires < OVERDUE_REMINDER_WINDOW;
+      bool named = overdue[owner]++ < OVERDUE_REPORT_IDS;
+      if (named || remind) {
+        selectBranch(owner);
+        if (logs[owner] < 0)
+          logs[owner] = open(rental_records, O_RDONLY);
+        if (logs[owner] >= 0 &&
+            pread(logs[owner], &rental, sizeof(rental), timer->record * (off_t)sizeof(rental)) ==
+            (ssize_t)sizeof(rental)) {
+          size_t length = strlen(ids[owner]);
+          if (named)
+            snprintf(ids[owner] + length, sizeof(ids[owner]) - length, "%s%.20s",
+                     length > 0 ? ", " : "", rental.rentalID);
+          if (remind)
+            rentalNotification(&reminders[owner][num_reminders[owner]++],
+                               NOTIFY_RENTAL_OVERDUE, &rental);
+          if (num_reminders[owner] == OUTBOX_BATCH) {
+            queueNotifications(reminders[owner], OUTBOX_BATCH);
+            num_reminders[owner] = 0;
+          }
+        }
+      }
+      unlinkTimer(handle);
+      freeTimer(handle);
+    }
+    handle = next;
+  }
+  for (size_t i = 0; i < num_branches; i++) {
+    if (logs[i] >= 0)
+      close(logs[i]);
+    if (num_reminders[i] > 0) {
+      selectBranch(i);
+      queueNotifications(reminders[i], num_reminders[i]);
+    }
+  }
+  selectBranch(branch);
+
+  for (size_t i = 0; i < num_branches; i++) {
+    if (overdue[i] == 0)
+      continue;
+    overdue_rentals += overdue[i];
+    printf("%zu rental(s) of branch %s overdue: %s%s\n", overdue[i], branches[i].name,
+           ids[i], overdue[i] > OVERDUE_REPORT_IDS ? ", ..." : "");
+  }
+  fflush(stdout);
+}
+
+/**
+ * Start the servers' timer wheel from the persisted state: every rental of
+ * every branch that was not checked in gets a timer for its return date.
+ * Rentals already overdue expire on the first tick.
+ */
+void startTimers(void)
+{
+  double started = monotonicSeconds();
+  size_t branch = current_branch;
+
+  for (size_t i = 0; i <= TIMER_EXPIRED; i++)
+    timer_wheel.slots[i] = -1;
+  timer_wheel.free = -1;
+  timer_wheel.now = time(NULL);
+  timer_wheel.started = true;
+  for (size_t i = 0; i < num_branches; i++) {
+    struct stat info;
+    selectBranch(i);
+    /* The rental log already holds every change made in place before now */
+    if (stat(tableLogPath(CHANGE_TABLE_RENTALS), &info) == 0)
+      rental_timers[i].changes = info.st_size / sizeof(struct ChangeRecord);
+    if (trackRentals(i) != 0)
+      fprintf(stderr, "Not every rental of branch %s could be scheduled\n", branches[i].name);
+  }
+  selectBranch(branch);
+  printf("Scheduled %zu timers in %.0lf ms\n", timer_wheel.pending,
+         (monotonicSeconds() - started) * 1000);
+  fflush(stdout);
+}
+
+/* End the step a session waits in without its input, printing why */
+void sessionTimeout(struct Session *session, int state, const char *message)
+{
+  selectBranch(session->branch < num_branches ? session->branch : 0);
+  fprintf(session->out, "\n%s\n", message);
+  session->state = state;
+  session->masked = false;
+  sessionPrompt(session);
+  sessionRender(session);
+}
+
+/**
+ * Restart a session connection's idle timer after input, and run its
+ * confirmation timer exactly while a rental summary waits to be confirmed.
+ */
+void restartSessionTimers(struct SessionConnection *conn, size_t slot)
+{
+  bool confirming = conn->session.state == STATE_RENT_CONFIRM;
+
+  cancelTimer(conn->idle_timer);
+  conn->idle_timer = addTimer(TIMER_SESSION_IDLE, time(NULL) + SESSION_IDLE_TIMEOUT, slot, 0);
+  if (confirming && conn->confirm_timer < 0) {
+    conn->confirm_timer = addTimer(TIMER_RENTAL_CONFIRM, time(NULL) + RENTAL_CONFIRM_TIMEOUT,
+                                   slot, 0);
+  } else if (!confirming && conn->confirm_timer >= 0) {
+    cancelTimer(conn->confirm_timer);
+    conn->confirm_timer = -1;
+  }
+}
+
+/* Act on the expired timers of terminal sessions: abandoned summaries and idle clients */
+void fireSessionTimers(struct SessionConnection **connections)
+{
+  struct Timer timer;
+  char idle[80];
+
+  snprintf(idle, sizeof(idle), "Session closed after %d minutes without input. Goodbye!",
+           SESSION_IDLE_TIMEOUT / 60);
+  while (nextExpiredTimer(&timer)) {
+    struct SessionConnection **slot = &connections[timer.owner];
+    struct SessionConnection *conn = *slot;
+    if (timer.kind == TIMER_SESSION_IDLE && conn != NULL) {
+      conn->idle_timer = -1;
+      sessionTimeout(&conn->session, STATE_CLOSED, idle);
+    } else if (timer.kind == TIMER_RENTAL_CONFIRM && conn != NULL) {
+      conn->confirm_timer = -1;
+      if (conn->session.deferred || conn->session.state != STATE_RENT_CONFIRM)
+        continue; /* The confirmation is being handled */
+      sessionTimeout(&conn->session, STATE_USER_MENU,
+                     "The rental summary expired unconfirmed. Returning to the User Dashboard...");
+    } else {
+      continue;
+    }
+    arenaReset(&request_arena);
+    if (!flushSessionOutput(conn) ||
+        (conn->session.state == STATE_CLOSED && conn->out.length == 0))
+      closeSessionConnection(slot);
+  }
+}
+
+/**
+ * Find a rental by its ID in every branch through the rental indexes, and
+ * select the branch it belongs to. Returns the rental's record in that
+ * branch's log, or -1, with the selected branch unchanged, if there is none.
+ */
+long findRentalAnyBranch(const char *rentalID, struct Rental *rental)
+{
+  size_t branch = current_branch;
+
+  for (size_t i = 0; i < num_branches; i++) {
+    selectBranch(i);
+    long position = findRentalByID(rentalID, rental);
+    if (position >= 0)
+      return position;
+  }
+  selectBranch(branch);
+  return -1;
+}
+
+/**
+ * Close a rental of the selected branch with its record in the return log
+ * and make its car available again: a unit goes back on its model's free
+ * list, and a model without units is the car itself. Output of the
+ * waitlist, which may take the car straight away, goes to out.
+ * Returns 0 on success and -1 if the record could not be written.
+ */
+int closeRental(FILE *out, struct RentalReturn *record)
+{
+  struct Inventory *inventory = loadInventory();
+  long unit = inventory != NULL ? findRentedUnit(inventory, record->rentalID) : -1;
+
+  if (unit >= 0)
+    memcpy(record->plate, inventory->units[unit].plate, sizeof(record->plate));
+  if (appendReturn(record) != 0)
+    return -1;
+  if (unit >= 0) {
+    updateUnitStatus(out, inventory, unit, UNIT_AVAILABLE);
+  } else if (inventory == NULL || findStock(inventory, record->model_name) == NULL) {
+    syncModelAvailability(out, record->model_name, true);
+  }
+  return 0;
+}
+
+/**
+ * Write a changed rental over its record in the selected branch's rental
+ * log and log the change. Its keys stay as they were, so the indexes only
+ * take note that the log changed. Returns 0 on success and -1 on error.
+ */
+int saveRental(long record, const struct Rental *rental)
+{
+  struct RentalIndex *rentals = &rental_indexes[current_branch];
+  bool indexed = rentals->loaded && strcmp(rentals->path, rental_records) == 0 &&
+                 stampCurrent(&rentals->stamp, rental_records);
+  struct stat info;
+
+  int fd = open(rental_records, O_WRONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error opening %s: %s\n", rental_records, strerror(errno));
+    return -1;
+  }
+  if (pwrite(fd, rental, sizeof(struct Rental), record * (off_t)sizeof(struct Rental)) !=
+      (ssize_t)sizeof(struct Rental)) {
+    fprintf(stderr, "Error writing to %s: %s\n", rental_records, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  logChange(CHANGE_TABLE_RENTALS, CHANGE_OP_UPDATE, record, rental);
+
+  rentals->loaded = indexed && stat(rental_records, &info) == 0;
+  if (rentals->loaded) {
+    stampFile(&rentals->stamp, &info);
+    rentals->dirty = true;
+  }
+  return 0;
+}
+
+/**
+ * Whether a rental of the selected branch still holds its car: its unit is
+ * rented out to it, or, for a model without units, the car is not available.
+ */
+bool rentalHoldsCar(const struct Rental *rental)
+{
+  struct Inventory *inventory = loadInventory();
+  struct CarModel car;
+
+  if (inventory == NULL)
+    return false;
+  if (findStock(inventory, rental->selectedCar.model_name) != NULL)
+    return findRentedUnit(inventory, rental->rentalID) >= 0;
+  return findCar(rental->selectedCar.model_name, &car) && !car.available_status;
+}
+
+/* Customers of the selected branch waiting for a model with a pickup date on or before date */
+size_t waitingBefore(const char *model_name, const char *date)
+{
+  struct WaitlistEntry entry;
+  size_t waiting = 0;
+
+  loadWaitlist();
+  struct WaitQueue *queue = findWaitQueue(model_name, false);
+  int fd = queue != NULL && queue->count > 0 ? open(waitlist_file, O_RDONLY) : -1;
+  for (size_t i = 0; fd >= 0 && i < queue->count; i++) {
+    if (pread(fd, &entry, sizeof(entry), queue->items[i].index * (off_t)sizeof(entry)) ==
+            (ssize_t)sizeof(entry) &&
+        entry.status == WAITLIST_WAITING && strcmp(entry.pickupDate, date) <= 0)
+      waiting++;
+  }
+  if (fd >= 0)
+    close(fd);
+  return waiting;
+}
+
+/**
+ * Extend or shorten a rental to a new return date (YYYY-MM-DD), from today
+ * on, and charge it again for its new length. The rental is changed in
+ * place. It must still hold its car, and an extension must not keep the car
+ * from customers waiting for the model who are due to pick it up before the
+ * new return date, unless enough units of the model are free. With a
+ * username, only that customer's rentals can be changed. On success the
+ * changed rental is left in rental.
+ * Returns NULL on success and what went wrong otherwise.
+ */
+const char *changeRentalReturn(const char *rentalID, const char *username, const char *date,
+                               struct Rental *rental)
+{
+  static char conflict[128];
+  size_t branch = current_branch;
+  const char *error = NULL;
+  char today[11];
+
+  long position = findRentalAnyBranch(rentalID, rental);
+  if (position < 0 ||
+      (username != NULL && strcmp(rental->rentingUser.username, username) != 0)) {
+    selectBranch(branch);
+    return "Unknown rental";
+  }
+
+  todaysDate(today, sizeof(today));
+  int days = calculateRentalDays(rental->pickupDate, date);
+  if (rentalReturned(rentalID))
+    error = "The rental was checked in or canceled already";
+  else if (days < 0 || strcmp(date, today) < 0)
+    error = "The return date must be a YYYY-MM-DD date from the pickup date and today on";
+  else if (strcmp(date, rental->returnDate) == 0)
+    error = "The rental returns on that date already";
+  else if (!rentalHoldsCar(rental))
+    error = "The car is no longer held for this rental";
+
+  /* Free units serve waiting customers first; the rest would wait for this car */
+  if (error == NULL && strcmp(date, rental->returnDate) > 0) {
+    struct Inventory *inventory = loadInventory();
+    struct ModelStock *stock = inventory != NULL ?
+                               findStock(inventory, rental->selectedCar.model_name) : NULL;
+    size_t waiting = waitingBefore(rental->selectedCar.model_name, date);
+    if (waiting > (stock != NULL ? stock->available : 0)) {
+      snprintf(conflict, sizeof(conflict),
+               "%zu waiting customer(s) are due to pick up a %.50s by then", waiting,
+               rental->selectedCar.model_name);
+      error = conflict;
+    }
+  }
+
+  if (error == NULL) {
+    snprintf(rental->returnDate, sizeof(rental->returnDate), "%s", date);
+    rental->totalCost = rental->selectedCar.rental_rate * days;
+    if (saveRental(position, rental) != 0)
+      error = "The rental could not be changed";
+  }
+  selectBranch(branch);
+  return error;
+}
+
+/**
+ * Cancel a rental before its pickup date: close it with a return record
+ * marked canceled, without a fee, make its car available again and clear
+ * its cost in place. With a username, only that customer's rentals can be
+ * canceled. Returns NULL on success and what went wrong otherwise.
+ */
+const char *cancelRental(FILE *out, const char *rentalID, const char *username,
+                         struct RentalReturn *record)
+{
+  struct Rental rental;
+  size_t branch = current_branch;
+  const char *error = NULL;
+  char today[11];
+
+  long position = findRentalAnyBranch(rentalID, &rental);
+  if (position < 0 ||
+      (username != NULL && strcmp(rental.rentingUser.username, username) != 0)) {
+    selectBranch(branch);
+    return "Unknown rental";
+  }
+
+  todaysDate(today, sizeof(today));
+  if (rentalReturned(rentalID))
+    error = "The rental was checked in or canceled already";
+  else if (strcmp(rental.pickupDate, today) <= 0)
+    error = "The rental has started; shorten it or check it in instead";
+
+  if (error == NULL) {
+    memset(record, 0, sizeof(struct RentalReturn));
+    memcpy(record->rentalID, rental.rentalID, sizeof(record->rentalID));
+    memcpy(record->username, rental.rentingUser.username, sizeof(record->username));
+    memcpy(record->model_name, rental.selectedCar.model_name, sizeof(record->model_name));
+    snprintf(record->returnDate, sizeof(record->returnDate), "%s", today);
+    record->rental = position;
+    record->canceled = true;
+    record->returned_at = time(NULL);
+    rental.totalCost = 0;
+    if (closeRental(out, record) != 0)
+      error = "The cancellation could not be recorded";
+    else if (saveRental(position, &rental) != 0)
+      error = "The rental was canceled but its cost could not be cleared";
+  }
+  selectBranch(branch);
+  return error;
+}
+
+/**
+ * POST /rentals/<id>?return=YYYY-MM-DD extends or shortens a rental and
+ * DELETE /rentals/<id> cancels it, as the customer who rented it or as the
+ * admin.
+ */
+void httpChangeRental(struct HttpConnection *conn, const struct HttpRequest *request,
+                      struct HttpSlice rentalID)
+{
+  char login[20], password[20], id[20], date[11];
+  struct Users user;
+  const char *username = NULL;
+  const char *error;
+
+  if (read_only) {
+    httpError(conn, request, 403, "This is a read-only replica");
+    return;
+  }
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_RENTAL, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many rental attempts");
+    return;
+  }
+  if (strcmp(login, admin_user) != 0 || strcmp(password, admin_password) != 0) {
+    if (!findUser(login, password, &user)) {
+      httpError(conn, request, 401, "Invalid credentials");
+      return;
+    }
+    username = user.username;
+  }
+  if (rentalID.length >= sizeof(id)) {
+    httpError(conn, request, 404, "Unknown rental");
+    return;
+  }
+  memcpy(id, rentalID.data, rentalID.length);
+  id[rentalID.length] = '\0';
+
+  http_body.length = 0;
+  if (sliceEquals(request->method, "DELETE")) {
+    struct RentalReturn record;
+    error = cancelRental(stdout, id, username, &record);
+    if (error == NULL)
+      jsonReturn(&http_body, &record);
+  } else {
+    struct Rental rental;
+    if (!httpParam(request, "return", date, sizeof(date))) {
+      httpError(conn, request, 400, "return is required");
+      return;
+    }
+    /* Select the rental's branch to name it in the response */
+    size_t branch = current_branch;
+    findRentalAnyBranch(id, &rental);
+    error = changeRentalReturn(id, username, date, &rental);
+    if (error == NULL)
+      jsonRental(&http_body, &rental, branches[current_branch].name);
+    selectBranch(branch);
+  }
+  if (error == NULL)
+    httpRespond(conn, request, 200, &http_body);
+  else
+    httpError(conn, request, strcmp(error, "Unknown rental") == 0 ? 404 : 409, error);
+}
+
+/**
+ * Stamp a rental with its commit time, also kept as the start of ctime().
+ * The time field is read with its size as the bound, so its 16 characters
+ * fill it without a terminator; it is left empty if ctime() fails.
+ */
+void stampRentalTime(struct Rental *rental, time_t now)
+{
+  const char *timestamp = ctime(&now);
+
+  memset(rental->time, 0, sizeof(rental->time));
+  if (timestamp != NULL)
+    memcpy(rental->time, timestamp, strnlen(timestamp, sizeof(rental->time)));
+  rental->rented_at = now;
+}
+
+/* Whether the selected branch's rental index matches its rental log */
+bool rentalIndexCurrent(void)
+{
+  struct RentalIndex *rentals = &rental_indexes[current_branch];
+
+  return rentals->loaded && strcmp(rentals->path, rental_records) == 0 &&
+         stampCurrent(&rentals->stamp, rental_records);
+}
+
+/**
+ * Add rentals just appended to the selected branch's rental log, from
+ * record first on, to its rental index. indexed tells whether the index was
+ * current before the append; if not, it is rebuilt on its next use.
+ */
+void indexAppendedRentals(bool indexed, long first, const struct Rental *appended, size_t count)
+{
+  struct RentalIndex *rentals = &rental_indexes[current_branch];
+  struct stat info;
+
+  rentals->loaded = indexed && stat(rental_records, &info) == 0;
+  for (size_t i = 0; i < count && rentals->loaded; i++)
+    rentals->loaded = indexRental(rentals, &appended[i], first + i) == 0;
+  if (rentals->loaded) {
+    rentals->count += count;
+    stampFile(&rentals->stamp, &info);
+    rentals->dirty = true;
+  }
+}
+
+/**
+ * Read the cars of a group booking from "<model>[:<count>],...", adding up
+ * the counts of a model listed twice. Returns NULL on success or what is
+ * wrong with the list.
+ */
+const char *parseGroup(const char *text, struct GroupBooking *group)
+{
+  size_t total = 0;
+
+  memset(group, 0, sizeof(*group));
+  while (*text != '\0') {
+    size_t length = strcspn(text, ",");
+    const char *colon = memchr(text, ':', length);
+    size_t name_length = colon != NULL ? (size_t)(colon - text) : length;
+    long count = 1;
+
+    if (colon != NULL) {
+      char *end;
+      count = strtol(colon + 1, &end, 10);
+      if (end != text + length || count < 1 || count > GROUP_MAX_CARS)
+        return "Invalid car count";
+    }
+    if (name_length == 0 || name_length >= sizeof(group->items[0].model_name))
+      return "Invalid car model";
+    total += count;
+    if (total > GROUP_MAX_CARS)
+      return "Too many cars for one booking";
+
+    size_t i = 0;
+    while (i < group->num_items && (strlen(group->items[i].model_name) != name_length ||
+                                    memcmp(group->items[i].model_name, text, name_length) != 0))
+      i++;
+    if (i == group->num_items) {
+      memcpy(group->items[i].model_name, text, name_length);
+      group->num_items++;
+    }
+    group->items[i].count += count;
+
+    text += length;
+    if (*text == ',')
+      text++;
+  }
+  return group->num_items > 0 ? NULL : "No cars requested";
+}
+
+/**
+ * Lock the selected branch's unit and car tables against every other
+ * process taking cars, units first, and have both read again, since
+ * another process may have changed them within the resolution of a file
+ * stamp. Returns 0 on success and -1 on error.
+ */
+int lockFleet(struct FleetLock *lock)
+{
+  lock->units = open(car_units_file, O_RDONLY | O_CREAT, 0644);
+  lock->cars = open(car_database, O_RDONLY);
+  if (lock->units < 0 || lock->cars < 0 ||
+      flock(lock->units, LOCK_EX) != 0 || flock(lock->cars, LOCK_EX) != 0) {
+    fprintf(stderr, "Error locking the cars of branch %s: %s\n",
+            branches[current_branch].name, strerror(errno));
+    unlockFleet(lock);
+    return -1;
+  }
+  inventories[current_branch].loaded = false;
+  invalidateFleet();
+  return 0;
+}
+
+/* Release the locks taken by lockFleet() */
+void unlockFleet(struct FleetLock *lock)
+{
+  if (lock->units >= 0)
+    close(lock->units);
+  if (lock->cars >= 0)
+    close(lock->cars);
+  lock->units = lock->cars = -1;
+}
+
+/**
+ * Write the car rows of the models a group booking took the last car of to
+ * the selected branch's car table: marked unavailable when taken, or as
+ * they were before the booking. Returns 0 on success and -1 on error.
+ */
+int storeGroupCars(const struct GroupBooking *group, bool taken)
+{
+  int fd = open(car_database, O_WRONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error opening %s: %s\n", car_database, strerror(errno));
+    return -1;
+  }
+  for (size_t i = 0; i < group->num_cars; i++) {
+    const struct GroupItem *item = &group->items[group->cars[i]];
+    struct CarModel car = item->car;
+    if (taken)
+      car.available_status = false;
+    if (pwrite(fd, &car, sizeof(car), item->car_index * (off_t)sizeof(car)) !=
+        (ssize_t)sizeof(car)) {
+      fprintf(stderr, "Error writing to %s: %s\n", car_database, strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+  invalidateFleet();
+  return 0;
+}
+
+/**
+ * Put back the units and car rows a group booking took before it failed,
+ * as they were read under the fleet lock, which is still held.
+ */
+void releaseGroup(struct GroupBooking *group, struct Inventory *inventory)
+{
+  for (size_t i = 0; i < group->num_units; i++)
+    inventory->units[group->units[i]] = group->units_before[i];
+  storeUnits(inventory, group->units, group->num_units);
+  /* The free lists are rebuilt from the table */
+  inventory->loaded = false;
+  storeGroupCars(group, false);
+}
+
+/**
+ * Book every car of a group in the selected branch for the same dates, or
+ * none of them. All models are checked before a car is taken. The rentals
+ * are then appended to the rental log with one write and one fsync, which
+ * commits the whole group, and the changes go to the change log in one more
+ * write. The rentals are left in group->rentals.
+ * Returns NULL on success or why the group was rejected.
+ */
+const char *bookGroup(const struct Users *user, struct GroupBooking *group, const char *pickup,
+                      const char *return_date)
+{
+  struct FleetLock lock;
+
+  int days = calculateRentalDays(pickup, return_date);
+  if (days < 0)
+    return "Invalid rental dates";
+  struct ChangeRecord *changes = arenaAlloc(&request_arena,
+                                            GROUP_MAX_CHANGES * sizeof(struct ChangeRecord));
+  if (changes == NULL)
+    return "The booking could not be recorded";
+
+  /* Nothing another process writes can come between the check and the commit */
+  if (lockFleet(&lock) != 0)
+    return "The cars could not be read";
+  const char *error = takeGroup(user, group, pickup, return_date, days, changes);
+  unlockFleet(&lock);
+  return error;
+}
+
+/**
+ * Check and take the cars of a group booking, with the branch's fleet
+ * locked by bookGroup(), and commit its rentals.
+ * Returns NULL on success or why the group was rejected.
+ */
+const char *takeGroup(const struct Users *user, struct GroupBooking *group, const char *pickup,
+                      const char *return_date, int days, struct ChangeRecord *changes)
+{
+  static char message[128];
+  struct Inventory *inventory = loadInventory();
+
+  if (inventory == NULL)
+    return "The cars could not be read";
+
+  /* Check the whole group before taking any car */
+  for (size_t i = 0; i < group->num_items; i++) {
+    struct GroupItem *item = &group->items[i];
+    item->car_index = findCarIndex(item->model_name, &item->car);
+    if (item->car_index < 0) {
+      snprintf(message, sizeof(message), "Unknown car model %s", item->model_name);
+      return message;
+    }
+    item->stock = findStock(inventory, item->model_name);
+    size_t available = item->stock != NULL ? item->stock->available :
+                       item->car.available_status ? 1 : 0;
+    if ((size_t)item->count > available) {
+      snprintf(message, sizeof(message), "Only %zu %s available", available, item->model_name);
+      return message;
+    }
+  }
+
+  /* Take the cars in memory and give every one its rental */
+  time_t now = time(NULL);
+  group->num_rentals = group->num_units = group->num_cars = 0;
+  for (size_t i = 0; i < group->num_items; i++) {
+    struct GroupItem *item = &group->items[i];
+    for (int n = 0; n < item->count; n++) {
+      struct Rental *rental = &group->rentals[group->num_rentals];
+      memset(rental, 0, sizeof(*rental));
+      rental->selectedCar = item->car;
+      rental->rentingUser = *user;
+      strncpy(rental->pickupDate, pickup, sizeof(rental->pickupDate) - 1);
+      strncpy(rental->returnDate, return_date, sizeof(rental->returnDate) - 1);
+      rental->totalCost = item->car.rental_rate * days;
+      stampRentalTime(rental, now);
+
+      /* Rental IDs are unique in every branch and within the group */
+      bool unique;
+      do {
+        char *uniqueID = generateUniqueRentalID("R");
+        if (uniqueID == NULL) {
+          /* Nothing is written yet, so only the units taken in memory are put back */
+          for (size_t j = 0; j < group->num_units; j++)
+            inventory->units[group->units[j]] = group->units_before[j];
+          /* The free lists are rebuilt from the table */
+          inventory->loaded = false;
+          return "The booking could not be recorded";
+        }
+        snprintf(rental->rentalID, sizeof(rental->rentalID), "%s", uniqueID);
+        unique = true;
+        for (size_t j = 0; j < group->num_rentals && unique; j++)
+          unique = strcmp(group->rentals[j].rentalID, rental->rentalID) != 0;
+      } while (!unique);
+      group->num_rentals++;
+
+      if (item->stock != NULL) {
+        long index = item->stock->free;
+        group->units_before[group->num_units] = inventory->units[index];
+        group->units[group->num_units++] = index;
+        takeFreeUnit(inventory, item->stock, rental->rentalID);
+      }
+    }
+    /* A model's row stays available while one of its units does */
+    if (item->stock == NULL || item->stock->available == 0)
+      group->cars[group->num_cars++] = i;
+  }
+
+  if (storeUnits(inventory, group->units, group->num_units) != 0 ||
+      storeGroupCars(group, true) != 0) {
+    releaseGroup(group, inventory);
+    return "The booking could not be recorded";
+  }
+
+  /* Appending the rentals commits the group */
+  bool indexed = rentalIndexCurrent();
+  size_t size = group->num_rentals * sizeof(struct Rental);
+  int fd = open(rental_records, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  off_t end = fd >= 0 ? lseek(fd, 0, SEEK_END) : -1;
+  if (end < 0 || write(fd, group->rentals, size) != (ssize_t)size || fsync(fd) != 0) {
+    fprintf(stderr, "Error writing to %s: %s\n", rental_records, strerror(errno));
+    if (end >= 0 && ftruncate(fd, end) != 0)
+      fprintf(stderr, "Error truncating %s: %s\n", rental_records, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    releaseGroup(group, inventory);
+    return "The booking could not be recorded";
+  }
+  close(fd);
+  long first = end / (long)sizeof(struct Rental);
+
+  /* Log the group in the order single rentals are logged in */
+  size_t num_changes = 0;
+  memset(changes, 0, GROUP_MAX_CHANGES * sizeof(struct ChangeRecord));
+  for (size_t i = 0; i < group->num_units; i++) {
+    struct ChangeRecord *change = &changes[num_changes++];
+    change->table = CHANGE_TABLE_UNITS;
+    change->op = CHANGE_OP_UPDATE;
+    change->index = group->units[i];
+    change->data.unit = inventory->units[group->units[i]];
+  }
+  for (size_t i = 0; i < group->num_cars; i++) {
+    struct ChangeRecord *change = &changes[num_changes++];
+    change->table = CHANGE_TABLE_CARS;
+    change->op = CHANGE_OP_UPDATE;
+    change->index = group->items[group->cars[i]].car_index;
+    change->data.car = group->items[group->cars[i]].car;
+    change->data.car.available_status = false;
+  }
+  for (size_t i = 0; i < group->num_rentals; i++) {
+    struct ChangeRecord *change = &changes[num_changes++];
+    change->table = CHANGE_TABLE_RENTALS;
+    change->op = CHANGE_OP_APPEND;
+    change->index = first + i;
+    change->data.rental = group->rentals[i];
+  }
+  for (size_t i = 0; i < group->num_rentals; i++)
+    notificationChange(&changes[num_changes++], NOTIFY_RENTAL_CONFIRMED, &group->rentals[i]);
+  logChanges(changes, num_changes, true);
+  indexAppendedRentals(indexed, first, group->rentals, group->num_rentals);
+  return NULL;
+}
+
+/**
+ * POST /bookings with cars ("<model>[:<count>],..."), pickup, return and
+ * branch, as the Basic-auth user: book up to GROUP_MAX_CARS cars for the
+ * same dates, all or none of them.
+ */
+void httpBookGroup(struct HttpConnection *conn, const struct HttpRequest *request)
+{
+  char login[20], password[20], cars[HTTP_BUFFER_SIZE], pickup[11], dropoff[11];
+  struct Users user;
+  double total = 0;
+
+  if (read_only) {
+    httpError(conn, request, 403, "This is a read-only replica");
+    return;
+  }
+  if (!httpBasicAuth(request, login, sizeof(login), password, sizeof(password))) {
+    httpError(conn, request, 401, "Credentials are required");
+    return;
+  }
+  if (!rateLimitAllow(RATE_LIMIT_RENTAL, login, conn->peer)) {
+    httpError(conn, request, 429, "Too many rental attempts");
+    return;
+  }
+  if (!findUser(login, password, &user)) {
+    httpError(conn, request, 401, "Invalid credentials");
+    return;
+  }
+  if (!httpParam(request, "cars", cars, sizeof(cars)) ||
+      !httpParam(request, "pickup", pickup, sizeof(pickup)) ||
+      !httpParam(request, "return", dropoff, sizeof(dropoff))) {
+    httpError(conn, request, 400, "cars, pickup and return are required");
+    return;
+  }
+  if (!httpSelectBranch(request)) {
+    httpError(conn, request, 404, "Unknown branch");
+    return;
+  }
+
+  struct GroupBooking *group = arenaAlloc(&request_arena, sizeof(struct GroupBooking));
+  if (group == NULL) {
+    httpError(conn, request, 503, "The system is busy, please retry");
+    return;
+  }
+  const char *error = parseGroup(cars, group);
+  if (error == NULL && calculateRentalDays(pickup, dropoff) < 0)
+    error = "Invalid rental dates";
+  if (error != NULL) {
+    httpError(conn, request, 400, error);
+    return;
+  }
+  error = bookGroup(&user, group, pickup, dropoff);
+  if (error != NULL) {
+    httpError(conn, request, strncmp(error, "Unknown", 7) == 0 ? 404 : 409, error);
+    return;
+  }
+
+  http_body.length = 0;
+  bufferAppend(&http_body, "{\"rentals\":[", 12);
+  for (size_t i = 0; i < group->num_rentals; i++) {
+    if (i > 0)
+      bufferAppend(&http_body, ",", 1);
+    jsonRental(&http_body, &group->rentals[i], branches[current_branch].name);
+    total += group->rentals[i].totalCost;
+  }
+  bufferPrintf(&http_body, "],\"cars\":%zu,\"total\":%.2f}", group->num_rentals, total);
+  httpRespond(conn, request, 201, &http_body);
+}
+
+/* Whether text is a month as YYYY-MM */
+bool isValidMonth(const char *month)
+{
+  if (strlen(month) != 7 || month[4] != '-')
+    return false;
+  for (int i = 0; i < 7; i++) {
+    if (i != 4 && !isdigit((unsigned char)month[i]))
+      return false;
+  }
+  return strncmp(month + 5, "01", 2) >= 0 && strncmp(month + 5, "12", 2) <= 0;
+}
+
+/* Make room for one more invoice line. Returns it, or NULL when out of memory. */
+struct InvoiceLine *addInvoiceLine(struct InvoiceLine **lines, size_t *count, size_t *capacity)
+{
+  if (*count == *capacity) {
+    size_t grown = *capacity > 0 ? *capacity * 2 : INVOICE_READ_BATCH;
+    struct InvoiceLine *larger = realloc(*lines, grown * sizeof(struct InvoiceLine));
+    if (larger == NULL) {
+      fprintf(stderr, "Out of memory while reading invoice lines\n");
+      return NULL;
+    }
+    *lines = larger;
+    *capacity = grown;
+  }
+  struct InvoiceLine *line = &(*lines)[*count];
+  memset(line, 0, sizeof(*line));
+  line->order = (*count)++;
+  return line;
+}
+
+/**
+ * Collect the charges of a month from every branch in one pass over its
+ * rental and return logs: each rental picked up in the month, and each late
+ * fee of a car that came back in it. records counts the records read.
+ * Returns 0 on success and -1 on error.
+ */
+int readInvoiceLines(const char *month, struct InvoiceLine **lines, size_t *count,
+                     size_t *records)
+{
+  size_t capacity = 0;
+  size_t branch = current_branch;
+  int result = 0;
+
+  struct Rental *rentals = malloc(INVOICE_READ_BATCH * sizeof(struct Rental));
+  struct RentalReturn *returns = malloc(INVOICE_READ_BATCH * sizeof(struct RentalReturn));
+  if (rentals == NULL || returns == NULL) {
+    fprintf(stderr, "Out of memory while reading invoice lines\n");
+    free(rentals);
+    free(returns);
+    return -1;
+  }
+
+  *lines = NULL;
+  *count = *records = 0;
+  for (size_t b = 0; b < num_branches && result == 0; b++) {
+    selectBranch(b);
+
+    /* Reports may be served by a read replica */
+    FILE *file = fopen(reportPath(rental_records), "rb");
+    size_t read;
+    while (file != NULL && result == 0 &&
+           (read = fread(rentals, sizeof(struct Rental), INVOICE_READ_BATCH, file)) > 0) {
+      *records += read;
+      for (size_t i = 0; i < read && result == 0; i++) {
+        const struct Rental *rental = &rentals[i];
+        if (strncmp(rental->pickupDate, month, 7) != 0 || rental->pickupDate[7] != '-')
+          continue;
+        struct InvoiceLine *line = addInvoiceLine(lines, count, &capacity);
+        if (line == NULL) {
+          result = -1;
+          break;
+        }
+        memcpy(line->username, rental->rentingUser.username, sizeof(line->username));
+        memcpy(line->rentalID, rental->rentalID, sizeof(line->rentalID));
+        memcpy(line->model_name, rental->selectedCar.model_name, sizeof(line->model_name));
+        memcpy(line->pickupDate, rental->pickupDate, sizeof(line->pickupDate));
+        memcpy(line->returnDate, rental->returnDate, sizeof(line->returnDate));
+        line->branch = b;
+        line->amount = rental->totalCost;
+      }
+    }
+    if (file != NULL)
+      fclose(file);
+
+    file = fopen(reportPath(returns_file), "rb");
+    while (file != NULL && result == 0 &&
+           (read = fread(returns, sizeof(struct RentalReturn), INVOICE_READ_BATCH, file)) > 0) {
+      *records += read;
+      for (size_t i = 0; i < read && result == 0; i++) {
+        const struct RentalReturn *record = &returns[i];
+        if (record->late_fee <= 0 || strncmp(record->returnDate, month, 7) != 0 ||
+            record->returnDate[7] != '-')
+          continue;
+        struct InvoiceLine *line = addInvoiceLine(lines, count, &capacity);
+        if (line == NULL) {
+          result = -1;
+          break;
+        }
+        memcpy(line->username, record->username, sizeof(line->username));
+        memcpy(line->rentalID, record->rentalID, sizeof(line->rentalID));
+        memcpy(line->model_name, record->model_name, sizeof(line->model_name));
+        memcpy(line->returnDate, record->returnDate, sizeof(line->returnDate));
+        line->late_fee = true;
+        line->branch = b;
+        line->amount = record->late_fee;
+      }
+    }
+    if (file != NULL)
+      fclose(file);
+  }
+  selectBranch(branch);
+  free(rentals);
+  free(returns);
+  if (result != 0) {
+    free(*lines);
+    *lines = NULL;
+  }
+  return result;
+}
+
+/* Order invoice lines by customer, and each customer's lines as they were read */
+int compareInvoiceLines(const void *a, const void *b)
+{
+  const struct InvoiceLine *left = a;
+  const struct InvoiceLine *right = b;
+  int order = strncmp(left->username, right->username, sizeof(left->username));
+
+  if (order != 0)
+    return order;
+  return left->order < right->order ? -1 : left->order > right->order;
+}
+
+/**
+ * A username of at most length bytes as a file name. Anything but letters,
+ * digits, '-' and '_' is escaped as %XX, so different usernames never share
+ * a file. Three bytes of name per byte of username always suffice.
+ */
+void invoiceFileName(const char *username, size_t length, char *name, size_t size)
+{
+  size_t used = 0;
+
+  for (size_t i = 0; i < length && username[i] != '\0' && used + 4 <= size; i++) {
+    unsigned char c = username[i];
+    if (isalnum(c) || c == '-' || c == '_')
+      name[used++] = c;
+    else
+      used += snprintf(name + used, size - used, "%%%02X", c);
+  }
+  name[used] = '\0';
+}
+
+/* Write a CSV field, quoted when it holds a comma, a quote or a line break */
+void csvField(FILE *out, const char *text)
+{
+  if (strpbrk(text, ",\"\r\n") == NULL) {
+    fputs(text, out);
+    return;
+  }
+  fputc('"', out);
+  for (; *text != '\0'; text++) {
+    if (*text == '"')
+      fputc('"', out);
+    fputc(*text, out);
+  }
+  fputc('"', out);
+}
+
+/**
+ * Write one customer's invoice for the run's month into the run's
+ * directory, as text or CSV. Returns 0 on success and -1 on error.
+ */
+int writeInvoice(const struct InvoiceRun *run, const struct InvoiceCustomer *customer)
+{
+  const struct InvoiceLine *first = &run->lines[customer->first];
+  char name[3 * sizeof(first->username) + 1];
+  char path[PATH_MAX];
+  double total = 0;
+
+  invoiceFileName(first->username, sizeof(first->username), name, sizeof(name));
+  snprintf(path, sizeof(path), "%s/%s-%s.%s", run->dir, name, run->month,
+           run->csv ? "csv" : "txt");
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (run->csv) {
+    fputs("rental_id,branch,charge,model,pickup_date,return_date,amount\n", out);
   } else {
-    printf("\nLogin failed. Please check your credentials.\n");
-    printf("If you have forgotten your password, please consult your "
-           "administrator for assistance.\n");
-    printf("\nDo you want to login again ? (yes/no) : ");
-    scanf("%3s", choice);
-    flushInputBuffer();
+    fprintf(out, "Car Rental System - Invoice for %s\n\n", run->month);
+    if (customer->registered) {
+      fprintf(out, "Customer: %s (%s)\nAddress: %s\nEmail: %s\n\n", customer->user.fullname,
+              customer->user.username, customer->user.address, customer->user.email);
+    } else {
+      fprintf(out, "Customer: %s\n\n", first->username);
+    }
+    fprintf(out, "%-15s%-20s%-10s%-15s%-15s%-15s%10s\n", "Rental_ID", "Branch", "Charge",
+            "Model Name", "Pickup Date", "Return Date", "Amount");
+  }
+
+  for (size_t i = customer->first; i < customer->end; i++) {
+    const struct InvoiceLine *line = &run->lines[i];
+    const char *charge = line->late_fee ? "late fee" : "rental";
+    if (run->csv) {
+      csvField(out, line->rentalID);
+      fputc(',', out);
+      csvField(out, branches[line->branch].name);
+      fprintf(out, ",%s,", charge);
+      csvField(out, line->model_name);
+      fprintf(out, ",%s,%s,%.2f\n", line->pickupDate, line->returnDate, line->amount);
+    } else {
+      fprintf(out, "%-15s%-20s%-10s%-15s%-15s%-15s%10.2f\n", line->rentalID,
+              branches[line->branch].name, charge, line->model_name, line->pickupDate,
+              line->returnDate, line->amount);
+    }
+    total += line->amount;
+  }
+  if (!run->csv)
+    fprintf(out, "\nTotal: %.2f NPR\n", total);
+
+  if (ferror(out) | fclose(out)) {
+    fprintf(stderr, "Error writing to %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Body of an invoice thread: write invoices until no customer is left */
+void *invoiceWorker(void *arg)
+{
+  struct InvoiceRun *run = arg;
+  size_t customer;
+
+  while ((customer = atomic_fetch_add(&run->next, 1)) < run->num_customers) {
+    if (writeInvoice(run, &run->customers[customer]) == 0)
+      atomic_fetch_add(&run->written, 1);
+  }
+  return NULL;
+}
+
+/**
+ * Write the month's invoice of every customer who was charged in it into
+ * dir, one file per customer. The logs of every branch are read once and
+ * the charges grouped by customer; the invoices are then written by a pool
+ * of threads, one customer at a time each. Prints the throughput.
+ * Returns 0 if every invoice was written.
+ */
+int writeInvoices(const char *month, const char *dir, bool csv)
+{
+  static struct InvoiceRun run;
+  pthread_t threads[INVOICE_MAX_WORKERS];
+  bool started[INVOICE_MAX_WORKERS];
+  struct InvoiceLine *lines;
+  size_t num_lines, records;
+  double total = 0;
+
+  if (!isValidMonth(month)) {
+    fprintf(stderr, "Invalid month '%s', expected YYYY-MM\n", month);
+    return -1;
+  }
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error creating %s: %s\n", dir, strerror(errno));
+    return -1;
+  }
+
+  double started_at = monotonicSeconds();
+  if (readInvoiceLines(month, &lines, &num_lines, &records) != 0)
+    return -1;
+  qsort(lines, num_lines, sizeof(struct InvoiceLine), compareInvoiceLines);
+
+  /* One customer per run of lines with the same username */
+  struct InvoiceCustomer *customers = malloc((num_lines + 1) * sizeof(struct InvoiceCustomer));
+  if (customers == NULL) {
+    fprintf(stderr, "Out of memory while grouping invoice lines\n");
+    free(lines);
+    return -1;
+  }
+  size_t num_customers = 0;
+  for (size_t i = 0; i < num_lines; i++) {
+    total += lines[i].amount;
+    if (i > 0 && strncmp(lines[i].username, lines[i - 1].username,
+                         sizeof(lines[i].username)) == 0)
+      continue;
+    if (num_customers > 0)
+      customers[num_customers - 1].end = i;
+    struct InvoiceCustomer *customer = &customers[num_customers++];
+    customer->first = i;
+    customer->registered = findUserIndex(lines[i].username, &customer->user) >= 0;
+  }
+  if (num_customers > 0)
+    customers[num_customers - 1].end = num_lines;
+  double grouped_at = monotonicSeconds();
+
+  run.month = month;
+  run.dir = dir;
+  run.csv = csv;
+  run.lines = lines;
+  run.customers = customers;
+  run.num_customers = num_customers;
+  atomic_store(&run.next, 0);
+  atomic_store(&run.written, 0);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers = cpus > 1 ? (size_t)cpus : 1;
+  if (workers > INVOICE_MAX_WORKERS)
+    workers = INVOICE_MAX_WORKERS;
+  if (workers > num_customers)
+    workers = num_customers > 0 ? num_customers : 1;
+  /* This thread is one of the workers; the ones that could not start leave it their share */
+  for (size_t i = 1; i < workers; i++)
+    started[i] = pthread_create(&threads[i], NULL, invoiceWorker, &run) == 0;
+  invoiceWorker(&run);
+  for (size_t i = 1; i < workers; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+
+  double finished_at = monotonicSeconds();
+  size_t written = atomic_load(&run.written);
+  double seconds = finished_at - grouped_at;
+  printf("Read %zu records and grouped %zu charges in %.0f ms\n", records, num_lines,
+         (grouped_at - started_at) * 1000);
+  printf("Wrote %zu of %zu invoices for %s to %s in %.0f ms with %zu threads "
+         "(%.0f invoices/s), %.2lf NPR in total\n", written, num_customers, month, dir,
+         seconds * 1000, workers, seconds > 0 ? written / seconds : 0.0, total);
+  free(customers);
+  free(lines);
+  return written == num_customers ? 0 : -1;
+}
+
+/* A notification about a rental, made now */
+void rentalNotification(struct Notification *notification, int kind, const struct Rental *rental)
+{
+  memset(notification, 0, sizeof(*notification));
+  notification->kind = kind;
+  memcpy(notification->username, rental->rentingUser.username, sizeof(notification->username));
+  memcpy(notification->rentalID, rental->rentalID, sizeof(notification->rentalID));
+  memcpy(notification->model_name, rental->selectedCar.model_name,
+         sizeof(notification->model_name));
+  memcpy(notification->pickupDate, rental->pickupDate, sizeof(notification->pickupDate));
+  memcpy(notification->returnDate, rental->returnDate, sizeof(notification->returnDate));
+  notification->amount = rental->totalCost;
+  notification->created_at = time(NULL);
+}
+
+/* A notification about a rental as a change of the outbox, to be logged with the rental's */
+void notificationChange(struct ChangeRecord *change, int kind, const struct Rental *rental)
+{
+  memset(change, 0, sizeof(*change));
+  change->table = CHANGE_TABLE_NOTIFICATIONS;
+  change->op = CHANGE_OP_APPEND;
+  change->index = -1;
+  rentalNotification(&change->data.notification, kind, rental);
+}
+
+/**
+ * Append notifications that belong to no other change, such as reminders,
+ * to the selected branch's outbox, which is its change log, with one
+ * logged write. Nothing is sent here; the delivery worker picks them up.
+ * Returns 0 on success and -1 on error.
+ */
+int queueNotifications(const struct Notification *notifications, size_t count)
+{
+  struct ChangeRecord changes[OUTBOX_BATCH];
+
+  for (size_t done = 0; done < count; done += OUTBOX_BATCH) {
+    size_t batch = count - done < OUTBOX_BATCH ? count - done : OUTBOX_BATCH;
+    memset(changes, 0, batch * sizeof(struct ChangeRecord));
+    for (size_t i = 0; i < batch; i++) {
+      changes[i].table = CHANGE_TABLE_NOTIFICATIONS;
+      changes[i].op = CHANGE_OP_APPEND;
+      changes[i].index = -1;
+      changes[i].data.notification = notifications[done + i];
+    }
+    if (logChanges(changes, batch, false) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* Load the delivery progress of the selected branch's outbox, or start from the beginning */
+void loadOutboxStatus(struct OutboxStatus *status)
+{
+  long retry_at = 0;
+
+  memset(status, 0, sizeof(*status));
+  FILE *file = fopen(outbox_status_file, "r");
+  if (file == NULL)
+    return;
+  if (fscanf(file, "%zu %d %ld", &status->delivered, &status->attempts, &retry_at) != 3)
+    memset(status, 0, sizeof(*status));
+  status->retry_at = retry_at;
+  fclose(file);
+}
+
+/* Save the delivery progress of the selected branch's outbox */
+void saveOutboxStatus(const struct OutboxStatus *status)
+{
+  FILE *file = fopen(outbox_status_file, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", outbox_status_file, strerror(errno));
+    return;
+  }
+  fprintf(file, "%zu %d %ld\n", status->delivered, status->attempts, (long)status->retry_at);
+  fclose(file);
+}
+
+/**
+ * The spool sink: write a batch as one file of messages in the spool
+ * directory, named after the branch and the batch's first position. The
+ * file appears whole through a rename, and a batch that is given again
+ * replaces its earlier copy.
+ */
+int spoolNotifications(const struct NotificationSink *sink, const char *branch, size_t first,
+                       const struct Notification *batch, size_t count)
+{
+  char path[PATH_MAX], temporary[PATH_MAX + 4];
+  struct Users user;
+
+  snprintf(path, sizeof(path), "%s/%s-%012zu.txt", sink->target, branch, first + 1);
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  FILE *file = fopen(temporary, "w");
+  if (file == NULL)
+    return -1;
+
+  for (size_t i = 0; i < count; i++) {
+    const struct Notification *notification = &batch[i];
+    bool registered = findUserIndex(notification->username, &user) >= 0;
+    fprintf(file, "To: %.20s", notification->username);
+    if (registered)
+      fprintf(file, " <%.20s> %.11s", user.email, user.number);
+    switch (notification->kind) {
+    case NOTIFY_RENTAL_CONFIRMED:
+      fprintf(file, "\nSubject: Rental %.20s confirmed\n\nYour rental of %.50s at %s from %.11s "
+              "to %.11s is confirmed. Total: %.2lf NPR.\n\n", notification->rentalID,
+              notification->model_name, branch, notification->pickupDate,
+              notification->returnDate, notification->amount);
+      break;
+    case NOTIFY_RENTAL_OVERDUE:
+      fprintf(file, "\nSubject: Rental %.20s is overdue\n\nThe %.50s you rented at %s was due "
+              "back on %.11s. Every day late is charged %.1f times the daily rate.\n\n",
+              notification->rentalID, notification->model_name, branch,
+              notification->returnDate, LATE_FEE_RATE);
+      break;
+    case NOTIFY_WAITLIST_OFFER:
+      fprintf(file, "\nSubject: A car is ready for you\n\nYour waitlisted request was allocated "
+              "a %.50s at %s from %.11s to %.11s as rental %.20s. Total: %.2lf NPR.\n\n",
+              notification->model_name, branch, notification->pickupDate,
+              notification->returnDate, notification->rentalID, notification->amount);
+      break;
+    }
+  }
+
+  if (ferror(file) | fclose(file) || rename(temporary, path) != 0) {
+    remove(temporary);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Deliver what is new in the selected branch's outbox to a sink, a batch at
+ * a time. The outbox is read from the branch's change log, skipping the
+ * other changes. A failed batch is tried again after a wait that doubles
+ * with every failure, and nothing after it is delivered before it is.
+ * Returns the number of notifications delivered.
+ */
+size_t deliverOutbox(const struct NotificationSink *sink)
+{
+  struct ChangeRecord changes[OUTBOX_BATCH];
+  struct Notification batch[OUTBOX_BATCH];
+  struct OutboxStatus status;
+  size_t delivered = 0;
+
+  loadOutboxStatus(&status);
+  size_t started = status.delivered;
+  if (status.retry_at > time(NULL))
+    return 0;
+  int fd = open(branch_change_log, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  while (1) {
+    /* Gather the notifications among the next changes, up to a batch of them */
+    size_t count = 0, first = 0, next = status.delivered;
+    ssize_t bytes;
+    while (count < OUTBOX_BATCH &&
+           (bytes = pread(fd, changes, sizeof(changes),
+                          next * (off_t)sizeof(struct ChangeRecord))) >=
+           (ssize_t)sizeof(struct ChangeRecord)) {
+      size_t read = (size_t)bytes / sizeof(struct ChangeRecord);
+      size_t i = 0;
+      for (; i < read && count < OUTBOX_BATCH; i++) {
+        if (changes[i].table != CHANGE_TABLE_NOTIFICATIONS)
+          continue;
+        if (count == 0)
+          first = next + i;
+        batch[count++] = changes[i].data.notification;
+      }
+      next += i;
+    }
+    if (count == 0) {
+      status.delivered = next;
+      break;
+    }
+    if (sink->deliver(sink, branches[current_branch].name, first, batch, count) != 0) {
+      int shift = status.attempts < 16 ? status.attempts : 16;
+      long wait = (long)OUTBOX_RETRY_MIN << shift;
+      if (wait > OUTBOX_RETRY_MAX)
+        wait = OUTBOX_RETRY_MAX;
+      status.attempts++;
+      status.retry_at = time(NULL) + wait;
+      fprintf(stderr, "%s: delivering %zu notification(s) to the %s sink failed (attempt %d), "
+              "retrying in %ld s\n", branches[current_branch].name, count, sink->name,
+              status.attempts, wait);
+      break;
+    }
+    status.delivered = next;
+    status.attempts = 0;
+    status.retry_at = 0;
+    delivered += count;
+  }
+  close(fd);
+  if (status.delivered != started || status.attempts > 0)
+    saveOutboxStatus(&status);
+  return delivered;
+}
+
+/**
+ * Run as the delivery worker: poll the outbox of every branch and deliver
+ * new notifications to the spool directory given, until stopped. Rentals
+ * only log their notifications, so they never wait for a delivery.
+ */
+void deliverNotifications(const char *spool_dir)
+{
+  const struct NotificationSink sink = {"spool", spool_dir, spoolNotifications};
+
+  if (mkdir(spool_dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error creating %s: %s\n", spool_dir, strerror(errno));
+    return;
+  }
+  printf("Delivering notifications to %s\n", spool_dir);
+  fflush(stdout);
+  signal(SIGINT, handleStopSignal);
+  signal(SIGTERM, handleStopSignal);
+
+  while (!stop_requested) {
+    loadBranches();
+    for (size_t i = 0; i < num_branches; i++) {
+      selectBranch(i);
+      size_t delivered = deliverOutbox(&sink);
+      if (delivered > 0) {
+        printf("%s: delivered %zu notification(s)\n", branches[i].name, delivered);
+        fflush(stdout);
+      }
+    }
+    usleep(OUTBOX_POLL_INTERVAL_US);
+  }
+}
+
+/**
+ * Whether a table still holds the record a removal change removed at the
+ * change's index. Users and cars are matched by their key, since the logged
+ * record may have been rebuilt from a cache.
+ */
+bool holdsRemovedRecord(const struct ChangeRecord *change, const char *filename,
+                        size_t record_size)
+{
+  struct ChangeRecord stored;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  ssize_t read = pread(fd, &stored.data, record_size, change->index * (off_t)record_size);
+  close(fd);
+  if (read != (ssize_t)record_size)
+    return false;
+
+  if (change->table == CHANGE_TABLE_USERS)
+    return strncmp(stored.data.user.username, change->data.user.username,
+                   sizeof(change->data.user.username)) == 0;
+  if (change->table == CHANGE_TABLE_CARS)
+    return strncmp(stored.data.car.model_name, change->data.car.model_name,
+                   sizeof(change->data.car.model_name)) == 0;
+  return memcmp(&stored.data, &change->data, record_size) == 0;
+}
+
+void jsonWaitlistEntry(struct Buffer *buffer, const struct WaitlistEntry *entry,
+                       const char *branch)
+{
+  static const char *const status_names[] = {"waiting", "allocated", "notified", "expired"};
+
+  bufferAppend(buffer, "{\"username\":", 12);
+  jsonString(buffer, entry->username, sizeof(entry->username));
+  bufferAppend(buffer, ",\"model\":", 9);
+  jsonString(buffer, entry->model_name, sizeof(entry->model_name));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferAppend(buffer, ",\"pickup\":", 10);
+  jsonString(buffer, entry->pickupDate, sizeof(entry->pickupDate));
+  bufferAppend(buffer, ",\"return\":", 10);
+  jsonString(buffer, entry->returnDate, sizeof(entry->returnDate));
+  bufferPrintf(buffer, ",\"priority\":%d,\"status\":\"%s\",\"requested_at\":%lld,\"rental\":",
+               entry->priority,
+               entry->status >= WAITLIST_WAITING && entry->status <= WAITLIST_EXPIRED ?
+               status_names[entry->status] : "unknown",
+               (long long)entry->requested_at);
+  jsonString(buffer, entry->rentalID, sizeof(entry->rentalID));
+  bufferAppend(buffer, "}", 1);
+}
+
+void jsonDemand(struct Buffer *buffer, const struct DemandStats *stats, const char *branch)
+{
+  bufferAppend(buffer, "{\"model\":", 9);
+  jsonString(buffer, stats->model_name, sizeof(stats->model_name));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferPrintf(buffer, ",\"turned_away\":%zu,\"queued\":%zu,\"allocated\":%zu,\"expired\":%zu}",
+               stats->turned_away, stats->queued, stats->allocated, stats->expired);
+}
+
+void jsonNotification(struct Buffer *buffer, const struct Notification *notification,
+                      const char *branch)
+{
+  static const char *const kinds[] = {"rental_confirmed", "rental_overdue", "waitlist_offer"};
+
+  bufferPrintf(buffer, "{\"kind\":\"%s\",\"username\":",
+               notification->kind >= NOTIFY_RENTAL_CONFIRMED &&
+               notification->kind <= NOTIFY_WAITLIST_OFFER ? kinds[notification->kind] :
+               "unknown");
+  jsonString(buffer, notification->username, sizeof(notification->username));
+  bufferAppend(buffer, ",\"rental\":", 10);
+  jsonString(buffer, notification->rentalID, sizeof(notification->rentalID));
+  bufferAppend(buffer, ",\"model\":", 9);
+  jsonString(buffer, notification->model_name, sizeof(notification->model_name));
+  bufferAppend(buffer, ",\"branch\":", 10);
+  jsonString(buffer, branch, BRANCH_NAME_SIZE);
+  bufferAppend(buffer, ",\"pickup\":", 10);
+  jsonString(buffer, notification->pickupDate, sizeof(notification->pickupDate));
+  bufferAppend(buffer, ",\"return\":", 10);
+  jsonString(buffer, notification->returnDate, sizeof(notification->returnDate));
+  bufferPrintf(buffer, ",\"amount\":%.2f}", notification->amount);
+}
 
-    if (strcmp(choice, "yes") == 0 || strcmp(choice, "Yes") == 0 ||
-        strcmp(choice, "YES") == 0)
-      userLogin(loggedInUser);
+/* Slot filed under a hash, or NULL if there is none */
+struct IndexSlot *keyIndexFind(struct KeyIndex *index, unsigned long long hash)
+{
+  size_t mask = index->capacity - 1;
+
+  for (size_t probe = 0; probe < index->capacity; probe++) {
+    struct IndexSlot *slot = &index->slots[(hash + probe) & mask];
+    if (slot->record < 0)
+      return NULL;
+    if (slot->hash == hash)
+      return slot;
   }
+  return NULL;
+}
+
+/* Key of a user's record in a rental index's chain of that user's rentals */
+unsigned long long userChainHash(unsigned long long user, long record)
+{
+  return user ^ ((unsigned long long)(record + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+/**
+ * File a rental under its ID and link it to the end of its user's chain.
+ * Records must be added in log order. Returns -1 when out of memory.
+ */
+int indexRental(struct RentalIndex *index, const struct Rental *rental, long record)
+{
+  unsigned long long user = hashKey(rental->rentingUser.username,
+                                    sizeof(rental->rentingUser.username));
+
+  if (keyIndexInsert(&index->by_id, hashKey(rental->rentalID, sizeof(rental->rentalID)),
+                     record) != 0)
+    return -1;
+  struct IndexSlot *last = keyIndexFind(&index->last_by_user, user);
+  if (last == NULL)
+    return keyIndexInsert(&index->by_user, user, record) == 0 &&
+           keyIndexInsert(&index->last_by_user, user, record) == 0 ? 0 : -1;
+
+  long previous = last->record;
+  last->record = record;
+  return keyIndexInsert(&index->next_by_user, userChainHash(user, previous), record);
 }
 
+/* The user's rental after a record in a rental index, or -1 if there is none */
+long nextUserRental(const struct RentalIndex *index, unsigned long long user, long record)
+{
+  size_t probe = 0;
+
+  return keyIndexNext(&index->next_by_user, userChainHash(user, record), &probe);
+}